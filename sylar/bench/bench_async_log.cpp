@@ -0,0 +1,84 @@
+/**
+ * @file bench_async_log.cpp
+ * @brief 异步日志和同步格式化写入的吞吐与单次调用延迟
+ * @details 每个线程连续写日志，同步方式在调用线程上格式化并write，和原来的流式日志一样；
+ * 异步方式只写本线程的缓冲区。输出到/dev/null，测的是调用方付出的代价，
+ * 后台线程跟不上时异步日志丢弃记录，连续写入测出的主要是丢弃的代价，
+ * 所以同时输出实际写出的速率，并另外测一轮限速写入（每写一批停1ms，让后台线程取走），
+ * 它的延迟才是记录真正写进缓冲区的代价。
+ * 每64次调用采样一次延迟，避免计时本身影响吞吐
+ */
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <thread>
+#include <vector>
+#include "async_log.h"
+#include "bench_util.h"
+
+static int s_fd = -1;
+
+static void SyncLog(uint64_t i, const char *peer, double cost){
+    char buf[256];
+    int n = snprintf(buf, sizeof(buf), "%s:%d\t[INFO]\treq %lu from %s took %.1fus\n",
+                     __FILE__, __LINE__, (unsigned long)i, peer, cost);
+    if(::write(s_fd, buf, n) < 0)
+        abort();
+}
+
+static void AsyncLog(uint64_t i, const char *peer, double cost){
+    SYLAR_ALOG_INFO("req {} from {} took {}us", i, peer, cost);
+}
+
+/**
+ * @param[in] batch 大于0时每写batch条停1ms，否则连续写
+ */
+static void Run(const char *label, void (*fn)(uint64_t, const char*, double),
+                size_t threads, size_t calls, size_t batch){
+    BenchLatency lat(threads * calls / 64 + threads);
+    uint64_t dropped = AsyncLogger::GetDropped();
+    uint64_t start = BenchNowNs();
+    std::vector<std::thread> ts;
+    for(size_t t = 0; t < threads; ++t){
+        ts.emplace_back([&](){
+            for(size_t i = 0; i < calls; ++i){
+                if(batch && i % batch == batch - 1)
+                    usleep(1000);
+                if(i % 64){
+                    fn(i, "127.0.0.1", 1.5);
+                    continue;
+                }
+                uint64_t t0 = BenchNowNs();
+                fn(i, "127.0.0.1", 1.5);
+                lat.add(BenchNowNs() - t0);
+            }
+        });
+    }
+    for(auto &t : ts)
+        t.join();
+    double sec = (BenchNowNs() - start) / 1e9;
+    AsyncLogger::Flush();
+    dropped = AsyncLogger::GetDropped() - dropped;
+    printf("%-12s threads=%-3zu %10.0f calls/s %10.0f written/s  p50=%5luns p99=%6luns p999=%7luns  dropped=%.1f%%\n",
+           label, threads, threads * calls / sec, (threads * calls - dropped) / sec,
+           (unsigned long)lat.percentile(0.5), (unsigned long)lat.percentile(0.99),
+           (unsigned long)lat.percentile(0.999), dropped * 100.0 / (threads * calls));
+}
+
+int main(int argc, char **argv){
+    size_t calls = argc > 1 ? atoi(argv[1]) : 500000;
+    s_fd = open(argc > 2 ? argv[2] : "/dev/null", O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if(s_fd < 0){
+        perror("open");
+        return 1;
+    }
+    AsyncLogger::SetFd(s_fd);
+    size_t thread_counts[] = {1, 4, 16};
+    for(size_t threads : thread_counts){
+        Run("sync", SyncLog, threads, calls, 0);
+        Run("async", AsyncLog, threads, calls, 0);
+        // 一批不超过缓冲区的一半
+        Run("async-paced", AsyncLog, threads, calls / 10, AsyncLogger::kRingSlots / 2);
+    }
+    return 0;
+}
@@ -0,0 +1,75 @@
+/**
+ * @file bench_batch_schedule.cpp
+ * @brief 批量调度和逐个schedule的吞吐对比
+ * @details 主线程按每批batch个任务投递空回调，分别用循环调用schedule、schedule(begin, end)
+ * 和Scheduler::ScheduleBatch，统计从开始投递到全部执行完的任务数/秒。
+ * 逐个schedule每个任务都要加一次锁、可能唤醒一次空闲线程，批量投递每批只加一次锁，
+ * 唤醒数不超过任务数
+ */
+#include "IOManager.h"
+#include "bench_util.h"
+#include <stdlib.h>
+#include <unistd.h>
+#include <vector>
+
+enum Mode{
+    MODE_LOOP,
+    MODE_RANGE,
+    MODE_BATCH
+};
+
+static const char *ModeName(int mode){
+    switch(mode){
+        case MODE_LOOP: return "schedule loop";
+        case MODE_RANGE: return "schedule(begin, end)";
+        default: return "ScheduleBatch";
+    }
+}
+
+// 返回任务数/秒
+static double Run(IOManager &iom, int mode, size_t total, size_t batch){
+    std::atomic<size_t> done = {0};
+    auto task = [&done](){ ++done;};
+    std::vector<std::function<void()> > tasks;
+    tasks.reserve(batch);
+
+    uint64_t start = BenchNowNs();
+    for(size_t sent = 0; sent < total; sent += batch){
+        size_t n = std::min(batch, total - sent);
+        if(mode == MODE_LOOP){
+            for(size_t i = 0; i < n; ++i)
+                iom.schedule(task);
+        }else if(mode == MODE_RANGE){
+            tasks.assign(n, task);
+            iom.schedule(tasks.begin(), tasks.end());
+        }else{
+            Scheduler::ScheduleBatch b(&iom);
+            for(size_t i = 0; i < n; ++i)
+                b.add(task);
+        }
+    }
+    while(done < total)
+        usleep(100);
+    return total / ((BenchNowNs() - start) / 1e9);
+}
+
+int main(int argc, char **argv){
+    size_t threads = argc > 1 ? atoi(argv[1]) : 4;
+    size_t total = argc > 2 ? atoi(argv[2]) : 2000000;
+    printf("usage: %s [threads] [tasks]\n", argv[0]);
+    printf("threads=%zu tasks=%zu\n", threads, total);
+
+    IOManager iom(threads, false, "bench_batch");
+    // 逐个schedule与批大小无关，只测一次作为基准
+    double base = Run(iom, MODE_LOOP, total, 1);
+    printf("%-10s %-24s %12.0f tasks/s\n", "", ModeName(MODE_LOOP), base);
+    static const size_t kBatches[] = {4, 16, 256};
+    for(size_t batch : kBatches){
+        for(int mode = MODE_RANGE; mode <= MODE_BATCH; ++mode){
+            double rate = Run(iom, mode, total, batch);
+            printf("batch=%-4zu %-24s %12.0f tasks/s (%.2fx)\n", batch, ModeName(mode), rate, rate / base);
+        }
+    }
+    iom.stop();
+    return 0;
+}
@@ -0,0 +1,141 @@
+/**
+ * @file bench_connection_pool.cpp
+ * @brief 使用连接池和每次新建连接的请求速率对比
+ * @details 服务端是本地的回显服务器，客户端在另一个IOManager上用多个协程并发请求，
+ * 每个请求一问一答。不用连接池时每个请求都要connect、accept和close，
+ * 回环上持续高速建连会积累TIME_WAIT，测试时间不宜过长
+ * @note 运行时编译不过，连接池与每次新建连接的请求速率对比还没有数字
+ */
+#include "connection_pool.h"
+#include "tcp_server.h"
+#include "bench_util.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+class EchoServer : public TcpServer{
+public:
+    EchoServer(IOManager *worker) : TcpServer(worker, "bench/pool_echo") {}
+
+protected:
+    void handleClient(int fd) override {
+        char buf[4096];
+        ssize_t n;
+        while((n = ::read(fd, buf, sizeof(buf))) > 0){
+            if(::write(fd, buf, n) != n)
+                break;
+        }
+    }
+};
+
+static const char kMsg[] = "GET /key HTTP/1.1\r\n\r\n";
+
+// 一问一答，读回与请求同样长度的数据
+static bool RoundTrip(int fd){
+    size_t len = sizeof(kMsg) - 1;
+    if(::write(fd, kMsg, len) != (ssize_t)len)
+        return false;
+    char buf[64];
+    size_t got = 0;
+    while(got < len){
+        ssize_t n = ::read(fd, buf, sizeof(buf));
+        if(n <= 0)
+            return false;
+        got += n;
+    }
+    return true;
+}
+
+static bool NewConnRequest(uint16_t port){
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(fd < 0)
+        return false;
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    bool ok = !connect(fd, (sockaddr*)&addr, sizeof(addr)) && RoundTrip(fd);
+    ::close(fd);
+    return ok;
+}
+
+static bool PooledRequest(ConnectionPool::ptr pool, uint16_t port){
+    ConnectionPool::Conn conn = pool->get("127.0.0.1", port, 3000);
+    if(!conn)
+        return false;
+    if(!RoundTrip(conn.getFd())){
+        conn.markBroken();
+        return false;
+    }
+    return true;
+}
+
+static void Run(IOManager &client, ConnectionPool::ptr pool, uint16_t port, size_t callers,
+                double seconds){
+    std::atomic<size_t> running = {callers};
+    std::atomic<uint64_t> ok = {0};
+    std::atomic<uint64_t> errors = {0};
+    BenchLatency lat(1 << 22);
+    uint64_t end = BenchNowNs() + (uint64_t)(seconds * 1e9);
+    uint64_t start = BenchNowNs();
+    for(size_t i = 0; i < callers; ++i){
+        client.schedule([&](){
+            while(BenchNowNs() < end){
+                uint64_t t0 = BenchNowNs();
+                if(pool ? PooledRequest(pool, port) : NewConnRequest(port)){
+                    lat.add(BenchNowNs() - t0);
+                    ++ok;
+                }else{
+                    ++errors;
+                }
+            }
+            --running;
+        });
+    }
+    while(running)
+        usleep(10 * 1000);
+    double wall = (BenchNowNs() - start) / 1e9;
+    char label[64];
+    snprintf(label, sizeof(label), "%s callers=%zu", pool ? "pool" : "new conn", callers);
+    printf("%-24s %10.0f req/s  errors=%lu\n", label, ok / wall, (unsigned long)errors.load());
+    lat.print(label);
+}
+
+int main(int argc, char **argv){
+    size_t threads = argc > 1 ? atoi(argv[1]) : 2;
+    double seconds = argc > 2 ? atof(argv[2]) : 2;
+    printf("usage: %s [threads_per_side] [seconds]\n", argv[0]);
+
+    IOManager server_iom(threads, false, "pool_server");
+    std::shared_ptr<EchoServer> server(new EchoServer(&server_iom));
+    if(!server->bind("127.0.0.1", 0) || !server->start()){
+        printf("bind failed\n");
+        return 1;
+    }
+    uint16_t port = server->getPort();
+
+    IOManager client_iom(threads, false, "pool_client");
+    ConnectionPool::Options opt;
+    opt.maxPerEndpoint = 256;
+    ConnectionPool::ptr pool = ConnectionPool::Create(&client_iom, opt);
+
+    size_t caller_counts[] = {1, 16, 128};
+    for(size_t callers : caller_counts){
+        Run(client_iom, nullptr, port, callers, seconds);
+        Run(client_iom, pool, port, callers, seconds);
+    }
+    printf("%s\n", pool->dumpStats().c_str());
+
+    pool->stop();
+    pool.reset();
+    client_iom.stop();
+    server->stop();
+    server_iom.stop();
+    return 0;
+}
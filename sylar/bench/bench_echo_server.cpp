@@ -0,0 +1,151 @@
+/**
+ * @file bench_echo_server.cpp
+ * @brief 回显服务器在不同调度线程数下的建连速率和请求速率
+ * @details 服务器是TcpServer的子类，客户端是普通的阻塞线程，和服务器在同一台机器上走回环。
+ * 建连测试每次连接只发一个请求就关闭，测accept和连接协程的创建销毁；
+ * 请求测试使用长连接，每个连接一问一答，测读写挂起和唤醒的代价。
+ * 传入log参数时服务器每个请求写一条异步日志，用于比较日志对请求速率的影响
+ * @note 运行时还不能编译，不同线程数下的建连速率和请求速率、以及异步日志的影响都还没有测过
+ */
+#include "tcp_server.h"
+#include "async_log.h"
+#include "bench_util.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <thread>
+#include <vector>
+
+static bool s_log = false;
+
+class EchoServer : public TcpServer{
+public:
+    EchoServer(IOManager *worker) : TcpServer(worker, "bench/echo") {}
+
+protected:
+    void handleClient(int fd) override {
+        char buf[4096];
+        while(true){
+            ssize_t n = ::read(fd, buf, sizeof(buf));
+            if(n <= 0)
+                break;
+            if(s_log)
+                SYLAR_ALOG_INFO("echo fd={} bytes={}", fd, n);
+            ssize_t off = 0;
+            while(off < n){
+                ssize_t w = ::write(fd, buf + off, n - off);
+                if(w <= 0)
+                    return;
+                off += w;
+            }
+        }
+    }
+};
+
+static int Connect(uint16_t port){
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(connect(fd, (sockaddr*)&addr, sizeof(addr))){
+        close(fd);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+// 发送一个请求并读回同样长度的回显
+static bool RoundTrip(int fd, const char *msg, size_t len){
+    if(write(fd, msg, len) != (ssize_t)len)
+        return false;
+    char buf[256];
+    size_t got = 0;
+    while(got < len){
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if(n <= 0)
+            return false;
+        got += n;
+    }
+    return true;
+}
+
+static void Run(size_t threads, size_t clients, double seconds){
+    IOManager iom(threads, false, "echo");
+    EchoServer::ptr server(new EchoServer(&iom));
+    if(!server->bind("127.0.0.1", 0) || !server->start()){
+        printf("bind failed\n");
+        return;
+    }
+    uint16_t port = server->getPort();
+    static const char msg[] = "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcde\n";
+
+    for(int mode = 0; mode < 2; ++mode){
+        std::atomic<bool> stop = {false};
+        std::atomic<uint64_t> ops = {0};
+        std::atomic<uint64_t> errors = {0};
+        BenchLatency lat(1 << 20);
+        std::vector<std::thread> ts;
+        double cpu = BenchCpuSeconds();
+        uint64_t start = BenchNowNs();
+        for(size_t c = 0; c < clients; ++c){
+            ts.emplace_back([&, mode](){
+                int fd = mode ? Connect(port) : -1;
+                while(!stop){
+                    uint64_t t0 = BenchNowNs();
+                    if(!mode){
+                        // 建连测试：连接、一问一答、关闭
+                        int cfd = Connect(port);
+                        bool ok = cfd >= 0 && RoundTrip(cfd, msg, sizeof(msg) - 1);
+                        if(cfd >= 0)
+                            close(cfd);
+                        if(!ok){
+                            ++errors;
+                            continue;
+                        }
+                    }else if(fd < 0 || !RoundTrip(fd, msg, sizeof(msg) - 1)){
+                        ++errors;
+                        break;
+                    }
+                    lat.add(BenchNowNs() - t0);
+                    ++ops;
+                }
+                if(fd >= 0)
+                    close(fd);
+            });
+        }
+        usleep(seconds * 1000000);
+        stop = true;
+        for(auto &t : ts)
+            t.join();
+        double wall = (BenchNowNs() - start) / 1e9;
+        cpu = BenchCpuSeconds() - cpu;
+        char label[64];
+        snprintf(label, sizeof(label), "%s threads=%zu", mode ? "request" : "connect", threads);
+        printf("%-32s %10.0f %s/s  errors=%lu  cpu=%.2f cores\n", label, ops / wall,
+               mode ? "req" : "conn", (unsigned long)errors.load(), cpu / wall);
+        lat.print("");
+    }
+    server->stop();
+    iom.stop();
+}
+
+int main(int argc, char **argv){
+    size_t clients = argc > 1 ? atoi(argv[1]) : 32;
+    double seconds = argc > 2 ? atof(argv[2]) : 3;
+    s_log = argc > 3 && !strcmp(argv[3], "log");
+    printf("usage: %s [clients] [seconds] [log]\n", argv[0]);
+    if(s_log)
+        AsyncLogger::SetFd(open("/dev/null", O_WRONLY));
+    size_t thread_counts[] = {1, 2, 4, 8};
+    for(size_t threads : thread_counts)
+        Run(threads, clients, seconds);
+    return 0;
+}
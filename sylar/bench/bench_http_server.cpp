@@ -0,0 +1,58 @@
+/**
+ * @file bench_http_server.cpp
+ * @brief 供wrk压测的HTTP服务器
+ * @details 注册/plaintext返回固定的13字节响应，/echo原样返回请求体，
+ * 运行到收到SIGINT或SIGTERM为止，退出时输出累计连接数和进程CPU时间。例如
+ * wrk -t4 -c256 -d30s http://127.0.0.1:8080/plaintext
+ * 流水线请求可以用wrk自带的pipeline.lua脚本测试
+ * @note 运行时不能编译，尚未用wrk压测过，/plaintext和/echo的请求速率和CPU占用待补
+ */
+#include "http_server.h"
+#include "bench_util.h"
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static volatile sig_atomic_t s_stop = 0;
+
+static void OnSignal(int){
+    s_stop = 1;
+}
+
+int main(int argc, char **argv){
+    size_t threads = argc > 1 ? atoi(argv[1]) : 4;
+    uint16_t port = argc > 2 ? atoi(argv[2]) : 8080;
+    const char *ip = argc > 3 ? argv[3] : "127.0.0.1";
+    printf("usage: %s [threads] [port] [ip]\n", argv[0]);
+
+    signal(SIGINT, OnSignal);
+    signal(SIGTERM, OnSignal);
+    signal(SIGPIPE, SIG_IGN);
+
+    IOManager iom(threads, false, "http");
+    HttpServer::ptr server(new HttpServer(&iom, "bench/http"));
+    server->addHandler("/plaintext", [](HttpRequest &, HttpResponse &resp){
+        resp.addHeader("Content-Type", "text/plain");
+        resp.setBody("Hello, World!");
+    });
+    server->addHandler("/echo", [](HttpRequest &req, HttpResponse &resp){
+        resp.getBody().append(std::move(req.getBody()));
+    });
+    if(!server->bind(ip, port) || !server->start()){
+        printf("bind %s:%u failed\n", ip, port);
+        return 1;
+    }
+    printf("listening on %s:%u with %zu threads\n", ip, server->getPort(), threads);
+
+    double cpu = BenchCpuSeconds();
+    uint64_t start = BenchNowNs();
+    while(!s_stop)
+        usleep(100 * 1000);
+    double wall = (BenchNowNs() - start) / 1e9;
+    cpu = BenchCpuSeconds() - cpu;
+    printf("accepted=%lu  cpu=%.2f cores over %.1f s\n",
+           (unsigned long)server->getAcceptCount(), cpu / wall, wall);
+    server->stop();
+    iom.stop();
+    return 0;
+}
@@ -0,0 +1,56 @@
+/**
+ * @file bench_idle_policy.cpp
+ * @brief 比较IOManager各空闲策略下任务的调度延迟和空闲线程的CPU占用
+ * @details 调度器外的线程按固定间隔投递回调，记录从schedule到回调开始执行的时间；
+ * 间隔期间工作线程都是空闲的，进程CPU时间基本就是空闲线程消耗的CPU
+ * @note 尚未运行：运行时目标(SYLAR_BUILD_RUNTIME)在当前树中还不能编译，三种空闲策略的调度延迟和空闲CPU仍待测量
+ */
+#include "IOManager.h"
+#include "bench_util.h"
+#include <unistd.h>
+#include <stdlib.h>
+
+static void run(IOManager::IdlePolicy policy, const char *name, size_t threads,
+                size_t tasks, uint64_t interval_us, uint64_t max_spin_us){
+    BenchLatency lat(tasks);
+    std::atomic<size_t> done = {0};
+    {
+        IOManager iom(threads, false, name);
+        iom.setIdlePolicy(policy, max_spin_us);
+        // 等工作线程都进入idle
+        usleep(100 * 1000);
+
+        double cpu = BenchCpuSeconds();
+        uint64_t start = BenchNowNs();
+        for(size_t i = 0; i < tasks; ++i){
+            uint64_t ts = BenchNowNs();
+            iom.schedule([ts, &lat, &done](){
+                lat.add(BenchNowNs() - ts);
+                ++done;
+            });
+            usleep(interval_us);
+        }
+        while(done < tasks)
+            usleep(1000);
+        double wall = (BenchNowNs() - start) / 1e9;
+        cpu = BenchCpuSeconds() - cpu;
+
+        char label[64];
+        snprintf(label, sizeof(label), "%s threads=%zu", name, threads);
+        lat.print(label);
+        printf("%-32s cpu=%.2f cores\n", "", cpu / wall);
+        iom.stop();
+    }
+}
+
+int main(int argc, char **argv){
+    size_t threads = argc > 1 ? atoi(argv[1]) : 2;
+    size_t tasks = argc > 2 ? atoi(argv[2]) : 20000;
+    uint64_t interval_us = argc > 3 ? atoi(argv[3]) : 100;
+    uint64_t max_spin_us = argc > 4 ? atoi(argv[4]) : 50;
+    printf("usage: %s [threads] [tasks] [interval_us] [max_spin_us]\n", argv[0]);
+    run(IOManager::IDLE_PARK, "park", threads, tasks, interval_us, max_spin_us);
+    run(IOManager::IDLE_SPIN_THEN_PARK, "spin_then_park", threads, tasks, interval_us, max_spin_us);
+    run(IOManager::IDLE_SPIN, "spin", threads, tasks, interval_us, max_spin_us);
+    return 0;
+}
@@ -0,0 +1,104 @@
+/**
+ * @file bench_iobuf_parse.cpp
+ * @brief 长度前缀帧的拆包：IOBuf零拷贝切分对比std::string拷贝
+ * @details 预先生成一段由varint长度加负载组成的字节流，按固定大小分段喂给解析器，
+ * 模拟每次read得到的数据。IOBuf方式用peekVarint64加cutTo取出帧，负载不拷贝；
+ * 拷贝方式是常见的std::string缓冲区写法，取帧时substr拷贝负载并从头部erase
+ */
+#include "iobuf.h"
+#include "bench_util.h"
+#include <stdlib.h>
+#include <string>
+
+static void PutVarint(std::string &s, uint64_t v){
+    while(v >= 0x80){
+        s.push_back((char)(v | 0x80));
+        v >>= 7;
+    }
+    s.push_back((char)v);
+}
+
+// 解析开头的varint，数据不足返回0
+static size_t GetVarint(const std::string &s, size_t off, uint64_t &v){
+    uint64_t r = 0;
+    for(size_t i = 0; i < 10 && off + i < s.size(); ++i){
+        uint8_t b = s[off + i];
+        r |= (uint64_t)(b & 0x7f) << (7 * i);
+        if(!(b & 0x80)){
+            v = r;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+// 返回取出的帧数，sink累加负载的首字节，防止被优化掉
+static size_t ParseIOBuf(const std::string &stream, size_t chunk, uint64_t &sink){
+    IOBuf in;
+    size_t frames = 0;
+    for(size_t off = 0; off < stream.size(); off += chunk){
+        in.append(stream.data() + off, std::min(chunk, stream.size() - off));
+        while(true){
+            uint64_t len;
+            size_t hdr = in.peekVarint64(len);
+            if(!hdr || in.size() < hdr + len)
+                break;
+            in.consume(hdr);
+            IOBuf msg;
+            in.cutTo(msg, len);
+            uint8_t first;
+            msg.readFixed8(first);
+            sink += first;
+            ++frames;
+        }
+    }
+    return frames;
+}
+
+static size_t ParseString(const std::string &stream, size_t chunk, uint64_t &sink){
+    std::string in;
+    size_t frames = 0;
+    for(size_t off = 0; off < stream.size(); off += chunk){
+        in.append(stream.data() + off, std::min(chunk, stream.size() - off));
+        while(true){
+            uint64_t len;
+            size_t hdr = GetVarint(in, 0, len);
+            if(!hdr || in.size() < hdr + len)
+                break;
+            std::string msg = in.substr(hdr, len);
+            in.erase(0, hdr + len);
+            sink += (uint8_t)msg[0];
+            ++frames;
+        }
+    }
+    return frames;
+}
+
+int main(int argc, char **argv){
+    size_t total = (argc > 1 ? atoi(argv[1]) : 64) << 20;
+    size_t chunk = argc > 2 ? atoi(argv[2]) : 16384;
+    printf("usage: %s [stream_mb] [read_chunk]\n", argv[0]);
+    size_t payloads[] = {64, 1024, 16384, 262144};
+    for(size_t payload : payloads){
+        std::string stream;
+        std::string body(payload, 'p');
+        while(stream.size() < total){
+            PutVarint(stream, payload);
+            stream += body;
+        }
+        uint64_t sink = 0;
+        const char *names[] = {"iobuf cut", "string copy"};
+        for(int m = 0; m < 2; ++m){
+            // 先跑一遍预热块池和分配器
+            size_t frames = m ? ParseString(stream, chunk, sink) : ParseIOBuf(stream, chunk, sink);
+            uint64_t start = BenchNowNs();
+            frames = m ? ParseString(stream, chunk, sink) : ParseIOBuf(stream, chunk, sink);
+            double sec = (BenchNowNs() - start) / 1e9;
+            printf("payload=%-7zu %-12s %10.0f frames/s %8.0f MB/s\n", payload, names[m],
+                   frames / sec, stream.size() / sec / (1 << 20));
+        }
+        if(!sink)
+            printf("\n");
+    }
+    return 0;
+}
@@ -0,0 +1,96 @@
+/**
+ * @file bench_mailbox.cpp
+ * @brief 两个调度器之间通过FiberMailbox传递消息的单跳延迟和吞吐
+ * @details 两个单线程IOManager，A上的协程把时间戳投递到B的邮箱，B的消费者协程原样投递回A，
+ * 往返时间的一半作为单跳延迟，此时消费者每次都要挂起和被唤醒。
+ * 吞吐测试中A上的协程连续投递，B的消费者批量取出，
+ * 同时对比每条消息都用schedule投递一个回调到B的做法
+ * @note 需要运行时，目前不能编译；单跳延迟以及与逐条schedule投递的吞吐对比都还没有测量
+ */
+#include "mailbox.h"
+#include "IOManager.h"
+#include "bench_util.h"
+#include <stdlib.h>
+#include <unistd.h>
+
+static void PingPong(IOManager &a, IOManager &b, size_t rounds){
+    FiberMailbox<uint64_t>::ptr to_b(new FiberMailbox<uint64_t>);
+    FiberMailbox<uint64_t>::ptr to_a(new FiberMailbox<uint64_t>);
+    BenchLatency lat(rounds);
+    std::atomic<int> done = {0};
+    b.schedule([&](){
+        uint64_t v;
+        while(to_b->pop(v))
+            to_a->push(v);
+        ++done;
+    });
+    a.schedule([&](){
+        uint64_t v;
+        for(size_t i = 0; i < rounds; ++i){
+            to_b->push(BenchNowNs());
+            if(!to_a->pop(v))
+                break;
+            lat.add((BenchNowNs() - v) / 2);
+        }
+        to_b->close();
+        ++done;
+    });
+    while(done < 2)
+        usleep(1000);
+    lat.print("mailbox hop");
+}
+
+static void Throughput(IOManager &a, IOManager &b, size_t count){
+    FiberMailbox<uint64_t>::ptr box(new FiberMailbox<uint64_t>);
+    std::atomic<uint64_t> received = {0};
+    std::atomic<int> done = {0};
+    uint64_t start = BenchNowNs();
+    b.schedule([&](){
+        uint64_t v;
+        uint64_t n = 0;
+        while(box->pop(v))
+            ++n;
+        received = n;
+        ++done;
+    });
+    a.schedule([&](){
+        for(size_t i = 0; i < count; ++i)
+            box->push(i);
+        box->close();
+        ++done;
+    });
+    while(done < 2)
+        usleep(1000);
+    double sec = (BenchNowNs() - start) / 1e9;
+    printf("%-32s %10.0f msgs/s\n", "mailbox push/pop", received / sec);
+
+    // 每条消息一个回调，经过B的调度队列
+    std::atomic<uint64_t> handled = {0};
+    done = 0;
+    start = BenchNowNs();
+    a.schedule([&](){
+        for(size_t i = 0; i < count; ++i){
+            b.schedule([&](){
+                if(++handled == count)
+                    ++done;
+            });
+        }
+    });
+    while(!done)
+        usleep(1000);
+    sec = (BenchNowNs() - start) / 1e9;
+    printf("%-32s %10.0f msgs/s\n", "schedule per message", count / sec);
+}
+
+int main(int argc, char **argv){
+    size_t rounds = argc > 1 ? atoi(argv[1]) : 100000;
+    size_t count = argc > 2 ? atoi(argv[2]) : 2000000;
+    printf("usage: %s [pingpong_rounds] [throughput_msgs]\n", argv[0]);
+    IOManager a(1, false, "mailbox_a");
+    IOManager b(1, false, "mailbox_b");
+    PingPong(a, b, rounds);
+    Throughput(a, b, count);
+    a.stop();
+    b.stop();
+    return 0;
+}
@@ -0,0 +1,169 @@
+/**
+ * @file bench_metrics.cpp
+ * @brief 运行时指标在协程切换路径上的开销
+ * @details 用ucontext在两个上下文之间来回切换，和调度器一样每次resume一个任务；
+ * 打开指标时在切换前后做Scheduler::stampTask/beginTask/endTask以及Fiber::resume/yield里
+ * 和指标相关的同样操作。对比的基准只有裸的swapcontext，没有调度器的锁和队列，算出来的比例偏大，是上界。
+ * 分别测默认配置（直方图每64个任务抽一个，协程耗时统计关闭）、每个任务都记录直方图、
+ * 以及打开协程耗时统计（FiberStats::SetEnabled）
+ */
+#include <ucontext.h>
+#include <stdlib.h>
+#include "metrics.h"
+#include "fiber_stats.h"
+#include "util.h"
+#include "bench_util.h"
+
+static ucontext_t s_main;
+static ucontext_t s_task;
+static WorkerMetrics s_metrics;
+static std::atomic<bool> s_running = {false};
+static std::atomic<uint64_t> s_runSeq = {0};
+static uint64_t s_sliceStartUs = 0;
+static uint32_t s_sampleEvery = 64;
+static uint32_t s_sampleCountdown = 0;
+
+// 协程上和指标相关的字段
+static uint64_t s_runs = 0;
+static uint64_t s_resumeCycles = 0;
+static uint64_t s_cpuCycles = 0;
+static uint64_t s_lastYieldUs = 0;
+static uint64_t s_queuedUs = 0;
+static uint64_t s_parkedUs = 0;
+
+struct Task{
+    uint64_t enqueueUs = 0;
+    bool sampled = false;
+};
+
+static void TaskMain(){
+    while(true)
+        swapcontext(&s_task, &s_main);
+}
+
+// 与Scheduler::stampTask相同，基准没有开启CoDel
+static void StampTask(Task &task){
+    uint32_t every = s_sampleEvery;
+    if(every && ++s_sampleCountdown >= every){
+        s_sampleCountdown = 0;
+        task.sampled = true;
+    }
+    if(task.sampled || FiberStats::IsEnabled())
+        task.enqueueUs = GetCurrentUS();
+}
+
+// 与Scheduler::beginTask中指标相关的部分相同
+static void BeginTask(uint64_t enqueue_us, bool sampled){
+    bool timing = FiberStats::IsEnabled();
+    uint64_t now = 0;
+    if(enqueue_us && (sampled || timing)){
+        now = GetCurrentUS();
+        if(now < enqueue_us)
+            now = enqueue_us;
+    }
+    if(now && timing){
+        uint64_t last = s_lastYieldUs;
+        s_queuedUs += now - enqueue_us;
+        s_parkedUs += last && enqueue_us > last ? enqueue_us - last : 0;
+    }
+    s_runSeq.store(s_runSeq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    s_running.store(true, std::memory_order_release);
+    s_sliceStartUs = sampled ? now : 0;
+    if(sampled && now)
+        s_metrics.scheduleLatencyUs.record(now - enqueue_us);
+}
+
+// 与Scheduler::endTask相同
+static void EndTask(){
+    s_running.store(false, std::memory_order_relaxed);
+    uint64_t start = s_sliceStartUs;
+    if(start){
+        s_sliceStartUs = 0;
+        uint64_t now = GetCurrentUS();
+        if(now >= start)
+            s_metrics.runSliceUs.record(now - start);
+    }
+}
+
+// 与Fiber::resume中计时的部分相同
+static void FiberResume(){
+    ++s_runs;
+    s_resumeCycles = FiberStats::IsEnabled() ? GetCycleCount() : 0;
+}
+
+// 与Fiber::yield中计时的部分相同，协程没有结束
+static void FiberYield(){
+    bool timing = FiberStats::IsEnabled();
+    if(timing && s_resumeCycles)
+        s_cpuCycles += GetCycleCount() - s_resumeCycles;
+    s_lastYieldUs = timing ? GetCurrentUS() : 0;
+}
+
+// 一次切换在指标上做的全部操作
+static void Instrument(bool do_switch){
+    Task task;
+    StampTask(task);
+    BeginTask(task.enqueueUs, task.sampled);
+    FiberResume();
+    if(do_switch)
+        swapcontext(&s_main, &s_task);
+    FiberYield();
+    EndTask();
+}
+
+// 返回每次resume+yield的纳秒数
+static double Measure(bool instrument, size_t n){
+    uint64_t start = BenchNowNs();
+    for(size_t i = 0; i < n; ++i){
+        if(instrument)
+            Instrument(true);
+        else
+            swapcontext(&s_main, &s_task);
+    }
+    return (double)(BenchNowNs() - start) / n;
+}
+
+// 不切换只做指标操作，返回每次的纳秒数；两次切换时间相减受干扰影响大，这个值更稳定
+static double MeasurePathOnly(size_t n){
+    uint64_t start = BenchNowNs();
+    for(size_t i = 0; i < n; ++i)
+        Instrument(false);
+    return (double)(BenchNowNs() - start) / n;
+}
+
+// 分成多轮短时间交替测，各取最小值，减少频率调节和其他进程干扰的影响
+static void Report(const char *name, size_t n){
+    static const int kRounds = 30;
+    double base = 1e18, inst = 1e18, path = 1e18;
+    for(int round = 0; round < kRounds; ++round){
+        base = std::min(base, Measure(false, n / 5));
+        inst = std::min(inst, Measure(true, n / 5));
+        path = std::min(path, MeasurePathOnly(n / 5));
+    }
+    printf("%-24s bare %6.1f ns  with metrics %6.1f ns (%+6.2f%%)  metrics path alone %5.1f ns (%5.2f%%)\n",
+           name, base, inst, (inst - base) * 100 / base, path, path * 100 / base);
+}
+
+int main(int argc, char **argv){
+    size_t n = argc > 1 ? atoi(argv[1]) : 2000000;
+    static char stack[64 * 1024];
+    getcontext(&s_task);
+    s_task.uc_stack.ss_sp = stack;
+    s_task.uc_stack.ss_size = sizeof(stack);
+    s_task.uc_link = nullptr;
+    makecontext(&s_task, &TaskMain, 0);
+
+    Measure(false, n / 10);
+    Report("default (sample 1/64)", n);
+    s_sampleEvery = 1;
+    Report("histograms every task", n);
+    s_sampleEvery = 64;
+    FiberStats::SetEnabled(true);
+    Report("fiber timing on", n);
+    FiberStats::SetEnabled(false);
+    MetricHistogram::Snapshot latency;
+    s_metrics.scheduleLatencyUs.snapshot(latency);
+    printf("tasks recorded: %llu, latency samples: %llu\n",
+           (unsigned long long)s_runSeq.load(), (unsigned long long)latency.count);
+    return 0;
+}
@@ -0,0 +1,122 @@
+/**
+ * @file bench_preempt.cpp
+ * @brief 计算密集的协程和延迟敏感的任务混跑时，抢占对尾延迟的影响
+ * @details 每个工作线程上放几个长时间计算的协程，主线程每隔一段时间投递一个探测任务，
+ * 记录从schedule到开始运行的时间。分三种模式：
+ * - off：不抢占，探测任务要等计算协程跑完
+ * - cooperative：setPreemption(slice, false)，计算循环里定期调用Fiber::MaybeYield
+ * - async：setPreemption(slice, true)，计算循环包在Fiber::PreemptibleScope里，没有检查点，
+ *   靠监控线程发出的SIGURG在信号处理函数里让出
+ * 运行时长由监控线程计时，检查间隔设为1ms，并关闭阻塞检测，避免补充线程干扰结果
+ */
+#include "scheduler.h"
+#include "fiber.h"
+#include "bench_util.h"
+#include <stdlib.h>
+#include <unistd.h>
+
+enum Mode{
+    MODE_OFF,
+    MODE_COOPERATIVE,
+    MODE_ASYNC
+};
+
+static const char *ModeName(int mode){
+    switch(mode){
+        case MODE_OFF: return "off";
+        case MODE_COOPERATIVE: return "cooperative MaybeYield";
+        default: return "async SIGURG";
+    }
+}
+
+// 每次检查点之间的计算量
+static const uint64_t kChunk = 1024;
+
+// 纯计算，不调用任何函数，异步抢占可以在任意位置打断
+static uint64_t Compute(uint64_t iters, uint64_t seed){
+    for(uint64_t i = 0; i < iters; ++i)
+        seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+    return seed;
+}
+
+static volatile uint64_t s_sink;
+
+// 估算每毫秒的计算迭代次数
+static uint64_t CalibrateItersPerMs(){
+    uint64_t iters = kChunk * 1024;
+    uint64_t start = BenchNowNs();
+    s_sink = Compute(iters, 1);
+    uint64_t ns = BenchNowNs() - start;
+    return ns ? iters * 1000000 / ns : iters;
+}
+
+static void Run(int mode, size_t threads, size_t hogs_per_thread, uint64_t hog_ms,
+        uint64_t slice_ms, uint64_t iters_per_ms){
+    Scheduler sc(threads, false, "bench_preempt");
+    sc.setSysmonOptions(1, 0);
+    if(mode != MODE_OFF)
+        sc.setPreemption(slice_ms, mode == MODE_ASYNC);
+    sc.start();
+
+    size_t hogs = threads * hogs_per_thread;
+    std::atomic<size_t> hogs_done = {0};
+    uint64_t hog_iters = hog_ms * iters_per_ms;
+    uint64_t start = BenchNowNs();
+    for(size_t i = 0; i < hogs; ++i){
+        sc.schedule([mode, hog_iters, &hogs_done](){
+            uint64_t seed = 1;
+            if(mode == MODE_ASYNC){
+                Fiber::PreemptibleScope scope;
+                seed = Compute(hog_iters, seed);
+            }else{
+                for(uint64_t done = 0; done < hog_iters; done += kChunk){
+                    seed = Compute(kChunk, seed);
+                    if(mode == MODE_COOPERATIVE)
+                        Fiber::MaybeYield();
+                }
+            }
+            s_sink = seed;
+            ++hogs_done;
+        });
+    }
+
+    // 计算协程运行期间每毫秒投递一个探测任务
+    size_t max_probes = hog_ms * hogs + 1000;
+    BenchLatency lat(max_probes);
+    std::atomic<size_t> probed = {0};
+    size_t sent = 0;
+    while(hogs_done < hogs && sent < max_probes){
+        uint64_t now = BenchNowNs();
+        ++sent;
+        sc.schedule([&lat, &probed, now](){
+            lat.add(BenchNowNs() - now);
+            ++probed;
+        });
+        usleep(1000);
+    }
+    while(hogs_done < hogs || probed < sent)
+        usleep(1000);
+    double sec = (BenchNowNs() - start) / 1e9;
+    SchedulerMetrics m;
+    sc.getMetrics(m);
+    sc.stop();
+
+    lat.print(ModeName(mode));
+    printf("%-32s %.2fs for %zu x %llums of compute, %llu preemptions\n", "", sec, hogs,
+           (unsigned long long)hog_ms, (unsigned long long)m.preemptions);
+}
+
+int main(int argc, char **argv){
+    size_t threads = argc > 1 ? atoi(argv[1]) : 2;
+    size_t hogs_per_thread = argc > 2 ? atoi(argv[2]) : 2;
+    uint64_t hog_ms = argc > 3 ? atoi(argv[3]) : 200;
+    uint64_t slice_ms = argc > 4 ? atoi(argv[4]) : 2;
+    printf("usage: %s [threads] [hogs_per_thread] [hog_ms] [slice_ms]\n", argv[0]);
+    uint64_t iters_per_ms = CalibrateItersPerMs();
+    printf("threads=%zu hogs=%zu hog=%llums slice=%llums\n", threads, threads * hogs_per_thread,
+           (unsigned long long)hog_ms, (unsigned long long)slice_ms);
+
+    for(int mode = MODE_OFF; mode <= MODE_ASYNC; ++mode)
+        Run(mode, threads, hogs_per_thread, hog_ms, slice_ms, iters_per_ms);
+    return 0;
+}
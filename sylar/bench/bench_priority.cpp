@@ -0,0 +1,88 @@
+/**
+ * @file bench_priority.cpp
+ * @brief 低优先级任务洪泛时高优先级任务的调度延迟
+ * @details 主线程持续向调度器投递低优先级的计算任务，保持队列里积压固定数量；
+ * 同时每隔一段时间投递一个探测任务，记录从schedule到开始运行的时间。
+ * 探测任务分别以PRIORITY_HIGH和PRIORITY_LOW投递，对比两者的p99，
+ * 后者相当于没有优先级时排在积压任务后面
+ */
+#include "IOManager.h"
+#include "bench_util.h"
+#include <stdlib.h>
+#include <unistd.h>
+
+// 忙等指定的纳秒数，模拟计算任务
+static void Spin(uint64_t ns){
+    uint64_t start = BenchNowNs();
+    while(BenchNowNs() - start < ns)
+        ;
+}
+
+/**
+ * @brief 在积压backlog个低优先级任务的情况下投递probes个探测任务
+ * @param[in] probe_priority 探测任务的优先级
+ * @param[in] work_ns 每个低优先级任务的计算时间
+ * @param[in] interval_us 探测任务的投递间隔
+ */
+static void Run(IOManager &iom, int probe_priority, size_t backlog, uint64_t work_ns,
+        size_t probes, uint64_t interval_us){
+    BenchLatency lat(probes);
+    std::atomic<size_t> outstanding = {0};
+    std::atomic<size_t> probed = {0};
+    std::atomic<uint64_t> low_ran = {0};
+
+    uint64_t start = BenchNowNs();
+    uint64_t next_probe = start;
+    size_t sent = 0;
+    while(sent < probes){
+        // 补齐积压
+        while(outstanding < backlog){
+            ++outstanding;
+            iom.schedule([&outstanding, &low_ran, work_ns](){
+                Spin(work_ns);
+                ++low_ran;
+                --outstanding;
+            }, -1, Scheduler::PRIORITY_LOW);
+        }
+        uint64_t now = BenchNowNs();
+        if(now >= next_probe){
+            next_probe = now + interval_us * 1000;
+            ++sent;
+            iom.schedule([&lat, &probed, now](){
+                lat.add(BenchNowNs() - now);
+                ++probed;
+            }, -1, probe_priority);
+        }else{
+            usleep(10);
+        }
+    }
+    while(probed < probes)
+        usleep(1000);
+    double sec = (BenchNowNs() - start) / 1e9;
+    uint64_t low_done = low_ran;
+    // 等积压的任务跑完，不影响下一轮
+    while(outstanding)
+        usleep(1000);
+
+    char label[64];
+    snprintf(label, sizeof(label), "probe %s",
+             probe_priority == Scheduler::PRIORITY_HIGH ? "high" : "low");
+    lat.print(label);
+    printf("%-32s %10.0f tasks/s\n", "  low priority throughput", low_done / sec);
+}
+
+int main(int argc, char **argv){
+    size_t threads = argc > 1 ? atoi(argv[1]) : 2;
+    size_t backlog = argc > 2 ? atoi(argv[2]) : 10000;
+    uint64_t work_us = argc > 3 ? atoi(argv[3]) : 5;
+    size_t probes = argc > 4 ? atoi(argv[4]) : 10000;
+    printf("usage: %s [threads] [backlog] [low_task_us] [probes]\n", argv[0]);
+    printf("threads=%zu backlog=%zu low_task=%lluus probes=%zu\n",
+           threads, backlog, (unsigned long long)work_us, probes);
+
+    IOManager iom(threads, false, "bench_priority");
+    Run(iom, Scheduler::PRIORITY_HIGH, backlog, work_us * 1000, probes, 200);
+    Run(iom, Scheduler::PRIORITY_LOW, backlog, work_us * 1000, probes / 10, 200);
+    iom.stop();
+    return 0;
+}
@@ -0,0 +1,94 @@
+/**
+ * @file bench_rpc.cpp
+ * @brief RPC调用速率和延迟随并发调用数的变化
+ * @details 服务端和客户端各用一个IOManager，客户端所有调用协程共享一个RpcChannel，
+ * 并发数分别为1、16、256，每个调用协程在测试时间内循环调用echo方法。
+ * 并发为1时测的是单次往返的延迟，并发较大时多个请求在写缓冲区里合并写出，测的是吞吐
+ * @note 尚未运行，1、16、256并发下的调用速率和延迟要等运行时能编译后再测
+ */
+#include "rpc.h"
+#include "bench_util.h"
+#include <stdlib.h>
+#include <unistd.h>
+
+static void Run(IOManager &client, RpcChannel::ptr ch, size_t callers, size_t payload,
+                double seconds){
+    std::atomic<size_t> running = {callers};
+    std::atomic<uint64_t> calls = {0};
+    std::atomic<uint64_t> errors = {0};
+    BenchLatency lat(1 << 22);
+    uint64_t end = BenchNowNs() + (uint64_t)(seconds * 1e9);
+    double cpu = BenchCpuSeconds();
+    uint64_t start = BenchNowNs();
+    for(size_t i = 0; i < callers; ++i){
+        client.schedule([&, ch](){
+            IOBuf req;
+            req.append(std::string(payload, 'r'));
+            IOBuf resp;
+            while(BenchNowNs() < end){
+                uint64_t t0 = BenchNowNs();
+                resp.clear();
+                if(ch->call("echo", req, resp)){
+                    ++errors;
+                    continue;
+                }
+                lat.add(BenchNowNs() - t0);
+                ++calls;
+            }
+            --running;
+        });
+    }
+    while(running)
+        usleep(10 * 1000);
+    double wall = (BenchNowNs() - start) / 1e9;
+    cpu = BenchCpuSeconds() - cpu;
+    char label[64];
+    snprintf(label, sizeof(label), "callers=%zu", callers);
+    printf("%-16s %10.0f calls/s  errors=%lu  cpu=%.2f cores\n", label, calls / wall,
+           (unsigned long)errors.load(), cpu / wall);
+    lat.print(label);
+}
+
+int main(int argc, char **argv){
+    size_t threads = argc > 1 ? atoi(argv[1]) : 2;
+    size_t payload = argc > 2 ? atoi(argv[2]) : 64;
+    double seconds = argc > 3 ? atof(argv[3]) : 3;
+    printf("usage: %s [threads_per_side] [payload] [seconds]\n", argv[0]);
+
+    IOManager server_iom(threads, false, "rpc_server");
+    RpcServer::ptr server(new RpcServer(&server_iom, "bench/rpc"));
+    server->registerMethod("echo", [](const IOBuf &req, IOBuf &resp){
+        resp.append(req);
+        return (int)RPC_OK;
+    });
+    if(!server->bind("127.0.0.1", 0) || !server->start()){
+        printf("bind failed\n");
+        return 1;
+    }
+
+    IOManager client_iom(threads, false, "rpc_client");
+    // 在协程里连接，socket才会由hook注册为非阻塞，读协程不会阻塞调度线程
+    RpcChannel::ptr ch;
+    std::atomic<bool> connected = {false};
+    uint16_t port = server->getPort();
+    client_iom.schedule([&](){
+        ch = RpcChannel::Connect(&client_iom, "127.0.0.1", port);
+        connected = true;
+    });
+    while(!connected)
+        usleep(1000);
+    if(!ch){
+        printf("connect failed\n");
+        return 1;
+    }
+    size_t caller_counts[] = {1, 16, 256};
+    for(size_t callers : caller_counts)
+        Run(client_iom, ch, callers, payload, seconds);
+
+    ch->close();
+    ch.reset();
+    client_iom.stop();
+    server->stop();
+    server_iom.stop();
+    return 0;
+}
@@ -0,0 +1,182 @@
+/**
+ * @file bench_sendfile.cpp
+ * @brief 发送文件时每GB消耗的CPU：read+send、sendfile和send_zerocopy
+ * @details 服务器在单线程IOManager上运行，每个连接把同一个文件反复发送到指定总量后关闭，
+ * 客户端线程读取并丢弃。发送协程用RUSAGE_THREAD统计所在调度线程的CPU时间，不含客户端。
+ * 文件先读一遍放进页缓存，测的是网络发送路径而不是磁盘。
+ * 回环连接上内核会把MSG_ZEROCOPY回退为拷贝，send_zerocopy在回环上的数字只代表回退路径，
+ * 零拷贝的收益需要用真实网卡、客户端在另一台机器上测，此时传入服务器地址并只运行服务器
+ * @note 还没有实测结果：依赖的运行时在当前树中无法编译，三种发送方式每GB的CPU待补测，零拷贝的部分还需要在真实网卡上测
+ */
+#include "tcp_server.h"
+#include "hook.h"
+#include "bench_util.h"
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <thread>
+
+enum Mode{
+    MODE_SEND = 0,
+    MODE_SENDFILE = 1,
+    MODE_ZEROCOPY = 2
+};
+
+static const char *s_modeNames[] = {"read+send", "sendfile", "send_zerocopy"};
+
+class FileServer : public TcpServer{
+public:
+    FileServer(IOManager *worker, int file, size_t file_size, uint64_t total)
+        :TcpServer(worker, "bench/sendfile")
+        ,m_file(file)
+        ,m_fileSize(file_size)
+        ,m_total(total){
+        m_map = (const char*)mmap(nullptr, file_size, PROT_READ, MAP_SHARED, file, 0);
+    }
+
+    ~FileServer(){
+        munmap((void*)m_map, m_fileSize);
+    }
+
+    std::atomic<int> mode = {MODE_SEND};
+    // 最近一个连接发送期间调度线程消耗的CPU(秒)
+    std::atomic<double> cpu = {0};
+
+protected:
+    void handleClient(int fd) override {
+        rusage ru;
+        getrusage(RUSAGE_THREAD, &ru);
+        double start = ru.ru_utime.tv_sec + ru.ru_stime.tv_sec
+            + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+        int m = mode;
+        std::string buf(256 * 1024, 0);
+        uint64_t sent = 0;
+        while(sent < m_total){
+            off_t off = 0;
+            bool ok = true;
+            while(ok && (size_t)off < m_fileSize){
+                size_t len = std::min(buf.size(), m_fileSize - off);
+                ssize_t n;
+                if(m == MODE_SEND){
+                    n = pread(m_file, &buf[0], len, off);
+                    ok = n > 0 && write_all(fd, buf.data(), n);
+                }else if(m == MODE_SENDFILE){
+                    off_t before = off;
+                    n = ::sendfile(fd, m_file, &off, len);
+                    ok = n > 0;
+                    off = before;
+                }else{
+                    // 文件页是只读映射，不复用缓冲区，不需要zerocopy_wait
+                    n = send_zerocopy(fd, m_map + off, len, 0);
+                    ok = n > 0;
+                }
+                if(ok)
+                    off += n;
+            }
+            if(!ok)
+                break;
+            sent += m_fileSize;
+        }
+        getrusage(RUSAGE_THREAD, &ru);
+        cpu = ru.ru_utime.tv_sec + ru.ru_stime.tv_sec
+            + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6 - start;
+    }
+
+private:
+    static bool write_all(int fd, const char *p, size_t len){
+        while(len){
+            ssize_t n = ::write(fd, p, len);
+            if(n <= 0)
+                return false;
+            p += n;
+            len -= n;
+        }
+        return true;
+    }
+
+private:
+    int m_file;
+    size_t m_fileSize;
+    uint64_t m_total;
+    const char *m_map;
+};
+
+// 连接服务器并读取到EOF，返回收到的字节数
+static uint64_t Drain(uint16_t port){
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(connect(fd, (sockaddr*)&addr, sizeof(addr))){
+        close(fd);
+        return 0;
+    }
+    static char buf[1 << 20];
+    uint64_t total = 0;
+    ssize_t n;
+    while((n = read(fd, buf, sizeof(buf))) > 0)
+        total += n;
+    close(fd);
+    return total;
+}
+
+int main(int argc, char **argv){
+    const char *path = argc > 1 ? argv[1] : "/tmp/bench_sendfile.dat";
+    size_t file_mb = argc > 2 ? atoi(argv[2]) : 64;
+    uint64_t total = (uint64_t)(argc > 3 ? atoi(argv[3]) : 4) << 30;
+    printf("usage: %s [file] [file_mb] [total_gb]\n", argv[0]);
+
+    int file = open(path, O_RDWR | O_CREAT, 0644);
+    if(file < 0){
+        perror("open");
+        return 1;
+    }
+    size_t file_size = file_mb << 20;
+    struct stat st;
+    fstat(file, &st);
+    if((size_t)st.st_size < file_size){
+        std::string block(1 << 20, 'f');
+        for(size_t i = 0; i < file_mb; ++i){
+            if(pwrite(file, block.data(), block.size(), i << 20) != (ssize_t)block.size()){
+                perror("pwrite");
+                return 1;
+            }
+        }
+    }
+    // 预热页缓存
+    std::string tmp(1 << 20, 0);
+    for(size_t off = 0; off < file_size; off += tmp.size()){
+        if(pread(file, &tmp[0], tmp.size(), off) < 0)
+            break;
+    }
+
+    IOManager iom(1, false, "sendfile");
+    std::shared_ptr<FileServer> server(new FileServer(&iom, file, file_size, total));
+    if(!server->bind("127.0.0.1", 0) || !server->start()){
+        printf("bind failed\n");
+        return 1;
+    }
+    for(int m = MODE_SEND; m <= MODE_ZEROCOPY; ++m){
+        server->mode = m;
+        uint64_t start = BenchNowNs();
+        uint64_t got = Drain(server->getPort());
+        double sec = (BenchNowNs() - start) / 1e9;
+        // 连接关闭后handleClient已经写入cpu
+        usleep(10 * 1000);
+        double gb = got / (double)(1ull << 30);
+        printf("%-14s %6.2f GB  %8.0f MB/s  sender cpu=%.3f s/GB\n", s_modeNames[m],
+               gb, got / sec / (1 << 20), gb > 0 ? server->cpu / gb : 0);
+    }
+    server->stop();
+    iom.stop();
+    close(file);
+    return 0;
+}
@@ -0,0 +1,86 @@
+/**
+ * @file bench_task_alloc.cpp
+ * @brief 统计调度路径上每个小任务的内存分配次数
+ * @details 模拟schedule->入队->出队->执行的过程，对比std::function和TaskFunc。
+ * 替换全局operator new计数，队列预热扩容之后，TaskFunc对小lambda应当是0次分配
+ */
+#include "task.h"
+#include "ring_queue.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <new>
+#include <deque>
+#include <string>
+#include <chrono>
+#include <functional>
+
+static uint64_t s_allocs = 0;
+
+void *operator new(size_t size){
+    ++s_allocs;
+    void *p = malloc(size ? size : 1);
+    if(!p) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) noexcept { free(p);}
+void operator delete(void *p, size_t) noexcept { free(p);}
+
+static const int kTasks = 1000000;
+
+template<class Queue, class Make>
+static void run(const char *name, Make make){
+    Queue q;
+    uint64_t sum = 0;
+    // 预热，让队列容量稳定下来
+    for(int i = 0; i < 1024; ++i)
+        q.push_back(make(sum, i));
+    while(!q.empty()){
+        q.front()();
+        q.pop_front();
+    }
+
+    uint64_t allocs = s_allocs;
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < kTasks; i += 64){
+        for(int j = 0; j < 64; ++j)
+            q.push_back(make(sum, i + j));
+        while(!q.empty()){
+            q.front()();
+            q.pop_front();
+        }
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    printf("%-40s %6.2f allocs/task %7.1f ns/task (sum=%llu)\n", name,
+           (double)(s_allocs - allocs) / kTasks, ns / kTasks, (unsigned long long)sum);
+}
+
+int main(){
+    // 捕获3个指针大小的值，典型的schedule回调
+    auto small = [](uint64_t &sum, int i){
+        void *a = &sum;
+        void *b = nullptr;
+        return [a, b, i](){ *static_cast<uint64_t*>(a) += i + (b ? 1 : 0);};
+    };
+    // 捕获一个std::string，超过std::function的内联大小
+    auto medium = [](uint64_t &sum, int i){
+        uint64_t *p = &sum;
+        std::string tag("request");
+        return [p, tag, i](){ *p += tag.size() + i;};
+    };
+
+    run<std::deque<std::function<void()>>>("std::function + deque, small", [&](uint64_t &s, int i){
+        return std::function<void()>(small(s, i));
+    });
+    run<RingQueue<TaskFunc>>("TaskFunc + RingQueue, small", [&](uint64_t &s, int i){
+        return TaskFunc(small(s, i));
+    });
+    run<std::deque<std::function<void()>>>("std::function + deque, string capture (SSO)", [&](uint64_t &s, int i){
+        return std::function<void()>(medium(s, i));
+    });
+    run<RingQueue<TaskFunc>>("TaskFunc + RingQueue, string capture (SSO)", [&](uint64_t &s, int i){
+        return TaskFunc(medium(s, i));
+    });
+    return 0;
+}
@@ -0,0 +1,142 @@
+/**
+ * @file bench_udp.cpp
+ * @brief 回环上的UDP收发速率：逐个收发、sendmmsg/recvmmsg批量收发和UDP_SEGMENT/GRO
+ * @details 接收协程和发送协程分别固定在IOManager的两个线程上，发送协程连续发送一段时间，
+ * 接收协程统计收到的报文数。UDP没有流控，接收跟不上时报文在socket缓冲区溢出被丢弃，
+ * 所以同时输出发送和接收的速率，接收速率才是端到端的吞吐
+ * @note 依赖运行时，当前树中不能编译，逐个收发、批量和UDP_SEGMENT/GRO三种模式的收发速率尚未测得
+ */
+#include "IOManager.h"
+#include "udp_socket.h"
+#include "bench_util.h"
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+enum Mode{
+    MODE_SINGLE = 0,
+    MODE_BATCH = 1,
+    MODE_SEGMENT = 2
+};
+
+static const char *s_modeNames[] = {"sendto/recvfrom", "sendmmsg/recvmmsg", "UDP_SEGMENT/GRO"};
+
+static void Run(IOManager &iom, int mode, size_t payload, double seconds){
+    // 在协程里创建socket，hook才会把它们注册到FdManager，收发时挂起协程而不是阻塞线程
+    UdpSocket::ptr rx;
+    UdpSocket::ptr tx;
+    std::atomic<int> setup = {0};
+    iom.schedule([&](){
+        rx.reset(new UdpSocket);
+        tx.reset(new UdpSocket);
+        if(!rx->bind("127.0.0.1", 0) || !tx->connect("127.0.0.1", rx->getPort())){
+            setup = -1;
+            return;
+        }
+        if(mode == MODE_SEGMENT && !rx->setGro(true)){
+            setup = -2;
+            return;
+        }
+        // 接收超时用来检查结束标志
+        timeval tv = {0, 100 * 1000};
+        setsockopt(rx->getFd(), SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        int rcvbuf = 4 << 20;
+        setsockopt(rx->getFd(), SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+        setup = 1;
+    });
+    while(!setup)
+        usleep(1000);
+    if(setup == -1){
+        printf("bind failed\n");
+        return;
+    }
+    if(setup == -2){
+        printf("%-20s GRO not supported\n", s_modeNames[mode]);
+        return;
+    }
+
+    std::vector<int> tids = iom.getThreadIds();
+    std::atomic<bool> sending = {true};
+    std::atomic<int> done = {0};
+    std::atomic<uint64_t> sent = {0};
+    std::atomic<uint64_t> received = {0};
+
+    iom.schedule([&](){
+        UdpSocket::RecvBatch batch(mode == MODE_SEGMENT ? 65536 : 2048);
+        char buf[2048];
+        uint64_t n = 0;
+        while(true){
+            int rt;
+            if(mode == MODE_SINGLE)
+                rt = ::recv(rx->getFd(), buf, sizeof(buf), 0) >= 0 ? 1 : -1;
+            else
+                rt = rx->recv(batch);
+            if(rt > 0){
+                n += rt;
+                continue;
+            }
+            if(!sending)
+                break;
+        }
+        received = n;
+        ++done;
+    }, tids[0]);
+
+    iom.schedule([&](){
+        std::string data(payload * UdpSocket::kMaxBatch, 'u');
+        UdpSocket::Datagram dgrams[UdpSocket::kMaxBatch];
+        for(size_t i = 0; i < UdpSocket::kMaxBatch; ++i)
+            dgrams[i] = {data.data() + i * payload, payload, nullptr, 0};
+        uint64_t n = 0;
+        uint64_t end = BenchNowNs() + (uint64_t)(seconds * 1e9);
+        while(BenchNowNs() < end){
+            if(mode == MODE_SINGLE){
+                if(::send(tx->getFd(), data.data(), payload, 0) > 0)
+                    ++n;
+            }else if(mode == MODE_BATCH){
+                int rt = tx->send(dgrams, UdpSocket::kMaxBatch);
+                if(rt > 0)
+                    n += rt;
+            }else{
+                ssize_t rt = tx->sendSegments(data.data(), data.size(), payload);
+                if(rt > 0)
+                    n += (rt + payload - 1) / payload;
+            }
+        }
+        sent = n;
+        sending = false;
+        ++done;
+    }, tids[1 % tids.size()]);
+
+    double cpu = BenchCpuSeconds();
+    uint64_t start = BenchNowNs();
+    while(done < 2)
+        usleep(10 * 1000);
+    double wall = (BenchNowNs() - start) / 1e9;
+    cpu = BenchCpuSeconds() - cpu;
+    // 同样在协程里关闭，hook的close会把fd从FdManager中删除
+    iom.schedule([&](){
+        rx.reset();
+        tx.reset();
+        setup = 0;
+    });
+    while(setup)
+        usleep(1000);
+    printf("%-20s payload=%-5zu sent=%9.0f pps  received=%9.0f pps  loss=%5.1f%%  cpu=%.2f cores\n",
+           s_modeNames[mode], payload, sent / seconds, received / seconds,
+           sent ? (sent - std::min(sent.load(), received.load())) * 100.0 / sent : 0, cpu / wall);
+}
+
+int main(int argc, char **argv){
+    double seconds = argc > 1 ? atof(argv[1]) : 3;
+    printf("usage: %s [seconds]\n", argv[0]);
+    IOManager iom(2, false, "udp");
+    size_t payloads[] = {64, 512, 1400};
+    for(size_t payload : payloads){
+        for(int mode = MODE_SINGLE; mode <= MODE_SEGMENT; ++mode)
+            Run(iom, mode, payload, seconds);
+    }
+    iom.stop();
+    return 0;
+}
@@ -0,0 +1,71 @@
+/**
+ * @file bench_util.h
+ * @brief 基准程序共用的计时和统计工具
+ */
+#ifndef __SYLAR_BENCH_UTIL_H__
+#define __SYLAR_BENCH_UTIL_H__
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+
+// 单调时钟(纳秒)
+inline uint64_t BenchNowNs(){
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// 进程累计使用的CPU时间(秒)，用户态加内核态
+inline double BenchCpuSeconds(){
+    rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec
+        + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+/**
+ * @brief 延迟样本，预先分配，多个线程可以同时记录
+ */
+class BenchLatency{
+public:
+    BenchLatency(size_t max_samples) : m_samples(max_samples) {}
+
+    void add(uint64_t ns){
+        size_t i = m_count.fetch_add(1, std::memory_order_relaxed);
+        if(i < m_samples.size())
+            m_samples[i] = ns;
+    }
+
+    size_t count() const { return std::min(m_count.load(), m_samples.size());}
+
+    void reset() { m_count = 0;}
+
+    // 第p分位的延迟(纳秒)，p在0到1之间，会对样本排序
+    uint64_t percentile(double p){
+        size_t n = count();
+        if(!n) return 0;
+        std::sort(m_samples.begin(), m_samples.begin() + n);
+        size_t i = (size_t)(p * (n - 1));
+        return m_samples[i];
+    }
+
+    // 输出p50/p99/p999，单位微秒
+    void print(const char *label){
+        size_t n = count();
+        double p50 = percentile(0.5) / 1000.0;
+        double p99 = percentile(0.99) / 1000.0;
+        double p999 = percentile(0.999) / 1000.0;
+        printf("%-32s n=%-8zu p50=%8.1fus p99=%8.1fus p999=%8.1fus\n", label, n, p50, p99, p999);
+    }
+
+private:
+    std::vector<uint64_t> m_samples;
+    std::atomic<size_t> m_count = {0};
+};
+
+#endif
@@ -0,0 +1,11 @@
+/**
+ * @file fiber_current.cpp
+ * @brief 在没有协程运行时的基准里代替Fiber::GetCurrent
+ * @details 只在线程上直接调用、从不进入协程的基准里使用，当前协程总是空
+ */
+#include "fiber.h"
+
+Fiber *Fiber::GetCurrent()
+{
+    return nullptr;
+}
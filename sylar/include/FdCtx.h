@@ -68,6 +68,22 @@ public:
      */
     uint64_t getTimeout(int type);
 
+    /**
+     * @brief MSG_ZEROCOPY状态，0未设置，1已开启，-1不支持或内核总是回退为拷贝
+     */
+    int getZeroCopy() const { return m_zeroCopy;}
+    void setZeroCopy(int v) { m_zeroCopy = v;}
+
+    /**
+     * @brief 零拷贝发送的编号
+     * @details 内核按顺序为每次成功的MSG_ZEROCOPY发送编号，sent是下一次发送的编号，
+     * done是已收到完成通知的编号上界（不含），两者相等时没有被内核引用的用户缓冲区
+     */
+    uint32_t getZeroCopySent() const { return m_zcSent;}
+    void incZeroCopySent() { ++m_zcSent;}
+    uint32_t getZeroCopyDone() const { return m_zcDone;}
+    void setZeroCopyDone(uint32_t v) { m_zcDone = v;}
+
 private:
     // 是否初始化
     bool m_isInit = 1;
@@ -85,4 +101,10 @@ private:
     uint64_t m_recvTimeout;
     // 写超时时间毫秒
     uint64_t m_sendTimeout;
+    // MSG_ZEROCOPY状态
+    int m_zeroCopy = 0;
+    // 下一次零拷贝发送的编号
+    uint32_t m_zcSent = 0;
+    // 已完成的零拷贝发送编号上界
+    uint32_t m_zcDone = 0;
 };
\ No newline at end of file
@@ -15,6 +15,37 @@ public:
     void run(); // 协程调度函数
     virtual void idle(); // 无任务调度时执行idle协程
     virtual bool stopping(); // 返回是否可以停止
+
+    // 返回当前线程的IOManager
+    static IOManager *GetThis();
+
+    /**
+     * @brief 空闲策略
+     * @details 任务队列为空时工作线程如何等待：直接阻塞在epoll_wait上最省CPU，
+     * 但下一次schedule要付出写pipe和唤醒线程的延迟；自旋轮询延迟最低但会占满一个核
+     */
+    enum IdlePolicy{
+        IDLE_PARK = 0,           // 直接阻塞在epoll_wait上（默认）
+        IDLE_SPIN_THEN_PARK = 1, // 先自旋轮询一段自适应调整的时间，没等到任务再阻塞
+        IDLE_SPIN = 2            // 一直自旋轮询，不阻塞
+    };
+
+    /**
+     * @brief 设置空闲策略
+     * @param[in] policy 空闲策略
+     * @param[in] max_spin_us 单次自旋的时间上限(微秒)，是CPU与延迟之间的权衡旋钮，
+     * IDLE_SPIN_THEN_PARK下实际自旋时间在[max_spin_us/16, max_spin_us]之间自适应：
+     * 自旋期间等到了任务就加倍，空转就减半
+     */
+    void setIdlePolicy(IdlePolicy policy, uint64_t max_spin_us = 50);
+
+    // 获取空闲策略
+    IdlePolicy getIdlePolicy() const { return m_idlePolicy;}
+
+    /**
+     * @brief 采集指标快照，在调度器指标之外补充待触发事件数和定时器数
+     */
+    void getMetrics(SchedulerMetrics &m) override;
     
 
     /**IO 事件，继承自epoll对事件的定义
@@ -24,9 +55,10 @@ public:
     NONE = 0x0,  // 无事件
     READ = 0x1,  // 读事件(EPOLLIN)
     WRITE = 0x4, // 写事件(EPOLLOUT)
+    ERROR = 0x8, // 错误事件(EPOLLERR)，错误队列有数据（如MSG_ZEROCOPY的完成通知）、出错或挂断时触发
    };
 
-   int addEvent(int fd, Event event, std::function<void()> cb);
+   int addEvent(int fd, Event event, TaskFunc cb = nullptr);
    bool IOManager::delEvent(int fd, Event event);
    bool IOManager::cancelEvent(int fd, Event event);
    bool IOManager::cancelAll(int fd);
@@ -46,7 +78,11 @@ public:
             // 事件回调协程
             Fiber::ptr fiber;
             // 事件回调函数
-            std::function<void()> cb;
+            TaskFunc cb;
+            // 事件触发时的调度优先级，继承自注册事件的协程
+            int priority = Scheduler::PRIORITY_NORMAL;
+            // 注册事件的工作线程所在的NUMA节点，事件触发后优先回到该节点执行
+            int node = -1;
         };
 
         /**获取事件上下文类
@@ -65,8 +101,9 @@ public:
          * @brief 触发事件
          * @details 根据事件类型调用对应上下文结构中的调度器去调度回调协程或回调函数
          * @param[in] event 事件类型
+         * @param[in] batch 批量调度，事件的调度器与batch相同时放入batch，否则直接调度
          */
-        void triggerEvent(Event event);
+        void triggerEvent(Event event, Scheduler::ScheduleBatch *batch = nullptr);
 
         
 
@@ -74,6 +111,8 @@ public:
         EventContext read;
         // 写事件上下文
         EventContext write;
+        // 错误事件上下文
+        EventContext error;
         // 事件关联的句柄
         int fd = 0;
         // 该fd添加了哪些事件的回调函数
@@ -82,6 +121,23 @@ public:
         MutexType mutex;
     };
 
+protected:
+    /**
+     * @brief idle的自旋阶段：轮询任务队列并做零超时的epoll_wait
+     * @param[out] events epoll事件数组
+     * @param[in] max_events 数组长度
+     * @param[in] limit_us 本次自旋的时间上限
+     * @param[out] rt epoll_wait返回的事件数
+     * @return 是否在自旋期间等到了任务或IO事件
+     */
+    bool spinPoll(epoll_event *events, int max_events, uint64_t limit_us, int &rt);
+
+    /**
+     * @brief 重置socket句柄上下文的容器大小
+     * @param[in] size 容量大小
+     */
+    void contextResize(size_t size);
+
 private:
     /// epoll ⽂件句柄
     int m_epfd = 0;
@@ -98,4 +154,13 @@ private:
     /// socket事件上下⽂的容器
     std::vector<FdContext *> m_fdContexts;
 
+    /// 空闲策略
+    IdlePolicy m_idlePolicy = IDLE_PARK;
+
+    /// 单次自旋时间上限(微秒)
+    std::atomic<uint64_t> m_maxSpinUs = {50};
+
+    /// 正在自旋且还没有被tickle占用的线程数，每个自旋线程只能抵消一次唤醒
+    std::atomic<size_t> m_spinningThreadCount = {0};
+
 };
\ No newline at end of file
@@ -49,6 +49,14 @@ public:
      */
     bool hasTimer();
 
+    /**
+     * @brief 定时器数量
+     */
+    size_t getTimerCount(){
+        RWMutexType::ReadLock lock(m_mutex);
+        return m_timers.size();
+    }
+
 protected:
     /**
      * @brief 当有新的定时器插入到定时器的首部，执行该函数
@@ -0,0 +1,180 @@
+/**
+ * @file async_log.h
+ * @brief 异步日志，用于协程切换、tickle等热路径
+ * @details 调用方只把日志点的静态描述（格式串、文件、行号）的地址和参数的二进制值写入
+ * 本线程的单生产者单消费者环形缓冲区，格式化和写文件由后台线程完成；
+ * 缓冲区满时直接丢弃并计数，不会阻塞协程。
+ * 编译期级别过滤：低于SYLAR_ALOG_LEVEL的日志宏展开为空语句，参数也不会求值。
+ * 格式串用{}作为参数占位符
+ */
+#ifndef __SYLAR_ASYNC_LOG_H__
+#define __SYLAR_ASYNC_LOG_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <string>
+#include <type_traits>
+#include <initializer_list>
+
+#define SYLAR_ALOG_LEVEL_DEBUG 1
+#define SYLAR_ALOG_LEVEL_INFO  2
+#define SYLAR_ALOG_LEVEL_WARN  3
+#define SYLAR_ALOG_LEVEL_ERROR 4
+#define SYLAR_ALOG_LEVEL_FATAL 5
+
+// 编译期日志级别，默认只保留INFO及以上
+#ifndef SYLAR_ALOG_LEVEL
+#define SYLAR_ALOG_LEVEL SYLAR_ALOG_LEVEL_INFO
+#endif
+
+/**
+ * @brief 日志点的静态描述，它的地址就是格式串的id
+ */
+struct AsyncLogSite{
+    int level;
+    const char *file;
+    int line;
+    const char *fmt;
+};
+
+class AsyncLogger{
+public:
+    /// 单条记录的大小，参数编码后超出的部分被截断
+    static const size_t kRecordSize = 256;
+    /// 每个线程缓冲区的记录数，必须是2的幂
+    static const size_t kRingSlots = 1024;
+
+    enum ArgType{
+        ARG_INT = 0,
+        ARG_UINT = 1,
+        ARG_DOUBLE = 2,
+        ARG_PTR = 3,
+        ARG_STR = 4,
+    };
+
+    /**
+     * @brief 二进制日志记录
+     */
+    struct Record{
+        const AsyncLogSite *site;
+        // 墙上时间(微秒)
+        uint64_t timeUs;
+        uint64_t fiberId;
+        uint32_t tid;
+        uint16_t size;
+        uint8_t nargs;
+        uint8_t truncated;
+        char data[kRecordSize - 32];
+    };
+
+    /**
+     * @brief 参数编码器，每个参数一字节类型加定长值，字符串为两字节长度加内容
+     */
+    class Encoder{
+    public:
+        Encoder(Record *r) : m_rec(r) {}
+
+        template<class T>
+        typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type
+        put(T v){ int64_t x = v; putRaw(ARG_INT, &x, sizeof(x));}
+
+        template<class T>
+        typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value>::type
+        put(T v){ uint64_t x = v; putRaw(ARG_UINT, &x, sizeof(x));}
+
+        template<class T>
+        typename std::enable_if<std::is_enum<T>::value>::type
+        put(T v){ int64_t x = (int64_t)v; putRaw(ARG_INT, &x, sizeof(x));}
+
+        template<class T>
+        typename std::enable_if<std::is_floating_point<T>::value>::type
+        put(T v){ double x = v; putRaw(ARG_DOUBLE, &x, sizeof(x));}
+
+        void put(const char *s){ putStr(s ? s : "(null)", s ? strlen(s) : 6);}
+        void put(char *s){ put((const char*)s);}
+        void put(const std::string &s){ putStr(s.data(), s.size());}
+
+        template<class T>
+        void put(T *p){ const void *x = p; putRaw(ARG_PTR, &x, sizeof(x));}
+
+    private:
+        void putRaw(uint8_t type, const void *v, size_t len);
+        void putStr(const char *s, size_t len);
+
+    private:
+        Record *m_rec;
+    };
+
+    /**
+     * @brief 写入一条日志，由SYLAR_ALOG系列宏调用
+     */
+    template<class... Args>
+    static void Log(const AsyncLogSite *site, const Args&... args){
+        Record *r = Acquire(site);
+        if(!r) return;
+        Encoder e(r);
+        (void)std::initializer_list<int>{(e.put(args), 0)...};
+        Commit();
+    }
+
+    /**
+     * @brief 设置输出的文件描述符，默认标准输出
+     */
+    static void SetFd(int fd);
+
+    /**
+     * @brief 因缓冲区满丢弃的记录总数
+     */
+    static uint64_t GetDropped();
+
+    /**
+     * @brief 等待调用时已写入的记录全部输出
+     */
+    static void Flush();
+
+private:
+    /**
+     * @brief 在本线程缓冲区中占用一条记录，缓冲区满时返回nullptr
+     */
+    static Record *Acquire(const AsyncLogSite *site);
+
+    /**
+     * @brief 发布Acquire占用的记录
+     */
+    static void Commit();
+};
+
+#define SYLAR_ALOG(level, fmt, ...) \
+    do{ \
+        static const AsyncLogSite s_alog_site = {level, __FILE__, __LINE__, fmt}; \
+        AsyncLogger::Log(&s_alog_site, ##__VA_ARGS__); \
+    }while(0)
+
+#if SYLAR_ALOG_LEVEL <= SYLAR_ALOG_LEVEL_DEBUG
+#define SYLAR_ALOG_DEBUG(fmt, ...) SYLAR_ALOG(SYLAR_ALOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
+#else
+#define SYLAR_ALOG_DEBUG(fmt, ...) ((void)0)
+#endif
+
+#if SYLAR_ALOG_LEVEL <= SYLAR_ALOG_LEVEL_INFO
+#define SYLAR_ALOG_INFO(fmt, ...) SYLAR_ALOG(SYLAR_ALOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
+#else
+#define SYLAR_ALOG_INFO(fmt, ...) ((void)0)
+#endif
+
+#if SYLAR_ALOG_LEVEL <= SYLAR_ALOG_LEVEL_WARN
+#define SYLAR_ALOG_WARN(fmt, ...) SYLAR_ALOG(SYLAR_ALOG_LEVEL_WARN, fmt, ##__VA_ARGS__)
+#else
+#define SYLAR_ALOG_WARN(fmt, ...) ((void)0)
+#endif
+
+#if SYLAR_ALOG_LEVEL <= SYLAR_ALOG_LEVEL_ERROR
+#define SYLAR_ALOG_ERROR(fmt, ...) SYLAR_ALOG(SYLAR_ALOG_LEVEL_ERROR, fmt, ##__VA_ARGS__)
+#else
+#define SYLAR_ALOG_ERROR(fmt, ...) ((void)0)
+#endif
+
+#define SYLAR_ALOG_FATAL(fmt, ...) SYLAR_ALOG(SYLAR_ALOG_LEVEL_FATAL, fmt, ##__VA_ARGS__)
+
+#endif
@@ -0,0 +1,117 @@
+/**
+ * @file cancel.h
+ * @brief 协程取消令牌与截止时间
+ */
+#ifndef __SYLAR_CANCEL_H__
+#define __SYLAR_CANCEL_H__
+
+#include <memory>
+#include <functional>
+#include <atomic>
+#include <mutex>
+#include <list>
+#include <map>
+#include <stdint.h>
+
+/**
+ * @brief 取消令牌
+ * @details 令牌挂在协程上，由该协程创建或调度出去的协程继承同一个令牌；
+ * 令牌之间构成树，取消父令牌会递归取消整棵子树。
+ * 截止时间是绝对时间(毫秒)，子令牌的截止时间不会晚于父令牌。
+ * hook的阻塞调用和协程同步原语在等待前检查令牌，并注册等待回调，
+ * 令牌被取消时通过回调把等待中的协程唤醒，失败返回ECANCELED或ETIMEDOUT
+ */
+class CancelToken : public std::enable_shared_from_this<CancelToken>{
+public:
+    typedef std::shared_ptr<CancelToken> ptr;
+    typedef std::mutex MutexType;
+    /// 等待回调，参数为取消原因(ECANCELED/ETIMEDOUT)
+    typedef std::function<void(int)> WaiterCb;
+
+    /**
+     * @brief 创建根令牌
+     * @param[in] timeout_ms 从现在开始的超时时间，~0ull表示没有截止时间
+     */
+    static CancelToken::ptr Create(uint64_t timeout_ms = ~0ull);
+
+    /**
+     * @brief 派生子令牌
+     * @param[in] timeout_ms 子令牌的超时时间，实际截止时间取与父令牌的较小值
+     */
+    CancelToken::ptr fork(uint64_t timeout_ms = ~0ull);
+
+    /**
+     * @brief 取消令牌及其所有子令牌，并唤醒所有等待者
+     * @param[in] reason 取消原因，ECANCELED或ETIMEDOUT
+     */
+    void cancel(int reason = ECANCELED);
+
+    /**
+     * @brief 返回令牌的错误码
+     * @return 0表示仍然有效；被取消返回取消原因；超过截止时间返回ETIMEDOUT
+     */
+    int error() const;
+
+    // 是否已失效（被取消或超时）
+    bool isCancelled() const { return error() != 0;}
+
+    // 获取绝对截止时间(毫秒)，~0ull表示没有截止时间
+    uint64_t getDeadline() const { return m_deadline;}
+
+    /**
+     * @brief 距离截止时间的剩余毫秒数
+     * @return 没有截止时间返回~0ull，已过期返回0
+     */
+    uint64_t remainingMS() const;
+
+    /**
+     * @brief 注册等待回调，令牌被取消时调用一次
+     * @return 回调id，令牌已经失效时返回0且不注册
+     */
+    uint64_t addWaiter(WaiterCb cb);
+
+    /**
+     * @brief 注销等待回调
+     */
+    void removeWaiter(uint64_t id);
+
+private:
+    CancelToken(uint64_t deadline);
+
+private:
+    /// 取消原因，0表示未取消
+    std::atomic<int> m_error = {0};
+    /// 绝对截止时间(毫秒)
+    uint64_t m_deadline = ~0ull;
+    /// Mutex
+    mutable MutexType m_mutex;
+    /// 子令牌，弱引用，子令牌的生命周期由使用它的协程决定
+    std::list<std::weak_ptr<CancelToken>> m_children;
+    /// 等待回调
+    std::map<uint64_t, WaiterCb> m_waiters;
+    /// 下一个等待回调id
+    uint64_t m_nextWaiterId = 1;
+};
+
+/**
+ * @brief 取消作用域
+ * @details 构造时给当前协程换上一个派生的子令牌，析构时恢复原来的令牌，
+ * 作用域内的所有阻塞调用都受该超时约束
+ */
+class CancelScope{
+public:
+    CancelScope(uint64_t timeout_ms = ~0ull);
+    ~CancelScope();
+
+    // 获取作用域内的令牌
+    CancelToken::ptr getToken() const { return m_token;}
+
+    // 取消作用域内的令牌
+    void cancel() { m_token->cancel();}
+
+private:
+    CancelToken::ptr m_token;
+    CancelToken::ptr m_prev;
+};
+
+#endif
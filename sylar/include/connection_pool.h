@@ -0,0 +1,169 @@
+/**
+ * @file connection_pool.h
+ * @brief 协程客户端的TCP连接池
+ * @details 按目的地址分组缓存空闲连接，一个IOManager一个连接池；
+ * 某个地址的连接数达到上限时借用者挂起等待归还；借出前用MSG_PEEK检查对端是否已经关闭，
+ * 定时器定期关闭空闲太久或已经失效的连接，并按需预先建立连接
+ */
+#ifndef __SYLAR_CONNECTION_POOL_H__
+#define __SYLAR_CONNECTION_POOL_H__
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <unordered_map>
+#include <sys/socket.h>
+#include "IOManager.h"
+#include "fiber_sync.h"
+
+class ConnectionPool : public std::enable_shared_from_this<ConnectionPool>{
+private:
+    struct Endpoint;
+
+public:
+    typedef std::shared_ptr<ConnectionPool> ptr;
+
+    struct Options{
+        // 每个地址的最大连接数（空闲加借出）
+        size_t maxPerEndpoint = 64;
+        // 每个地址至少保持的空闲连接数，定时器会补足
+        size_t minIdle = 0;
+        // 空闲超过这个时间的连接被关闭
+        uint64_t idleTimeoutMs = 60 * 1000;
+        uint64_t connectTimeoutMs = 3000;
+        // 检查空闲连接的间隔
+        uint64_t checkIntervalMs = 1000;
+    };
+
+    struct Stats{
+        // 新建的连接数
+        uint64_t created = 0;
+        // 复用空闲连接的次数
+        uint64_t reused = 0;
+        // 因空闲超时关闭的连接数
+        uint64_t evicted = 0;
+        // 检查时发现已失效或被标记出错的连接数
+        uint64_t broken = 0;
+        // 建立连接失败的次数
+        uint64_t connectFailed = 0;
+        // 因达到上限而挂起的次数
+        uint64_t waits = 0;
+        // 等待超时或被取消的次数
+        uint64_t waitTimeouts = 0;
+        size_t idle = 0;
+        size_t active = 0;
+    };
+
+    /**
+     * @brief 借出的连接，析构时自动归还
+     */
+    class Conn{
+    friend class ConnectionPool;
+    public:
+        Conn() {}
+        ~Conn() { release();}
+
+        Conn(Conn &&other) { *this = std::move(other);}
+        Conn &operator=(Conn &&other);
+
+        Conn(const Conn&) = delete;
+        Conn &operator=(const Conn&) = delete;
+
+        int getFd() const { return m_fd;}
+        explicit operator bool() const { return m_fd >= 0;}
+
+        // 是否复用的空闲连接，复用的连接上第一次请求失败时可以换一个连接重试
+        bool isReused() const { return m_reused;}
+
+        /**
+         * @brief 标记连接不可复用，比如IO出错或者协议状态不确定，归还时直接关闭
+         */
+        void markBroken() { m_broken = true;}
+
+        // 提前归还
+        void release();
+
+    private:
+        ConnectionPool::ptr m_pool;
+        Endpoint *m_ep = nullptr;
+        int m_fd = -1;
+        bool m_reused = false;
+        bool m_broken = false;
+    };
+
+    /**
+     * @brief 创建连接池并启动检查定时器
+     */
+    static ConnectionPool::ptr Create(IOManager *iom, const Options &opt);
+    static ConnectionPool::ptr Create(IOManager *iom) { return Create(iom, Options());}
+
+    ~ConnectionPool();
+
+    /**
+     * @brief 借出一个到ip:port的连接
+     * @details 优先复用最近归还的空闲连接；没有空闲连接且未达上限时新建，
+     * 否则挂起当前协程直到有连接归还
+     * @param[in] timeout_ms 等待和建立连接的总超时，实际不超过当前协程取消令牌的截止时间
+     * @return 失败时返回的Conn为空，errno给出原因
+     */
+    Conn get(const std::string &ip, uint16_t port, uint64_t timeout_ms = ~0ull);
+
+    /**
+     * @brief 在后台为ip:port预先建立连接，直到空闲连接数达到n
+     */
+    void warm(const std::string &ip, uint16_t port, size_t n);
+
+    /**
+     * @brief 关闭所有空闲连接并停止定时器，借出的连接归还时关闭
+     */
+    void stop();
+
+    Stats getStats();
+    std::string dumpStats();
+
+    /**
+     * @brief 检查空闲连接是否仍然可用
+     * @details 空闲连接上不应有数据，MSG_PEEK读到EOF说明对端已经关闭，读到数据说明协议错位，
+     * 两种情况都不能复用
+     */
+    static bool IsAlive(int fd);
+
+private:
+    ConnectionPool(IOManager *iom, const Options &opt);
+
+    struct IdleConn{
+        int fd;
+        uint64_t since;
+    };
+
+    struct Endpoint{
+        std::string key;
+        sockaddr_storage addr;
+        socklen_t addrlen;
+        // 最近归还的在末尾
+        std::vector<IdleConn> idle;
+        // 空闲、借出和正在建立的连接总数
+        size_t total = 0;
+        // 正在后台预建连接
+        bool warming = false;
+        FiberWaitQueue waiters;
+    };
+
+    Endpoint *getEndpoint(const std::string &ip, uint16_t port);
+    int connectTo(Endpoint *ep, uint64_t timeout_ms);
+    void put(Endpoint *ep, int fd, bool broken);
+    void check();
+    void fill(Endpoint *ep, size_t n);
+
+private:
+    IOManager *m_iom;
+    Options m_opt;
+    std::mutex m_mutex;
+    std::unordered_map<std::string, std::unique_ptr<Endpoint>> m_endpoints;
+    Stats m_stats;
+    Timer::ptr m_timer;
+    bool m_stopped = false;
+};
+
+#endif
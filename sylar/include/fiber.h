@@ -12,13 +12,32 @@
 #include <memory>
 #include <functional>
 #include <ucontext.h>
+#include <csignal>
+#include <string>
+#include "cancel.h"
+#include "task.h"
 
+class Scheduler;
 
+/// 当前线程上运行的协程是否被要求让出，由调度器的监控线程设置，新任务开始运行时清零
+extern thread_local volatile sig_atomic_t t_fiber_preempt;
 
 class Fiber: public std::enable_shared_from_this<Fiber>{
 public:
     typedef std::shared_ptr<Fiber> ptr;
     /*协程状态，在sylar的基础上简化了状态：running、ready、term*/
+    /// 协程切换完成后在新上下文中执行的动作
+    typedef void (*PostSwitchFunc)(void *);
+
+    /// 协程局部存储槽位的析构函数
+    typedef void (*LocalDtor)(void *);
+
+    /// 内联在Fiber中的局部存储槽位数，超出部分放在溢出数组
+    static const size_t kInlineLocalSlots = 8;
+
+    /// 进程内最多可分配的局部存储槽位数
+    static const size_t kMaxLocalSlots = 128;
+
     enum State{
         READY, // 就绪态，刚创建或者yield之后的状态
         RUNNING, // 运行态，resume之后的状态
@@ -32,9 +51,9 @@ private:
      * stacksize--栈大小
      * run_in_scheduler--本协程是否参与调度器调度，默认true
      * */
-     Fiber(std::function<void()> cb, size_t stacksize=0, bool run_in_scheduler=true);
+     Fiber(TaskFunc cb, size_t stacksize=0, bool run_in_scheduler=true);
      Fiber();
-     Fiber(std::function<void()> cb, size_t stacksize=0);
+     Fiber(TaskFunc cb, size_t stacksize=0);
      /**
       * 析构函数
       */
@@ -64,7 +83,7 @@ public:
     static uint64_t GetFiberID();
     
     // 重置协程状态和入口函数，复用栈空间，不重新创建栈
-     void reset(std::function<void()> cb);
+     void reset(TaskFunc cb);
 
     //  将当前协程切换到执行状态--即当前协程与正在运行的协程进行交换，前者状态（当前）变为running，后者为ready
     void resume();
@@ -72,20 +91,214 @@ public:
     // 当前协程转让出执行权--当前协程与上次resume时退出后台的协程进行交换，前者为ready，后者变为running
     void yield();
 
+    /**
+     * 对称切换：当前协程（必须是this）直接切换到next，不经过调度协程，只有一次上下文切换
+     * next必须是READY状态，且与当前协程的m_runInScheduler相同，这样next让出时回到的仍是
+     * 当初resume当前协程的那个上下文；当前协程变为READY，由调用者负责之后再次唤醒它
+     * next在运行期间由线程局部变量持有，直到它让出或切换到下一个协程
+     */
+    void switchTo(Fiber::ptr next);
+
+    // 本协程是否参与调度器调度
+    bool isRunInScheduler() const { return m_runInScheduler;}
+
+    // 获取调度优先级，见Scheduler::Priority
+    int getPriority() const { return m_priority;}
+
+    // 设置调度优先级，协程被IO事件或定时器唤醒时按该优先级重新入队
+    void setPriority(int priority) { m_priority = priority;}
+
     // 获取协程ID
     uint64_t getID() const{ return m_id;}
 
     // 获取协程状态
     State getState() const { return m_state;}
 
+    /**
+     * 设置协程标签，CPU时间和等待时间按标签汇总（见FiberStats），
+     * 标签必须是静态生命周期的字符串（通常是字面量），由它创建的协程继承同一个标签
+     */
+    void setTag(const char *tag) { m_tag = tag;}
+
+    // 获取协程标签，可能为空
+    const char *getTag() const { return m_tag;}
+
+    // 被resume的次数
+    uint64_t getRuns() const { return m_runs;}
+
+    // 累计CPU周期数，不含当前正在运行的这一段
+    uint64_t getCpuCycles() const { return m_cpuCycles;}
+
+    // 可运行但在调度队列里等待的累计时间(微秒)
+    uint64_t getQueuedUS() const { return m_queuedUs;}
+
+    // 挂起等待IO事件、定时器等的累计时间(微秒)
+    uint64_t getParkedUS() const { return m_parkedUs;}
+
+    // 由调度器在resume前计入等待时间
+    void addWaitTime(uint64_t queued_us, uint64_t parked_us) { m_queuedUs += queued_us; m_parkedUs += parked_us;}
+
+    // 上次让出的时间(微秒)，0表示还没有让出过或者没有开启FiberStats统计
+    uint64_t getLastYieldUS() const { return m_lastYieldUs;}
+
+    /**
+     * 协程挂起等待的原因，仅用于调试输出（见DumpLiveFibers）
+     * reason--静态字符串，如"io"、"sleep"、"wait_queue"
+     * fd/event--等待的IO事件，没有时为-1/0
+     * timeoutMs--等待的超时时间，没有时为~0ull
+     */
+    struct WaitInfo{
+        const char *reason = nullptr;
+        int fd = -1;
+        int event = 0;
+        uint64_t timeoutMs = ~0ull;
+    };
+
+    // 记录当前协程即将挂起等待的原因，协程下一次resume时清除
+    static void SetCurrentWait(const char *reason, int fd = -1, int event = 0, uint64_t timeout_ms = ~0ull);
+
+    // 获取挂起等待的原因
+    const WaitInfo &getWaitInfo() const { return m_waitInfo;}
+
+    // 最近一次运行本协程的调度器，可能为空
+    Scheduler *getScheduler() const { return m_scheduler;}
+
+    // 由调度器在resume前记录
+    void setScheduler(Scheduler *sc) { m_scheduler = sc;}
+
+    /**
+     * 沿帧指针链回溯挂起协程的调用栈，从保存的上下文开始，只在协程栈范围内回溯，
+     * 需要以-fno-omit-frame-pointer编译；正在运行的协程或不支持的平台返回0
+     * 返回写入addrs的地址数
+     */
+    size_t backtrace(void **addrs, size_t max) const;
+
+    typedef void (*VisitFunc)(Fiber *fiber, void *arg);
+
+    // 遍历所有存活的协程，遍历期间持有注册表的锁，fn中不能创建或销毁协程
+    static void VisitLive(VisitFunc fn, void *arg);
+
+    /**
+     * 输出所有存活协程的id、状态、调度器、标签、等待原因和挂起时长，
+     * with_backtrace为true时附带挂起协程的符号化调用栈
+     */
+    static std::string DumpLiveFibers(bool with_backtrace = true);
+
+    /**
+     * 安装信号触发的协程转储：信号处理函数只写一个字节到管道，
+     * 由后台线程调用DumpLiveFibers并写到fd，重复调用只生效一次
+     */
+    static bool InstallDumpSignal(int sig = SIGUSR2, int fd = 2);
+
+    // 获取协程的取消令牌，可能为空
+    const CancelToken::ptr &getCancelToken() const { return m_cancelToken;}
+
+    // 设置协程的取消令牌
+    void setCancelToken(CancelToken::ptr token) { m_cancelToken.swap(token);}
+
+    // 获取当前正在运行协程的取消令牌，当前线程没有协程时返回空，不会创建主协程
+    static CancelToken::ptr GetCurrentCancelToken();
+
+    // 返回当前正在运行协程的裸指针，不增加引用计数，也不会创建主协程
+    static Fiber *GetCurrent();
+
+    /**
+     * 分配一个协程局部存储槽位，进程内全局有效，通常在静态初始化时分配一次
+     * dtor--协程结束或reset时对非空的槽位值调用，可以为空
+     * 返回槽位号，槽位耗尽时断言失败
+     */
+    static size_t AllocLocalSlot(LocalDtor dtor = nullptr);
+
+    // 获取槽位值，O(1)，未设置时返回nullptr
+    void *getLocal(size_t slot) const{
+        if(slot < kInlineLocalSlots)
+            return m_locals[slot];
+        slot -= kInlineLocalSlots;
+        return slot < m_spillSize ? m_spillLocals[slot] : nullptr;
+    }
+
+    // 设置槽位值，不会调用旧值的析构函数
+    void setLocal(size_t slot, void *value);
+
+    /**
+     * 设置下一次协程切换完成后要执行的动作，
+     * 用于"先让出执行权，再释放锁/重新入队"，避免其他线程在本协程让出之前就resume它
+     */
+    static void SetPostSwitch(PostSwitchFunc fn, void *arg);
+
+    // 执行并清除挂起的切换后动作，每次swapcontext返回以及新协程入口处调用
+    static void RunPostSwitch();
+
+    /**
+     * 协作式抢占检查点，只读一次线程局部变量，
+     * 当前协程运行超过调度器设置的时间片时让出并重新入队，长时间计算的循环里应定期调用
+     */
+    static void MaybeYield(){
+        if(t_fiber_preempt)
+            PreemptYield();
+    }
+
+    // 响应抢占请求：清除标记，如果调度队列里有其他任务则让出并重新入队
+    static void PreemptYield();
+
+    // 是否在PreemptibleScope内
+    bool isPreemptible() const { return m_preemptible > 0;}
+
+    /**
+     * 可被信号异步抢占的区域，通常只包住不经过检查点的纯计算循环。
+     * 区域内的代码不能持有锁、分配内存、写日志或调用可能挂起的函数：
+     * 调度器开启异步抢占后，抢占信号到达时如果当前协程在区域内，信号处理函数直接让出协程；
+     * 区域外仍然只在MaybeYield检查点让出。计数记在协程上，协程迁移到其他线程后依然有效
+     */
+    class PreemptibleScope{
+    public:
+        PreemptibleScope() : m_fiber(GetCurrent()) { if(m_fiber) ++m_fiber->m_preemptible;}
+        ~PreemptibleScope() { if(m_fiber) --m_fiber->m_preemptible;}
+        PreemptibleScope(const PreemptibleScope&) = delete;
+        PreemptibleScope &operator=(const PreemptibleScope&) = delete;
+    private:
+        Fiber *m_fiber;
+    };
+
+    /**
+     * 安装异步抢占的信号处理函数，进程内只生效一次，由开启了异步抢占的调度器在start时调用
+     * sig--抢占信号，默认SIGURG（默认动作是忽略，多余的信号没有副作用）
+     */
+    static bool InstallPreemptSignal(int sig = SIGURG);
+
 private:
     uint64_t m_id = 0; // 协程ID
     uint32_t m_stacksize = 0; // 协程栈大小
     State m_state = READY; // 协程状态
     ucontext_t m_ctx; // 协程上下文
     void *m_stack = nullptr; // 协程栈地址
-    std::function<void()> m_cb; // 协程入口函数
+    TaskFunc m_cb; // 协程入口函数，小对象内联存储，只移动不拷贝
     bool m_runInScheduler; // 本协程是否参与调度器调度
+    CancelToken::ptr m_cancelToken; // 取消令牌，创建时继承自创建者协程
+    int m_priority = 1; // 调度优先级，默认Scheduler::PRIORITY_NORMAL
+    void *m_locals[kInlineLocalSlots] = {nullptr}; // 内联的局部存储槽位
+    void **m_spillLocals = nullptr; // 溢出的局部存储槽位
+    size_t m_spillSize = 0; // 溢出数组长度
+    const char *m_tag = nullptr; // 统计标签
+    uint64_t m_runs = 0; // 被resume的次数
+    uint64_t m_cpuCycles = 0; // 累计CPU周期数
+    uint64_t m_resumeCycles = 0; // 本次resume时的周期计数
+    uint64_t m_queuedUs = 0; // 累计排队时间
+    uint64_t m_parkedUs = 0; // 累计挂起时间
+    uint64_t m_lastYieldUs = 0; // 上次让出的时间
+    WaitInfo m_waitInfo; // 挂起等待的原因
+    volatile sig_atomic_t m_preemptible = 0; // 嵌套的PreemptibleScope数，信号处理函数读取
+    Scheduler *m_scheduler = nullptr; // 最近一次运行本协程的调度器
+    Fiber *m_livePrev = nullptr; // 存活协程注册表的侵入式链表
+    Fiber *m_liveNext = nullptr;
+
+private:
+    // 对已设置的槽位调用析构函数并清空，协程结束和reset时调用
+    void clearLocals();
+
+    // 加入/移出存活协程注册表，构造和析构时调用
+    void registerLive();
+    void unregisterLive();
 };
 
 
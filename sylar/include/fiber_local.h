@@ -0,0 +1,70 @@
+/**
+ * @file fiber_local.h
+ * @brief 协程局部存储
+ * @details 协程可能在不同的工作线程之间迁移，请求级别的上下文不能放在thread_local中。
+ * FiberLocal在构造时分配一个槽位，读写都是对当前协程槽位数组的下标访问
+ */
+#ifndef __SYLAR_FIBER_LOCAL_H__
+#define __SYLAR_FIBER_LOCAL_H__
+
+#include "fiber.h"
+
+/**
+ * @brief 协程局部变量，通常定义为静态或全局对象
+ * @details 值在协程结束或reset时被delete
+ */
+template<class T>
+class FiberLocal{
+public:
+    FiberLocal()
+        :m_slot(Fiber::AllocLocalSlot(&FiberLocal::Delete)){
+    }
+
+    /**
+     * @brief 获取当前协程的值，未设置时返回nullptr
+     */
+    T *get() const{
+        Fiber *cur = Fiber::GetCurrent();
+        return cur ? static_cast<T*>(cur->getLocal(m_slot)) : nullptr;
+    }
+
+    /**
+     * @brief 设置当前协程的值，接管v的所有权，旧值被delete
+     * @details 当前线程还没有协程时设置到线程的主协程上，线程退出时释放
+     */
+    void set(T *v){
+        Fiber *cur = Fiber::GetCurrent();
+        if(!cur)
+            cur = Fiber::GetThis().get();
+        T *old = static_cast<T*>(cur->getLocal(m_slot));
+        cur->setLocal(m_slot, v);
+        delete old;
+    }
+
+    /**
+     * @brief 获取当前协程的值，未设置时默认构造一个
+     */
+    T &operator*(){
+        T *v = get();
+        if(!v){
+            v = new T();
+            set(v);
+        }
+        return *v;
+    }
+
+    T *operator->(){ return &**this;}
+
+    // 槽位号
+    size_t getSlot() const { return m_slot;}
+
+private:
+    static void Delete(void *v){
+        delete static_cast<T*>(v);
+    }
+
+private:
+    size_t m_slot;
+};
+
+#endif
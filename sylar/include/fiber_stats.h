@@ -0,0 +1,74 @@
+/**
+ * @file fiber_stats.h
+ * @brief 按标签汇总协程的CPU时间和等待时间
+ * @details 协程结束时把自己的累计值计入当前线程的汇总表，查询时合并所有线程；
+ * 每个线程的汇总表有自己的锁，只有查询时才会有竞争
+ */
+#ifndef __SYLAR_FIBER_STATS_H__
+#define __SYLAR_FIBER_STATS_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+/**
+ * @brief 一个标签的汇总值
+ */
+struct FiberTagStats{
+    std::string tag;
+    // 已结束的协程数
+    uint64_t fibers = 0;
+    // 运行次数（被resume的次数）
+    uint64_t runs = 0;
+    // CPU时间(微秒)
+    uint64_t cpuUs = 0;
+    // 可运行但在队列里等待的时间(微秒)
+    uint64_t queuedUs = 0;
+    // 挂起等待IO事件、定时器等的时间(微秒)
+    uint64_t parkedUs = 0;
+    // 单个协程的最大CPU时间(微秒)
+    uint64_t maxCpuUs = 0;
+};
+
+class FiberStats{
+public:
+    /**
+     * @brief 开启或关闭协程的CPU时间和等待时间统计，默认关闭
+     * @details 开启后每次切换都要读两次时钟，在切换密集的场景下开销明显，需要按标签分析时再打开；
+     * 运行中打开时，正在运行的那一段不计入
+     */
+    static void SetEnabled(bool v) { s_enabled.store(v, std::memory_order_relaxed);}
+
+    // 是否开启统计，切换路径上调用，只做一次relaxed读
+    static bool IsEnabled() { return s_enabled.load(std::memory_order_relaxed);}
+
+    /**
+     * @brief 计入一个结束的协程
+     * @param[in] tag 协程标签，为空时计入"untagged"
+     * @param[in] cpu_cycles CPU周期数
+     */
+    static void Account(const char *tag, uint64_t runs, uint64_t cpu_cycles,
+            uint64_t queued_us, uint64_t parked_us);
+
+    /**
+     * @brief 合并所有线程的汇总值，按CPU时间从高到低排序
+     */
+    static std::vector<FiberTagStats> Snapshot();
+
+    /**
+     * @brief 输出CPU时间最高的n个标签
+     */
+    static std::string DumpTop(size_t n = 20);
+
+    /**
+     * @brief 清空汇总值
+     */
+    static void Reset();
+
+private:
+    static std::atomic<bool> s_enabled;
+};
+
+#endif
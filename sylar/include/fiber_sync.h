@@ -0,0 +1,105 @@
+/**
+ * @file fiber_sync.h
+ * @brief 协程同步原语
+ * @details 等待时只挂起当前协程，不阻塞线程；所有等待都遵守协程取消令牌的截止时间
+ */
+#ifndef __SYLAR_FIBER_SYNC_H__
+#define __SYLAR_FIBER_SYNC_H__
+
+#include <memory>
+#include <mutex>
+#include <list>
+#include <stdint.h>
+#include "noncopyable.h"
+#include "fiber.h"
+
+class Scheduler;
+
+/**
+ * @brief 协程等待队列，语义类似条件变量
+ * @details 调用wait时必须持有保护条件的锁，notify时也应持有同一把锁，
+ * 等待队列的生命周期必须长于所有等待者
+ */
+class FiberWaitQueue : Noncopyable{
+public:
+    typedef std::mutex MutexType;
+
+    /**
+     * @brief 挂起当前协程，直到被唤醒、超时或取消令牌失效
+     * @param[in, out] lock 调用者持有的锁，挂起期间释放，返回前重新加锁
+     * @param[in] timeout_ms 超时时间(毫秒)，~0ull表示不超时，实际超时不超过令牌的截止时间
+     * @return 被唤醒返回0，超时返回ETIMEDOUT，被取消返回ECANCELED
+     */
+    int wait(std::unique_lock<std::mutex> &lock, uint64_t timeout_ms = ~0ull);
+
+    /**
+     * @brief 按FIFO顺序唤醒一个等待者
+     * @return 是否唤醒了协程
+     */
+    bool notifyOne();
+
+    /**
+     * @brief 唤醒全部等待者
+     * @return 唤醒的协程数
+     */
+    size_t notifyAll();
+
+    // 是否有协程在等待
+    bool hasWaiters();
+
+private:
+    struct Waiter;
+    typedef std::shared_ptr<Waiter> WaiterPtr;
+
+    /**
+     * @brief 等待者，result为-1表示仍在等待
+     */
+    struct Waiter{
+        Fiber::ptr fiber;
+        Scheduler *scheduler = nullptr;
+        int result = -1;
+        std::list<WaiterPtr>::iterator it;
+    };
+
+    /**
+     * @brief 结束一个等待者的等待并重新调度它，调用时需持有m_mutex
+     * @return 等待者已经被其他路径唤醒时返回false
+     */
+    bool wakeNoLock(const WaiterPtr &waiter, int result);
+
+private:
+    /// 保护等待队列，挂起的协程在切换出去之后才释放
+    MutexType m_mutex;
+    /// 等待者队列
+    std::list<WaiterPtr> m_waiters;
+};
+
+/**
+ * @brief 协程信号量
+ */
+class FiberSemaphore : Noncopyable{
+public:
+    FiberSemaphore(size_t count = 0);
+
+    /**
+     * @brief 获取信号量，计数为0时挂起当前协程
+     * @return 成功返回0，超时返回ETIMEDOUT，被取消返回ECANCELED
+     */
+    int wait(uint64_t timeout_ms = ~0ull);
+
+    // 不等待地尝试获取信号量
+    bool tryWait();
+
+    // 释放信号量
+    void notify(size_t n = 1);
+
+    // 当前计数
+    size_t getCount();
+
+private:
+    std::mutex m_mutex;
+    size_t m_count;
+    FiberWaitQueue m_queue;
+};
+
+#endif
@@ -27,6 +27,8 @@
 
  XX(recvmsg) \
 
+ XX(recvmmsg) \
+
  XX(write) \
 
  XX(writev) \
@@ -37,6 +39,14 @@
 
  XX(sendmsg) \
 
+ XX(sendmmsg) \
+
+ XX(sendfile) \
+
+ XX(splice) \
+
+ XX(tee) \
+
  XX(close) \
 
  XX(fcntl) \
@@ -93,4 +103,32 @@ hook_init() {
  setsocketopt_f = (setsocketopt_fun)dlsym(RTLD_NEXT, "setsocketopt");
 }
 
-
+/**
+ * @brief 带超时的connect，超时时间同时受当前协程取消令牌的约束
+ * @return 成功返回0，失败返回-1并设置errno
+ */
+int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen, uint64_t timeout_ms);
+
+/**
+ * @brief 使用MSG_ZEROCOPY发送len字节，内核直接引用buf中的页而不拷贝
+ * @details 发送缓冲区满时挂起在WRITE事件上，全部发出即返回，不等待完成通知；
+ * 之前发送的完成通知在每次调用时顺便收取。返回后buf的页仍可能被内核引用，
+ * 只读的数据（如mmap的文件）可以不管，需要复用buf时先调用zerocopy_wait。
+ * 小于ZEROCOPY_MIN_SIZE的数据、不支持SO_ZEROCOPY的socket以及内核回退为拷贝的连接（如回环）直接走普通send
+ * @return 发送的字节数，出错且一个字节都没发出时返回-1
+ */
+ssize_t send_zerocopy(int fd, const void *buf, size_t len, int flags);
+
+/**
+ * @brief fd上已经发出的零拷贝发送数，作为zerocopy_wait的编号
+ * @details 在send_zerocopy之后调用，得到的编号覆盖到这次发送为止
+ */
+uint32_t zerocopy_seq(int fd);
+
+/**
+ * @brief 等待编号seq及之前的零拷贝发送都已被内核释放，之后对应的buf可以复用
+ * @details 挂起在IOManager::ERROR事件上，完成通知到达时被唤醒，同一个fd同时只能有一个协程等待；
+ * 连接出错或挂断后EPOLLERR一直就绪，此时退回退避睡眠
+ * @return 成功返回0，超时返回ETIMEDOUT，被取消返回ECANCELED，fd已关闭返回EBADF
+ */
+int zerocopy_wait(int fd, uint32_t seq, uint64_t timeout_ms = ~0ull);
@@ -0,0 +1,209 @@
+/**
+ * @file http.h
+ * @brief HTTP/1.1请求、响应和增量请求解析器
+ * @details 请求头整体拷贝到请求对象自己的缓冲区里，方法、路径和各个头部都是指向这个
+ * 缓冲区的片段，不再单独分配；请求体通过IOBuf::cutTo从读缓冲区中切出，不拷贝。
+ * 请求对象在同一个连接上反复使用，缓冲区的容量会被保留
+ */
+#ifndef __SYLAR_HTTP_H__
+#define __SYLAR_HTTP_H__
+
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <string>
+#include <vector>
+#include "iobuf.h"
+
+/**
+ * @brief 指向其他缓冲区的字符串片段，不持有数据
+ */
+struct HttpStr{
+    const char *data = nullptr;
+    size_t len = 0;
+
+    HttpStr() {}
+    HttpStr(const char *d, size_t l) : data(d), len(l) {}
+
+    bool empty() const { return len == 0;}
+    std::string str() const { return std::string(data, len);}
+
+    bool equals(const char *s) const { return strlen(s) == len && !memcmp(data, s, len);}
+    // 不区分大小写比较，用于头部名字和取值
+    bool iequals(const char *s) const { return strlen(s) == len && !strncasecmp(data, s, len);}
+};
+
+class HttpRequest{
+friend class HttpRequestParser;
+public:
+    typedef std::pair<HttpStr, HttpStr> Header;
+
+    HttpRequest() {}
+
+    // 片段指向m_raw，不能拷贝
+    HttpRequest(const HttpRequest&) = delete;
+    HttpRequest &operator=(const HttpRequest&) = delete;
+
+    HttpStr getMethod() const { return m_method;}
+    // 不含查询字符串的路径
+    HttpStr getPath() const { return m_path;}
+    // '?'之后的查询字符串
+    HttpStr getQuery() const { return m_query;}
+    HttpStr getVersion() const { return m_version;}
+
+    // 是否HTTP/1.1，否则是HTTP/1.0
+    bool isHttp11() const { return m_http11;}
+
+    // 处理完这个请求后连接是否保持
+    bool isKeepAlive() const { return m_keepAlive;}
+
+    /**
+     * @brief 查找头部，名字不区分大小写
+     * @return 头部的值，不存在时为空
+     */
+    HttpStr getHeader(const char *name) const;
+    const std::vector<Header> &getHeaders() const { return m_headers;}
+
+    IOBuf &getBody() { return m_body;}
+    const IOBuf &getBody() const { return m_body;}
+
+    // 清空内容，保留缓冲区容量
+    void clear();
+
+private:
+    // 请求行和头部的原始数据
+    std::string m_raw;
+    HttpStr m_method;
+    HttpStr m_path;
+    HttpStr m_query;
+    HttpStr m_version;
+    std::vector<Header> m_headers;
+    IOBuf m_body;
+    bool m_http11 = true;
+    bool m_keepAlive = true;
+};
+
+class HttpResponse{
+public:
+    HttpResponse() {}
+
+    HttpResponse(const HttpResponse&) = delete;
+    HttpResponse &operator=(const HttpResponse&) = delete;
+
+    /**
+     * @brief 设置状态码
+     * @param[in] reason 原因短语，为空时使用状态码的标准短语
+     */
+    void setStatus(int status, const char *reason = nullptr) { m_status = status; m_reason = reason;}
+    int getStatus() const { return m_status;}
+
+    // 添加一个头部，Content-Length、Transfer-Encoding和Connection由服务器生成
+    void addHeader(const std::string &name, const std::string &value);
+
+    IOBuf &getBody() { return m_body;}
+    void setBody(const std::string &body) { m_body.clear(); m_body.append(body);}
+
+    bool isKeepAlive() const { return m_keepAlive;}
+    // 处理函数可以要求在这个响应之后关闭连接
+    void setKeepAlive(bool v) { m_keepAlive = v;}
+
+    /**
+     * @brief 以chunked编码立即写出一段数据
+     * @details 第一次调用时先写出连接上排在前面的响应和这个响应的头部，
+     * 之后body中的数据都作为chunk发送；处理函数返回后服务器写出结束块
+     * @return 写失败返回false，连接随后会被关闭
+     */
+    bool writeChunk(const void *data, size_t len);
+
+    // 是否已经以chunked方式开始发送
+    bool isChunked() const { return m_chunked;}
+
+    /**
+     * @brief 绑定连接，由服务器在调用处理函数前设置
+     * @param[in] fd 连接的socket
+     * @param[in] out 连接的写缓冲区，里面是排在这个响应之前还没有写出的响应
+     * @param[in] req 对应的请求
+     */
+    void reset(int fd, IOBuf *out, const HttpRequest &req);
+
+    /**
+     * @brief 把响应追加到写缓冲区；chunked响应只追加结束块
+     */
+    void finish();
+
+    static const char *StatusReason(int status);
+
+    // 把buf中的数据全部写到fd
+    static bool FlushAll(IOBuf &buf, int fd);
+
+private:
+    void appendHead(bool chunked);
+
+private:
+    int m_status = 200;
+    const char *m_reason = nullptr;
+    std::vector<std::pair<std::string, std::string>> m_headers;
+    IOBuf m_body;
+    bool m_keepAlive = true;
+    bool m_http11 = true;
+    bool m_chunked = false;
+    int m_fd = -1;
+    IOBuf *m_out = nullptr;
+};
+
+/**
+ * @brief 增量请求解析器
+ * @details 每次读到数据后调用parse，不完整时记住已扫描的位置和当前所处的阶段，
+ * 下次从断点继续；支持Content-Length和chunked两种请求体
+ */
+class HttpRequestParser{
+public:
+    enum Result{
+        OK,     // 解析出一个完整请求，对应的数据已从缓冲区消费
+        AGAIN,  // 数据不完整
+        ERROR   // 请求不合法，getStatus()给出应答的状态码
+    };
+
+    /**
+     * @param[in] max_header 请求行加头部的最大长度
+     * @param[in] max_body 请求体的最大长度
+     */
+    HttpRequestParser(size_t max_header = 8192, size_t max_body = 8 * 1024 * 1024)
+        :m_maxHeader(max_header)
+        ,m_maxBody(max_body) {}
+
+    Result parse(IOBuf &buf, HttpRequest &req);
+
+    // 出错时应答的状态码
+    int getStatus() const { return m_status;}
+
+    // 是否处在两个请求之间
+    bool isIdle() const { return m_state == HEADER && !m_scanned;}
+
+private:
+    Result parseHead(IOBuf &buf, HttpRequest &req);
+    bool parseRequestLine(HttpRequest &req);
+    Result error(int status) { m_status = status; return ERROR;}
+
+private:
+    enum State{
+        HEADER,
+        BODY,
+        CHUNK_SIZE,
+        CHUNK_DATA,
+        TRAILER
+    };
+
+    size_t m_maxHeader;
+    size_t m_maxBody;
+    State m_state = HEADER;
+    // 头部结束标记已经扫描过的长度
+    size_t m_scanned = 0;
+    // 当前请求体或chunk剩余的长度
+    size_t m_remain = 0;
+    // chunked尾部已读取的长度
+    size_t m_trailer = 0;
+    int m_status = 0;
+};
+
+#endif
@@ -0,0 +1,58 @@
+/**
+ * @file http_server.h
+ * @brief 基于TcpServer的HTTP/1.1服务器
+ * @details 每个连接一个协程，处理函数直接在连接协程里运行，可以阻塞在hook的IO上；
+ * 一次读到的多个流水线请求按顺序处理，响应依次追加到写缓冲区，
+ * 缓冲区中没有完整请求时才一次性写出，保证响应顺序并合并写操作
+ */
+#ifndef __SYLAR_HTTP_SERVER_H__
+#define __SYLAR_HTTP_SERVER_H__
+
+#include <functional>
+#include "tcp_server.h"
+#include "http.h"
+
+class HttpServer : public TcpServer{
+public:
+    typedef std::shared_ptr<HttpServer> ptr;
+    typedef std::function<void(HttpRequest &req, HttpResponse &resp)> Handler;
+
+    HttpServer(IOManager *worker, const std::string &name = "sylar/http_server");
+
+    /**
+     * @brief 为路径注册处理函数，精确匹配，需在start之前调用
+     */
+    void addHandler(const std::string &path, Handler cb);
+
+    // 没有匹配的路径时调用，默认返回404
+    void setDefaultHandler(Handler cb) { m_default = cb;}
+
+    /**
+     * @brief 读超时，收到部分请求后等待剩余数据的最长时间
+     */
+    void setReadTimeout(uint64_t ms) { m_readTimeout = ms;}
+
+    /**
+     * @brief 空闲超时，保持的连接上等待下一个请求的最长时间
+     */
+    void setIdleTimeout(uint64_t ms) { m_idleTimeout = ms;}
+
+    void setMaxHeaderSize(size_t v) { m_maxHeader = v;}
+    void setMaxBodySize(size_t v) { m_maxBody = v;}
+
+protected:
+    void handleClient(int fd) override;
+
+private:
+    void dispatch(HttpRequest &req, HttpResponse &resp);
+
+private:
+    std::vector<std::pair<std::string, Handler>> m_handlers;
+    Handler m_default;
+    uint64_t m_readTimeout = 30 * 1000;
+    uint64_t m_idleTimeout = 60 * 1000;
+    size_t m_maxHeader = 8192;
+    size_t m_maxBody = 8 * 1024 * 1024;
+};
+
+#endif
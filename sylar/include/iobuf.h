@@ -0,0 +1,165 @@
+/**
+ * @file iobuf.h
+ * @brief 由引用计数的定长块组成的链式缓冲区
+ * @details 块从线程局部的块池分配，释放时回到释放线程的块池；
+ * 切分(cutTo)、拼接(append(const IOBuf&))只增加块的引用计数，不拷贝数据；
+ * readFrom/writeTo通过hook的readv/writev直接读写块链
+ */
+#ifndef __SYLAR_IOBUF_H__
+#define __SYLAR_IOBUF_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <string>
+#include <deque>
+#include <atomic>
+
+class IOBuf{
+public:
+    /// 块的大小（含块头），从池中分配
+    static const size_t kBlockSize = 8192;
+    /// find没有找到时的返回值
+    static const size_t npos = (size_t)-1;
+
+    /**
+     * @brief 数据块，多个IOBuf可以共享同一个块的不同区间
+     */
+    struct Block{
+        std::atomic<uint32_t> refs;
+        // 已写入的长度，只有唯一持有者可以在其后追加
+        uint32_t size;
+        uint32_t cap;
+        Block *next;
+        char data[0];
+
+        static Block *Alloc();
+        void ref() { refs.fetch_add(1, std::memory_order_relaxed);}
+        void unref();
+    };
+
+    IOBuf() {}
+    ~IOBuf() { clear();}
+
+    // 拷贝只增加块的引用计数
+    IOBuf(const IOBuf &other) { append(other);}
+    IOBuf &operator=(const IOBuf &other);
+
+    IOBuf(IOBuf &&other) : m_size(other.m_size) { m_refs.swap(other.m_refs); other.m_size = 0;}
+    IOBuf &operator=(IOBuf &&other);
+
+    size_t size() const { return m_size;}
+    bool empty() const { return m_size == 0;}
+
+    // 释放所有块
+    void clear();
+
+    // 追加数据，拷贝到块中
+    void append(const void *data, size_t len);
+    void append(const std::string &s) { append(s.data(), s.size());}
+
+    // 追加另一个缓冲区的全部内容，共享块不拷贝
+    void append(const IOBuf &other);
+
+    // 追加并清空另一个缓冲区，不增减引用计数
+    void append(IOBuf &&other);
+
+    /**
+     * @brief 把开头的n字节移到out的末尾，不拷贝数据
+     * @return 实际移动的字节数
+     */
+    size_t cutTo(IOBuf &out, size_t n);
+
+    // 丢弃开头的n字节，返回实际丢弃的字节数
+    size_t consume(size_t n);
+
+    /**
+     * @brief 从offset开始拷贝n字节到buf，不消费数据
+     * @return 实际拷贝的字节数
+     */
+    size_t copyTo(void *buf, size_t n, size_t offset = 0) const;
+
+    // 拷贝全部内容为字符串
+    std::string toString() const;
+
+    /**
+     * @brief 从start开始查找长度为n的字节串，可以跨越块的边界
+     * @return 起始位置，没有找到返回npos
+     */
+    size_t find(const char *s, size_t n, size_t start = 0) const;
+
+    /**
+     * @brief 用readv从fd读取最多max_len字节追加到末尾，先填满尾块剩余空间再分配新块
+     * @return readv的返回值
+     */
+    ssize_t readFrom(int fd, size_t max_len = 64 * 1024);
+
+    /**
+     * @brief 用writev把开头的数据写到fd，并消费已写出的部分
+     * @return writev的返回值
+     */
+    ssize_t writeTo(int fd);
+
+    /**
+     * @brief 循环writeTo直到全部写出
+     * @return 出错返回false，未写出的数据留在缓冲区里
+     */
+    bool writeAll(int fd);
+
+    // 固定长度整数，网络字节序
+    void writeFixed8(uint8_t v) { append(&v, 1);}
+    void writeFixed16(uint16_t v);
+    void writeFixed32(uint32_t v);
+    void writeFixed64(uint64_t v);
+
+    // 变长整数，每字节7位，小端在前
+    void writeVarint32(uint32_t v) { writeVarint64(v);}
+    void writeVarint64(uint64_t v);
+
+    // zigzag编码的有符号变长整数
+    void writeVarintS32(int32_t v) { writeVarint64(EncodeZigzag(v));}
+    void writeVarintS64(int64_t v) { writeVarint64(EncodeZigzag(v));}
+
+    /**
+     * 读取并消费开头的整数，数据不足时返回false且不消费
+     */
+    bool readFixed8(uint8_t &v);
+    bool readFixed16(uint16_t &v);
+    bool readFixed32(uint32_t &v);
+    bool readFixed64(uint64_t &v);
+    bool readVarint32(uint32_t &v);
+    bool readVarint64(uint64_t &v);
+    bool readVarintS32(int32_t &v);
+    bool readVarintS64(int64_t &v);
+
+    /**
+     * @brief 解析开头的变长整数但不消费
+     * @return 编码占用的字节数，数据不足或超过10字节时返回0
+     */
+    size_t peekVarint64(uint64_t &v) const;
+
+    static uint64_t EncodeZigzag(int64_t v) { return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);}
+    static int64_t DecodeZigzag(uint64_t v) { return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);}
+
+private:
+    /**
+     * @brief 块中的一段区间
+     */
+    struct Ref{
+        Block *block;
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    // 尾块可追加的空间，尾块被共享时为0
+    size_t tailRoom() const;
+
+    // 从第ref个区间的off处开始是否与s的前n个字节相同
+    bool equalAt(size_t ref, size_t off, const char *s, size_t n) const;
+
+private:
+    std::deque<Ref> m_refs;
+    size_t m_size = 0;
+};
+
+#endif
@@ -0,0 +1,282 @@
+/**
+ * @file limiter.h
+ * @brief 挂起协程的限流器：并发数限制和令牌桶
+ * @details 超过限制的协程按FIFO顺序挂起等待，不自旋也不直接拒绝（可以设置排队超时）。
+ * 计数放在一个原子变量里，没有竞争时获取和释放都只是一次原子操作，
+ * 只有需要挂起或唤醒协程时才加锁；多个线程频繁争用同一个限制时可以使用分片版本
+ */
+#ifndef __SYLAR_LIMITER_H__
+#define __SYLAR_LIMITER_H__
+
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <list>
+#include <vector>
+#include <stdint.h>
+#include "noncopyable.h"
+#include "fiber_sync.h"
+#include "TimerManager.h"
+
+/**
+ * @brief FIFO许可队列，两种限流器的公共部分
+ * @details m_state为可用许可数减去等待者数，小于0时说明有协程在等待。
+ * 释放时如果有等待者，许可直接交给队头的协程，新来的协程不能插队
+ */
+class FiberPermits : Noncopyable{
+public:
+    FiberPermits(int64_t count = 0) : m_state(count) {}
+
+    /**
+     * @brief 获取一个许可，没有可用许可时挂起当前协程
+     * @param[in] timeout_ms 排队超时，实际不超过当前协程取消令牌的截止时间
+     * @return 成功返回0，超时返回ETIMEDOUT，被取消返回ECANCELED
+     */
+    int acquire(uint64_t timeout_ms = ~0ull);
+
+    // 不等待地尝试获取许可，有协程在排队时也返回false
+    bool tryAcquire();
+
+    /**
+     * @brief 归还n个许可，优先交给等待者
+     * @param[in] cap 大于0时可用许可数不超过cap，多余的丢弃，用于令牌桶的容量
+     */
+    void release(size_t n = 1, int64_t cap = 0);
+
+    // 可用许可数，有协程在排队时为负数，表示排队的协程数
+    int64_t getState() const { return m_state;}
+
+    // 挂起等待的协程数
+    size_t getWaiting();
+
+private:
+    struct Waiter{
+        // 许可已经交给该等待者
+        bool granted = false;
+        FiberWaitQueue queue;
+        std::list<Waiter*>::iterator it;
+    };
+
+    /**
+     * @brief 把k个许可交给等待者，调用时需持有m_mutex
+     * @return 交给已经放弃等待的协程、需要重新归还的许可数
+     */
+    size_t handoffNoLock(size_t k);
+
+    /**
+     * @brief 等待者超时或被取消后撤销自己的计数，调用时需持有m_mutex
+     */
+    void abandonNoLock();
+
+private:
+    std::atomic<int64_t> m_state;
+    std::mutex m_mutex;
+    // 按到达顺序排队的等待者，等待者对象在各自协程的栈上
+    std::list<Waiter*> m_waiters;
+    // 已经计入但还没有进入队列的等待者可以直接领取的许可数
+    size_t m_handoff = 0;
+    // 已经放弃等待、但释放者已经为其计数的协程数，交给它们的许可需要重新归还
+    size_t m_abandoned = 0;
+};
+
+/**
+ * @brief 并发数限制，语义是带排队超时的信号量
+ */
+class ConcurrencyLimiter : Noncopyable{
+public:
+    typedef std::shared_ptr<ConcurrencyLimiter> ptr;
+
+    ConcurrencyLimiter(size_t limit) : m_limit(limit), m_permits(limit) {}
+
+    /**
+     * @brief 占用一个并发名额，名额用完时挂起当前协程
+     * @return 成功返回0，超时返回ETIMEDOUT，被取消返回ECANCELED
+     */
+    int acquire(uint64_t timeout_ms = ~0ull) { return m_permits.acquire(timeout_ms);}
+
+    bool tryAcquire() { return m_permits.tryAcquire();}
+
+    // 归还一个名额
+    void release() { m_permits.release(1);}
+
+    size_t getLimit() const { return m_limit;}
+
+    // 正在使用的名额数
+    size_t getInUse() const {
+        int64_t s = m_permits.getState();
+        return s >= 0 ? m_limit - s : m_limit;
+    }
+
+    size_t getWaiting() { return m_permits.getWaiting();}
+
+private:
+    size_t m_limit;
+    FiberPermits m_permits;
+};
+
+/**
+ * @brief 令牌桶，由定时器按速率补充令牌
+ * @details 每次补充按距上次补充的实际时间计算令牌数，定时器延迟不会损失令牌；
+ * 桶满时多余的令牌丢弃，突发最多消耗burst个令牌
+ */
+class TokenBucket : public std::enable_shared_from_this<TokenBucket>, Noncopyable{
+public:
+    typedef std::shared_ptr<TokenBucket> ptr;
+
+    /**
+     * @brief 创建令牌桶并启动补充定时器，初始是满的
+     * @param[in] timers 运行补充定时器的定时器管理器，通常是IOManager
+     * @param[in] rate 每秒补充的令牌数
+     * @param[in] burst 桶的容量，至少为1
+     * @param[in] refill_ms 补充间隔，越小令牌到达越平滑
+     */
+    static TokenBucket::ptr Create(TimerManager *timers, double rate, size_t burst,
+                                   uint64_t refill_ms = 10);
+
+    ~TokenBucket();
+
+    /**
+     * @brief 取一个令牌，桶空时挂起当前协程
+     * @return 成功返回0，超时返回ETIMEDOUT，被取消返回ECANCELED
+     */
+    int acquire(uint64_t timeout_ms = ~0ull) { return m_permits.acquire(timeout_ms);}
+
+    bool tryAcquire() { return m_permits.tryAcquire();}
+
+    // 调整速率，从下一次补充开始生效
+    void setRate(double rate) { m_rate = rate;}
+
+    double getRate() const { return m_rate;}
+    size_t getBurst() const { return m_burst;}
+
+    // 桶中的令牌数
+    size_t getTokens() const {
+        int64_t s = m_permits.getState();
+        return s > 0 ? s : 0;
+    }
+
+    size_t getWaiting() { return m_permits.getWaiting();}
+
+    // 停止补充，挂起的协程只能等到超时
+    void stop();
+
+private:
+    TokenBucket(double rate, size_t burst);
+    void refill();
+
+private:
+    std::atomic<double> m_rate;
+    size_t m_burst;
+    FiberPermits m_permits;
+    // 上次补充的时间(微秒)，只由定时器回调访问
+    uint64_t m_lastUs;
+    // 不足一个令牌的部分，留到下次补充
+    double m_carry = 0;
+    std::mutex m_mutex;
+    Timer::ptr m_timer;
+};
+
+/**
+ * @brief 分片的并发数限制，所有调度线程共享一个总限制
+ * @details 名额平均分到各分片，线程优先使用自己的分片，本分片用完时先尝试其他分片，
+ * 都没有时挂起在本分片上。名额总数是精确的，但是等待者只能拿到本分片归还的名额，
+ * 排队的公平性只在分片内成立
+ */
+class ShardedConcurrencyLimiter : Noncopyable{
+public:
+    typedef std::shared_ptr<ShardedConcurrencyLimiter> ptr;
+
+    /**
+     * @param[in] limit 总并发数
+     * @param[in] shards 分片数，通常取调度线程数，会被限制在limit以内
+     */
+    ShardedConcurrencyLimiter(size_t limit, size_t shards);
+
+    /**
+     * @brief 占用一个名额
+     * @param[out] shard 名额所在的分片，release时传回
+     * @return 成功返回0，超时返回ETIMEDOUT，被取消返回ECANCELED
+     */
+    int acquire(size_t &shard, uint64_t timeout_ms = ~0ull);
+
+    bool tryAcquire(size_t &shard);
+
+    void release(size_t shard) { m_shards[shard]->release(1);}
+
+    size_t getLimit() const { return m_limit;}
+    size_t getShardCount() const { return m_shards.size();}
+
+private:
+    size_t m_limit;
+    // 每个分片单独分配，计数不在同一个缓存行上
+    std::vector<std::unique_ptr<FiberPermits>> m_shards;
+};
+
+/**
+ * @brief 分片的令牌桶，速率和容量平均分到各分片，同一个定时器补充所有分片
+ */
+class ShardedTokenBucket : public std::enable_shared_from_this<ShardedTokenBucket>, Noncopyable{
+public:
+    typedef std::shared_ptr<ShardedTokenBucket> ptr;
+
+    static ShardedTokenBucket::ptr Create(TimerManager *timers, double rate, size_t burst,
+                                          size_t shards, uint64_t refill_ms = 10);
+
+    ~ShardedTokenBucket();
+
+    /**
+     * @brief 取一个令牌，先取本线程的分片，再尝试其他分片，都没有时挂起在本分片上
+     */
+    int acquire(uint64_t timeout_ms = ~0ull);
+
+    bool tryAcquire();
+
+    size_t getShardCount() const { return m_shards.size();}
+
+    void stop();
+
+private:
+    ShardedTokenBucket(double rate, size_t burst, size_t shards);
+    void refill();
+
+private:
+    double m_rate;
+    size_t m_burst;
+    std::vector<std::unique_ptr<FiberPermits>> m_shards;
+    uint64_t m_lastUs;
+    double m_carry = 0;
+    // 零头令牌从哪个分片开始分配，轮流分给各分片
+    size_t m_next = 0;
+    std::mutex m_mutex;
+    Timer::ptr m_timer;
+};
+
+/**
+ * @brief 限流器的作用域守卫，析构时归还名额
+ */
+class LimiterGuard : Noncopyable{
+public:
+    /**
+     * @brief 占用limiter的一个名额，用ok()检查是否成功
+     */
+    LimiterGuard(ConcurrencyLimiter &limiter, uint64_t timeout_ms = ~0ull)
+        :m_limiter(&limiter){
+        m_error = limiter.acquire(timeout_ms);
+    }
+
+    ~LimiterGuard() {
+        if(!m_error)
+            m_limiter->release();
+    }
+
+    bool ok() const { return m_error == 0;}
+
+    // 获取失败的原因，ETIMEDOUT或ECANCELED
+    int getError() const { return m_error;}
+
+private:
+    ConcurrencyLimiter *m_limiter;
+    int m_error;
+};
+
+#endif
@@ -0,0 +1,118 @@
+/**
+ * @file mailbox.h
+ * @brief 协程邮箱，在调度器之间传递消息
+ * @details 多个生产者可以在任意调度器、任意线程上投递，只有一个消费者协程。
+ * 投递是无锁的MPSC入队，消费者没有挂起时不需要任何额外操作；
+ * 消费者挂起时由抢到唤醒权的那个生产者通过调度器的邮箱把它投递回去，也不加调度器的全局锁。
+ * 用于搭建分阶段的流水线：每个阶段一个消费者协程，阶段之间用邮箱连接
+ */
+#ifndef __SYLAR_MAILBOX_H__
+#define __SYLAR_MAILBOX_H__
+
+#include <memory>
+#include <atomic>
+#include "noncopyable.h"
+#include "mpsc_queue.h"
+#include "scheduler.h"
+
+template<class T>
+class FiberMailbox : Noncopyable{
+public:
+    typedef std::shared_ptr<FiberMailbox> ptr;
+
+    FiberMailbox() {}
+
+    /**
+     * @brief 投递一条消息
+     * @details 邮箱必须比所有正在投递的生产者活得久，通常用shared_ptr持有
+     * @return 邮箱已关闭时返回false；与close同时发生的投递可能在关闭后被丢弃
+     */
+    bool push(T v){
+        if(m_closed)
+            return false;
+        m_queue.push(std::move(v));
+        wake();
+        return true;
+    }
+
+    /**
+     * @brief 取一条消息，邮箱为空时挂起当前协程
+     * @details 同一时间只能有一个协程调用，不受取消令牌约束，需要退出时由其他协程close
+     * @return 邮箱已关闭且消息已经取完时返回false
+     */
+    bool pop(T &v){
+        while(true){
+            if(m_queue.pop(v))
+                return true;
+            if(m_closed)
+                return m_queue.pop(v);
+            park();
+        }
+    }
+
+    // 不挂起地取一条消息，只能由消费者调用
+    bool tryPop(T &v) { return m_queue.pop(v);}
+
+    /**
+     * @brief 关闭邮箱，挂起的消费者被唤醒，取完剩余消息后pop返回false
+     */
+    void close(){
+        m_closed = true;
+        wake();
+    }
+
+    bool isClosed() const { return m_closed;}
+
+    // 是否为空，结果只是一个瞬间的近似
+    bool empty() const { return m_queue.empty();}
+
+private:
+    enum State{
+        RUNNING = 0,
+        PARKED = 1
+    };
+
+    /**
+     * @brief 挂起消费者协程
+     * @details 切换出去之后才标记为PARKED，之前投递的生产者看不到PARKED不会唤醒，
+     * 所以标记之后要再检查一次队列
+     */
+    void park(){
+        Fiber::ptr self = Fiber::GetThis();
+        m_scheduler = Scheduler::GetThis();
+        SYLAR_ASSERT(m_scheduler);
+        m_waiter = self;
+        Fiber *raw_ptr = self.get();
+        self.reset();
+        Fiber::SetPostSwitch([](void *arg){
+            FiberMailbox *mb = static_cast<FiberMailbox*>(arg);
+            mb->m_state.store(PARKED);
+            if(!mb->m_queue.empty() || mb->m_closed)
+                mb->wake();
+        }, this);
+        Fiber::SetCurrentWait("mailbox", -1, 0);
+        raw_ptr->yield();
+    }
+
+    // 消费者挂起时把它投递回原来的调度器，多个生产者同时唤醒时只有一个成功
+    void wake(){
+        if(m_state.load() != PARKED)
+            return;
+        int expected = PARKED;
+        if(!m_state.compare_exchange_strong(expected, RUNNING))
+            return;
+        Fiber::ptr f;
+        f.swap(m_waiter);
+        m_scheduler->post(f);
+    }
+
+private:
+    MpscQueue<T> m_queue;
+    std::atomic<int> m_state = {RUNNING};
+    std::atomic<bool> m_closed = {false};
+    // 挂起的消费者协程和它所在的调度器，只在RUNNING到PARKED之前由消费者写入
+    Fiber::ptr m_waiter;
+    Scheduler *m_scheduler = nullptr;
+};
+
+#endif
@@ -0,0 +1,149 @@
+/**
+ * @file metrics.h
+ * @brief 调度器运行时指标
+ * @details 计数器和直方图按工作线程各自一份，只由所属线程写入，写入是普通的load+store，
+ * 不用带锁前缀的原子加；读取方（快照）只做relaxed读，允许读到稍旧的值
+ */
+#ifndef __SYLAR_METRICS_H__
+#define __SYLAR_METRICS_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+/**
+ * @brief 单写者计数器
+ */
+class MetricCounter{
+public:
+    void inc(uint64_t n = 1){
+        m_value.store(m_value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    uint64_t get() const { return m_value.load(std::memory_order_relaxed);}
+
+private:
+    std::atomic<uint64_t> m_value = {0};
+};
+
+/**
+ * @brief 单写者直方图，按2的幂分桶
+ * @details 第i个桶记录[2^(i-1), 2^i)范围内的值，第0个桶记录0
+ */
+class MetricHistogram{
+public:
+    static const size_t kBuckets = 40;
+
+    /**
+     * @brief 直方图快照，可以把多个线程的直方图合并到一起
+     */
+    struct Snapshot{
+        uint64_t buckets[kBuckets] = {0};
+        uint64_t count = 0;
+        uint64_t sum = 0;
+
+        void merge(const Snapshot &other);
+
+        /**
+         * @brief 估算分位数，返回所在桶的上界
+         * @param[in] p 0到1之间
+         */
+        uint64_t percentile(double p) const;
+    };
+
+    void record(uint64_t v){
+        size_t i = v ? 64 - __builtin_clzll(v) : 0;
+        if(i >= kBuckets) i = kBuckets - 1;
+        bump(m_buckets[i], 1);
+        bump(m_count, 1);
+        bump(m_sum, v);
+    }
+
+    void snapshot(Snapshot &snap) const;
+
+    // 第i个桶的上界（不含），最后一个桶没有上界
+    static uint64_t BucketBound(size_t i){ return 1ull << i;}
+
+private:
+    static void bump(std::atomic<uint64_t> &v, uint64_t n){
+        v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<uint64_t> m_buckets[kBuckets] = {};
+    std::atomic<uint64_t> m_count = {0};
+    std::atomic<uint64_t> m_sum = {0};
+};
+
+/**
+ * @brief 每个工作线程的指标，放在工作线程私有的Worker里
+ */
+struct WorkerMetrics{
+    // resume idle协程的次数；执行的任务数就是调度器给任务编的序号，不在切换路径上重复计数
+    MetricCounter idleSwitches;
+    // 在idle协程里的时间(微秒)
+    MetricCounter idleUs;
+    // epoll_wait调用次数（含自旋阶段的零超时调用）
+    MetricCounter epollWaits;
+    // 阻塞在epoll_wait里的时间(微秒)
+    MetricCounter epollWaitUs;
+    // 触发的定时器数
+    MetricCounter timerFires;
+    // 每次epoll_wait返回的事件数
+    MetricHistogram eventsPerWait;
+    // 任务从入队到开始运行的时间(微秒)
+    MetricHistogram scheduleLatencyUs;
+    // 任务每次运行到让出的时间(微秒)
+    MetricHistogram runSliceUs;
+};
+
+/**
+ * @brief 调度器指标快照
+ */
+struct SchedulerMetrics{
+    struct Worker{
+        size_t index = 0;
+        int cpu = -1;
+        int node = -1;
+        uint64_t tasksExecuted = 0;
+        uint64_t contextSwitches = 0;
+        uint64_t idleUs = 0;
+        uint64_t epollWaits = 0;
+        uint64_t epollWaitUs = 0;
+        uint64_t timerFires = 0;
+    };
+
+    std::string name;
+    // 任务队列深度
+    uint64_t queueDepth = 0;
+    // 存活的工作线程数
+    uint64_t workers = 0;
+    uint64_t activeThreads = 0;
+    uint64_t idleThreads = 0;
+    // 进程内存活的协程数
+    uint64_t totalFibers = 0;
+    // 监控线程发出的抢占次数
+    uint64_t preemptions = 0;
+    // 过载保护：因队列满和协程数超限被拒绝的新任务数，被CoDel判定排队太久的任务数
+    uint64_t shedQueueFull = 0;
+    uint64_t shedTooManyFibers = 0;
+    uint64_t shedStale = 0;
+    // 以下只有IOManager有
+    uint64_t pendingEvents = 0;
+    uint64_t timers = 0;
+
+    std::vector<Worker> perWorker;
+    MetricHistogram::Snapshot eventsPerWait;
+    MetricHistogram::Snapshot scheduleLatencyUs;
+    MetricHistogram::Snapshot runSliceUs;
+
+    /**
+     * @brief 输出Prometheus文本格式
+     * @param[in] prefix 指标名前缀
+     */
+    std::string toPrometheus(const std::string &prefix = "sylar") const;
+};
+
+#endif
@@ -0,0 +1,75 @@
+/**
+ * @file mpsc_queue.h
+ * @brief 无锁多生产者单消费者队列
+ * @details 链表实现，入队只有一次原子交换，不会因为其他生产者而重试；
+ * 出队只能由一个消费者进行。生产者交换了队尾还没有链上next时，消费者暂时看不到这个元素，
+ * 此时pop返回false而empty返回false，稍后再取即可
+ */
+#ifndef __SYLAR_MPSC_QUEUE_H__
+#define __SYLAR_MPSC_QUEUE_H__
+
+#include <atomic>
+#include <utility>
+
+template<class T>
+class MpscQueue{
+public:
+    MpscQueue(){
+        Node *stub = new Node;
+        m_head.store(stub, std::memory_order_relaxed);
+        m_tail.store(stub, std::memory_order_relaxed);
+    }
+
+    ~MpscQueue(){
+        T v;
+        while(pop(v));
+        delete m_tail.load(std::memory_order_relaxed);
+    }
+
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue &operator=(const MpscQueue&) = delete;
+
+    // 入队，任意线程都可以调用
+    void push(T &&v){
+        Node *n = new Node;
+        n->value = std::move(v);
+        Node *prev = m_head.exchange(n, std::memory_order_acq_rel);
+        prev->next.store(n, std::memory_order_release);
+    }
+
+    /**
+     * @brief 出队，只能由消费者调用
+     * @return 队列为空或队头元素还没有链上时返回false
+     */
+    bool pop(T &v){
+        Node *tail = m_tail.load(std::memory_order_relaxed);
+        Node *next = tail->next.load(std::memory_order_acquire);
+        if(!next)
+            return false;
+        // next成为新的哑节点，它的值移走之后就不再使用
+        v = std::move(next->value);
+        m_tail.store(next, std::memory_order_release);
+        delete tail;
+        return true;
+    }
+
+    // 是否为空，任意线程都可以调用，结果只是一个瞬间的近似
+    bool empty() const {
+        return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_acquire);
+    }
+
+private:
+    struct Node{
+        std::atomic<Node*> next = {nullptr};
+        T value;
+    };
+
+    // 生产者写入的一端
+    std::atomic<Node*> m_head;
+    // 生产者和消费者各写一端，隔开避免在同一个缓存行上来回失效
+    char m_pad[64];
+    // 消费者读取的一端，指向哑节点
+    std::atomic<Node*> m_tail;
+};
+
+#endif
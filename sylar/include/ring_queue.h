@@ -0,0 +1,90 @@
+/**
+ * @file ring_queue.h
+ * @brief 基于环形数组的队列
+ * @details 容量按2的幂扩张，入队出队不会为每个元素分配节点；元素只移动不拷贝
+ */
+#ifndef __SYLAR_RING_QUEUE_H__
+#define __SYLAR_RING_QUEUE_H__
+
+#include <stddef.h>
+#include <utility>
+#include <new>
+
+template<class T>
+class RingQueue{
+public:
+    RingQueue() {}
+
+    ~RingQueue(){
+        clear();
+        ::operator delete(m_data);
+    }
+
+    RingQueue(const RingQueue&) = delete;
+    RingQueue &operator=(const RingQueue&) = delete;
+
+    bool empty() const { return m_size == 0;}
+
+    size_t size() const { return m_size;}
+
+    // 第i个元素，0为队头
+    T &operator[](size_t i) { return m_data[(m_head + i) & (m_capacity - 1)];}
+
+    T &front() { return (*this)[0];}
+
+    void push_back(T &&v){
+        if(m_size == m_capacity)
+            grow();
+        new (&(*this)[m_size]) T(std::move(v));
+        ++m_size;
+    }
+
+    void pop_front(){
+        front().~T();
+        m_head = (m_head + 1) & (m_capacity - 1);
+        --m_size;
+    }
+
+    /**
+     * @brief 删除第i个元素，后面的元素依次前移
+     * @details 只在跳过指定线程的任务时使用，通常i很小
+     */
+    void erase(size_t i){
+        if(i == 0){
+            pop_front();
+            return;
+        }
+        for(size_t j = i; j + 1 < m_size; ++j)
+            (*this)[j] = std::move((*this)[j + 1]);
+        (*this)[m_size - 1].~T();
+        --m_size;
+    }
+
+    void clear(){
+        while(m_size)
+            pop_front();
+        m_head = 0;
+    }
+
+private:
+    void grow(){
+        size_t capacity = m_capacity ? m_capacity * 2 : 16;
+        T *data = static_cast<T*>(::operator new(capacity * sizeof(T)));
+        for(size_t i = 0; i < m_size; ++i){
+            new (&data[i]) T(std::move((*this)[i]));
+            (*this)[i].~T();
+        }
+        ::operator delete(m_data);
+        m_data = data;
+        m_capacity = capacity;
+        m_head = 0;
+    }
+
+private:
+    T *m_data = nullptr;
+    size_t m_capacity = 0;
+    size_t m_head = 0;
+    size_t m_size = 0;
+};
+
+#endif
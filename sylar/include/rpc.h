@@ -0,0 +1,181 @@
+/**
+ * @file rpc.h
+ * @brief 基于IOManager的二进制RPC
+ * @details 帧格式为4字节网络序长度加帧体：
+ *   请求: type(1)=1 | id(8) | timeout_ms(varint) | method(varint长度+字节) | payload
+ *   响应: type(1)=2 | id(8) | status(varint) | payload
+ * 一个连接上可以同时有多个调用，按id匹配响应；每个连接一个读协程负责分发，
+ * 多个协程并发发送的帧在写缓冲区里合并，由其中一个协程用一次writev写出
+ */
+#ifndef __SYLAR_RPC_H__
+#define __SYLAR_RPC_H__
+
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <unordered_map>
+#include <unistd.h>
+#include "tcp_server.h"
+#include "fiber_sync.h"
+#include "iobuf.h"
+
+/**
+ * @brief 调用状态，0表示成功，传输层错误使用errno，大于等于1000的由服务端方法自定义
+ */
+enum RpcStatus{
+    RPC_OK = 0,
+    RPC_NO_METHOD = 1000,
+    RPC_BAD_REQUEST = 1001,
+    // 服务端过载，请求没有被处理，可以换一个实例重试
+    RPC_OVERLOADED = 1002
+};
+
+/**
+ * @brief RPC连接的发送端
+ * @details send把帧追加到写缓冲区，如果没有其他协程在写就由当前协程负责写出，
+ * 写的过程中其他协程追加的帧会在下一轮一起写出
+ */
+class RpcConnection{
+public:
+    typedef std::shared_ptr<RpcConnection> ptr;
+
+    RpcConnection(int fd) : m_fd(fd) {}
+
+    int getFd() const { return m_fd;}
+
+    /**
+     * @brief 发送一个完整的帧
+     * @return 连接已经出错时返回false
+     */
+    bool send(IOBuf &&frame);
+
+    bool isBroken() const { return m_broken;}
+
+    // 编码帧，前面加上长度
+    static void EncodeRequest(IOBuf &out, uint64_t id, const std::string &method,
+                              uint64_t timeout_ms, const IOBuf &payload);
+    static void EncodeResponse(IOBuf &out, uint64_t id, int status, IOBuf &&payload);
+
+    /**
+     * @brief 从缓冲区中切出一个完整的帧体
+     * @return 1表示成功，0表示数据不完整，-1表示帧长度不合法
+     */
+    static int CutFrame(IOBuf &in, IOBuf &frame);
+
+    /// 单个帧的最大长度
+    static const uint32_t kMaxFrame = 64 * 1024 * 1024;
+
+private:
+    int m_fd;
+    std::mutex m_mutex;
+    // 等待写出的帧
+    IOBuf m_pending;
+    // 是否有协程正在写
+    bool m_writing = false;
+    std::atomic<bool> m_broken = {false};
+};
+
+/**
+ * @brief RPC客户端连接，可以被多个协程同时使用
+ */
+class RpcChannel : public std::enable_shared_from_this<RpcChannel>{
+public:
+    typedef std::shared_ptr<RpcChannel> ptr;
+
+    /**
+     * @brief 连接服务端并在iom上启动读协程
+     * @param[in] timeout_ms 连接超时
+     * @return 失败返回nullptr
+     */
+    static RpcChannel::ptr Connect(IOManager *iom, const std::string &ip, uint16_t port,
+                                   uint64_t timeout_ms = 3000);
+
+    ~RpcChannel();
+
+    /**
+     * @brief 调用远端方法，挂起当前协程直到收到响应、超时或连接断开
+     * @param[in] timeout_ms 调用的截止时间，同时发给服务端作为处理的截止时间，
+     * 实际超时不超过当前协程取消令牌的截止时间
+     * @return 状态码，见RpcStatus
+     */
+    int call(const std::string &method, const IOBuf &req, IOBuf &resp, uint64_t timeout_ms = 3000);
+
+    /**
+     * @brief 关闭连接，所有等待中的调用返回ECONNRESET，读协程随后退出
+     * @details 释放最后一个引用时会自动关闭
+     */
+    void close();
+
+    bool isClosed() const { return m_closed;}
+
+    // 等待响应的调用数
+    size_t getPendingCount();
+
+private:
+    // fd的所有者，通道和读协程各持有一份，最后一个释放时关闭，读协程退出之前fd不会被复用
+    struct FdOwner{
+        int fd;
+        FdOwner(int f) : fd(f) {}
+        ~FdOwner() { ::close(fd);}
+    };
+
+    RpcChannel(int fd);
+
+    /**
+     * @brief 读协程，只持有通道的弱引用，挂起在read上时不阻止通道析构
+     */
+    static void ReadLoop(std::weak_ptr<RpcChannel> weak, std::shared_ptr<FdOwner> owner);
+
+    /**
+     * @brief 把一个响应帧交给等待的调用
+     * @return 帧格式错误返回false
+     */
+    bool onResponse(IOBuf &frame);
+
+    void failAll(int err);
+
+private:
+    struct Call{
+        std::mutex mutex;
+        FiberWaitQueue queue;
+        bool done = false;
+        int status = 0;
+        IOBuf resp;
+    };
+    typedef std::shared_ptr<Call> CallPtr;
+
+    int m_fd;
+    std::shared_ptr<FdOwner> m_fdOwner;
+    RpcConnection m_conn;
+    std::mutex m_mutex;
+    std::unordered_map<uint64_t, CallPtr> m_calls;
+    uint64_t m_nextId = 0;
+    std::atomic<bool> m_closed = {false};
+};
+
+/**
+ * @brief RPC服务端，每个请求在独立的协程中处理，响应按完成顺序发送
+ */
+class RpcServer : public TcpServer{
+public:
+    typedef std::shared_ptr<RpcServer> ptr;
+    /**
+     * @brief 方法处理函数，返回状态码，可以阻塞在hook的IO上
+     * @details 请求带的截止时间以取消令牌的形式作用于处理协程
+     */
+    typedef std::function<int(const IOBuf &req, IOBuf &resp)> Method;
+
+    RpcServer(IOManager *worker, const std::string &name = "sylar/rpc_server");
+
+    // 注册方法，需在start之前调用
+    void registerMethod(const std::string &name, Method cb);
+
+protected:
+    void handleClient(int fd) override;
+
+private:
+    std::unordered_map<std::string, Method> m_methods;
+};
+
+#endif
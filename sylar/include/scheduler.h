@@ -4,6 +4,14 @@
 #include <vector>
 #include <list>
 #include <thread>
+#include <algorithm>
+#include "task.h"
+#include "ring_queue.h"
+#include "mpsc_queue.h"
+#include "metrics.h"
+#include "fiber_stats.h"
+#include "util.h"
+#include "trace.h"
 
 
 class Scheduler{
@@ -11,6 +19,31 @@ public:
     typedef std::shared_ptr<Scheduler> ptr;
     typedef Mutex MutexType;
 
+    /**
+     * @brief 任务优先级
+     * @details 不同优先级的任务按权重加权轮转出队，低优先级不会被饿死
+     */
+    enum Priority{
+        PRIORITY_INHERIT = -1, // 继承：协程任务取协程自身的优先级，回调任务取调度者协程的优先级
+        PRIORITY_HIGH = 0,     // 延迟敏感的请求协程
+        PRIORITY_NORMAL = 1,   // 默认
+        PRIORITY_LOW = 2,      // 后台批量任务，如日志上报、缓存刷新
+        PRIORITY_COUNT = 3
+    };
+
+    /**
+     * @brief 过载保护丢弃或拒绝任务的原因
+     */
+    enum ShedReason{
+        SHED_QUEUE_FULL = 1,      // 队列深度达到上限，新任务被拒绝
+        SHED_TOO_MANY_FIBERS = 2, // 存活协程数达到上限，新任务被拒绝
+        SHED_STALE = 3,           // 过载时排队太久，带着已超时的令牌运行
+        SHED_REASON_COUNT = 4
+    };
+
+    /// 过载保护回调，参数为ShedReason，在不持有调度器锁时调用
+    typedef std::function<void(int reason)> ShedCallback;
+
     /**
      * 创建调度器
      * threads---线程数
@@ -29,21 +62,273 @@ public:
     // 当前线程的主协程
     static Fiber *GetMainFiber();
 
+    /**
+     * @brief 把执行权直接交给next，当前协程重新入队
+     * @details next必须是READY且不在任务队列中（通常是当前协程刚刚唤醒的协程），
+     * 当前协程在切换完成后才重新入队，避免其他线程提前resume它；
+     * 不在调度器的任务协程中调用时，退化为schedule(next)
+     */
+    static void YieldTo(Fiber::ptr next);
+
+    /**
+     * @brief 把当前协程迁移到target上继续运行
+     * @details 当前协程让出后由target的工作线程继续执行，返回时已经运行在target的线程上。
+     * 用于分阶段的流水线：网络协程切到磁盘或计算调度器上做阻塞或耗时的工作，完成后再切回来，
+     * 整个过程不需要额外的协程和回调。迁移通过target的邮箱投递，不加target的全局锁
+     * @return 当前协程不在调度器的任务协程中时返回false，不做迁移
+     */
+    static bool SwitchTo(Scheduler *target);
+
     /**添加调度任务
      * FiberOrCb调度任务类型，可以是协程对象或函数指针
      * fc 协程对象或指针
      * thread 指定运行该任务的线程号， -1表示任何线程
+     * priority 任务优先级，默认继承
+     * 返回是否入队，新任务超过准入限制时被拒绝（见setAdmissionLimits），任务随之析构
      */
     template<class FiberOrCb>
-    void schedule(FiberOrCb fc, int thread=-1)
+    bool schedule(FiberOrCb &&fc, int thread=-1, int priority=PRIORITY_INHERIT)
     {
-        bool need_tickle = false;
+        // 任务在加锁前构造好，锁内只做移动
+        ScheduleTask task(std::forward<FiberOrCb>(fc), thread);
+        return scheduleTask(task, priority, 0);
+    }
+
+    /**添加带截止时间的调度任务
+     * deadline_ms 绝对截止时间(毫秒，GetCurrentMS)
+     * 开启EDF模式时，带截止时间的任务先于优先级队列按截止时间从早到晚出队；
+     * 未开启时截止时间被忽略，按priority入队
+     */
+    template<class FiberOrCb>
+    bool scheduleWithDeadline(FiberOrCb &&fc, uint64_t deadline_ms, int thread=-1, int priority=PRIORITY_INHERIT)
+    {
+        ScheduleTask task(std::forward<FiberOrCb>(fc), thread);
+        return scheduleTask(task, priority, deadline_ms);
+    }
+
+    /**批量添加调度任务
+     * 整个区间只加一次锁，并且只唤醒实际需要的空闲线程数，迭代器指向协程或回调函数，
+     * 元素的内容会被移动进任务队列。每个任务都检查准入限制，被拒绝的任务随之析构并计入过载保护
+     * 返回入队的任务数
+     */
+    template<class InputIterator>
+    size_t schedule(InputIterator begin, InputIterator end, int priority=PRIORITY_INHERIT)
+    {
+        size_t count = 0;
+        // 被拒绝的任务按原因计数，解锁后再调用过载回调
+        size_t shed[SHED_REASON_COUNT] = {0};
         {
             MutexType::Lock lock(m_mutex);
-            need_tickle = scheduleNoLock(fc, thread);
+            while(begin != end){
+                ScheduleTask task(&*begin, -1);
+                int reason = admit(task);
+                if(reason)
+                    ++shed[reason];
+                else if(enqueueNoLock(task, priority, 0))
+                    ++count;
+                ++begin;
+            }
+        }
+        for(int i = 1; i < SHED_REASON_COUNT; ++i){
+            if(shed[i])
+                onShed(i, shed[i]);
         }
-        if(need_tickle)
-            tickle(); // 唤醒idle协程
+        if(count)
+            tickleIdle(count);
+        return count;
+    }
+
+    /**
+     * @brief 通过无锁邮箱投递任务，主要用于从其他调度器的线程跨调度器投递
+     * @details 投递只做一次原子交换，不加调度器的全局锁；邮箱由空变为非空时才唤醒一次空闲线程，
+     * 连续投递的任务由工作线程一次取出、加一次锁批量入队。任务不能指定线程和截止时间
+     * @return 新任务超过准入限制时返回false
+     */
+    template<class FiberOrCb>
+    bool post(FiberOrCb &&fc, int priority=PRIORITY_INHERIT)
+    {
+        ScheduleTask task(std::forward<FiberOrCb>(fc), -1);
+        if(priority >= 0)
+            task.priority = priority;
+        return postTask(task);
+    }
+
+    /**
+     * @brief 通过邮箱批量投递，整个区间最多唤醒一次
+     * @return 投递成功的任务数
+     */
+    template<class InputIterator>
+    size_t post(InputIterator begin, InputIterator end, int priority=PRIORITY_INHERIT)
+    {
+        size_t count = 0;
+        while(begin != end){
+            ScheduleTask task(&*begin, -1);
+            if(priority >= 0)
+                task.priority = priority;
+            if(pushMailbox(task))
+                ++count;
+            ++begin;
+        }
+        if(count)
+            signalMailbox();
+        return count;
+    }
+
+    /**
+     * @brief 批量调度，定义见类外
+     */
+    class ScheduleBatch;
+
+    /**
+     * @brief 设置各优先级的出队权重，默认高:中:低 = 8:4:1
+     */
+    void setPriorityWeights(uint32_t high, uint32_t normal, uint32_t low);
+
+    // 开启/关闭最早截止时间优先(EDF)模式
+    void setEdfEnabled(bool v) { m_edfEnabled = v;}
+
+    // 是否开启EDF模式
+    bool isEdfEnabled() const { return m_edfEnabled;}
+
+    /**
+     * @brief 设置工作线程绑定的CPU列表，需在start之前调用
+     * @details 第i个工作线程（use_caller时caller线程为第0个）绑定到第i % cpus.size()个CPU；
+     * group_by_node为true时先把CPU按NUMA节点排序，编号相邻的工作线程落在同一节点上。
+     * 工作线程绑核之后才分配自己的调度结构，按首次访问原则落在本节点内存上；
+     * 协程栈仍由全局的栈分配器分配，不保证在本节点
+     */
+    void setCpuAffinity(const std::vector<int> &cpus, bool group_by_node = true);
+
+    // 当前工作线程所在的NUMA节点，未绑核或不在调度线程中返回-1
+    static int GetCurrentNode();
+
+    /**添加优先在指定NUMA节点上运行的任务
+     * node 节点号，-1表示不限；同节点的工作线程优先取走该任务，
+     * 一段时间内没有同节点线程空闲时其他节点的线程也可以执行
+     */
+    template<class FiberOrCb>
+    bool scheduleOnNode(FiberOrCb &&fc, int node, int priority=PRIORITY_INHERIT)
+    {
+        ScheduleTask task(std::forward<FiberOrCb>(fc), -1);
+        task.node = node;
+        return scheduleTask(task, priority, 0);
+    }
+
+    /**
+     * @brief 设置工作线程数的弹性范围，需在start之前调用
+     * @details 默认上下限都等于构造时的线程数，即不伸缩。设置了范围后由监控线程(sysmon)
+     * 根据队列积压和阻塞的工作线程增减线程数，线程数不含use_caller的caller线程
+     */
+    void setWorkerBounds(size_t min_threads, size_t max_threads);
+
+    /**
+     * @brief 开启协程抢占，需在start之前调用
+     * @details 监控线程发现某个工作线程运行同一个任务超过slice_ms时，设置该线程的抢占标记，
+     * 协程在下一个检查点(Fiber::MaybeYield，hook的IO调用入口)让出并重新入队。
+     * async为true时监控线程还会向该线程发送抢占信号，协程正处于Fiber::PreemptibleScope内时
+     * 在信号处理函数里直接让出；区域外不做异步切换，因为被打断的协程可能持有malloc、日志等的锁。
+     * 运行时长由监控线程按检查间隔计时，实际在slice_ms到slice_ms加一个检查间隔（见setSysmonOptions）之间抢占
+     * @param[in] slice_ms 时间片长度，0表示关闭
+     * @param[in] async 是否发送抢占信号
+     */
+    void setPreemption(uint64_t slice_ms, bool async = false);
+
+    /**
+     * @brief 设置准入限制
+     * @details 只约束新任务：回调任务和还没有运行过的协程。被IO事件、定时器、同步原语唤醒的协程
+     * 以及让出后重新入队的协程不受限制，否则它们持有的资源永远得不到释放。
+     * 超过限制时schedule返回false并调用过载回调
+     * @param[in] max_queue_depth 队列深度上限，0表示不限
+     * @param[in] max_fibers 进程内存活协程数上限（每个协程占一个栈），0表示不限
+     */
+    void setAdmissionLimits(size_t max_queue_depth, size_t max_fibers);
+
+    /**
+     * @brief 开启按排队延迟丢弃（CoDel）
+     * @details 每个interval_ms统计一次出队任务的最小排队延迟，超过target_ms说明队列持续积压而不是突发，
+     * 进入过载状态；过载期间排队超过2倍target_ms的回调任务不再正常执行，而是换上已超时的取消令牌运行，
+     * hook的阻塞调用和等待立即返回ETIMEDOUT，任务可以尽快结束并完成自己的清理。
+     * 排队太久的请求调用方多半已经放弃，继续处理只会拖慢后面的请求
+     * @param[in] target_ms 目标排队延迟，0表示关闭
+     * @param[in] interval_ms 统计窗口
+     */
+    void setCodel(uint64_t target_ms, uint64_t interval_ms = 100);
+
+    // 设置过载保护回调，用于记录日志或上报
+    void setShedCallback(ShedCallback cb);
+
+    /**
+     * @brief 是否处于过载状态：新任务会被拒绝或者CoDel判定队列持续积压
+     * @details 不加锁，供accept等入口在接收新工作之前判断
+     */
+    bool isOverloaded() const;
+
+    // 按原因累计的过载保护次数
+    uint64_t getShedCount(int reason) const {
+        return reason > 0 && reason < SHED_REASON_COUNT ? m_shedCount[reason].load() : 0;
+    }
+
+    /**
+     * @brief 让出当前协程并重新入队，队列里没有其他任务时直接返回
+     * @details 当前协程不参与调度或者就是调度协程时什么都不做
+     */
+    static void YieldCurrent();
+
+    /**
+     * @brief 响应抢占标记，由Fiber::MaybeYield和抢占信号处理函数调用
+     * @details 清除标记，只有标记是为当前正在运行的任务设置的才让出，
+     * 监控线程采样之后上一个任务已经结束的话，留下的标记直接忽略
+     */
+    static void PreemptCurrent();
+
+    /**
+     * @brief 当前工作线程的指标，不在工作线程上时返回nullptr
+     * @details 只能由当前线程写入，供子类（如IOManager::idle）记录自己的指标
+     */
+    static WorkerMetrics *GetWorkerMetrics();
+
+    /**
+     * @brief 采集指标快照，子类可以补充自己的指标
+     */
+    virtual void getMetrics(SchedulerMetrics &m);
+
+    /**
+     * @brief 以Prometheus文本格式输出指标
+     */
+    std::string dumpMetrics(const std::string &prefix = "sylar");
+
+    /**
+     * @brief 设置调度延迟和运行时长直方图的抽样间隔
+     * @details 每every个任务抽一个在入队、开始运行和让出时读时钟，其余任务只增加计数，
+     * 切换路径上不读时钟；直方图反映的是抽样任务的分布
+     * @param[in] every 抽样间隔，1表示每个任务都记录，0表示不记录直方图，默认64
+     */
+    void setMetricsSampling(uint32_t every) { m_metricsSampleEvery = every;}
+
+    /**
+     * @brief 设置监控线程参数
+     * @param[in] interval_ms 检查间隔
+     * @param[in] stuck_ms 工作线程运行同一个任务超过该时间视为被阻塞（非hook的阻塞调用或长时间计算），
+     * 为它补充一个工作线程，0表示不检测
+     */
+    void setSysmonOptions(uint64_t interval_ms, uint64_t stuck_ms);
+
+    /**
+     * @brief 在运行时增加一个工作线程
+     * @return 已达到上限或调度器正在停止时返回false
+     */
+    bool addWorker();
+
+    // 当前存活的工作线程数，不含use_caller的caller线程
+    size_t getWorkerCount() const { return m_liveWorkerCount;}
+
+    /**
+     * @brief 所有调度线程的线程id，use_caller时包含caller线程，不含已缩容退出的线程，
+     * 可作为schedule的thread参数把任务固定在某个线程上；固定的线程之后退出了，任务改由任意线程执行
+     */
+    std::vector<int> getThreadIds(){
+        MutexType::Lock lock(m_mutex);
+        return m_threadIds;
     }
 
     // 启动调度器
@@ -61,38 +346,282 @@ protected:
     virtual bool stopping(); // 返回是否可以停止
     void setThis(); // 设置当前的协程调度器
     bool hasIdleThreads(){ return m_idleThreadCount>0;} // 返回是否有空闲线程----当调度协程进⼊idle时空闲线程数加1，从idle协程返回时空闲线程数减1
+    bool hasPendingTasks() const { return m_taskCount > 0 || !m_mailbox.empty();} // 任务队列或邮箱是否非空，不加锁，供idle自旋时轮询
+
+    /**
+     * @brief 新增了tasks个任务后唤醒空闲线程，唤醒数不超过任务数和空闲线程数，至少唤醒一次
+     */
+    void tickleIdle(size_t tasks);
 
 private:
     // 调度任务，协程/函数二选一，可指定在哪个线程上调度
+    // 只能移动：回调是小对象内联存储的TaskFunc，从入队到执行全程不拷贝
     struct ScheduleTask{
         Fiber::ptr fiber;
-        std::function<void()> cb;
+        TaskFunc cb;
         int thread;
+        // 回调任务继承调度者的取消令牌，协程任务自身已经携带令牌
+        CancelToken::ptr token;
+        // 优先级，协程任务默认取协程自身的优先级，回调任务默认取调度者协程的优先级
+        int priority = PRIORITY_NORMAL;
+        // 绝对截止时间(毫秒)，0表示没有截止时间
+        uint64_t deadline = 0;
+        // 偏好的NUMA节点，-1表示不限
+        int node = -1;
+        // 入队时间(微秒)，只有抽样任务、开启CoDel或协程耗时统计时才记录，0表示没有记录
+        uint64_t enqueueUs = 0;
+        // 是否已经决定过要不要记录入队时间，经邮箱投递的任务在投递时决定
+        bool stamped = false;
+        // 是否抽中记录调度延迟和运行时长
+        bool sampled = false;
+        // 回调任务继承调度者协程的统计标签
+        const char *tag = nullptr;
 
         ScheduleTask(Fiber::ptr f, int thr){
-            fiber = f;
+            fiber.swap(f);
             thread = thr;
+            if(fiber) priority = fiber->getPriority();
         }
 
         ScheduleTask(Fiber::ptr *f, int thr){
             fiber.swap(*f);
             thread = thr;
+            if(fiber) priority = fiber->getPriority();
         }
 
-        ScheduleTask(std::function<void()>f, int thr){
-            cb = f;
-            thread = thr;
+        ScheduleTask(TaskFunc f, int thr){
+            cb.swap(f);
+            initCb(thr);
+        }
+
+        ScheduleTask(TaskFunc *f, int thr){
+            cb.swap(*f);
+            initCb(thr);
+        }
+
+        ScheduleTask(std::function<void()> *f, int thr){
+            if(*f) cb = std::move(*f);
+            *f = nullptr;
+            initCb(thr);
         }
 
         ScheduleTask(){thread=-1;}
 
+        ScheduleTask(ScheduleTask&&) = default;
+        ScheduleTask &operator=(ScheduleTask&&) = default;
+
+        void initCb(int thr){
+            thread = thr;
+            token = Fiber::GetCurrentCancelToken();
+            Fiber *cur = Fiber::GetCurrent();
+            if(cur){
+                priority = cur->getPriority();
+                tag = cur->getTag();
+            }
+        }
+
+        // 是否新任务，只有新任务受准入限制和CoDel约束
+        bool isNewWork() const { return cb || (fiber && fiber->getRuns() == 0);}
+
         void reset(){
             fiber = nullptr;
             cb = nullptr;
             thread = -1;
+            token = nullptr;
+            priority = PRIORITY_NORMAL;
+            deadline = 0;
+            node = -1;
+            enqueueUs = 0;
+            stamped = false;
+            sampled = false;
+            tag = nullptr;
+        }
+    };
+
+    /**
+     * @brief 把构造好的任务放入对应的队列，调用时需持有m_mutex
+     * @param[in] priority 大于等于0时覆盖任务自身的优先级
+     * @return 任务是否有效并已入队
+     */
+    bool enqueueNoLock(ScheduleTask &task, int priority, uint64_t deadline)
+    {
+        if(!task.fiber && !task.cb)
+            return false;
+        if(priority >= 0)
+            task.priority = priority;
+        if(task.priority >= PRIORITY_COUNT)
+            task.priority = PRIORITY_LOW;
+        task.deadline = deadline;
+        // 固定到已缩容退出或者不属于本调度器的线程上的任务永远不会被取走，改为任意线程执行
+        if(task.thread != -1
+                && std::find(m_threadIds.begin(), m_threadIds.end(), task.thread) == m_threadIds.end())
+            task.thread = -1;
+        // 经邮箱投递的任务在投递时已经决定过
+        if(!task.stamped)
+            stampTask(task, m_sampleCountdown);
+        SYLAR_TRACE(SCHEDULE, task.fiber ? task.fiber->getID() : 0, task.priority);
+        if(deadline && m_edfEnabled){
+            m_deadlineTasks.push_back(std::move(task));
+            std::push_heap(m_deadlineTasks.begin(), m_deadlineTasks.end(), DeadlineLater());
+        }else{
+            m_tasks[task.priority].push_back(std::move(task));
+        }
+        ++m_taskCount;
+        return true;
+    }
+
+    /**
+     * @brief 决定任务是否抽样，需要时记录入队时间
+     * @param[in,out] countdown 抽样计数，入队路径用m_sampleCountdown（持有m_mutex），邮箱投递用线程局部的计数
+     */
+    void stampTask(ScheduleTask &task, uint32_t &countdown)
+    {
+        task.stamped = true;
+        uint32_t every = m_metricsSampleEvery.load(std::memory_order_relaxed);
+        if(every && ++countdown >= every){
+            countdown = 0;
+            task.sampled = true;
+        }
+        // CoDel按每个任务的排队延迟判断，协程耗时统计要计入每次的排队时间
+        if(task.sampled || m_codelTargetUs || FiberStats::IsEnabled())
+            task.enqueueUs = GetCurrentUS();
+    }
+
+    /**
+     * @brief 检查准入限制并入队，被拒绝时调用过载回调
+     */
+    bool scheduleTask(ScheduleTask &task, int priority, uint64_t deadline);
+
+    /**
+     * @brief 检查新任务是否超过准入限制，只读取原子计数和配置，不需要持有m_mutex
+     * @return 0表示允许，否则为ShedReason
+     */
+    int admit(const ScheduleTask &task) const;
+
+    /**
+     * @brief 检查准入限制并放入邮箱，不唤醒空闲线程
+     * @return 任务有效且没有被拒绝
+     */
+    bool pushMailbox(ScheduleTask &task);
+
+    // 邮箱由空变为非空后唤醒一次空闲线程
+    void signalMailbox();
+
+    // 投递一个任务并按需唤醒
+    bool postTask(ScheduleTask &task);
+
+    /**
+     * @brief 把邮箱里的任务取出并批量放入任务队列，同一时间只有一个线程在取
+     */
+    void drainMailbox();
+
+    /**
+     * @brief 用出队任务的排队延迟更新CoDel状态，调用时需持有m_mutex
+     * @return 该任务是否应当被丢弃
+     */
+    bool codelNoLock(uint64_t enqueue_us);
+
+    // 记录count次过载保护并逐个调用回调，不能持有m_mutex
+    void onShed(int reason, size_t count = 1);
+
+    /**
+     * @brief 截止时间堆的比较函数，堆顶是截止时间最早的任务
+     */
+    struct DeadlineLater{
+        bool operator()(const ScheduleTask &lhs, const ScheduleTask &rhs) const{
+            return lhs.deadline > rhs.deadline;
         }
     };
 
+    /**
+     * @brief 为当前线程取出一个可执行的任务，调用时需持有m_mutex
+     * @param[out] task 取出的任务
+     * @param[out] tickle_me 是否还有其他线程可执行的任务，需要通知其他线程
+     * @return 是否取到任务
+     */
+    bool takeTaskNoLock(ScheduleTask &task, bool &tickle_me);
+
+    /**
+     * @brief 从指定优先级队列中取出第一个当前线程可执行的任务
+     */
+    bool takeFromQueueNoLock(RingQueue<ScheduleTask> &queue, ScheduleTask &task, bool &tickle_me);
+
+    /**
+     * @brief 工作线程的私有状态
+     * @details 由工作线程在绑核之后自己分配，保证落在本节点内存上
+     */
+    struct Worker{
+        // 工作线程序号
+        size_t index = 0;
+        // 绑定的CPU，-1表示未绑定
+        int cpu = -1;
+        // 所在NUMA节点，-1表示未知
+        int node = -1;
+        // 线程id
+        int threadId = 0;
+        // 是否正在运行任务
+        std::atomic<bool> running = {false};
+        // 已开始运行的任务数，只由工作线程写入，监控线程据此判断是否一直在运行同一个任务，也作为执行的任务数指标
+        std::atomic<uint64_t> runSeq = {0};
+        // 抽样任务开始运行的时间(微秒)，0表示当前任务没有抽中，只由工作线程访问
+        uint64_t sliceStartUs = 0;
+        // 监控线程上次看到的runSeq和看到它变化的时间，只由监控线程访问
+        uint64_t observedSeq = 0;
+        uint64_t observedUs = 0;
+        // 监控线程已经为哪个任务补充过线程，只由监控线程访问
+        uint64_t compensatedSeq = 0;
+        // 监控线程已经对哪个任务发出过抢占，只由监控线程访问
+        uint64_t preemptedSeq = 0;
+        // 抢占标记是为哪个任务设置的，工作线程响应时和runSeq比较
+        std::atomic<uint64_t> preemptReqSeq = {0};
+        // 工作线程的抢占标记t_fiber_preempt
+        volatile sig_atomic_t *preemptFlag = nullptr;
+        // 是否已经退出
+        std::atomic<bool> retired = {false};
+        // 运行时指标
+        WorkerMetrics metrics;
+    };
+
+    // 当前线程的Worker，不在调度线程中时为空
+    static thread_local Worker *t_worker;
+
+    /**
+     * @brief 初始化当前线程的Worker，在run开始时调用
+     */
+    void initWorker();
+
+    // 标记当前工作线程开始运行一个任务，供监控线程检测阻塞，抽中的任务记录调度延迟，同时计入协程的等待时间
+    void beginTask(Fiber *fiber, uint64_t enqueue_us, bool sampled);
+
+    // 标记当前工作线程的任务让出或结束
+    void endTask();
+
+    /**
+     * @brief 空闲的工作线程检查自己是否应该退出，用于缩容
+     */
+    bool shouldRetire();
+
+    /**
+     * @brief 从线程id列表中去掉退出的线程，队列里固定到它的任务改为任意线程执行
+     */
+    void unpinRetired(int thread);
+
+    /**
+     * @brief 监控线程，周期性检查阻塞的工作线程和队列积压，按需扩缩容
+     */
+    void sysmon();
+
+    /**
+     * @brief 监控线程每次检查时的扩展点，子类可以在这里做额外的周期性检查
+     * @param[in] now_us 当前时间(微秒)
+     */
+    virtual void onSysmonTick(uint64_t now_us) {}
+
+    /**
+     * @brief 是否需要启动监控线程
+     */
+    virtual bool needSysmon() const { return m_maxWorkers > m_minWorkers || m_preemptSliceUs;}
+
 private:
     /// 协程调度器名称
     std::string m_name;
@@ -103,8 +632,107 @@ private:
     /// 线程池
     std::vector<Thread::ptr> m_threads;
 
-    /// 任务队列
-    std::list<ScheduleTask> m_tasks;
+    /// 任务队列，每个优先级一个，环形数组不会每个任务分配一个节点
+    RingQueue<ScheduleTask> m_tasks[PRIORITY_COUNT];
+
+    /// EDF模式下带截止时间的任务，按截止时间组织的小顶堆
+    std::vector<ScheduleTask> m_deadlineTasks;
+
+    /// 队列中的任务总数，只在持有m_mutex时修改，可以不加锁读取
+    std::atomic<size_t> m_taskCount = {0};
+
+    /// 各优先级的出队权重
+    int64_t m_weights[PRIORITY_COUNT] = {8, 4, 1};
+
+    /// 平滑加权轮转的当前权重
+    int64_t m_credits[PRIORITY_COUNT] = {0, 0, 0};
+
+    /// 是否开启EDF模式
+    bool m_edfEnabled = false;
+
+    /// 工作线程绑定的CPU列表，为空表示不绑核
+    std::vector<int> m_cpus;
+
+    /// 各工作线程的私有状态
+    std::vector<std::unique_ptr<Worker>> m_workers;
+
+    /// 下一个工作线程的序号
+    std::atomic<size_t> m_nextWorkerIndex = {0};
+
+    /// 工作线程数下限
+    size_t m_minWorkers = 0;
+
+    /// 工作线程数上限
+    size_t m_maxWorkers = 0;
+
+    /// 存活的工作线程数
+    std::atomic<size_t> m_liveWorkerCount = {0};
+
+    /// 待退出的工作线程数，由监控线程设置，空闲的工作线程领取后退出
+    std::atomic<size_t> m_retireCount = {0};
+
+    /// 是否已启动
+    bool m_started = false;
+
+    /// 监控线程
+    Thread::ptr m_sysmonThread;
+
+    /// 监控线程检查间隔(毫秒)
+    uint64_t m_sysmonIntervalMs = 10;
+
+    /// 判定工作线程被阻塞的时间(毫秒)
+    uint64_t m_stuckMs = 100;
+
+    /// 抢占时间片(微秒)，0表示不抢占
+    uint64_t m_preemptSliceUs = 0;
+
+    /// 是否向超时的工作线程发送抢占信号
+    bool m_preemptAsync = false;
+
+    /// 监控线程发出的抢占次数
+    std::atomic<uint64_t> m_preemptCount = {0};
+
+    /// 队列深度上限，0表示不限，admit和isOverloaded不加锁读取
+    std::atomic<size_t> m_maxQueueDepth = {0};
+
+    /// 存活协程数上限，0表示不限
+    std::atomic<size_t> m_maxFibers = {0};
+
+    /// 直方图抽样间隔，0表示不记录
+    std::atomic<uint32_t> m_metricsSampleEvery = {64};
+
+    /// 入队路径的抽样计数，由m_mutex保护
+    uint32_t m_sampleCountdown = 0;
+
+    /// CoDel目标排队延迟(微秒)，0表示关闭
+    uint64_t m_codelTargetUs = 0;
+
+    /// CoDel统计窗口(微秒)
+    uint64_t m_codelIntervalUs = 100 * 1000;
+
+    /// 当前窗口结束时间(微秒)
+    uint64_t m_codelWindowEndUs = 0;
+
+    /// 当前窗口内的最小排队延迟(微秒)
+    uint64_t m_codelMinDelayUs = ~0ull;
+
+    /// CoDel是否判定过载
+    std::atomic<bool> m_codelOverloaded = {false};
+
+    /// 过载保护回调
+    ShedCallback m_shedCb;
+
+    /// 按原因累计的过载保护次数
+    std::atomic<uint64_t> m_shedCount[SHED_REASON_COUNT] = {};
+
+    /// 跨调度器投递的任务，生产者无锁入队，由工作线程取出后放入任务队列
+    MpscQueue<ScheduleTask> m_mailbox;
+
+    /// 是否有线程正在取邮箱，保证邮箱只有一个消费者
+    std::atomic<bool> m_mailboxDraining = {false};
+
+    /// 邮箱非空后是否已经唤醒过，取邮箱前清除
+    std::atomic<bool> m_mailboxSignaled = {false};
 
     /// 线程池的线程ID数组
     std::vector<int> m_threadIds;
@@ -127,12 +755,75 @@ private:
     /// use_caller为true时，调度器所在线程的id
     int m_rootThread = 0;
 
-    /// 是否正在停⽌
-    bool m_stopping = false;
+    /// 是否正在停⽌，监控线程和工作线程不加锁读取
+    std::atomic<bool> m_stopping = {false};
 
     /// 当前线程的调度器，同⼀个调度器下的所有线程指同同⼀个调度器实例
     static thread_local Scheduler *t_scheduler = nullptr;
 
     /// 当前线程的调度协程，每个线程都独有⼀份，包括caller线程
     static thread_local Fiber *t_scheduler_fiber = nullptr;
-};
\ No newline at end of file
+};
+
+/**
+ * @brief 批量调度
+ * @details 在不持有调度器锁的情况下收集任务，submit时一次性加锁入队并按需tickle，
+ * 用于IO事件批量唤醒、扇出等一次产生大量任务的场景。析构时自动submit
+ */
+class Scheduler::ScheduleBatch{
+public:
+    ScheduleBatch(Scheduler *scheduler)
+        :m_scheduler(scheduler){
+    }
+
+    ~ScheduleBatch() { submit();}
+
+    // 添加任务，参数含义同Scheduler::schedule/scheduleOnNode
+    template<class FiberOrCb>
+    void add(FiberOrCb &&fc, int thread=-1, int priority=Scheduler::PRIORITY_INHERIT, int node=-1)
+    {
+        m_tasks.push_back(Scheduler::ScheduleTask(std::forward<FiberOrCb>(fc), thread));
+        if(priority >= 0)
+            m_tasks.back().priority = priority;
+        m_tasks.back().node = node;
+    }
+
+    // 获取批量任务的目标调度器
+    Scheduler *getScheduler() const { return m_scheduler;}
+
+    // 已收集的任务数
+    size_t size() const { return m_tasks.size();}
+
+    /**
+     * @brief 提交已收集的任务，和Scheduler::schedule一样检查准入限制
+     * @return 入队的任务数，不含被拒绝的任务
+     */
+    size_t submit();
+
+private:
+    Scheduler *m_scheduler;
+    std::vector<Scheduler::ScheduleTask> m_tasks;
+};
+
+/**
+ * @brief 在作用域内把当前协程迁移到另一个调度器，析构时迁回原来的调度器
+ */
+class SchedulerSwitcher{
+public:
+    SchedulerSwitcher(Scheduler *target)
+        :m_caller(Scheduler::GetThis()){
+        if(target && !Scheduler::SwitchTo(target))
+            m_caller = nullptr;
+    }
+
+    ~SchedulerSwitcher(){
+        if(m_caller)
+            Scheduler::SwitchTo(m_caller);
+    }
+
+    SchedulerSwitcher(const SchedulerSwitcher&) = delete;
+    SchedulerSwitcher &operator=(const SchedulerSwitcher&) = delete;
+
+private:
+    Scheduler *m_caller;
+};
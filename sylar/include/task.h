@@ -0,0 +1,143 @@
+/**
+ * @file task.h
+ * @brief 只能移动的小对象优化回调
+ * @details 调度路径上的回调函数。std::function按值构造并且可拷贝，大多数lambda都要在堆上分配；
+ * TaskFunc把不超过kInlineSize字节的可调用对象直接存放在对象内部，只支持移动，
+ * 从schedule到出队再到协程执行全程只移动不拷贝
+ */
+#ifndef __SYLAR_TASK_H__
+#define __SYLAR_TASK_H__
+
+#include <functional>
+#include <type_traits>
+#include <utility>
+#include <cstddef>
+#include <new>
+
+class TaskFunc{
+public:
+    /// 内联存储的大小，超过的可调用对象放到堆上
+    static const size_t kInlineSize = 48;
+
+    TaskFunc() noexcept {}
+
+    TaskFunc(std::nullptr_t) noexcept {}
+
+    /**
+     * @brief 从任意无参可调用对象构造
+     * @details 空的std::function或空函数指针构造出空的TaskFunc
+     */
+    template<class F, class D = typename std::decay<F>::type,
+            class = typename std::enable_if<!std::is_same<D, TaskFunc>::value>::type,
+            class = decltype(std::declval<D&>()())>
+    TaskFunc(F &&f){
+        if(IsNull(f)) return;
+        init<D>(std::forward<F>(f), std::integral_constant<bool, IsInline<D>()>());
+    }
+
+    TaskFunc(TaskFunc &&rhs) noexcept{
+        moveFrom(rhs);
+    }
+
+    TaskFunc &operator=(TaskFunc &&rhs) noexcept{
+        if(this != &rhs){
+            destroy();
+            moveFrom(rhs);
+        }
+        return *this;
+    }
+
+    TaskFunc &operator=(std::nullptr_t) noexcept{
+        destroy();
+        return *this;
+    }
+
+    TaskFunc(const TaskFunc&) = delete;
+    TaskFunc &operator=(const TaskFunc&) = delete;
+
+    ~TaskFunc() { destroy();}
+
+    explicit operator bool() const { return m_ops != nullptr;}
+
+    void operator()() { m_ops->invoke(m_buf);}
+
+    void swap(TaskFunc &rhs) noexcept{
+        TaskFunc tmp(std::move(rhs));
+        rhs = std::move(*this);
+        *this = std::move(tmp);
+    }
+
+private:
+    /**
+     * @brief 按存储方式生成的操作表，每种可调用类型一份
+     */
+    struct Ops{
+        void (*invoke)(void *buf);
+        void (*move)(void *dst, void *src);
+        void (*destroy)(void *buf);
+    };
+
+    template<class D>
+    static constexpr bool IsInline(){
+        return sizeof(D) <= kInlineSize
+            && alignof(D) <= alignof(std::max_align_t)
+            && std::is_nothrow_move_constructible<D>::value;
+    }
+
+    template<class D>
+    static bool IsNull(const D&) { return false;}
+    template<class R, class... Args>
+    static bool IsNull(const std::function<R(Args...)> &f) { return !f;}
+    template<class R, class... Args>
+    static bool IsNull(R (*f)(Args...)) { return f == nullptr;}
+
+    // 可调用对象直接构造在m_buf中
+    template<class D, class F>
+    void init(F &&f, std::true_type){
+        new (m_buf) D(std::forward<F>(f));
+        static const Ops ops = {
+            [](void *buf){ (*static_cast<D*>(buf))();},
+            [](void *dst, void *src){
+                new (dst) D(std::move(*static_cast<D*>(src)));
+                static_cast<D*>(src)->~D();
+            },
+            [](void *buf){ static_cast<D*>(buf)->~D();}
+        };
+        m_ops = &ops;
+    }
+
+    // 可调用对象放在堆上，m_buf中只保存指针
+    template<class D, class F>
+    void init(F &&f, std::false_type){
+        *reinterpret_cast<D**>(m_buf) = new D(std::forward<F>(f));
+        static const Ops ops = {
+            [](void *buf){ (**static_cast<D**>(buf))();},
+            [](void *dst, void *src){
+                *static_cast<D**>(dst) = *static_cast<D**>(src);
+            },
+            [](void *buf){ delete *static_cast<D**>(buf);}
+        };
+        m_ops = &ops;
+    }
+
+    void moveFrom(TaskFunc &rhs) noexcept{
+        if(rhs.m_ops){
+            rhs.m_ops->move(m_buf, rhs.m_buf);
+            m_ops = rhs.m_ops;
+            rhs.m_ops = nullptr;
+        }
+    }
+
+    void destroy() noexcept{
+        if(m_ops){
+            m_ops->destroy(m_buf);
+            m_ops = nullptr;
+        }
+    }
+
+private:
+    alignas(std::max_align_t) unsigned char m_buf[kInlineSize];
+    const Ops *m_ops = nullptr;
+};
+
+#endif
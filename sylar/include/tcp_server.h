@@ -0,0 +1,119 @@
+/**
+ * @file tcp_server.h
+ * @brief 基于IOManager的TCP服务器
+ * @details 每个调度线程一个SO_REUSEPORT监听socket，由内核在它们之间分配新连接，
+ * 每个监听socket一个accept协程，accept到的连接在当前线程上创建一个处理协程。
+ * 连接数达到上限或调度器过载时accept协程暂停，新连接留在内核的backlog里，
+ * 由客户端的连接超时和重试自然形成背压
+ */
+#ifndef __SYLAR_TCP_SERVER_H__
+#define __SYLAR_TCP_SERVER_H__
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <set>
+#include <mutex>
+#include <atomic>
+#include <sys/socket.h>
+#include "IOManager.h"
+#include "fiber_sync.h"
+
+class TcpServer : public std::enable_shared_from_this<TcpServer>{
+public:
+    typedef std::shared_ptr<TcpServer> ptr;
+
+    /**
+     * @brief 构造函数
+     * @param[in] worker 运行accept协程和连接处理协程的IOManager，需已启动
+     * @param[in] name 服务器名称
+     */
+    TcpServer(IOManager *worker, const std::string &name = "sylar/tcp_server");
+
+    virtual ~TcpServer();
+
+    /**
+     * @brief 为worker的每个调度线程创建一个监听socket并绑定到同一地址
+     * @param[in] ip IPv4或IPv6地址字符串
+     * @param[in] port 端口，0表示由内核分配，之后的监听socket复用同一个端口
+     * @return 是否全部成功，失败时已创建的socket会被关闭
+     */
+    bool bind(const std::string &ip, uint16_t port, int backlog = SOMAXCONN);
+
+    /**
+     * @brief 为每个监听socket在对应的调度线程上启动accept协程
+     */
+    bool start();
+
+    /**
+     * @brief 停止服务器
+     * @details 先停止accept并关闭监听socket，再等待已有连接处理完，
+     * 超过drain_timeout_ms仍未结束的连接被shutdown，处理协程随后读到EOF退出
+     */
+    void stop(uint64_t drain_timeout_ms = 5000);
+
+    bool isStop() const { return m_stopping;}
+
+    // 实际监听的端口
+    uint16_t getPort() const { return m_port;}
+
+    // 当前连接数
+    size_t getConnectionCount();
+
+    // 累计accept的连接数
+    uint64_t getAcceptCount() const { return m_acceptCount;}
+
+    /**
+     * @brief 设置最大连接数，达到上限时accept协程挂起，直到有连接关闭
+     * @param[in] n 0表示不限
+     */
+    void setMaxConnections(size_t n) { m_maxConnections = n;}
+
+    /**
+     * @brief 调度器过载时accept协程每次暂停的时间
+     * @details 过载期间不再accept新连接；已经accept但处理协程被调度器拒绝的连接直接关闭
+     */
+    void setOverloadPause(uint64_t ms) { m_overloadPauseMs = ms ? ms : 1;}
+
+    // 因调度器拒绝而直接关闭的连接数
+    uint64_t getRejectCount() const { return m_rejectCount;}
+
+    const std::string &getName() const { return m_name;}
+
+protected:
+    /**
+     * @brief 处理一个连接，在独立的协程中运行，返回后由服务器关闭fd
+     * @details fd是非阻塞的并已在FdManager中注册，直接使用hook的read/write即可，由子类实现
+     */
+    virtual void handleClient(int fd) = 0;
+
+private:
+    void acceptLoop(int lfd);
+    void onClient(int fd);
+    void closeListeners();
+
+private:
+    struct Listener{
+        int fd;
+        int thread;
+    };
+
+    IOManager *m_worker;
+    std::string m_name;
+    uint16_t m_port = 0;
+    std::vector<Listener> m_listeners;
+    std::atomic<bool> m_stopping = {true};
+    // 还在运行的accept协程数
+    std::atomic<size_t> m_acceptors = {0};
+    std::atomic<uint64_t> m_acceptCount = {0};
+    std::atomic<uint64_t> m_rejectCount = {0};
+    std::atomic<size_t> m_maxConnections = {0};
+    std::atomic<uint64_t> m_overloadPauseMs = {10};
+    std::mutex m_mutex;
+    // 正在处理的连接
+    std::set<int> m_clients;
+    // 因连接数达到上限而挂起的accept协程
+    FiberWaitQueue m_slots;
+};
+
+#endif
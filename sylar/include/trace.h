@@ -0,0 +1,87 @@
+/**
+ * @file trace.h
+ * @brief 协程切换跟踪，导出为Chrome trace格式（chrome://tracing、Perfetto可直接打开）
+ * @details 只有定义了SYLAR_ENABLE_TRACE时才编译进去，否则SYLAR_TRACE展开为空语句，
+ * 热路径上没有任何开销。每个线程一个环形缓冲区，只由本线程写入，写满后覆盖最旧的记录；
+ * 时间戳取TSC，导出时再换算成微秒
+ */
+#ifndef __SYLAR_TRACE_H__
+#define __SYLAR_TRACE_H__
+
+#include <stdint.h>
+#include <string>
+
+class Tracer{
+public:
+    /**
+     * @brief 事件类型
+     */
+    enum Type{
+        // 协程开始运行，fiber为被resume的协程
+        RESUME = 0,
+        // 协程让出，fiber为让出的协程
+        YIELD = 1,
+        // 任务入队，fiber为协程任务的协程id，回调任务为0
+        SCHEDULE = 2,
+        // 注册IO事件，arg为fd
+        ADD_EVENT = 3,
+        // IO事件触发，arg为fd
+        TRIGGER = 4,
+        // 定时器触发，arg为本轮触发的定时器数
+        TIMER_FIRE = 5,
+    };
+
+    /**
+     * @brief 单条记录
+     */
+    struct Event{
+        uint64_t tsc;
+        uint64_t fiber;
+        uint64_t arg;
+        uint32_t type;
+        uint32_t reserved;
+    };
+
+    /// 每个线程缓冲的记录数，必须是2的幂
+    static const size_t kRingSize = 1 << 15;
+
+    /**
+     * @brief 记录一条事件，只应通过SYLAR_TRACE调用
+     */
+    static void Record(Type type, uint64_t fiber, uint64_t arg);
+
+    /**
+     * @brief 运行时开关，默认打开，只在编译时开启跟踪后有效
+     */
+    static void SetEnabled(bool v);
+
+    static bool IsEnabled();
+
+    /**
+     * @brief 导出所有线程缓冲区中的记录为Chrome trace JSON
+     * @details 每个工作线程一条轨道，协程运行区间为一个切片，
+     * 入队/IO触发到对应协程下一次resume之间画一条flow箭头；
+     * 未开启跟踪时返回空的trace
+     */
+    static std::string DumpChromeJson();
+
+    /**
+     * @brief 导出到文件
+     * @return 是否写入成功
+     */
+    static bool DumpToFile(const std::string &path);
+
+    /**
+     * @brief 清空所有线程的缓冲区
+     */
+    static void Clear();
+};
+
+#ifdef SYLAR_ENABLE_TRACE
+#define SYLAR_TRACE(type, fiber, arg) \
+    Tracer::Record(Tracer::type, (uint64_t)(fiber), (uint64_t)(arg))
+#else
+#define SYLAR_TRACE(type, fiber, arg) ((void)0)
+#endif
+
+#endif
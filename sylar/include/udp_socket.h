@@ -0,0 +1,119 @@
+/**
+ * @file udp_socket.h
+ * @brief 批量收发的UDP socket
+ * @details 通过hook的recvmmsg/sendmmsg一次系统调用收发最多kMaxBatch个报文，
+ * 没有报文或发送缓冲区满时挂起当前协程；可选开启UDP_GRO把同一来源的连续报文合并接收，
+ * 以及用UDP_SEGMENT让内核把一个大缓冲区切成多个报文发送
+ */
+#ifndef __SYLAR_UDP_SOCKET_H__
+#define __SYLAR_UDP_SOCKET_H__
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+class UdpSocket{
+public:
+    typedef std::shared_ptr<UdpSocket> ptr;
+
+    /// 一次系统调用最多收发的报文数
+    static const size_t kMaxBatch = 64;
+
+    /**
+     * @brief 一个报文，data指向批次或调用者的缓冲区
+     */
+    struct Datagram{
+        const char *data;
+        size_t len;
+        const sockaddr *addr;
+        socklen_t addrlen;
+    };
+
+    /**
+     * @brief 接收批次，预先分配kMaxBatch个槽位，可以反复使用
+     * @details 开启GRO时一个槽位可能收到合并后的多个报文，
+     * 按内核给出的段长度拆开后放在datagrams里
+     */
+    class RecvBatch{
+    friend class UdpSocket;
+    public:
+        /**
+         * @param[in] slot_size 每个槽位的大小，开启GRO时应不小于64KB
+         */
+        RecvBatch(size_t slot_size = 2048);
+
+        size_t size() const { return m_datagrams.size();}
+        const Datagram &operator[](size_t i) const { return m_datagrams[i];}
+
+    private:
+        void prepare();
+        void parse(size_t n);
+
+    private:
+        size_t m_slotSize;
+        std::vector<char> m_buf;
+        std::vector<mmsghdr> m_msgs;
+        std::vector<iovec> m_iovs;
+        std::vector<sockaddr_storage> m_addrs;
+        std::vector<char> m_control;
+        std::vector<Datagram> m_datagrams;
+    };
+
+    /**
+     * @brief 创建UDP socket
+     * @param[in] family AF_INET或AF_INET6
+     */
+    UdpSocket(int family = AF_INET);
+    ~UdpSocket();
+
+    UdpSocket(const UdpSocket&) = delete;
+    UdpSocket &operator=(const UdpSocket&) = delete;
+
+    int getFd() const { return m_fd;}
+
+    /**
+     * @brief 绑定本地地址
+     * @param[in] reuse_port 是否设置SO_REUSEPORT，多个线程各绑一个socket时使用
+     */
+    bool bind(const std::string &ip, uint16_t port, bool reuse_port = false);
+
+    // 设置默认的目的地址，之后发送时addr可以为空
+    bool connect(const std::string &ip, uint16_t port);
+
+    // 实际绑定的端口
+    uint16_t getPort() const;
+
+    /**
+     * @brief 开启或关闭UDP_GRO，内核不支持时返回false
+     */
+    bool setGro(bool on);
+
+    /**
+     * @brief 接收一批报文，一个都没有时挂起等待
+     * @return 收到的报文数（GRO拆分后），出错返回-1
+     */
+    int recv(RecvBatch &batch, int flags = 0);
+
+    /**
+     * @brief 用sendmmsg发送最多kMaxBatch个报文，发送缓冲区满时挂起
+     * @return 发出的报文数，出错返回-1
+     */
+    int send(const Datagram *datagrams, size_t n, int flags = 0);
+
+    /**
+     * @brief 用UDP_SEGMENT把data按segment_size切成多个报文发给同一个地址
+     * @details 切分在内核（或网卡）里完成，只需要一次系统调用；
+     * 最后一段可以短于segment_size，段数不能超过64
+     * @return 发出的字节数，出错返回-1
+     */
+    ssize_t sendSegments(const void *data, size_t len, uint16_t segment_size,
+                         const sockaddr *addr = nullptr, socklen_t addrlen = 0);
+
+private:
+    int m_fd = -1;
+    int m_family;
+};
+
+#endif
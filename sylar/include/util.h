@@ -0,0 +1,77 @@
+/**
+ * @file util.h
+ * @brief 常用的工具函数
+ */
+#ifndef __SYLAR_UTIL_H__
+#define __SYLAR_UTIL_H__
+
+#include <stdint.h>
+#include <time.h>
+#include <string>
+#include <sys/socket.h>
+
+/**
+ * @brief 获取当前时间的毫秒（单调时钟）
+ */
+uint64_t GetCurrentMS();
+
+/**
+ * @brief 获取当前时间的微秒（单调时钟）
+ */
+uint64_t GetCurrentUS();
+
+/**
+ * @brief 获取CPU所在的NUMA节点
+ * @return 节点号，无法确定时返回0（单节点机器）
+ */
+int GetCpuNode(int cpu);
+
+/**
+ * @brief 把当前线程绑定到指定CPU
+ * @return 是否成功
+ */
+bool SetThreadAffinity(int cpu);
+
+/**
+ * @brief 把IPv4或IPv6地址字符串和端口转换成socket地址
+ * @return 地址不合法时返回false
+ */
+bool ParseAddress(const std::string &ip, uint16_t port, sockaddr_storage &addr, socklen_t &addrlen);
+
+/**
+ * @brief 读取CPU周期计数器（x86为TSC），其他平台退化为单调时钟的纳秒数
+ */
+inline uint64_t GetCycleCount(){
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ul + ts.tv_nsec;
+#endif
+}
+
+/**
+ * @brief 每微秒的周期数，第一次调用时对照单调时钟校准（约1毫秒）
+ */
+double GetCyclesPerUS();
+
+/**
+ * @brief 把周期数换算成微秒
+ */
+inline uint64_t CyclesToUS(uint64_t cycles){
+    return (uint64_t)(cycles / GetCyclesPerUS());
+}
+
+/**
+ * @brief 自旋等待时的CPU提示，降低功耗并让出超线程的执行资源
+ */
+inline void CpuRelax(){
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#endif
+}
+
+#endif
@@ -1,5 +1,9 @@
 #include "IOManager.h"
 #include <string.h>
+#include <stdexcept>
+#include <algorithm>
+#include "util.h"
+#include "async_log.h"
 #include "windows.h"
 #include "io.h"
 
@@ -39,6 +43,72 @@ IOManager::IOManager(size_t threads, bool use_caller, const std::string &name)
     start();
 }
 
+IOManager *IOManager::GetThis()
+{
+    return dynamic_cast<IOManager*>(Scheduler::GetThis());
+}
+
+IOManager::FdContext::EventContext &IOManager::FdContext::getEventContext(Event event)
+{
+    switch(event){
+        case IOManager::READ:
+            return read;
+        case IOManager::WRITE:
+            return write;
+        case IOManager::ERROR:
+            return error;
+        default:
+            SYLAR_ASSERT2(false, "getContext");
+    }
+    throw std::invalid_argument("getContext invalid event");
+}
+
+void IOManager::FdContext::resetEventContext(EventContext &ctx)
+{
+    ctx.scheduler = nullptr;
+    ctx.fiber.reset();
+    ctx.cb = nullptr;
+    ctx.priority = Scheduler::PRIORITY_NORMAL;
+    ctx.node = -1;
+}
+
+/**
+ * @brief 触发事件
+ * @details 从fd的已注册事件中去掉event，按注册时的优先级把回调函数或协程交给调度器，
+ * 这样被IO唤醒的协程不会因为由idle协程调度而丢失原来的优先级；
+ * 同时偏好回到注册事件时所在的NUMA节点，fd的处理协程不会在节点之间来回迁移
+ */
+void IOManager::FdContext::triggerEvent(Event event, Scheduler::ScheduleBatch *batch)
+{
+    SYLAR_ASSERT(events & event);
+    events = (Event)(events & ~event);
+    EventContext &ctx = getEventContext(event);
+    SYLAR_TRACE(TRIGGER, ctx.fiber ? ctx.fiber->getID() : 0, fd);
+    if(batch && batch->getScheduler() == ctx.scheduler){
+        if(ctx.cb){
+            batch->add(&ctx.cb, -1, ctx.priority, ctx.node);
+        }else{
+            batch->add(&ctx.fiber, -1, ctx.priority, ctx.node);
+        }
+    }else if(ctx.cb){
+        ctx.scheduler->scheduleOnNode(&ctx.cb, ctx.node, ctx.priority);
+    }else{
+        ctx.scheduler->scheduleOnNode(&ctx.fiber, ctx.node, ctx.priority);
+    }
+    resetEventContext(ctx);
+}
+
+void IOManager::contextResize(size_t size)
+{
+    m_fdContexts.resize(size);
+    for(size_t i = 0; i < m_fdContexts.size(); ++i){
+        if(!m_fdContexts[i]){
+            m_fdContexts[i] = new FdContext;
+            m_fdContexts[i]->fd = i;
+        }
+    }
+}
+
 /**
  * @brief 通知调度器有任务要调度
  * @details 写pipe让idle协程从epoll_wait退出，待idle协程yield之后Scheduler::run就可以调度其他任务
@@ -46,11 +116,70 @@ IOManager::IOManager(size_t threads, bool use_caller, const std::string &name)
  */
 void IOManager::tickle()
 {
-    SYLAR_LOG_DEBUG(g_logger) << "tickle";
+    SYLAR_ALOG_DEBUG("tickle");
     if(!hasIdleThreads())
         return ;
-        int rt = write(m_tickleFds[1], "T", 1);
-        SYLAR_ASSERT(rt==1);
+    // 有线程正在自旋轮询任务队列，它会直接看到新任务，省掉一次pipe写和线程唤醒。
+    // 一个自旋线程只会取走一个任务，所以只抵消一次tickle：tickleIdle(n)只为超出自旋线程数的部分写pipe。
+    // 自旋线程在停止自旋后会再检查一次队列，与这里的检查配合不会丢失唤醒
+    size_t spinning = m_spinningThreadCount;
+    while(spinning > 0){
+        if(m_spinningThreadCount.compare_exchange_weak(spinning, spinning - 1))
+            return ;
+    }
+    int rt = write(m_tickleFds[1], "T", 1);
+    SYLAR_ASSERT(rt==1);
+}
+
+void IOManager::setIdlePolicy(IdlePolicy policy, uint64_t max_spin_us)
+{
+    m_maxSpinUs = max_spin_us ? max_spin_us : 1;
+    m_idlePolicy = policy;
+}
+
+void IOManager::getMetrics(SchedulerMetrics &m)
+{
+    Scheduler::getMetrics(m);
+    m.pendingEvents = m_pendingEventCount;
+    m.timers = getTimerCount();
+}
+
+bool IOManager::spinPoll(epoll_event *events, int max_events, uint64_t limit_us, int &rt)
+{
+    ++m_spinningThreadCount;
+    WorkerMetrics *metrics = GetWorkerMetrics();
+    uint64_t start = GetCurrentUS();
+    bool ready = false;
+    for(uint32_t i = 0; ; ++i){
+        if(hasPendingTasks()){
+            ready = true;
+            break;
+        }
+        // epoll_wait是系统调用，比检查队列贵得多，隔几轮做一次
+        if((i & 7) == 0){
+            rt = epoll_wait(m_epfd, events, max_events, 0);
+            if(metrics)
+                metrics->epollWaits.inc();
+            if(rt > 0){
+                ready = true;
+                break;
+            }
+            rt = 0;
+            if(GetCurrentUS() - start >= limit_us)
+                break;
+        }
+        CpuRelax();
+    }
+    // 取回自己的计数；已经被tickle占用完时不再减，那次tickle的任务由下面的检查接住
+    size_t spinning = m_spinningThreadCount;
+    while(spinning > 0 && !m_spinningThreadCount.compare_exchange_weak(spinning, spinning - 1))
+        ;
+
+    // 停止自旋之后再检查一次队列：tickle占用了自旋线程的计数时不写pipe，
+    // 如果新任务恰好在这之间入队，这里一定能看到它
+    if(!ready && hasPendingTasks())
+        ready = true;
+    return ready;
 }
 
 /**
@@ -63,7 +192,7 @@ void IOManager::tickle()
  */
 void IOManager::idle()
 {
-    SYLAR_LOG_DEBUG(g_logger) << "idle";
+    SYLAR_ALOG_DEBUG("idle");
 
     // 一次epoll_wait最多检测256个就绪时间，如果超过这个数，那么会在下轮epoll_wait继续处理
     const uint64_t MAX_EVENTS = 256;
@@ -73,19 +202,41 @@ void IOManager::idle()
         delete[] ptr;
     });
 
+    // 自旋预算，每个工作线程的idle协程各自维护，按自旋的收益自适应调整
+    uint64_t spin_budget_us = m_maxSpinUs;
+
+    // 本线程的指标，idle协程一直在同一个工作线程上运行
+    WorkerMetrics *metrics = GetWorkerMetrics();
+
     // 进入循环，等待事件
     while(true)
     {
         // 获取下一个定时器的超时时间，顺便判断调度器是否停止
         uint64_t next_timeout = 0;
         if( SYLAR_UNLIKELY(stopping(next_timeout))) {
-            SYLAR_LOG_DEBUG(g_logger) << "name=" << getName() << "idle stopping exit";
+            SYLAR_ALOG_DEBUG("name={} idle stopping exit", getName());
             break;
         }
 
-        // 阻塞在epoll_wait上，等待事件发生或定时器超时
+        // 按空闲策略先自旋一段时间，自旋期间等到了任务或IO事件就不再阻塞
         int rt = 0;
-        do{
+        bool ready = false;
+        if(m_idlePolicy != IDLE_PARK){
+            uint64_t limit_us = m_idlePolicy == IDLE_SPIN ? m_maxSpinUs.load() : spin_budget_us;
+            if(next_timeout != ~0ull)
+                limit_us = std::min(limit_us, next_timeout * 1000);
+            ready = spinPoll(events, MAX_EVENTS, limit_us, rt);
+            if(m_idlePolicy == IDLE_SPIN_THEN_PARK){
+                uint64_t max_us = m_maxSpinUs;
+                if(ready)
+                    spin_budget_us = std::min(max_us, spin_budget_us * 2);
+                else
+                    spin_budget_us = std::max(max_us / 16 + 1, spin_budget_us / 2);
+            }
+        }
+
+        // 阻塞在epoll_wait上，等待事件发生或定时器超时
+        if(!ready && m_idlePolicy != IDLE_SPIN) do{
             // 默认超时时间5秒，如果下一个定时器的超时时间大于5秒，仍以5秒来计算超时。
             // 避免定时器超时时间太大时，epoll_wait一直在阻塞
             static const int MAX_TIMEOUT = 5000;
@@ -94,21 +245,35 @@ void IOManager::idle()
             else
                 next_timeout = MAX_TIMEOUT;
             
+            uint64_t wait_start = metrics ? GetCurrentUS() : 0;
             rt = epoll_wait(m_epfd, events, MAX_EVENTS, (int)next_timeout);
+            if(metrics){
+                metrics->epollWaits.inc();
+                metrics->epollWaitUs.inc(GetCurrentUS() - wait_start);
+            }
 
             if(rt<0 && errno==EINTR)
                 continue;
             else    break;
         }while(true);
 
+        // 本轮产生的任务（超时定时器回调、就绪IO事件）先收集起来，最后一次性入队，
+        // 只加一次调度器锁，并且只唤醒需要的空闲线程数
+        ScheduleBatch batch(this);
+
         // 收集所有已超时的定时器，执行回调函数
         std::vector<std::function<void()>> cbs;
         listExpiredCb(cbs);
-        if(!cbs.empty()){
-            for(const auto &cb:cbs)
-                schedule(cb);
-            cbs.clear();
+        if(!cbs.empty())
+            SYLAR_TRACE(TIMER_FIRE, 0, cbs.size());
+        if(metrics){
+            metrics->timerFires.inc(cbs.size());
+            if(rt >= 0)
+                metrics->eventsPerWait.record(rt);
         }
+        for(auto &cb:cbs)
+            batch.add(&cb);
+        cbs.clear();
         
         // 遍历所有发生的事件，根据epoll_wait的私有指针找到对应的FdContext，进行事件处理
         for(int i=0; i<rt; ++i){
@@ -143,6 +308,10 @@ void IOManager::idle()
             if (event.events & EPOLLOUT) {
                 real_events |= WRITE;
             }
+            // 错误队列不能单独注册到epoll，EPOLLERR总会上报；只有注册了ERROR的fd才交给等待者
+            if((event.events & (EPOLLERR|EPOLLHUP)) && (fd_ctx->events & ERROR)){
+                real_events |= ERROR;
+            }
             if ((fd_ctx->events & real_events) == NONE) {
                 continue;
             }
@@ -168,16 +337,23 @@ void IOManager::idle()
             // 处理已经发生的事件，也就是让调度器调度制定的函数或协程
             if(real_events & READ)
             {
-                fd_ctx->triggerEvent(READ);
+                fd_ctx->triggerEvent(READ, &batch);
                 --m_pendingEventCount;
             }
 
             if(real_events & WRITE)
             {
-                fd_ctx->triggerEvent(WRITE);
+                fd_ctx->triggerEvent(WRITE, &batch);
+                --m_pendingEventCount;
+            }
+
+            if(real_events & ERROR)
+            {
+                fd_ctx->triggerEvent(ERROR, &batch);
                 --m_pendingEventCount;
             }
         }
+        batch.submit();
 
         /**
          * @brief 当前协程让出 CPU，等待调度器重新调度：
@@ -199,7 +375,7 @@ void IOManager::idle()
  * @param[in] cb 事件回调函数，如果为空，则默认把当前协程作为回调执行体
  * @return 添加成功返回0，失败返回-1
  */
-int IOManager::addEvent(int fd, Event event, std::function<void()> cb)
+int IOManager::addEvent(int fd, Event event, TaskFunc cb)
 {
     // 找到fd对应的FdContext，如果不存在，那就分配一个
     FdContext *fd_ctx = nullptr;
@@ -245,6 +421,7 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb)
 
     // 待执行IO事件数+1
     ++m_pendingEventCount;
+    SYLAR_TRACE(ADD_EVENT, Fiber::GetCurrent() ? Fiber::GetCurrent()->getID() : 0, fd);
 
     // 找到这个fd的event事件对应的EventContext，对其中的scheduler, cb, fiber进行赋值
     fd_ctx->events = (Event)(fd_ctx->events | event);
@@ -253,6 +430,9 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb)
 
     // 赋值scheduler和回调函数，如果回调函数为空，则把当前协程当成回调执行体(当该事件触发时，将执行当前正在运行的协程)
     event_ctx.scheduler = Scheduler::GetThis();
+    Fiber *cur = Fiber::GetCurrent();
+    event_ctx.priority = cur ? cur->getPriority() : Scheduler::PRIORITY_NORMAL;
+    event_ctx.node = Scheduler::GetCurrentNode();
     if(cb){
         event_ctx.cb.swap(cb);
     }else{
@@ -391,6 +571,10 @@ bool IOManager::cancelAll(int fd) {
         fd_ctx->triggerEvent(WRITE);
         --m_pendingEventCount;
     }
+    if(fd_ctx->events & ERROR){
+        fd_ctx->triggerEvent(ERROR);
+        --m_pendingEventCount;
+    }
     SYLAR_ASSERT(fd_ctx->events == 0);
     return true;
 }
@@ -0,0 +1,326 @@
+#include "async_log.h"
+#include "fiber.h"
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+namespace {
+
+/**
+ * 线程的日志缓冲区：所属线程写head，后台线程写tail，
+ * 线程退出时标记closed，由后台线程输出剩余记录后释放
+ */
+struct LogRing{
+    std::atomic<uint64_t> head = {0};
+    std::atomic<uint64_t> tail = {0};
+    std::atomic<uint64_t> dropped = {0};
+    std::atomic<bool> closed = {false};
+    uint32_t tid = 0;
+    AsyncLogger::Record slots[AsyncLogger::kRingSlots];
+};
+
+struct RingHolder{
+    LogRing *ring = nullptr;
+    ~RingHolder(){
+        if(ring) ring->closed = true;
+    }
+};
+
+const char *s_level_names[] = {"UNKNOWN", "DEBUG", "INFO", "WARN", "ERROR", "FATAL"};
+
+/**
+ * 后台输出线程，第一次有线程写日志时启动，进程退出时输出剩余记录
+ */
+class LogWriter{
+public:
+    LogWriter(){
+        m_thread = std::thread(&LogWriter::run, this);
+    }
+
+    ~LogWriter(){
+        m_stopping = true;
+        m_thread.join();
+    }
+
+    void add(LogRing *ring){
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_rings.push_back(ring);
+    }
+
+    void flush(){
+        uint64_t target = ++m_flushRequest;
+        while(m_flushDone < target && !m_stopping)
+            usleep(100);
+    }
+
+    std::atomic<int> fd = {STDOUT_FILENO};
+    std::atomic<uint64_t> dropped = {0};
+
+private:
+    void run(){
+        std::string buf;
+        std::vector<LogRing*> rings;
+        while(true){
+            uint64_t flush_request = m_flushRequest;
+            bool stopping = m_stopping;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                rings = m_rings;
+            }
+            size_t n = 0;
+            for(auto ring : rings)
+                n += drain(ring, buf);
+            if(!buf.empty()){
+                write(buf);
+                buf.clear();
+            }
+            reap();
+            m_flushDone = flush_request;
+            if(stopping)
+                break;
+            if(!n)
+                usleep(1000);
+        }
+    }
+
+    size_t drain(LogRing *ring, std::string &buf){
+        uint64_t d = ring->dropped.exchange(0);
+        if(d){
+            dropped += d;
+            buf += "[async_log] dropped " + std::to_string(d) + " records from thread "
+                + std::to_string(ring->tid) + "\n";
+        }
+        uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        for(uint64_t i = tail; i < head; ++i){
+            format(ring->slots[i & (AsyncLogger::kRingSlots - 1)], buf);
+            if(buf.size() >= 64 * 1024){
+                write(buf);
+                buf.clear();
+            }
+        }
+        ring->tail.store(head, std::memory_order_release);
+        return head - tail;
+    }
+
+    // 释放已退出线程的缓冲区，closed之后不会再有写入，最后再输出一次
+    void reap(){
+        std::vector<LogRing*> closed;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto it = std::partition(m_rings.begin(), m_rings.end(), [](LogRing *r){
+                return !r->closed;
+            });
+            closed.assign(it, m_rings.end());
+            m_rings.erase(it, m_rings.end());
+        }
+        std::string buf;
+        for(auto ring : closed){
+            drain(ring, buf);
+            delete ring;
+        }
+        if(!buf.empty())
+            write(buf);
+    }
+
+    void format(const AsyncLogger::Record &r, std::string &buf){
+        char head[128];
+        time_t sec = r.timeUs / 1000000;
+        struct tm tm;
+        localtime_r(&sec, &tm);
+        int level = r.site->level;
+        if(level < 0 || level > SYLAR_ALOG_LEVEL_FATAL) level = 0;
+        size_t len = strftime(head, sizeof(head), "%Y-%m-%d %H:%M:%S", &tm);
+        len += snprintf(head + len, sizeof(head) - len, ".%06lu\t%u\t%lu\t[%s]\t",
+                (unsigned long)(r.timeUs % 1000000), r.tid, (unsigned long)r.fiberId, s_level_names[level]);
+        buf.append(head, len);
+
+        const char *file = strrchr(r.site->file, '/');
+        buf += file ? file + 1 : r.site->file;
+        buf += ":" + std::to_string(r.site->line) + "\t";
+
+        const char *p = r.data;
+        const char *end = r.data + r.size;
+        uint8_t left = r.nargs;
+        for(const char *f = r.site->fmt; *f; ++f){
+            if(f[0] == '{' && f[1] == '}' && left){
+                appendArg(p, end, buf);
+                --left;
+                ++f;
+            }else{
+                buf += *f;
+            }
+        }
+        if(r.truncated)
+            buf += " ...";
+        buf += "\n";
+    }
+
+    static void appendArg(const char *&p, const char *end, std::string &buf){
+        if(p >= end) return;
+        uint8_t type = *p++;
+        switch(type){
+            case AsyncLogger::ARG_INT: {
+                int64_t v;
+                memcpy(&v, p, sizeof(v));
+                p += sizeof(v);
+                buf += std::to_string(v);
+                break;
+            }
+            case AsyncLogger::ARG_UINT: {
+                uint64_t v;
+                memcpy(&v, p, sizeof(v));
+                p += sizeof(v);
+                buf += std::to_string(v);
+                break;
+            }
+            case AsyncLogger::ARG_DOUBLE: {
+                double v;
+                memcpy(&v, p, sizeof(v));
+                p += sizeof(v);
+                char tmp[32];
+                snprintf(tmp, sizeof(tmp), "%g", v);
+                buf += tmp;
+                break;
+            }
+            case AsyncLogger::ARG_PTR: {
+                const void *v;
+                memcpy(&v, p, sizeof(v));
+                p += sizeof(v);
+                char tmp[32];
+                snprintf(tmp, sizeof(tmp), "%p", v);
+                buf += tmp;
+                break;
+            }
+            case AsyncLogger::ARG_STR: {
+                uint16_t len;
+                memcpy(&len, p, sizeof(len));
+                p += sizeof(len);
+                buf.append(p, len);
+                p += len;
+                break;
+            }
+            default:
+                p = end;
+                break;
+        }
+    }
+
+    void write(const std::string &buf){
+        const char *p = buf.data();
+        size_t left = buf.size();
+        while(left){
+            ssize_t n = ::write(fd, p, left);
+            if(n < 0 && errno == EINTR) continue;
+            if(n <= 0) break;
+            p += n;
+            left -= n;
+        }
+    }
+
+private:
+    std::thread m_thread;
+    std::mutex m_mutex;
+    std::vector<LogRing*> m_rings;
+    std::atomic<bool> m_stopping = {false};
+    std::atomic<uint64_t> m_flushRequest = {0};
+    std::atomic<uint64_t> m_flushDone = {0};
+};
+
+LogWriter &GetWriter()
+{
+    static LogWriter s_writer;
+    return s_writer;
+}
+
+thread_local RingHolder t_holder;
+
+}
+
+void AsyncLogger::Encoder::putRaw(uint8_t type, const void *v, size_t len)
+{
+    Record *r = m_rec;
+    if(r->size + 1 + len > sizeof(r->data)){
+        r->truncated = 1;
+        return;
+    }
+    r->data[r->size] = type;
+    memcpy(r->data + r->size + 1, v, len);
+    r->size += 1 + len;
+    ++r->nargs;
+}
+
+void AsyncLogger::Encoder::putStr(const char *s, size_t len)
+{
+    Record *r = m_rec;
+    size_t room = sizeof(r->data) - r->size;
+    if(room < 1 + sizeof(uint16_t)){
+        r->truncated = 1;
+        return;
+    }
+    room -= 1 + sizeof(uint16_t);
+    if(len > room){
+        len = room;
+        r->truncated = 1;
+    }
+    uint16_t l = len;
+    r->data[r->size] = ARG_STR;
+    memcpy(r->data + r->size + 1, &l, sizeof(l));
+    memcpy(r->data + r->size + 1 + sizeof(l), s, len);
+    r->size += 1 + sizeof(l) + len;
+    ++r->nargs;
+}
+
+AsyncLogger::Record *AsyncLogger::Acquire(const AsyncLogSite *site)
+{
+    LogRing *ring = t_holder.ring;
+    if(!ring){
+        ring = t_holder.ring = new LogRing;
+        ring->tid = syscall(SYS_gettid);
+        GetWriter().add(ring);
+    }
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    if(head - ring->tail.load(std::memory_order_acquire) >= kRingSlots){
+        ring->dropped.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    Record *r = &ring->slots[head & (kRingSlots - 1)];
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    r->site = site;
+    r->timeUs = ts.tv_sec * 1000000ul + ts.tv_nsec / 1000;
+    Fiber *cur = Fiber::GetCurrent();
+    r->fiberId = cur ? cur->getID() : 0;
+    r->tid = ring->tid;
+    r->size = 0;
+    r->nargs = 0;
+    r->truncated = 0;
+    return r;
+}
+
+void AsyncLogger::Commit()
+{
+    LogRing *ring = t_holder.ring;
+    ring->head.store(ring->head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void AsyncLogger::SetFd(int fd)
+{
+    GetWriter().fd = fd;
+}
+
+uint64_t AsyncLogger::GetDropped()
+{
+    return GetWriter().dropped;
+}
+
+void AsyncLogger::Flush()
+{
+    GetWriter().flush();
+}
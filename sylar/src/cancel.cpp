@@ -0,0 +1,106 @@
+#include "cancel.h"
+#include "fiber.h"
+#include "util.h"
+#include <errno.h>
+#include <vector>
+#include <algorithm>
+
+CancelToken::CancelToken(uint64_t deadline)
+    :m_deadline(deadline){
+}
+
+CancelToken::ptr CancelToken::Create(uint64_t timeout_ms)
+{
+    uint64_t deadline = timeout_ms == ~0ull ? ~0ull : GetCurrentMS() + timeout_ms;
+    return CancelToken::ptr(new CancelToken(deadline));
+}
+
+CancelToken::ptr CancelToken::fork(uint64_t timeout_ms)
+{
+    uint64_t deadline = timeout_ms == ~0ull ? ~0ull : GetCurrentMS() + timeout_ms;
+    CancelToken::ptr child(new CancelToken(std::min(deadline, m_deadline)));
+
+    std::unique_lock<MutexType> lock(m_mutex);
+    if(m_error){
+        child->m_error = (int)m_error;
+        return child;
+    }
+    // 顺便清理已经释放的子令牌，避免长寿命的父令牌无限增长
+    for(auto it = m_children.begin(); it != m_children.end();){
+        if(it->expired())
+            it = m_children.erase(it);
+        else
+            ++it;
+    }
+    m_children.push_back(child);
+    return child;
+}
+
+void CancelToken::cancel(int reason)
+{
+    std::map<uint64_t, WaiterCb> waiters;
+    std::list<std::weak_ptr<CancelToken>> children;
+    {
+        std::unique_lock<MutexType> lock(m_mutex);
+        int expect = 0;
+        if(!m_error.compare_exchange_strong(expect, reason))
+            return;
+        waiters.swap(m_waiters);
+        children.swap(m_children);
+    }
+
+    // 回调在锁外执行，回调中会调用cancelEvent/schedule等可能再次访问令牌的接口
+    for(auto &i : waiters)
+        i.second(reason);
+
+    for(auto &i : children){
+        CancelToken::ptr child = i.lock();
+        if(child)
+            child->cancel(reason);
+    }
+}
+
+int CancelToken::error() const
+{
+    int err = m_error;
+    if(err) return err;
+    if(m_deadline != ~0ull && GetCurrentMS() >= m_deadline)
+        return ETIMEDOUT;
+    return 0;
+}
+
+uint64_t CancelToken::remainingMS() const
+{
+    if(m_deadline == ~0ull) return ~0ull;
+    uint64_t now = GetCurrentMS();
+    return now >= m_deadline ? 0 : m_deadline - now;
+}
+
+uint64_t CancelToken::addWaiter(WaiterCb cb)
+{
+    std::unique_lock<MutexType> lock(m_mutex);
+    if(m_error) return 0;
+    uint64_t id = m_nextWaiterId++;
+    m_waiters[id].swap(cb);
+    return id;
+}
+
+void CancelToken::removeWaiter(uint64_t id)
+{
+    if(!id) return;
+    std::unique_lock<MutexType> lock(m_mutex);
+    m_waiters.erase(id);
+}
+
+CancelScope::CancelScope(uint64_t timeout_ms)
+{
+    Fiber::ptr cur = Fiber::GetThis();
+    m_prev = cur->getCancelToken();
+    m_token = m_prev ? m_prev->fork(timeout_ms) : CancelToken::Create(timeout_ms);
+    cur->setCancelToken(m_token);
+}
+
+CancelScope::~CancelScope()
+{
+    Fiber::GetThis()->setCancelToken(m_prev);
+}
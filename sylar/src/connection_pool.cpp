@@ -0,0 +1,332 @@
+#include "connection_pool.h"
+#include "hook.h"
+#include "util.h"
+#include <errno.h>
+#include <unistd.h>
+#include <sstream>
+#include <algorithm>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+ConnectionPool::Conn &ConnectionPool::Conn::operator=(Conn &&other)
+{
+    if(this != &other){
+        release();
+        m_pool.swap(other.m_pool);
+        m_ep = other.m_ep;
+        m_fd = other.m_fd;
+        m_reused = other.m_reused;
+        m_broken = other.m_broken;
+        other.m_fd = -1;
+    }
+    return *this;
+}
+
+void ConnectionPool::Conn::release()
+{
+    if(m_fd >= 0)
+        m_pool->put(m_ep, m_fd, m_broken);
+    m_fd = -1;
+    m_pool.reset();
+}
+
+ConnectionPool::ConnectionPool(IOManager *iom, const Options &opt)
+    :m_iom(iom)
+    ,m_opt(opt)
+{
+    SYLAR_ASSERT(m_iom);
+}
+
+ConnectionPool::ptr ConnectionPool::Create(IOManager *iom, const Options &opt)
+{
+    ConnectionPool::ptr pool(new ConnectionPool(iom, opt));
+    std::weak_ptr<ConnectionPool> weak(pool);
+    pool->m_timer = iom->addConditionTimer(opt.checkIntervalMs, [weak](){
+        ConnectionPool::ptr p = weak.lock();
+        if(p) p->check();
+    }, weak, true);
+    return pool;
+}
+
+ConnectionPool::~ConnectionPool()
+{
+    stop();
+}
+
+bool ConnectionPool::IsAlive(int fd)
+{
+    // 必须用原始recv，hook的recv遇到EAGAIN会挂起等待
+    char c;
+    ssize_t n = recv_f(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+ConnectionPool::Endpoint *ConnectionPool::getEndpoint(const std::string &ip, uint16_t port)
+{
+    std::string key = ip + ":" + std::to_string(port);
+    auto it = m_endpoints.find(key);
+    if(it != m_endpoints.end())
+        return it->second.get();
+    std::unique_ptr<Endpoint> ep(new Endpoint);
+    if(!ParseAddress(ip, port, ep->addr, ep->addrlen))
+        return nullptr;
+    ep->key = key;
+    Endpoint *raw = ep.get();
+    m_endpoints[key] = std::move(ep);
+    return raw;
+}
+
+int ConnectionPool::connectTo(Endpoint *ep, uint64_t timeout_ms)
+{
+    // 地址在Endpoint创建后不再修改，不需要加锁
+    int fd = socket(ep->addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd < 0)
+        return -1;
+    if(connect_with_timeout(fd, (sockaddr*)&ep->addr, ep->addrlen, timeout_ms)){
+        int err = errno;
+        ::close(fd);
+        errno = err;
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+ConnectionPool::Conn ConnectionPool::get(const std::string &ip, uint16_t port, uint64_t timeout_ms)
+{
+    uint64_t deadline = timeout_ms == ~0ull ? ~0ull : GetCurrentMS() + timeout_ms;
+    auto remaining = [deadline]() -> uint64_t {
+        if(deadline == ~0ull)
+            return ~0ull;
+        uint64_t now = GetCurrentMS();
+        return now >= deadline ? 0 : deadline - now;
+    };
+
+    Conn conn;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    Endpoint *ep = getEndpoint(ip, port);
+    if(!ep){
+        errno = EINVAL;
+        return conn;
+    }
+    while(true){
+        if(m_stopped){
+            errno = ESHUTDOWN;
+            return conn;
+        }
+        // 最近归还的连接最可能还活着
+        while(!ep->idle.empty()){
+            int fd = ep->idle.back().fd;
+            ep->idle.pop_back();
+            lock.unlock();
+            bool alive = IsAlive(fd);
+            if(!alive)
+                ::close(fd);
+            lock.lock();
+            if(alive){
+                ++m_stats.reused;
+                conn.m_pool = shared_from_this();
+                conn.m_ep = ep;
+                conn.m_fd = fd;
+                conn.m_reused = true;
+                return conn;
+            }
+            --ep->total;
+            ++m_stats.broken;
+        }
+
+        if(ep->total < m_opt.maxPerEndpoint){
+            ++ep->total;
+            lock.unlock();
+            int fd = connectTo(ep, std::min(remaining(), m_opt.connectTimeoutMs));
+            int err = errno;
+            lock.lock();
+            if(fd < 0){
+                --ep->total;
+                ++m_stats.connectFailed;
+                ep->waiters.notifyOne();
+                errno = err;
+                return conn;
+            }
+            ++m_stats.created;
+            conn.m_pool = shared_from_this();
+            conn.m_ep = ep;
+            conn.m_fd = fd;
+            return conn;
+        }
+
+        uint64_t left = remaining();
+        int rt = left ? 0 : ETIMEDOUT;
+        if(!rt){
+            ++m_stats.waits;
+            rt = ep->waiters.wait(lock, left);
+        }
+        if(rt){
+            ++m_stats.waitTimeouts;
+            errno = rt;
+            return conn;
+        }
+    }
+}
+
+void ConnectionPool::put(Endpoint *ep, int fd, bool broken)
+{
+    bool close = false;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if(broken || m_stopped){
+            --ep->total;
+            if(broken)
+                ++m_stats.broken;
+            close = true;
+        }else{
+            ep->idle.push_back(IdleConn{fd, GetCurrentMS()});
+        }
+        // 归还的连接或者空出来的名额都可以让一个等待者继续
+        ep->waiters.notifyOne();
+    }
+    if(close)
+        ::close(fd);
+}
+
+void ConnectionPool::check()
+{
+    std::vector<int> closing;
+    std::vector<Endpoint*> fills;
+    uint64_t now = GetCurrentMS();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if(m_stopped)
+            return;
+        for(auto &i : m_endpoints){
+            Endpoint *ep = i.second.get();
+            size_t before = closing.size();
+            std::vector<IdleConn> kept;
+            kept.reserve(ep->idle.size());
+            for(auto &c : ep->idle){
+                if(IsAlive(c.fd)){
+                    kept.push_back(c);
+                }else{
+                    closing.push_back(c.fd);
+                    ++m_stats.broken;
+                }
+            }
+            // 最旧的在前面，超时的关闭但至少保留minIdle个
+            size_t drop = 0;
+            while(drop < kept.size() && kept.size() - drop > m_opt.minIdle
+                    && now - kept[drop].since >= m_opt.idleTimeoutMs){
+                closing.push_back(kept[drop].fd);
+                ++drop;
+            }
+            m_stats.evicted += drop;
+            kept.erase(kept.begin(), kept.begin() + drop);
+            ep->idle.swap(kept);
+            ep->total -= closing.size() - before;
+            if(closing.size() != before)
+                ep->waiters.notifyAll();
+            if(ep->idle.size() < m_opt.minIdle && !ep->warming)
+                fills.push_back(ep);
+        }
+    }
+    for(int fd : closing)
+        ::close(fd);
+    for(Endpoint *ep : fills)
+        fill(ep, m_opt.minIdle);
+}
+
+void ConnectionPool::fill(Endpoint *ep, size_t n)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if(ep->warming || m_stopped)
+            return;
+        ep->warming = true;
+    }
+    ConnectionPool::ptr self = shared_from_this();
+    bool ok = m_iom->schedule([self, ep, n](){
+        std::unique_lock<std::mutex> lock(self->m_mutex);
+        while(!self->m_stopped && ep->idle.size() < n && ep->total < self->m_opt.maxPerEndpoint){
+            ++ep->total;
+            lock.unlock();
+            int fd = self->connectTo(ep, self->m_opt.connectTimeoutMs);
+            lock.lock();
+            if(fd < 0){
+                --ep->total;
+                ++self->m_stats.connectFailed;
+                break;
+            }
+            ++self->m_stats.created;
+            if(self->m_stopped){
+                --ep->total;
+                ::close(fd);
+                break;
+            }
+            ep->idle.push_back(IdleConn{fd, GetCurrentMS()});
+            ep->waiters.notifyOne();
+        }
+        ep->warming = false;
+    });
+    if(!ok){
+        // 调度器过载时不预建连接，下次检查再试
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ep->warming = false;
+    }
+}
+
+void ConnectionPool::warm(const std::string &ip, uint16_t port, size_t n)
+{
+    Endpoint *ep;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        ep = getEndpoint(ip, port);
+    }
+    if(ep)
+        fill(ep, std::min(n, m_opt.maxPerEndpoint));
+}
+
+void ConnectionPool::stop()
+{
+    std::vector<int> closing;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if(m_stopped)
+            return;
+        m_stopped = true;
+        for(auto &i : m_endpoints){
+            Endpoint *ep = i.second.get();
+            for(auto &c : ep->idle)
+                closing.push_back(c.fd);
+            ep->total -= ep->idle.size();
+            ep->idle.clear();
+            ep->waiters.notifyAll();
+        }
+    }
+    if(m_timer)
+        m_timer->cancel();
+    for(int fd : closing)
+        ::close(fd);
+}
+
+ConnectionPool::Stats ConnectionPool::getStats()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Stats s = m_stats;
+    for(auto &i : m_endpoints){
+        s.idle += i.second->idle.size();
+        s.active += i.second->total - i.second->idle.size();
+    }
+    return s;
+}
+
+std::string ConnectionPool::dumpStats()
+{
+    Stats s = getStats();
+    std::stringstream ss;
+    ss << "idle=" << s.idle << " active=" << s.active
+       << " created=" << s.created << " reused=" << s.reused
+       << " evicted=" << s.evicted << " broken=" << s.broken
+       << " connect_failed=" << s.connectFailed
+       << " waits=" << s.waits << " wait_timeouts=" << s.waitTimeouts;
+    return ss.str();
+}
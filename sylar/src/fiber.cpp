@@ -2,10 +2,37 @@
 #include "ucontext.h"
 #include <cassert>
 #include<mutex>
+#include <atomic>
+#include "trace.h"
+#include "util.h"
+#include "fiber_stats.h"
+#include "async_log.h"
+#include <string.h>
+#include <errno.h>
 
 
 
 
+/// 挂起的切换后动作，由即将让出执行权的协程设置，在切换到的上下文中执行
+static thread_local Fiber::PostSwitchFunc t_post_switch_fn = nullptr;
+static thread_local void *t_post_switch_arg = nullptr;
+
+thread_local volatile sig_atomic_t t_fiber_preempt = 0;
+
+/// 通过switchTo切换到的协程，在它运行期间由这里持有
+static thread_local Fiber::ptr t_handoff_fiber = nullptr;
+
+/// 存活协程注册表，按协程id分片，构造和析构时只锁一个分片
+static const size_t kLiveShards = 16;
+static struct LiveShard{
+    std::mutex mutex;
+    Fiber *head = nullptr;
+} s_live_shards[kLiveShards];
+
+/// 已分配的局部存储槽位数及各槽位的析构函数
+static std::atomic<size_t> s_local_slot_count = {0};
+static Fiber::LocalDtor s_local_dtors[Fiber::kMaxLocalSlots];
+
 namespace StackAllocator{
 
     void* Alloc(size_t size) {
@@ -45,8 +72,9 @@ Fiber::Fiber()
     }
     ++s_fiber_count;
     m_id = s_fiber_count++;
+    registerLive();
 
-    SYLAR_LOG_DEBUG(g_logger) << "Fiber::Fiber() main id = " << m_id;
+    SYLAR_ALOG_DEBUG("Fiber::Fiber() main id = {}", m_id);
 }
 
 /**
@@ -54,9 +82,15 @@ Fiber::Fiber()
  * cb--协程入口函数
  * stacksize--栈大小，默认为128k
  */
-Fiber::Fiber(std::function<void()> cb, size_t statcksize) : m_id(s_fiber_id++), m_cb(cb)
+Fiber::Fiber(TaskFunc cb, size_t statcksize) : m_id(s_fiber_id++), m_cb(std::move(cb))
 {
     ++s_fiber_count;
+    // 继承创建者协程的取消令牌，取消父协程时由它创建的协程一起失效；标签同样继承，
+    // 由它派生的协程的CPU时间计入同一个标签
+    if(t_fiber){
+        m_cancelToken = t_fiber->m_cancelToken;
+        m_tag = t_fiber->m_tag;
+    }
     m_stacksize = statcksize ? statcksize: g_fiber_stack_size->getValue();
     m_stack = StackAllocator::Alloc(m_stacksize);
 
@@ -70,16 +104,23 @@ Fiber::Fiber(std::function<void()> cb, size_t statcksize) : m_id(s_fiber_id++),
     m_ctx.uc_stack.ss_size = m_stacksize;
 
     makecontext(&m_ctx, &Fiber::MainFunc, 0);
-    SYLAR_LOG_DEBUG(g_logger) << "Fiber::Fiber() id = " << m_id;
+    registerLive();
+    SYLAR_ALOG_DEBUG("Fiber::Fiber() id = {}", m_id);
 }
 
 
 /*增加m_runInScheduler成员，表示当前协程是否参与调度器调度，在
 协程的resume和yield时，根据协程的运⾏环境确定是和线程主协程进⾏交换还是和调度协程进⾏交换 */
-Fiber::Fiber(std::function<void()> cb, size_t statcksize, bool run_in_scheduler)
-:m_id(s_fiber_id++), m_cb(cb), m_runInScheduler(run_in_scheduler)
+Fiber::Fiber(TaskFunc cb, size_t statcksize, bool run_in_scheduler)
+:m_id(s_fiber_id++), m_cb(std::move(cb)), m_runInScheduler(run_in_scheduler)
 {
     ++s_fiber_count;
+    // 继承创建者协程的取消令牌，取消父协程时由它创建的协程一起失效；标签同样继承，
+    // 由它派生的协程的CPU时间计入同一个标签
+    if(t_fiber){
+        m_cancelToken = t_fiber->m_cancelToken;
+        m_tag = t_fiber->m_tag;
+    }
     m_stacksize = statcksize ? statcksize : g_fiber_stack_size->getValue();
     m_stack = StackAllocator::Alloc(m_stacksize);
 
@@ -93,7 +134,60 @@ Fiber::Fiber(std::function<void()> cb, size_t statcksize, bool run_in_scheduler)
     m_ctx.uc_stack.ss_size = m_stacksize;
 
     makecontext(&m_ctx, &Fiber::MainFunc, 0);
-    SYLAR_LOG_DEBUG(g_logger) << "Fiber::Fiber() id = " << m_id;
+    registerLive();
+    SYLAR_ALOG_DEBUG("Fiber::Fiber() id = {}", m_id);
+}
+
+Fiber::~Fiber()
+{
+    unregisterLive();
+    --s_fiber_count;
+    // 没有执行完就被销毁的协程（以及线程的主协程）在这里释放局部存储
+    clearLocals();
+    if(m_stack)
+        StackAllocator::deallocate(m_stack);
+}
+
+void Fiber::registerLive()
+{
+    LiveShard &shard = s_live_shards[m_id % kLiveShards];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    m_liveNext = shard.head;
+    if(shard.head)
+        shard.head->m_livePrev = this;
+    shard.head = this;
+}
+
+void Fiber::unregisterLive()
+{
+    LiveShard &shard = s_live_shards[m_id % kLiveShards];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if(m_livePrev)
+        m_livePrev->m_liveNext = m_liveNext;
+    else
+        shard.head = m_liveNext;
+    if(m_liveNext)
+        m_liveNext->m_livePrev = m_livePrev;
+    m_livePrev = m_liveNext = nullptr;
+}
+
+void Fiber::VisitLive(VisitFunc fn, void *arg)
+{
+    for(auto &shard : s_live_shards){
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for(Fiber *f = shard.head; f; f = f->m_liveNext)
+            fn(f, arg);
+    }
+}
+
+void Fiber::SetCurrentWait(const char *reason, int fd, int event, uint64_t timeout_ms)
+{
+    if(!t_fiber) return;
+    WaitInfo &w = t_fiber->m_waitInfo;
+    w.reason = reason;
+    w.fd = fd;
+    w.event = event;
+    w.timeoutMs = timeout_ms;
 }
 
 
@@ -124,6 +218,10 @@ void Fiber::resume()
     SYLAR_ASSERT(m_state != TERM && m_state != RUNNING);
     SetThis(this);
     m_state = RUNNING;
+    SYLAR_TRACE(RESUME, m_id, 0);
+    m_waitInfo.reason = nullptr;
+    ++m_runs;
+    m_resumeCycles = FiberStats::IsEnabled() ? GetCycleCount() : 0;
 
     if(m_runInScheduler)
     {
@@ -136,12 +234,26 @@ void Fiber::resume()
             }
         }
     }
+    RunPostSwitch();
+    // 回到resume的调用者时，经由switchTo接力运行的协程都已让出，不再需要持有
+    t_handoff_fiber.reset();
 }                                      
 
 void Fiber::yield()
 {
     // 协程运行完会自动yield一次，用于回到主协程，此时状态为结束状态
     SYLAR_ASSERT(m_state == RUNNING || m_state == TERM);
+    SYLAR_TRACE(YIELD, m_id, m_state == TERM);
+    // 没有开启统计时不读时钟，本次resume时还没开启的那一段也不计入
+    bool timing = FiberStats::IsEnabled();
+    if(timing && m_resumeCycles)
+        m_cpuCycles += GetCycleCount() - m_resumeCycles;
+    if(m_state == TERM){
+        if(timing && m_resumeCycles)
+            FiberStats::Account(m_tag, m_runs, m_cpuCycles, m_queuedUs, m_parkedUs);
+    }else{
+        m_lastYieldUs = timing ? GetCurrentUS() : 0; // 切换前记录，切换后可能马上被其他线程重新入队
+    }
     SetThis(t_thread_fiber.get()); // 
     if(m_state!=TERM) 
     {
@@ -161,16 +273,172 @@ void Fiber::yield()
             }
         }
     }
+    RunPostSwitch();
+}
+
+CancelToken::ptr Fiber::GetCurrentCancelToken()
+{
+    return t_fiber ? t_fiber->m_cancelToken : nullptr;
+}
+
+Fiber *Fiber::GetCurrent()
+{
+    return t_fiber;
+}
+
+size_t Fiber::AllocLocalSlot(LocalDtor dtor)
+{
+    size_t slot = s_local_slot_count++;
+    SYLAR_ASSERT2(slot < kMaxLocalSlots, "fiber local slots exhausted");
+    s_local_dtors[slot] = dtor;
+    return slot;
+}
+
+void Fiber::setLocal(size_t slot, void *value)
+{
+    SYLAR_ASSERT(slot < s_local_slot_count);
+    if(slot < kInlineLocalSlots){
+        m_locals[slot] = value;
+        return;
+    }
+    slot -= kInlineLocalSlots;
+    if(slot >= m_spillSize){
+        // 按当前已分配的槽位数一次扩到位，避免频繁扩容
+        size_t size = s_local_slot_count - kInlineLocalSlots;
+        void **spill = new void*[size]();
+        for(size_t i = 0; i < m_spillSize; ++i)
+            spill[i] = m_spillLocals[i];
+        delete[] m_spillLocals;
+        m_spillLocals = spill;
+        m_spillSize = size;
+    }
+    m_spillLocals[slot] = value;
+}
+
+void Fiber::clearLocals()
+{
+    for(size_t i = 0; i < kInlineLocalSlots; ++i){
+        void *value = m_locals[i];
+        if(!value) continue;
+        m_locals[i] = nullptr;
+        if(s_local_dtors[i])
+            s_local_dtors[i](value);
+    }
+    for(size_t i = 0; i < m_spillSize; ++i){
+        void *value = m_spillLocals[i];
+        if(!value) continue;
+        m_spillLocals[i] = nullptr;
+        if(s_local_dtors[i + kInlineLocalSlots])
+            s_local_dtors[i + kInlineLocalSlots](value);
+    }
+    delete[] m_spillLocals;
+    m_spillLocals = nullptr;
+    m_spillSize = 0;
+}
+
+void Fiber::switchTo(Fiber::ptr next)
+{
+    SYLAR_ASSERT(t_fiber == this && m_state == RUNNING);
+    SYLAR_ASSERT(next && next.get() != this);
+    SYLAR_ASSERT2(next->m_state == READY, "state=" << next->m_state);
+    SYLAR_ASSERT2(next->m_runInScheduler == m_runInScheduler, "switchTo across scheduler/thread main fiber");
+
+    Fiber *raw_next = next.get();
+    // 如果本协程自身也是被接力运行的，它的持有者在本协程栈上保留到再次被resume，
+    // 此时唤醒它的一方已经持有了它
+    Fiber::ptr prev;
+    prev.swap(t_handoff_fiber);
+    t_handoff_fiber.swap(next);
+    if(prev.get() != this)
+        prev.reset();
+
+    SetThis(raw_next);
+    m_state = READY;
+    raw_next->m_state = RUNNING;
+    SYLAR_TRACE(YIELD, m_id, 0);
+    SYLAR_TRACE(RESUME, raw_next->m_id, 0);
+    uint64_t now = 0;
+    if(FiberStats::IsEnabled()){
+        now = GetCycleCount();
+        if(m_resumeCycles)
+            m_cpuCycles += now - m_resumeCycles;
+        m_lastYieldUs = GetCurrentUS();
+    }else{
+        m_lastYieldUs = 0;
+    }
+    ++raw_next->m_runs;
+    raw_next->m_waitInfo.reason = nullptr;
+    raw_next->m_resumeCycles = now;
+    if(swapcontext(&m_ctx, &raw_next->m_ctx))
+    {
+        SYLAR_ASSERT2(false, "swapcontext");
+    }
+    RunPostSwitch();
+}
+
+void Fiber::SetPostSwitch(PostSwitchFunc fn, void *arg)
+{
+    SYLAR_ASSERT(!t_post_switch_fn);
+    t_post_switch_fn = fn;
+    t_post_switch_arg = arg;
+}
+
+void Fiber::RunPostSwitch()
+{
+    PostSwitchFunc fn = t_post_switch_fn;
+    if(!fn) return;
+    t_post_switch_fn = nullptr;
+    fn(t_post_switch_arg);
+}
+
+void Fiber::PreemptYield()
+{
+    Scheduler::PreemptCurrent();
+}
+
+/**
+ * 抢占信号的处理函数：只有当前协程在PreemptibleScope内时才在这里让出，
+ * 否则什么都不做，等协程走到下一个MaybeYield检查点。
+ * 让出时swapcontext保存的信号屏蔽字里抢占信号是屏蔽的，协程恢复后从这里返回，
+ * 由sigreturn恢复被打断时的现场和屏蔽字
+ */
+static void PreemptSignalHandler(int)
+{
+    int saved_errno = errno;
+    Fiber *cur = Fiber::GetCurrent();
+    if(t_fiber_preempt && cur && cur->isPreemptible())
+        Fiber::PreemptYield();
+    errno = saved_errno;
+}
+
+bool Fiber::InstallPreemptSignal(int sig)
+{
+    static std::atomic<bool> s_installed = {false};
+    if(s_installed.exchange(true))
+        return true;
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = &PreemptSignalHandler;
+    // 被打断的系统调用自动重启，抢占信号不会让非hook的阻塞调用返回EINTR
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if(sigaction(sig, &sa, nullptr)){
+        s_installed = false;
+        return false;
+    }
+    return true;
 }
 
 /* 协程入口函数 */
 void Fiber::MainFunc()
 {
+    RunPostSwitch();
     Fiber::ptr cur = GetThis();
     SYLAR_ASSERT(cur);
 
     cur->m_cb(); // 执行协程的入口函数
     cur->m_cb = nullptr;
+    cur->clearLocals(); // 在协程栈上执行局部存储的析构函数
     cur->m_state = TERM;
 
     auto raw_ptr = cur.get();
@@ -179,11 +447,19 @@ void Fiber::MainFunc()
 }
 
 /*协程重置---重复利用已结束的协程，复用其栈空间，创建新协程，此处强制只有TERM状态的协程才可以重置*/
-void Fiber::reset(std::function<void()> cb)
+void Fiber::reset(TaskFunc cb)
 {
     SYLAR_ASSERT(m_stack);
     SYLAR_ASSERT(m_state == TERM);
-    m_cb = cb;
+    m_cb = std::move(cb);
+    m_cancelToken.reset();
+    m_tag = nullptr;
+    m_runs = 0;
+    m_cpuCycles = 0;
+    m_queuedUs = 0;
+    m_parkedUs = 0;
+    m_lastYieldUs = 0;
+    clearLocals();
     if(getcontext(&m_ctx))
     {
         SYLAR_ASSERT2(false, "getcontext");
@@ -0,0 +1,201 @@
+#include "fiber.h"
+#include "scheduler.h"
+#include "util.h"
+#include <vector>
+#include <algorithm>
+#include <sstream>
+#include <thread>
+#include <atomic>
+#include <execinfo.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+size_t Fiber::backtrace(void **addrs, size_t max) const
+{
+#if defined(__x86_64__)
+    // 正在运行的协程的上下文是旧的，线程主协程没有独立的栈
+    if(m_state == RUNNING || !m_stack || !max)
+        return 0;
+    uintptr_t lo = (uintptr_t)m_stack;
+    uintptr_t hi = lo + m_stacksize;
+    size_t n = 0;
+    // swapcontext保存的rip是它的返回地址，rbp是调用者的帧指针
+    addrs[n++] = (void*)m_ctx.uc_mcontext.gregs[REG_RIP];
+    uintptr_t fp = m_ctx.uc_mcontext.gregs[REG_RBP];
+    while(n < max && fp >= lo && fp + 2 * sizeof(uintptr_t) <= hi && (fp & 7) == 0){
+        uintptr_t *frame = (uintptr_t*)fp;
+        uintptr_t ret = frame[1];
+        uintptr_t next = frame[0];
+        if(!ret)
+            break;
+        addrs[n++] = (void*)ret;
+        // 栈向低地址增长，上一帧一定在更高的地址
+        if(next <= fp)
+            break;
+        fp = next;
+    }
+    return n;
+#else
+    return 0;
+#endif
+}
+
+namespace {
+
+struct FiberInfo{
+    uint64_t id;
+    Fiber::State state;
+    std::string scheduler;
+    const char *tag;
+    Fiber::WaitInfo wait;
+    uint64_t lastYieldUs;
+    uint64_t runs;
+    uint64_t cpuCycles;
+    size_t depth;
+    void *addrs[32];
+};
+
+struct Collector{
+    bool withBacktrace;
+    std::vector<FiberInfo> fibers;
+};
+
+const char *StateName(Fiber::State s)
+{
+    switch(s){
+        case Fiber::READY: return "READY";
+        case Fiber::RUNNING: return "RUNNING";
+        case Fiber::TERM: return "TERM";
+    }
+    return "UNKNOWN";
+}
+
+// 在注册表锁内只拷贝字段和回溯地址，符号化放到锁外
+void Collect(Fiber *f, void *arg)
+{
+    Collector *c = static_cast<Collector*>(arg);
+    FiberInfo info;
+    info.id = f->getID();
+    info.state = f->getState();
+    info.scheduler = f->getScheduler() ? f->getScheduler()->getName() : "";
+    info.tag = f->getTag();
+    info.wait = f->getWaitInfo();
+    info.lastYieldUs = f->getLastYieldUS();
+    info.runs = f->getRuns();
+    info.cpuCycles = f->getCpuCycles();
+    info.depth = c->withBacktrace ? f->backtrace(info.addrs, 32) : 0;
+    c->fibers.push_back(info);
+}
+
+}
+
+std::string Fiber::DumpLiveFibers(bool with_backtrace)
+{
+    Collector c;
+    c.withBacktrace = with_backtrace;
+    VisitLive(&Collect, &c);
+
+    uint64_t now = GetCurrentUS();
+    auto parked = [now](const FiberInfo &i) -> uint64_t {
+        if(i.state != READY || !i.wait.reason || !i.lastYieldUs || now < i.lastYieldUs)
+            return 0;
+        return now - i.lastYieldUs;
+    };
+    // 挂起最久的排在前面，最可能是丢失唤醒或泄漏的协程
+    std::stable_sort(c.fibers.begin(), c.fibers.end(), [&](const FiberInfo &a, const FiberInfo &b){
+        return parked(a) > parked(b);
+    });
+
+    size_t counts[3] = {0};
+    size_t waiting = 0;
+    for(auto &i : c.fibers){
+        if(i.state <= TERM) ++counts[i.state];
+        if(i.wait.reason) ++waiting;
+    }
+
+    std::stringstream ss;
+    ss << "live fibers: " << c.fibers.size()
+       << " (ready=" << counts[READY] << " running=" << counts[RUNNING]
+       << " term=" << counts[TERM] << " waiting=" << waiting << ")\n";
+    for(auto &i : c.fibers){
+        ss << "fiber " << i.id << " " << StateName(i.state);
+        if(!i.scheduler.empty())
+            ss << " scheduler=" << i.scheduler;
+        if(i.tag)
+            ss << " tag=" << i.tag;
+        ss << " runs=" << i.runs << " cpu_us=" << CyclesToUS(i.cpuCycles);
+        if(i.wait.reason){
+            ss << " wait=" << i.wait.reason;
+            if(i.wait.fd >= 0)
+                ss << " fd=" << i.wait.fd << " event=" << i.wait.event;
+            if(i.wait.timeoutMs != ~0ull)
+                ss << " timeout_ms=" << i.wait.timeoutMs;
+            ss << " parked_ms=" << parked(i) / 1000;
+        }
+        ss << "\n";
+        if(i.depth){
+            char **syms = backtrace_symbols(i.addrs, i.depth);
+            for(size_t j = 0; j < i.depth; ++j)
+                ss << "    #" << j << " " << (syms ? syms[j] : "?") << "\n";
+            free(syms);
+        }
+    }
+    return ss.str();
+}
+
+static int s_dump_pipe[2] = {-1, -1};
+static int s_dump_fd = 2;
+
+static void DumpSignalHandler(int)
+{
+    // 只做异步信号安全的事情：通知后台线程
+    int saved = errno;
+    char c = 1;
+    ssize_t rt = write(s_dump_pipe[1], &c, 1);
+    (void)rt;
+    errno = saved;
+}
+
+bool Fiber::InstallDumpSignal(int sig, int fd)
+{
+    static std::atomic<bool> s_installed = {false};
+    if(s_installed.exchange(true))
+        return false;
+    if(pipe(s_dump_pipe)){
+        s_installed = false;
+        return false;
+    }
+    fcntl(s_dump_pipe[1], F_SETFL, O_NONBLOCK);
+    s_dump_fd = fd;
+
+    std::thread([](){
+        char buf[64];
+        while(true){
+            ssize_t n = read(s_dump_pipe[0], buf, sizeof(buf));
+            if(n < 0 && errno == EINTR)
+                continue;
+            if(n <= 0)
+                break;
+            std::string s = DumpLiveFibers(true);
+            const char *p = s.data();
+            size_t left = s.size();
+            while(left){
+                ssize_t w = write(s_dump_fd, p, left);
+                if(w < 0 && errno == EINTR) continue;
+                if(w <= 0) break;
+                p += w;
+                left -= w;
+            }
+        }
+    }).detach();
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = &DumpSignalHandler;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    return sigaction(sig, &sa, nullptr) == 0;
+}
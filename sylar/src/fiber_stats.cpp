@@ -0,0 +1,146 @@
+#include "fiber_stats.h"
+#include "util.h"
+#include <mutex>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+#include <sstream>
+#include <iomanip>
+
+namespace {
+
+struct Entry{
+    uint64_t fibers = 0;
+    uint64_t runs = 0;
+    uint64_t cpuCycles = 0;
+    uint64_t queuedUs = 0;
+    uint64_t parkedUs = 0;
+    uint64_t maxCpuCycles = 0;
+};
+
+/**
+ * 线程的汇总表，按标签指针索引，同一内容的不同指针在查询时再按字符串合并
+ */
+struct ThreadTable{
+    std::mutex mutex;
+    std::unordered_map<const char*, Entry> entries;
+
+    ThreadTable();
+    ~ThreadTable();
+};
+
+std::mutex s_mutex;
+std::vector<ThreadTable*> s_tables;
+// 已退出线程的汇总值
+std::map<std::string, Entry> s_retired;
+
+void Merge(Entry &dst, const Entry &src)
+{
+    dst.fibers += src.fibers;
+    dst.runs += src.runs;
+    dst.cpuCycles += src.cpuCycles;
+    dst.queuedUs += src.queuedUs;
+    dst.parkedUs += src.parkedUs;
+    dst.maxCpuCycles = std::max(dst.maxCpuCycles, src.maxCpuCycles);
+}
+
+ThreadTable::ThreadTable()
+{
+    std::lock_guard<std::mutex> lock(s_mutex);
+    s_tables.push_back(this);
+}
+
+ThreadTable::~ThreadTable()
+{
+    std::lock_guard<std::mutex> lock(s_mutex);
+    s_tables.erase(std::remove(s_tables.begin(), s_tables.end(), this), s_tables.end());
+    for(auto &i : entries)
+        Merge(s_retired[i.first], i.second);
+}
+
+thread_local ThreadTable t_table;
+
+}
+
+std::atomic<bool> FiberStats::s_enabled = {false};
+
+void FiberStats::Account(const char *tag, uint64_t runs, uint64_t cpu_cycles,
+        uint64_t queued_us, uint64_t parked_us)
+{
+    if(!tag) tag = "untagged";
+    std::lock_guard<std::mutex> lock(t_table.mutex);
+    Entry &e = t_table.entries[tag];
+    ++e.fibers;
+    e.runs += runs;
+    e.cpuCycles += cpu_cycles;
+    e.queuedUs += queued_us;
+    e.parkedUs += parked_us;
+    e.maxCpuCycles = std::max(e.maxCpuCycles, cpu_cycles);
+}
+
+std::vector<FiberTagStats> FiberStats::Snapshot()
+{
+    std::map<std::string, Entry> merged;
+    {
+        std::lock_guard<std::mutex> lock(s_mutex);
+        merged = s_retired;
+        for(auto table : s_tables){
+            std::lock_guard<std::mutex> lock2(table->mutex);
+            for(auto &i : table->entries)
+                Merge(merged[i.first], i.second);
+        }
+    }
+
+    std::vector<FiberTagStats> result;
+    for(auto &i : merged){
+        FiberTagStats s;
+        s.tag = i.first;
+        s.fibers = i.second.fibers;
+        s.runs = i.second.runs;
+        s.cpuUs = CyclesToUS(i.second.cpuCycles);
+        s.queuedUs = i.second.queuedUs;
+        s.parkedUs = i.second.parkedUs;
+        s.maxCpuUs = CyclesToUS(i.second.maxCpuCycles);
+        result.push_back(s);
+    }
+    std::sort(result.begin(), result.end(), [](const FiberTagStats &a, const FiberTagStats &b){
+        return a.cpuUs > b.cpuUs;
+    });
+    return result;
+}
+
+std::string FiberStats::DumpTop(size_t n)
+{
+    std::vector<FiberTagStats> stats = Snapshot();
+    std::stringstream ss;
+    ss << std::left << std::setw(24) << "tag"
+       << std::right << std::setw(10) << "fibers"
+       << std::setw(12) << "runs"
+       << std::setw(14) << "cpu_us"
+       << std::setw(12) << "avg_cpu_us"
+       << std::setw(12) << "max_cpu_us"
+       << std::setw(14) << "queued_us"
+       << std::setw(14) << "parked_us" << "\n";
+    for(size_t i = 0; i < stats.size() && i < n; ++i){
+        const FiberTagStats &s = stats[i];
+        ss << std::left << std::setw(24) << s.tag
+           << std::right << std::setw(10) << s.fibers
+           << std::setw(12) << s.runs
+           << std::setw(14) << s.cpuUs
+           << std::setw(12) << (s.fibers ? s.cpuUs / s.fibers : 0)
+           << std::setw(12) << s.maxCpuUs
+           << std::setw(14) << s.queuedUs
+           << std::setw(14) << s.parkedUs << "\n";
+    }
+    return ss.str();
+}
+
+void FiberStats::Reset()
+{
+    std::lock_guard<std::mutex> lock(s_mutex);
+    s_retired.clear();
+    for(auto table : s_tables){
+        std::lock_guard<std::mutex> lock2(table->mutex);
+        table->entries.clear();
+    }
+}
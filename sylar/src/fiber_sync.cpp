@@ -0,0 +1,152 @@
+#include "fiber_sync.h"
+#include "IOManager.h"
+#include "util.h"
+#include <errno.h>
+#include <algorithm>
+
+int FiberWaitQueue::wait(std::unique_lock<std::mutex> &lock, uint64_t timeout_ms)
+{
+    Fiber::ptr self = Fiber::GetThis();
+    CancelToken::ptr token = self->getCancelToken();
+    if(token){
+        int err = token->error();
+        if(err) return err;
+        timeout_ms = std::min(timeout_ms, token->remainingMS());
+    }
+    if(timeout_ms == 0) return ETIMEDOUT;
+
+    WaiterPtr waiter(new Waiter);
+    waiter->fiber = self;
+    waiter->scheduler = Scheduler::GetThis();
+    SYLAR_ASSERT(waiter->scheduler);
+    std::weak_ptr<Waiter> weak(waiter);
+
+    // 持有m_mutex直到本协程切换出去，所有唤醒路径都要先拿m_mutex，
+    // 因此不会在本协程让出执行权之前就把它重新调度
+    m_mutex.lock();
+    uint64_t waiter_id = 0;
+    if(token){
+        waiter_id = token->addWaiter([this, weak](int reason){
+            WaiterPtr w = weak.lock();
+            if(!w) return;
+            std::lock_guard<MutexType> guard(m_mutex);
+            wakeNoLock(w, reason);
+        });
+        if(!waiter_id){
+            m_mutex.unlock();
+            return token->error();
+        }
+    }
+    waiter->it = m_waiters.insert(m_waiters.end(), waiter);
+
+    Timer::ptr timer;
+    if(timeout_ms != ~0ull){
+        IOManager *iom = IOManager::GetThis();
+        SYLAR_ASSERT(iom);
+        timer = iom->addConditionTimer(timeout_ms, [this, weak](){
+            WaiterPtr w = weak.lock();
+            if(!w) return;
+            std::lock_guard<MutexType> guard(m_mutex);
+            wakeNoLock(w, ETIMEDOUT);
+        }, weak);
+    }
+
+    lock.unlock();
+    Fiber::SetPostSwitch([](void *m){
+        static_cast<MutexType*>(m)->unlock();
+    }, &m_mutex);
+    Fiber *raw_ptr = self.get();
+    self.reset();
+    Fiber::SetCurrentWait("wait_queue", -1, 0, timeout_ms);
+    raw_ptr->yield();
+
+    if(timer) timer->cancel();
+    if(token) token->removeWaiter(waiter_id);
+    lock.lock();
+    return waiter->result;
+}
+
+bool FiberWaitQueue::wakeNoLock(const WaiterPtr &waiter, int result)
+{
+    if(waiter->result != -1)
+        return false;
+    waiter->result = result;
+    m_waiters.erase(waiter->it);
+    Fiber::ptr fiber;
+    fiber.swap(waiter->fiber);
+    waiter->scheduler->schedule(fiber);
+    return true;
+}
+
+bool FiberWaitQueue::notifyOne()
+{
+    std::lock_guard<MutexType> guard(m_mutex);
+    if(m_waiters.empty())
+        return false;
+    WaiterPtr waiter = m_waiters.front();
+    return wakeNoLock(waiter, 0);
+}
+
+size_t FiberWaitQueue::notifyAll()
+{
+    std::lock_guard<MutexType> guard(m_mutex);
+    size_t count = 0;
+    while(!m_waiters.empty()){
+        WaiterPtr waiter = m_waiters.front();
+        if(wakeNoLock(waiter, 0))
+            ++count;
+    }
+    return count;
+}
+
+bool FiberWaitQueue::hasWaiters()
+{
+    std::lock_guard<MutexType> guard(m_mutex);
+    return !m_waiters.empty();
+}
+
+FiberSemaphore::FiberSemaphore(size_t count)
+    :m_count(count){
+}
+
+int FiberSemaphore::wait(uint64_t timeout_ms)
+{
+    uint64_t deadline = timeout_ms == ~0ull ? ~0ull : GetCurrentMS() + timeout_ms;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while(m_count == 0){
+        uint64_t left = ~0ull;
+        if(deadline != ~0ull){
+            uint64_t now = GetCurrentMS();
+            if(now >= deadline) return ETIMEDOUT;
+            left = deadline - now;
+        }
+        int rt = m_queue.wait(lock, left);
+        if(rt) return rt;
+    }
+    --m_count;
+    return 0;
+}
+
+bool FiberSemaphore::tryWait()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if(m_count == 0) return false;
+    --m_count;
+    return true;
+}
+
+void FiberSemaphore::notify(size_t n)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_count += n;
+    for(size_t i = 0; i < n; ++i){
+        if(!m_queue.notifyOne())
+            break;
+    }
+}
+
+size_t FiberSemaphore::getCount()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_count;
+}
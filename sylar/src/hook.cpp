@@ -2,23 +2,233 @@
 #include "ws2def.h"
 #include "fiber.h"
 #include "FdCtx.h"
+#include "cancel.h"
+#include "util.h"
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+
+// 小于这个长度时页面固定和完成通知的开销超过拷贝本身
+static const size_t ZEROCOPY_MIN_SIZE = 10 * 1024;
 
 static thread_local bool t_hook_enable = false;
+
+/**
+ * @brief 超时/取消信息
+ * @details cancelled记录等待被打断的原因，定时器和取消令牌只有先到的一方生效。
+ * 定时器和令牌回调在协程切换出去之后才登记（见arm_wait），
+ * 避免回调在协程让出之前就触发事件或把它重新调度；
+ * 登记和协程醒来后的撤销都持有mutex，done之后不再登记
+ */
+struct timer_info{
+    std::atomic<int> cancelled = {0};
+
+    IOManager *iom = nullptr;
+    int fd = -1;
+    IOManager::Event event = IOManager::NONE;
+    uint64_t timeout_ms = ~0ull;
+    CancelToken::ptr token;
+    // wait_ms挂起的协程，为空时表示在fd上等待事件
+    Fiber::ptr fiber;
+
+    std::mutex mutex;
+    bool done = false;
+    Timer::ptr timer;
+    uint64_t waiter_id = 0;
+
+    bool trySet(int err){
+        int expect = 0;
+        return cancelled.compare_exchange_strong(expect, err);
+    }
+
+    // 超时或取消，先到的一方负责唤醒：sleep时重新调度协程，等待IO时通过cancelEvent触发事件
+    void wake(int err){
+        if(!trySet(err))
+            return;
+        if(event == IOManager::NONE){
+            Fiber::ptr f;
+            f.swap(fiber);
+            iom->schedule(f);
+        }else{
+            iom->cancelEvent(fd, event);
+        }
+    }
+
+    // 协程醒来后撤销定时器和令牌回调
+    void disarm(){
+        std::lock_guard<std::mutex> lock(mutex);
+        done = true;
+        if(timer) timer->cancel();
+        if(waiter_id) token->removeWaiter(waiter_id);
+        fiber.reset();
+    }
+};
+
+/**
+ * @brief 切换后动作：登记超时定时器和取消令牌回调
+ * @details arg是new出来的shared_ptr<timer_info>，在这里释放。
+ * 等待IO时事件可能已经触发、协程已经在别的线程上醒来并撤销，此时done为true，不再登记
+ */
+static void arm_wait(void *arg){
+    std::shared_ptr<timer_info> *holder = static_cast<std::shared_ptr<timer_info>*>(arg);
+    std::shared_ptr<timer_info> t;
+    t.swap(*holder);
+    delete holder;
+
+    std::weak_ptr<timer_info> winfo(t);
+    bool cancelled = false;
+    {
+        std::lock_guard<std::mutex> lock(t->mutex);
+        if(t->done)
+            return;
+        if(t->timeout_ms != ~0ull){
+            t->timer = t->iom->addConditionTimer(t->timeout_ms, [winfo]() {
+                auto p = winfo.lock();
+                if(p) p->wake(p->event == IOManager::NONE ? -1 : ETIMEDOUT);
+            }, winfo);
+        }
+        if(t->token){
+            t->waiter_id = t->token->addWaiter([winfo](int reason) {
+                auto p = winfo.lock();
+                if(p) p->wake(reason);
+            });
+            cancelled = t->waiter_id == 0;
+        }
+    }
+    // 令牌在检查之后、登记之前失效了，没有回调会来唤醒，由这里代替
+    if(cancelled)
+        t->wake(t->token->error());
+}
+
+/**
+ * @brief 让出当前协程，切换出去之后再登记超时和取消回调
+ */
+static void yield_and_arm(const std::shared_ptr<timer_info> &tinfo){
+    Fiber::SetPostSwitch(arm_wait, new std::shared_ptr<timer_info>(tinfo));
+    Fiber::GetThis()->yield();
+    tinfo->disarm();
+}
+
+/**
+ * @brief 在fd上等待事件，同时遵守超时时间和当前协程的取消令牌
+ * @param[in] fd socket句柄
+ * @param[in] event 等待的事件
+ * @param[in] timeout_ms 超时时间，~0ull表示不超时，实际超时不超过令牌的截止时间
+ * @return 事件就绪返回0，超时返回ETIMEDOUT，取消返回ECANCELED，注册事件失败返回EINVAL
+ */
+static int wait_event(int fd, IOManager::Event event, uint64_t timeout_ms){
+    IOManager* iom = IOManager::GetThis();
+    CancelToken::ptr token = Fiber::GetThis()->getCancelToken();
+    if(token){
+        int err = token->error();
+        if(err) return err;
+        timeout_ms = std::min(timeout_ms, token->remainingMS());
+    }
+    if(timeout_ms == 0)
+        return ETIMEDOUT;
+
+    // 先注册事件，超时和取消都通过cancelEvent打断等待，cancelEvent会触发一次事件把协程重新调度
+    int rt = iom->addEvent(fd, event);
+    if(rt){
+        SYLAR_LOG_ERROR(g_logger) << "addEvent(" << fd << ", " << event << ") error";
+        return EINVAL;
+    }
+
+    std::shared_ptr<timer_info> tinfo(new timer_info);
+    tinfo->iom = iom;
+    tinfo->fd = fd;
+    tinfo->event = event;
+    tinfo->timeout_ms = timeout_ms;
+    tinfo->token = token;
+
+    Fiber::SetCurrentWait("io", fd, event, timeout_ms);
+    yield_and_arm(tinfo);
+    return tinfo->cancelled;
+}
+
+/**
+ * @brief 挂起当前协程一段时间，取消令牌失效时提前返回
+ * @return 睡眠结束返回0，被取消返回ECANCELED或ETIMEDOUT
+ */
+static int wait_ms(uint64_t ms){
+    Fiber::ptr fiber = Fiber::GetThis();
+    CancelToken::ptr token = fiber->getCancelToken();
+    if(token){
+        int err = token->error();
+        if(err) return err;
+    }
+
+    // 定时器和令牌回调谁先到谁负责把协程重新调度，定时器到期记为-1
+    std::shared_ptr<timer_info> tinfo(new timer_info);
+    tinfo->iom = IOManager::GetThis();
+    tinfo->timeout_ms = ms;
+    tinfo->token = token;
+    tinfo->fiber.swap(fiber);
+
+    Fiber::SetCurrentWait("sleep", -1, 0, ms);
+    yield_and_arm(tinfo);
+    return tinfo->cancelled == -1 ? 0 : (int)tinfo->cancelled;
+}
+
 /**
  * @brief sleep/usleep/nanosleep的hook实现
- * @details 先添加定时器再yield
+ * @details 先添加定时器再yield，取消令牌失效时提前醒来
  */
 unsigned int sleep(unsigned int seconds){
     if(!t_hook_enable){
         return sleep_f(seconds);
     }
+    uint64_t start = GetCurrentMS();
+    if(wait_ms(seconds * 1000ull)){
+        // 被打断时按sleep的约定返回剩余秒数
+        uint64_t used = GetCurrentMS() - start;
+        return used >= seconds * 1000ull ? 0 : (seconds * 1000ull - used + 999) / 1000;
+    }
+    return 0;
+}
 
-    Fiber::ptr fiber = Fiber::GetThis();
-    IOManager* iom = IOManager::GetThis();
-    iom->addTimer(seconds * 1000 , std::bind((void(Scheduler::*)
-    (Fiber::ptr, int thread))& IOManager::schedule
-    , iom, fiber, -1));
-    Fiber::GetThis()->yield();
+int usleep(useconds_t usec){
+    if(!t_hook_enable){
+        return usleep_f(usec);
+    }
+    int rt = wait_ms(usec / 1000);
+    if(rt){
+        errno = EINTR;
+        return -1;
+    }
+    return 0;
+}
+
+int nanosleep(const struct timespec *req, struct timespec *rem){
+    if(!t_hook_enable){
+        return nanosleep_f(req, rem);
+    }
+    uint64_t timeout_ms = req->tv_sec * 1000 + req->tv_nsec / 1000 / 1000;
+    uint64_t start = GetCurrentMS();
+    int rt = wait_ms(timeout_ms);
+    if(rt){
+        if(rem){
+            uint64_t used = GetCurrentMS() - start;
+            uint64_t left = used >= timeout_ms ? 0 : timeout_ms - used;
+            rem->tv_sec = left / 1000;
+            rem->tv_nsec = (left % 1000) * 1000 * 1000;
+        }
+        errno = EINTR;
+        return -1;
+    }
     return 0;
 }
 
@@ -45,7 +255,7 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
         return connect_f(fd, addr, addrlen);
     }
     FdCtx::ptr ctx = FdMgr::GetInstance()->get(fd);
-    if(!ctx || ctx->m_isClosed()){
+    if(!ctx || ctx->isClose()){
         errno = EBADF;
         return -1;
     }
@@ -62,39 +272,11 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
     if(n==0) return 0;
     else if(n!=-1 || errno!=EINPROGRESS) return n;
 
-    IOManager* iom  = IOManager::GetThis();
-    Timer::ptr timer;
-    // 创建一个 timer_info 对象，用于超时处理
-    std::shared_ptr<timer_info> tinfo(new timer_info);
-    std::weak_ptr<timer_info> winfo(tinfo);
-
-    // 如果设置了超时时间，添加一个条件定时器
-    if(timeout_ms !=(uint64_t)-1){
-        timer = iom->addConditionTimer(timeout_ms, [winfo, fd, iom]() {
-        auto t = winfo.lock();
-        if(!t || t->cancelled) {
-        return;
-        }
-        t->cancelled = ETIMEDOUT;
-        iom->cancelEvent(fd, sylar::IOManager::WRITE);
-        }, winfo);
-    }
-
-    // 为文件描述符添加一个 WRITE 事件
-    int rt = iom->addEvent(fd, IOManager::WRITE);
-    if(rt==0){
-        Fiber::GetThis()->yield();
-        if(timer) timer->cancel();{
-            if(tinfo->cancelled){
-                errno = tinfo->cancelled;
-                return -1;
-            }
-        }else{
-            if(timer){
-                timer->cancel();
-            }
-        }
-        SYLAR_LOG_ERROR(g_logger) << "connect addEvent(" << fd << ", WRITE) error";
+    // 等待可写，超时或者取消令牌失效时返回对应错误
+    int err = wait_event(fd, IOManager::WRITE, timeout_ms);
+    if(err){
+        errno = err;
+        return -1;
     }
 
     int error = 0;
@@ -105,4 +287,342 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
         errno = error;
         return -1;
     }
-}
\ No newline at end of file
+}
+
+int connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen){
+    return connect_with_timeout(sockfd, addr, addrlen, (uint64_t)-1);
+}
+
+/**
+ * @brief socket IO的通用hook实现
+ * @details 先直接调用原始函数，返回EAGAIN时在fd上注册事件并挂起当前协程，
+ * 事件就绪后重试；超时时间取fd上设置的SO_RCVTIMEO/SO_SNDTIMEO与取消令牌截止时间的较小值
+ * @param[in] fd 文件句柄
+ * @param[in] fun 原始函数
+ * @param[in] hook_fun_name 函数名，用于日志
+ * @param[in] event 等待的事件
+ * @param[in] timeout_so 超时类型
+ */
+template<typename OriginFun, typename... Args>
+static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name,
+        IOManager::Event event, int timeout_so, Args&&... args){
+    if(!t_hook_enable){
+        return fun(fd, std::forward<Args>(args)...);
+    }
+    // 数据总是就绪的IO不会挂起，在这里响应抢占请求
+    Fiber::MaybeYield();
+
+    FdCtx::ptr ctx = FdMgr::GetInstance()->get(fd);
+    if(!ctx){
+        return fun(fd, std::forward<Args>(args)...);
+    }
+    if(ctx->isClose()){
+        errno = EBADF;
+        return -1;
+    }
+    if(!ctx->isSocket() || ctx->getUserNonblock()){
+        return fun(fd, std::forward<Args>(args)...);
+    }
+
+    uint64_t to = ctx->getTimeout(timeout_so);
+    while(true){
+        ssize_t n = fun(fd, std::forward<Args>(args)...);
+        while(n == -1 && errno == EINTR){
+            n = fun(fd, std::forward<Args>(args)...);
+        }
+        if(n != -1 || errno != EAGAIN){
+            return n;
+        }
+
+        int err = wait_event(fd, event, to);
+        if(err){
+            if(err == EINVAL){
+                SYLAR_LOG_ERROR(g_logger) << hook_fun_name << " wait_event(" << fd << ", " << event << ") error";
+            }
+            errno = err;
+            return -1;
+        }
+    }
+}
+
+int accept(int s, struct sockaddr *addr, socklen_t *addrlen){
+    int fd = do_io(s, accept_f, "accept", IOManager::READ, SO_RCVTIMEO, addr, addrlen);
+    if(fd >= 0){
+        FdMgr::GetInstance()->get(fd, true);
+    }
+    return fd;
+}
+
+ssize_t read(int fd, void *buf, size_t count){
+    return do_io(fd, read_f, "read", IOManager::READ, SO_RCVTIMEO, buf, count);
+}
+
+ssize_t readv(int fd, const struct iovec *iov, int iovcnt){
+    return do_io(fd, readv_f, "readv", IOManager::READ, SO_RCVTIMEO, iov, iovcnt);
+}
+
+ssize_t recv(int sockfd, void *buf, size_t len, int flags){
+    return do_io(sockfd, recv_f, "recv", IOManager::READ, SO_RCVTIMEO, buf, len, flags);
+}
+
+ssize_t recvfrom(int sockfd, void *buf, size_t len, int flags, struct sockaddr *src_addr, socklen_t *addrlen){
+    return do_io(sockfd, recvfrom_f, "recvfrom", IOManager::READ, SO_RCVTIMEO, buf, len, flags, src_addr, addrlen);
+}
+
+ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags){
+    return do_io(sockfd, recvmsg_f, "recvmsg", IOManager::READ, SO_RCVTIMEO, msg, flags);
+}
+
+/**
+ * @brief recvmmsg的hook实现
+ * @details 非阻塞socket上只返回已到达的报文，一个都没有时挂起等待可读；
+ * timeout参数原样传给内核，挂起的超时由SO_RCVTIMEO决定
+ */
+int recvmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags, struct timespec *timeout){
+    return do_io(sockfd, recvmmsg_f, "recvmmsg", IOManager::READ, SO_RCVTIMEO, msgvec, vlen, flags, timeout);
+}
+
+ssize_t write(int fd, const void *buf, size_t count){
+    return do_io(fd, write_f, "write", IOManager::WRITE, SO_SNDTIMEO, buf, count);
+}
+
+ssize_t writev(int fd, const struct iovec *iov, int iovcnt){
+    return do_io(fd, writev_f, "writev", IOManager::WRITE, SO_SNDTIMEO, iov, iovcnt);
+}
+
+ssize_t send(int s, const void *msg, size_t len, int flags){
+    return do_io(s, send_f, "send", IOManager::WRITE, SO_SNDTIMEO, msg, len, flags);
+}
+
+ssize_t sendto(int s, const void *msg, size_t len, int flags, const struct sockaddr *to, socklen_t tolen){
+    return do_io(s, sendto_f, "sendto", IOManager::WRITE, SO_SNDTIMEO, msg, len, flags, to, tolen);
+}
+
+ssize_t sendmsg(int s, const struct msghdr *msg, int flags){
+    return do_io(s, sendmsg_f, "sendmsg", IOManager::WRITE, SO_SNDTIMEO, msg, flags);
+}
+
+/**
+ * @brief sendmmsg的hook实现
+ * @details 发送缓冲区满时挂起，可能只发出前一部分报文，返回值是发出的报文数
+ */
+int sendmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen, int flags){
+    return do_io(sockfd, sendmmsg_f, "sendmmsg", IOManager::WRITE, SO_SNDTIMEO, msgvec, vlen, flags);
+}
+
+ssize_t sendfile(int out_fd, int in_fd, off_t *offset, size_t count){
+    return do_io(out_fd, sendfile_f, "sendfile", IOManager::WRITE, SO_SNDTIMEO, in_fd, offset, count);
+}
+
+/**
+ * @brief splice的hook实现
+ * @details 两端中至少有一端是管道。EAGAIN可能来自socket没有就绪，也可能来自管道满或空，
+ * 后一种情况socket一直就绪，在socket上等待会空转；这里先检查管道一端，
+ * 管道没有就绪时挂起在管道上（输入是socket时等管道可写，否则等管道可读），否则挂起在socket上
+ */
+ssize_t splice(int fd_in, loff_t *off_in, int fd_out, loff_t *off_out, size_t len, unsigned int flags){
+    if(!t_hook_enable){
+        return splice_f(fd_in, off_in, fd_out, off_out, len, flags);
+    }
+    FdCtx::ptr in = FdMgr::GetInstance()->get(fd_in);
+    bool in_sock = in && in->isSocket();
+    FdCtx::ptr ctx = in_sock ? in : FdMgr::GetInstance()->get(fd_out);
+    if(!ctx || !ctx->isSocket() || ctx->getUserNonblock()){
+        return splice_f(fd_in, off_in, fd_out, off_out, len, flags);
+    }
+    if(ctx->isClose()){
+        errno = EBADF;
+        return -1;
+    }
+    Fiber::MaybeYield();
+
+    int sock = in_sock ? fd_in : fd_out;
+    int pipe_fd = in_sock ? fd_out : fd_in;
+    IOManager::Event sock_event = in_sock ? IOManager::READ : IOManager::WRITE;
+    IOManager::Event pipe_event = in_sock ? IOManager::WRITE : IOManager::READ;
+    uint64_t to = ctx->getTimeout(in_sock ? SO_RCVTIMEO : SO_SNDTIMEO);
+    while(true){
+        ssize_t n = splice_f(fd_in, off_in, fd_out, off_out, len, flags | SPLICE_F_NONBLOCK);
+        if(n >= 0){
+            return n;
+        }
+        if(errno == EINTR){
+            continue;
+        }
+        if(errno != EAGAIN){
+            return -1;
+        }
+        pollfd pfd;
+        pfd.fd = pipe_fd;
+        pfd.events = pipe_event == IOManager::READ ? POLLIN : POLLOUT;
+        pfd.revents = 0;
+        bool pipe_ready = poll(&pfd, 1, 0) > 0;
+        int err = wait_event(pipe_ready ? sock : pipe_fd, pipe_ready ? sock_event : pipe_event, to);
+        if(err){
+            if(err == EINVAL){
+                SYLAR_LOG_ERROR(g_logger) << "splice wait_event(" << (pipe_ready ? sock : pipe_fd) << ") error";
+            }
+            errno = err;
+            return -1;
+        }
+    }
+}
+
+/**
+ * @brief tee的hook实现
+ * @details tee的两端都是管道，do_io对非socket直接调用原始函数，这里只响应抢占请求
+ */
+ssize_t tee(int fd_in, int fd_out, size_t len, unsigned int flags){
+    return do_io(fd_in, tee_f, "tee", IOManager::READ, SO_RCVTIMEO, fd_out, len, flags);
+}
+
+/**
+ * @brief 读取错误队列中的MSG_ZEROCOPY完成通知，推进fd上已完成的编号
+ * @details TCP按发送顺序释放缓冲区，通知里的编号区间是递增的；
+ * 内核回退为拷贝时关闭这个fd后续的零拷贝发送
+ * @return 是否读到了完成通知
+ */
+static bool reap_zerocopy(int fd, const FdCtx::ptr &ctx){
+    bool got = false;
+    while(true){
+        char control[128];
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if(recvmsg_f(fd, &msg, MSG_ERRQUEUE) == -1){
+            if(errno == EINTR) continue;
+            return got;
+        }
+        for(cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)){
+            if(!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR)
+                    && !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)){
+                continue;
+            }
+            sock_extended_err *serr = (sock_extended_err*)CMSG_DATA(cm);
+            if(serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr->ee_errno != 0){
+                continue;
+            }
+            // [ee_info, ee_data]是这次释放的编号区间
+            uint32_t hi = serr->ee_data + 1;
+            if((int32_t)(hi - ctx->getZeroCopyDone()) > 0){
+                ctx->setZeroCopyDone(hi);
+            }
+            if(serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED){
+                ctx->setZeroCopy(-1);
+            }
+            got = true;
+        }
+    }
+}
+
+ssize_t send_zerocopy(int fd, const void *buf, size_t len, int flags){
+    FdCtx::ptr ctx = t_hook_enable ? FdMgr::GetInstance()->get(fd) : nullptr;
+    if(!ctx || ctx->isClose() || !ctx->isSocket() || ctx->getUserNonblock()
+            || len < ZEROCOPY_MIN_SIZE || ctx->getZeroCopy() < 0){
+        return send(fd, buf, len, flags);
+    }
+    if(ctx->getZeroCopy() == 0){
+        int one = 1;
+        ctx->setZeroCopy(setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) ? -1 : 1);
+        if(ctx->getZeroCopy() < 0){
+            return send(fd, buf, len, flags);
+        }
+    }
+    Fiber::MaybeYield();
+    // 顺便收取之前发送的完成通知，不为它们等待
+    reap_zerocopy(fd, ctx);
+
+    uint64_t to = ctx->getTimeout(SO_SNDTIMEO);
+    const char *p = (const char*)buf;
+    size_t left = len;
+    while(left){
+        ssize_t n = send_f(fd, p, left, flags | MSG_ZEROCOPY);
+        if(n > 0){
+            ctx->incZeroCopySent();
+            p += n;
+            left -= n;
+            continue;
+        }
+        if(n == -1 && errno == EINTR){
+            continue;
+        }
+        // ENOBUFS表示固定的页超过了optmem限制，和EAGAIN一样先等一部分完成
+        if(n == -1 && (errno == EAGAIN || errno == ENOBUFS)){
+            if(reap_zerocopy(fd, ctx)){
+                continue;
+            }
+            int err = wait_event(fd, IOManager::WRITE, to);
+            if(err){
+                if(left == len){
+                    errno = err;
+                    return -1;
+                }
+                break;
+            }
+            continue;
+        }
+        if(left == len){
+            return -1;
+        }
+        break;
+    }
+    return len - left;
+}
+
+uint32_t zerocopy_seq(int fd){
+    FdCtx::ptr ctx = FdMgr::GetInstance()->get(fd);
+    return ctx ? ctx->getZeroCopySent() : 0;
+}
+
+int zerocopy_wait(int fd, uint32_t seq, uint64_t timeout_ms){
+    FdCtx::ptr ctx = FdMgr::GetInstance()->get(fd);
+    if(!ctx || ctx->getZeroCopy() <= 0){
+        return 0;
+    }
+    uint64_t deadline = timeout_ms == ~0ull ? ~0ull : GetCurrentMS() + timeout_ms;
+    // 完成通知进入错误队列时以EPOLLERR上报，挂起在ERROR事件上等通知，注册时epoll会检查当前是否就绪，
+    // 注册之前到达的通知不会错过。定时器只是兜底，每次最多等FALLBACK_MS再检查一次；
+    // 醒来却没有收到任何通知（连接出错或挂断时EPOLLERR会一直就绪）就改为退避睡眠，避免空转
+    static const uint64_t FALLBACK_MS = 100;
+    CancelToken::ptr token = Fiber::GetThis()->getCancelToken();
+    bool spurious = false;
+    uint64_t backoff_ms = 1;
+    while((int32_t)(seq - ctx->getZeroCopyDone()) > 0){
+        if(reap_zerocopy(fd, ctx)){
+            spurious = false;
+            backoff_ms = 1;
+            continue;
+        }
+        if(ctx->isClose()){
+            return EBADF;
+        }
+        // 令牌失效时wait_event直接返回ETIMEDOUT，不能当作兜底定时器到期
+        int err = token ? token->error() : 0;
+        if(err){
+            return err;
+        }
+        uint64_t now = GetCurrentMS();
+        if(now >= deadline){
+            return ETIMEDOUT;
+        }
+        uint64_t wait = std::min(spurious ? backoff_ms : FALLBACK_MS, deadline - now);
+        int rt;
+        if(spurious){
+            rt = wait_ms(wait);
+            backoff_ms = std::min<uint64_t>(backoff_ms * 2, 8);
+        }else{
+            rt = wait_event(fd, IOManager::ERROR, wait);
+            // 兜底定时器到期，回到循环开头检查截止时间
+            if(rt == ETIMEDOUT && GetCurrentMS() < deadline){
+                rt = 0;
+            }else if(!rt){
+                spurious = true;
+            }
+        }
+        if(rt){
+            return rt;
+        }
+    }
+    return 0;
+}
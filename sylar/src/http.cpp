@@ -0,0 +1,355 @@
+#include "http.h"
+#include <stdio.h>
+
+namespace {
+
+const char *SkipSpace(const char *p, const char *end)
+{
+    while(p < end && (*p == ' ' || *p == '\t'))
+        ++p;
+    return p;
+}
+
+HttpStr TrimRight(const char *begin, const char *end)
+{
+    while(end > begin && (end[-1] == ' ' || end[-1] == '\t'))
+        --end;
+    return HttpStr(begin, end - begin);
+}
+
+}
+
+HttpStr HttpRequest::getHeader(const char *name) const
+{
+    for(auto &h : m_headers){
+        if(h.first.iequals(name))
+            return h.second;
+    }
+    return HttpStr();
+}
+
+void HttpRequest::clear()
+{
+    m_raw.clear();
+    m_method = m_path = m_query = m_version = HttpStr();
+    m_headers.clear();
+    m_body.clear();
+    m_http11 = true;
+    m_keepAlive = true;
+}
+
+bool HttpRequestParser::parseRequestLine(HttpRequest &req)
+{
+    const char *p = req.m_raw.data();
+    const char *end = p + req.m_raw.size() - 2;
+    const char *eol = (const char*)memchr(p, '\r', end - p);
+    if(!eol)
+        return false;
+
+    // METHOD SP request-target SP HTTP-version
+    const char *sp1 = (const char*)memchr(p, ' ', eol - p);
+    if(!sp1 || sp1 == p)
+        return false;
+    const char *target = sp1 + 1;
+    const char *sp2 = (const char*)memchr(target, ' ', eol - target);
+    if(!sp2 || sp2 == target)
+        return false;
+    req.m_method = HttpStr(p, sp1 - p);
+    const char *q = (const char*)memchr(target, '?', sp2 - target);
+    if(q){
+        req.m_path = HttpStr(target, q - target);
+        req.m_query = HttpStr(q + 1, sp2 - q - 1);
+    }else{
+        req.m_path = HttpStr(target, sp2 - target);
+    }
+    req.m_version = HttpStr(sp2 + 1, eol - sp2 - 1);
+    if(req.m_version.equals("HTTP/1.1")){
+        req.m_http11 = true;
+    }else if(req.m_version.equals("HTTP/1.0")){
+        req.m_http11 = false;
+    }else{
+        return false;
+    }
+
+    // name ":" OWS value OWS CRLF，不支持已废弃的折行
+    p = eol + 2;
+    while(p < end){
+        eol = (const char*)memchr(p, '\r', end - p + 2);
+        if(!eol || eol[1] != '\n')
+            return false;
+        const char *colon = (const char*)memchr(p, ':', eol - p);
+        if(!colon || colon == p || colon[-1] == ' ' || colon[-1] == '\t')
+            return false;
+        const char *v = SkipSpace(colon + 1, eol);
+        req.m_headers.push_back(HttpRequest::Header(HttpStr(p, colon - p), TrimRight(v, eol)));
+        p = eol + 2;
+    }
+
+    HttpStr conn = req.getHeader("Connection");
+    req.m_keepAlive = req.m_http11 ? !conn.iequals("close") : conn.iequals("keep-alive");
+    return true;
+}
+
+HttpRequestParser::Result HttpRequestParser::parseHead(IOBuf &buf, HttpRequest &req)
+{
+    size_t pos = buf.find("\r\n\r\n", 4, m_scanned);
+    if(pos == IOBuf::npos){
+        if(buf.size() > m_maxHeader)
+            return error(431);
+        // 结束标记可能跨越这次和下次读到的数据，回退3个字节
+        m_scanned = buf.size() > 3 ? buf.size() - 3 : 0;
+        return AGAIN;
+    }
+    size_t len = pos + 4;
+    if(len > m_maxHeader)
+        return error(431);
+    m_scanned = 0;
+
+    req.clear();
+    req.m_raw.resize(len);
+    buf.copyTo(&req.m_raw[0], len);
+    buf.consume(len);
+    if(!parseRequestLine(req))
+        return error(400);
+
+    HttpStr te = req.getHeader("Transfer-Encoding");
+    HttpStr cl = req.getHeader("Content-Length");
+    if(!te.empty()){
+        if(!te.iequals("chunked"))
+            return error(501);
+        // 同时带有两种长度的请求可能被用来夹带请求，直接拒绝
+        if(!cl.empty())
+            return error(400);
+        m_state = CHUNK_SIZE;
+        return AGAIN;
+    }
+    if(!cl.empty()){
+        uint64_t n = 0;
+        for(size_t i = 0; i < cl.len; ++i){
+            if(cl.data[i] < '0' || cl.data[i] > '9' || n > m_maxBody)
+                return error(400);
+            n = n * 10 + (cl.data[i] - '0');
+        }
+        if(n > m_maxBody)
+            return error(413);
+        if(n){
+            m_remain = n;
+            m_state = BODY;
+            return AGAIN;
+        }
+    }
+    return OK;
+}
+
+HttpRequestParser::Result HttpRequestParser::parse(IOBuf &buf, HttpRequest &req)
+{
+    if(m_state == HEADER){
+        Result rt = parseHead(buf, req);
+        if(rt != AGAIN || m_state == HEADER)
+            return rt;
+    }
+    while(true){
+        switch(m_state){
+            case HEADER:
+                return OK;
+            case BODY:
+                if(buf.size() < m_remain)
+                    return AGAIN;
+                buf.cutTo(req.m_body, m_remain);
+                m_state = HEADER;
+                return OK;
+            case CHUNK_SIZE: {
+                // chunk-size [; ext] CRLF
+                size_t pos = buf.find("\r\n", 2);
+                if(pos == IOBuf::npos){
+                    if(buf.size() > 256)
+                        return error(400);
+                    return AGAIN;
+                }
+                char line[257];
+                if(pos > 256)
+                    return error(400);
+                buf.copyTo(line, pos);
+                buf.consume(pos + 2);
+                size_t n = 0;
+                size_t i = 0;
+                for(; i < pos; ++i){
+                    char c = line[i];
+                    int d;
+                    if(c >= '0' && c <= '9') d = c - '0';
+                    else if(c >= 'a' && c <= 'f') d = c - 'a' + 10;
+                    else if(c >= 'A' && c <= 'F') d = c - 'A' + 10;
+                    else break;
+                    if(n > m_maxBody)
+                        return error(413);
+                    n = n * 16 + d;
+                }
+                if(!i || (i < pos && line[i] != ';' && line[i] != ' ' && line[i] != '\t'))
+                    return error(400);
+                if(!n){
+                    m_trailer = 0;
+                    m_state = TRAILER;
+                    break;
+                }
+                if(req.m_body.size() + n > m_maxBody)
+                    return error(413);
+                m_remain = n;
+                m_state = CHUNK_DATA;
+                break;
+            }
+            case CHUNK_DATA: {
+                if(buf.size() < m_remain + 2)
+                    return AGAIN;
+                buf.cutTo(req.m_body, m_remain);
+                char crlf[2];
+                buf.copyTo(crlf, 2);
+                if(crlf[0] != '\r' || crlf[1] != '\n')
+                    return error(400);
+                buf.consume(2);
+                m_state = CHUNK_SIZE;
+                break;
+            }
+            case TRAILER: {
+                // 尾部的头部被忽略，遇到空行结束
+                size_t pos = buf.find("\r\n", 2);
+                if(pos == IOBuf::npos){
+                    if(m_trailer + buf.size() > m_maxHeader)
+                        return error(431);
+                    return AGAIN;
+                }
+                m_trailer += pos + 2;
+                if(m_trailer > m_maxHeader)
+                    return error(431);
+                buf.consume(pos + 2);
+                if(!pos){
+                    m_state = HEADER;
+                    return OK;
+                }
+                break;
+            }
+        }
+    }
+}
+
+void HttpResponse::addHeader(const std::string &name, const std::string &value)
+{
+    m_headers.push_back(std::make_pair(name, value));
+}
+
+void HttpResponse::reset(int fd, IOBuf *out, const HttpRequest &req)
+{
+    m_status = 200;
+    m_reason = nullptr;
+    m_headers.clear();
+    m_body.clear();
+    m_keepAlive = req.isKeepAlive();
+    m_http11 = req.isHttp11();
+    m_chunked = false;
+    m_fd = fd;
+    m_out = out;
+}
+
+const char *HttpResponse::StatusReason(int status)
+{
+    switch(status){
+        case 100: return "Continue";
+        case 200: return "OK";
+        case 201: return "Created";
+        case 204: return "No Content";
+        case 206: return "Partial Content";
+        case 301: return "Moved Permanently";
+        case 302: return "Found";
+        case 304: return "Not Modified";
+        case 400: return "Bad Request";
+        case 401: return "Unauthorized";
+        case 403: return "Forbidden";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 408: return "Request Timeout";
+        case 413: return "Payload Too Large";
+        case 429: return "Too Many Requests";
+        case 431: return "Request Header Fields Too Large";
+        case 500: return "Internal Server Error";
+        case 501: return "Not Implemented";
+        case 502: return "Bad Gateway";
+        case 503: return "Service Unavailable";
+        case 504: return "Gateway Timeout";
+    }
+    return "Unknown";
+}
+
+void HttpResponse::appendHead(bool chunked)
+{
+    char line[64];
+    int n = snprintf(line, sizeof(line), "HTTP/1.%d %d ", m_http11 ? 1 : 0, m_status);
+    m_out->append(line, n);
+    const char *reason = m_reason ? m_reason : StatusReason(m_status);
+    m_out->append(reason, strlen(reason));
+    m_out->append("\r\n", 2);
+    for(auto &h : m_headers){
+        m_out->append(h.first);
+        m_out->append(": ", 2);
+        m_out->append(h.second);
+        m_out->append("\r\n", 2);
+    }
+    if(chunked){
+        static const char te[] = "Transfer-Encoding: chunked\r\n";
+        m_out->append(te, sizeof(te) - 1);
+    }else{
+        n = snprintf(line, sizeof(line), "Content-Length: %zu\r\n", m_body.size());
+        m_out->append(line, n);
+    }
+    // HTTP/1.1默认保持连接，HTTP/1.0默认关闭
+    if(!m_keepAlive){
+        static const char close[] = "Connection: close\r\n\r\n";
+        m_out->append(close, sizeof(close) - 1);
+    }else if(!m_http11){
+        static const char keep[] = "Connection: keep-alive\r\n\r\n";
+        m_out->append(keep, sizeof(keep) - 1);
+    }else{
+        m_out->append("\r\n", 2);
+    }
+}
+
+bool HttpResponse::writeChunk(const void *data, size_t len)
+{
+    // HTTP/1.0不支持chunked，只能先缓存起来，处理结束后带长度发送
+    if(!m_http11){
+        m_body.append(data, len);
+        return true;
+    }
+    if(!m_chunked){
+        m_chunked = true;
+        appendHead(true);
+        if(!m_body.empty()){
+            char line[32];
+            int n = snprintf(line, sizeof(line), "%zx\r\n", m_body.size());
+            m_out->append(line, n);
+            m_out->append(std::move(m_body));
+            m_out->append("\r\n", 2);
+        }
+    }
+    if(len){
+        char line[32];
+        int n = snprintf(line, sizeof(line), "%zx\r\n", len);
+        m_out->append(line, n);
+        m_out->append(data, len);
+        m_out->append("\r\n", 2);
+    }
+    return FlushAll(*m_out, m_fd);
+}
+
+void HttpResponse::finish()
+{
+    if(m_chunked){
+        m_out->append("0\r\n\r\n", 5);
+        return;
+    }
+    appendHead(false);
+    m_out->append(std::move(m_body));
+}
+
+bool HttpResponse::FlushAll(IOBuf &buf, int fd)
+{
+    return buf.writeAll(fd);
+}
@@ -0,0 +1,75 @@
+#include "http_server.h"
+#include "cancel.h"
+
+HttpServer::HttpServer(IOManager *worker, const std::string &name)
+    :TcpServer(worker, name)
+{
+}
+
+void HttpServer::addHandler(const std::string &path, Handler cb)
+{
+    m_handlers.push_back(std::make_pair(path, cb));
+}
+
+void HttpServer::dispatch(HttpRequest &req, HttpResponse &resp)
+{
+    // 路由一般只有几条，线性比较不需要为路径构造字符串
+    HttpStr path = req.getPath();
+    for(auto &i : m_handlers){
+        if(i.first.size() == path.len && !memcmp(i.first.data(), path.data, path.len)){
+            i.second(req, resp);
+            return;
+        }
+    }
+    if(m_default){
+        m_default(req, resp);
+        return;
+    }
+    resp.setStatus(404);
+}
+
+void HttpServer::handleClient(int fd)
+{
+    IOBuf in;
+    IOBuf out;
+    HttpRequestParser parser(m_maxHeader, m_maxBody);
+    HttpRequest req;
+    HttpResponse resp;
+
+    while(true){
+        bool close = false;
+        HttpRequestParser::Result rt;
+        while((rt = parser.parse(in, req)) == HttpRequestParser::OK){
+            resp.reset(fd, &out, req);
+            dispatch(req, resp);
+            if(isStop())
+                resp.setKeepAlive(false);
+            resp.finish();
+            if(!resp.isKeepAlive()){
+                close = true;
+                break;
+            }
+        }
+        if(rt == HttpRequestParser::ERROR){
+            // 出错后无法再确定下一个请求的边界，应答后关闭连接
+            resp.reset(fd, &out, req);
+            resp.setStatus(parser.getStatus());
+            resp.setKeepAlive(false);
+            resp.finish();
+            close = true;
+        }
+        if(!out.empty() && !HttpResponse::FlushAll(out, fd))
+            return;
+        if(close || isStop())
+            return;
+
+        // 超时通过取消令牌作用于hook的readv，由IOManager的定时器唤醒
+        ssize_t n;
+        {
+            CancelScope scope(parser.isIdle() && in.empty() ? m_idleTimeout : m_readTimeout);
+            n = in.readFrom(fd);
+        }
+        if(n <= 0)
+            return;
+    }
+}
@@ -0,0 +1,475 @@
+#include "iobuf.h"
+#include <string.h>
+#include <errno.h>
+#include <sys/uio.h>
+#include <new>
+#include <algorithm>
+
+namespace {
+
+/**
+ * 线程局部的块池，只缓存有限个空闲块；
+ * 线程退出后再释放到这个线程的块直接归还给系统
+ */
+struct BlockPool{
+    static const size_t kMaxBlocks = 256;
+
+    IOBuf::Block *head = nullptr;
+    size_t count = 0;
+    bool alive = true;
+
+    ~BlockPool(){
+        alive = false;
+        while(head){
+            IOBuf::Block *b = head;
+            head = b->next;
+            ::operator delete(b);
+        }
+        count = 0;
+    }
+};
+
+thread_local BlockPool t_pool;
+
+}
+
+IOBuf::Block *IOBuf::Block::Alloc()
+{
+    Block *b;
+    if(t_pool.head){
+        b = t_pool.head;
+        t_pool.head = b->next;
+        --t_pool.count;
+    }else{
+        b = static_cast<Block*>(::operator new(kBlockSize));
+        new (&b->refs) std::atomic<uint32_t>(0);
+        b->cap = kBlockSize - sizeof(Block);
+    }
+    b->refs.store(1, std::memory_order_relaxed);
+    b->size = 0;
+    b->next = nullptr;
+    return b;
+}
+
+void IOBuf::Block::unref()
+{
+    if(refs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+        return;
+    if(t_pool.alive && t_pool.count < BlockPool::kMaxBlocks){
+        next = t_pool.head;
+        t_pool.head = this;
+        ++t_pool.count;
+    }else{
+        ::operator delete(this);
+    }
+}
+
+IOBuf &IOBuf::operator=(const IOBuf &other)
+{
+    if(this != &other){
+        clear();
+        append(other);
+    }
+    return *this;
+}
+
+IOBuf &IOBuf::operator=(IOBuf &&other)
+{
+    if(this != &other){
+        clear();
+        m_refs.swap(other.m_refs);
+        m_size = other.m_size;
+        other.m_size = 0;
+    }
+    return *this;
+}
+
+void IOBuf::clear()
+{
+    for(auto &r : m_refs)
+        r.block->unref();
+    m_refs.clear();
+    m_size = 0;
+}
+
+size_t IOBuf::tailRoom() const
+{
+    if(m_refs.empty())
+        return 0;
+    const Ref &r = m_refs.back();
+    Block *b = r.block;
+    if(b->refs.load(std::memory_order_acquire) != 1 || r.offset + r.length != b->size)
+        return 0;
+    return b->cap - b->size;
+}
+
+void IOBuf::append(const void *data, size_t len)
+{
+    const char *p = static_cast<const char*>(data);
+    while(len){
+        size_t room = tailRoom();
+        if(!room){
+            Block *b = Block::Alloc();
+            m_refs.push_back(Ref{b, 0, 0});
+            room = b->cap;
+        }
+        Ref &r = m_refs.back();
+        size_t n = std::min(room, len);
+        memcpy(r.block->data + r.block->size, p, n);
+        r.block->size += n;
+        r.length += n;
+        m_size += n;
+        p += n;
+        len -= n;
+    }
+}
+
+void IOBuf::append(const IOBuf &other)
+{
+    if(&other == this){
+        IOBuf tmp(other);
+        append(std::move(tmp));
+        return;
+    }
+    for(auto &r : other.m_refs){
+        r.block->ref();
+        m_refs.push_back(r);
+    }
+    m_size += other.m_size;
+}
+
+void IOBuf::append(IOBuf &&other)
+{
+    if(&other == this)
+        return;
+    for(auto &r : other.m_refs)
+        m_refs.push_back(r);
+    m_size += other.m_size;
+    other.m_refs.clear();
+    other.m_size = 0;
+}
+
+size_t IOBuf::cutTo(IOBuf &out, size_t n)
+{
+    n = std::min(n, m_size);
+    size_t left = n;
+    while(left){
+        Ref &r = m_refs.front();
+        if(r.length <= left){
+            out.m_refs.push_back(r);
+            left -= r.length;
+            m_refs.pop_front();
+        }else{
+            // 块被拆成两段，各持有一个引用
+            r.block->ref();
+            out.m_refs.push_back(Ref{r.block, r.offset, (uint32_t)left});
+            r.offset += left;
+            r.length -= left;
+            left = 0;
+        }
+    }
+    m_size -= n;
+    out.m_size += n;
+    return n;
+}
+
+size_t IOBuf::consume(size_t n)
+{
+    n = std::min(n, m_size);
+    size_t left = n;
+    while(left){
+        Ref &r = m_refs.front();
+        if(r.length <= left){
+            left -= r.length;
+            r.block->unref();
+            m_refs.pop_front();
+        }else{
+            r.offset += left;
+            r.length -= left;
+            left = 0;
+        }
+    }
+    m_size -= n;
+    return n;
+}
+
+size_t IOBuf::copyTo(void *buf, size_t n, size_t offset) const
+{
+    char *p = static_cast<char*>(buf);
+    size_t copied = 0;
+    for(auto &r : m_refs){
+        if(copied >= n)
+            break;
+        if(offset >= r.length){
+            offset -= r.length;
+            continue;
+        }
+        size_t len = std::min<size_t>(r.length - offset, n - copied);
+        memcpy(p + copied, r.block->data + r.offset + offset, len);
+        copied += len;
+        offset = 0;
+    }
+    return copied;
+}
+
+std::string IOBuf::toString() const
+{
+    std::string s;
+    s.resize(m_size);
+    if(m_size)
+        copyTo(&s[0], m_size);
+    return s;
+}
+
+bool IOBuf::equalAt(size_t ref, size_t off, const char *s, size_t n) const
+{
+    while(n){
+        if(ref >= m_refs.size())
+            return false;
+        const Ref &r = m_refs[ref];
+        size_t len = std::min<size_t>(r.length - off, n);
+        if(memcmp(r.block->data + r.offset + off, s, len))
+            return false;
+        s += len;
+        n -= len;
+        ++ref;
+        off = 0;
+    }
+    return true;
+}
+
+size_t IOBuf::find(const char *s, size_t n, size_t start) const
+{
+    if(!n || start + n > m_size)
+        return npos;
+    // base是当前区间在缓冲区中的起始位置
+    size_t base = 0;
+    for(size_t i = 0; i < m_refs.size(); ++i){
+        const Ref &r = m_refs[i];
+        if(start >= base + r.length){
+            base += r.length;
+            continue;
+        }
+        const char *data = r.block->data + r.offset;
+        size_t off = start > base ? start - base : 0;
+        while(off < r.length){
+            const char *p = (const char*)memchr(data + off, s[0], r.length - off);
+            if(!p)
+                break;
+            off = p - data;
+            if(base + off + n > m_size)
+                return npos;
+            if(equalAt(i, off, s, n))
+                return base + off;
+            ++off;
+        }
+        base += r.length;
+    }
+    return npos;
+}
+
+ssize_t IOBuf::readFrom(int fd, size_t max_len)
+{
+    static const size_t MAX_IOV = 16;
+    iovec iov[MAX_IOV];
+    Block *blocks[MAX_IOV];
+    size_t niov = 0;
+    size_t nblocks = 0;
+    size_t total = 0;
+
+    size_t room = tailRoom();
+    if(room){
+        Block *b = m_refs.back().block;
+        iov[niov].iov_base = b->data + b->size;
+        iov[niov].iov_len = std::min(room, max_len);
+        total += iov[niov].iov_len;
+        ++niov;
+    }
+    while(total < max_len && niov < MAX_IOV){
+        Block *b = Block::Alloc();
+        blocks[nblocks++] = b;
+        iov[niov].iov_base = b->data;
+        iov[niov].iov_len = std::min<size_t>(b->cap, max_len - total);
+        total += iov[niov].iov_len;
+        ++niov;
+    }
+
+    ssize_t rt = ::readv(fd, iov, niov);
+    size_t left = rt > 0 ? rt : 0;
+    m_size += left;
+    if(room){
+        size_t n = std::min(left, (size_t)iov[0].iov_len);
+        m_refs.back().length += n;
+        m_refs.back().block->size += n;
+        left -= n;
+    }
+    for(size_t i = 0; i < nblocks; ++i){
+        Block *b = blocks[i];
+        if(!left){
+            b->unref();
+            continue;
+        }
+        size_t n = std::min<size_t>(left, b->cap);
+        b->size = n;
+        m_refs.push_back(Ref{b, 0, (uint32_t)n});
+        left -= n;
+    }
+    return rt;
+}
+
+ssize_t IOBuf::writeTo(int fd)
+{
+    static const size_t MAX_IOV = 64;
+    iovec iov[MAX_IOV];
+    size_t niov = 0;
+    for(auto &r : m_refs){
+        if(niov >= MAX_IOV)
+            break;
+        iov[niov].iov_base = r.block->data + r.offset;
+        iov[niov].iov_len = r.length;
+        ++niov;
+    }
+    if(!niov)
+        return 0;
+    ssize_t rt = ::writev(fd, iov, niov);
+    if(rt > 0)
+        consume(rt);
+    return rt;
+}
+
+bool IOBuf::writeAll(int fd)
+{
+    while(!empty()){
+        ssize_t n = writeTo(fd);
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return false;
+    }
+    return true;
+}
+
+void IOBuf::writeFixed16(uint16_t v)
+{
+    uint8_t b[2] = {(uint8_t)(v >> 8), (uint8_t)v};
+    append(b, sizeof(b));
+}
+
+void IOBuf::writeFixed32(uint32_t v)
+{
+    uint8_t b[4];
+    for(int i = 0; i < 4; ++i)
+        b[i] = (uint8_t)(v >> (24 - 8 * i));
+    append(b, sizeof(b));
+}
+
+void IOBuf::writeFixed64(uint64_t v)
+{
+    uint8_t b[8];
+    for(int i = 0; i < 8; ++i)
+        b[i] = (uint8_t)(v >> (56 - 8 * i));
+    append(b, sizeof(b));
+}
+
+void IOBuf::writeVarint64(uint64_t v)
+{
+    uint8_t b[10];
+    size_t n = 0;
+    while(v >= 0x80){
+        b[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    b[n++] = (uint8_t)v;
+    append(b, n);
+}
+
+bool IOBuf::readFixed8(uint8_t &v)
+{
+    if(m_size < 1) return false;
+    copyTo(&v, 1);
+    consume(1);
+    return true;
+}
+
+bool IOBuf::readFixed16(uint16_t &v)
+{
+    uint8_t b[2];
+    if(m_size < sizeof(b)) return false;
+    copyTo(b, sizeof(b));
+    consume(sizeof(b));
+    v = (uint16_t)(b[0] << 8 | b[1]);
+    return true;
+}
+
+bool IOBuf::readFixed32(uint32_t &v)
+{
+    uint8_t b[4];
+    if(m_size < sizeof(b)) return false;
+    copyTo(b, sizeof(b));
+    consume(sizeof(b));
+    v = 0;
+    for(int i = 0; i < 4; ++i)
+        v = v << 8 | b[i];
+    return true;
+}
+
+bool IOBuf::readFixed64(uint64_t &v)
+{
+    uint8_t b[8];
+    if(m_size < sizeof(b)) return false;
+    copyTo(b, sizeof(b));
+    consume(sizeof(b));
+    v = 0;
+    for(int i = 0; i < 8; ++i)
+        v = v << 8 | b[i];
+    return true;
+}
+
+size_t IOBuf::peekVarint64(uint64_t &v) const
+{
+    uint8_t b[10];
+    size_t n = copyTo(b, sizeof(b));
+    uint64_t result = 0;
+    for(size_t i = 0; i < n; ++i){
+        result |= (uint64_t)(b[i] & 0x7f) << (7 * i);
+        if(!(b[i] & 0x80)){
+            v = result;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+bool IOBuf::readVarint64(uint64_t &v)
+{
+    size_t n = peekVarint64(v);
+    if(!n) return false;
+    consume(n);
+    return true;
+}
+
+bool IOBuf::readVarint32(uint32_t &v)
+{
+    uint64_t x;
+    size_t n = peekVarint64(x);
+    if(!n || x > UINT32_MAX) return false;
+    consume(n);
+    v = (uint32_t)x;
+    return true;
+}
+
+bool IOBuf::readVarintS32(int32_t &v)
+{
+    int64_t x;
+    if(!readVarintS64(x)) return false;
+    v = (int32_t)x;
+    return true;
+}
+
+bool IOBuf::readVarintS64(int64_t &v)
+{
+    uint64_t x;
+    if(!readVarint64(x)) return false;
+    v = DecodeZigzag(x);
+    return true;
+}
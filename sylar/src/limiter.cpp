@@ -0,0 +1,290 @@
+#include "limiter.h"
+#include "util.h"
+#include <errno.h>
+#include <algorithm>
+
+int FiberPermits::acquire(uint64_t timeout_ms)
+{
+    // 先占位再判断，计数不为正说明许可已经用完或者前面还有等待者，不能插队
+    if(m_state.fetch_sub(1) > 0)
+        return 0;
+
+    uint64_t deadline = timeout_ms == ~0ull ? ~0ull : GetCurrentMS() + timeout_ms;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    // 释放者在本协程入队之前就已经为它留了许可
+    if(m_handoff){
+        --m_handoff;
+        return 0;
+    }
+    // 等待者在栈上，必须在持有m_mutex时析构，交出许可的释放者也持有m_mutex
+    Waiter w;
+    w.it = m_waiters.insert(m_waiters.end(), &w);
+    while(!w.granted){
+        uint64_t left = ~0ull;
+        if(deadline != ~0ull){
+            uint64_t now = GetCurrentMS();
+            left = now >= deadline ? 0 : deadline - now;
+        }
+        int rt = w.queue.wait(lock, left);
+        // 超时和交出许可可能同时发生，已经拿到许可就算成功
+        if(rt && !w.granted){
+            m_waiters.erase(w.it);
+            abandonNoLock();
+            return rt;
+        }
+    }
+    return 0;
+}
+
+bool FiberPermits::tryAcquire()
+{
+    int64_t s = m_state.load();
+    while(s > 0){
+        if(m_state.compare_exchange_weak(s, s - 1))
+            return true;
+    }
+    return false;
+}
+
+void FiberPermits::release(size_t n, int64_t cap)
+{
+    while(n){
+        int64_t s = m_state.load();
+        int64_t add;
+        do{
+            add = n;
+            // 有等待者时s为负，先满足等待者，桶里最多剩cap个
+            if(cap > 0 && s + add > cap)
+                add = cap - s;
+            if(add <= 0)
+                return;
+        }while(!m_state.compare_exchange_weak(s, s + add));
+
+        // 前-s个许可属于等待者，没有等待者时不需要加锁
+        size_t k = s < 0 ? (size_t)std::min(add, -s) : 0;
+        if(!k)
+            return;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        n = handoffNoLock(k);
+    }
+}
+
+size_t FiberPermits::handoffNoLock(size_t k)
+{
+    size_t redo = 0;
+    for(; k; --k){
+        if(m_abandoned){
+            --m_abandoned;
+            ++redo;
+        }else if(!m_waiters.empty()){
+            Waiter *w = m_waiters.front();
+            m_waiters.pop_front();
+            w->granted = true;
+            w->queue.notifyOne();
+        }else{
+            // 等待者已经计数但还没有拿到锁，留给它直接领取
+            ++m_handoff;
+        }
+    }
+    return redo;
+}
+
+/**
+ * 等待者离开时要撤销acquire时减掉的计数：
+ * 计数为负说明还有没被满足的等待者，直接加回来即可；
+ * 否则说明已经有释放者为所有等待者（包括本协程）加过计数，只是还没拿到锁交出许可，
+ * 记下来由那个释放者把许可重新归还
+ */
+void FiberPermits::abandonNoLock()
+{
+    int64_t s = m_state.load();
+    while(s < 0){
+        if(m_state.compare_exchange_weak(s, s + 1))
+            return;
+    }
+    ++m_abandoned;
+}
+
+size_t FiberPermits::getWaiting()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_waiters.size();
+}
+
+TokenBucket::TokenBucket(double rate, size_t burst)
+    :m_rate(rate)
+    ,m_burst(burst ? burst : 1)
+    ,m_permits(m_burst)
+    ,m_lastUs(GetCurrentUS())
+{
+}
+
+TokenBucket::ptr TokenBucket::Create(TimerManager *timers, double rate, size_t burst, uint64_t refill_ms)
+{
+    SYLAR_ASSERT(timers && rate >= 0);
+    TokenBucket::ptr tb(new TokenBucket(rate, burst));
+    std::weak_ptr<TokenBucket> weak(tb);
+    tb->m_timer = timers->addConditionTimer(refill_ms ? refill_ms : 1, [weak](){
+        TokenBucket::ptr p = weak.lock();
+        if(p) p->refill();
+    }, weak, true);
+    return tb;
+}
+
+TokenBucket::~TokenBucket()
+{
+    stop();
+}
+
+void TokenBucket::refill()
+{
+    size_t n;
+    {
+        // 定时器回调可能在不同的线程上重叠执行
+        std::lock_guard<std::mutex> lock(m_mutex);
+        uint64_t now = GetCurrentUS();
+        double tokens = m_carry + (now > m_lastUs ? now - m_lastUs : 0) * m_rate.load() / 1000000.0;
+        m_lastUs = now;
+        // 长时间没有补充时一次最多补满
+        if(tokens > m_burst)
+            tokens = m_burst;
+        n = (size_t)tokens;
+        m_carry = tokens - n;
+    }
+    if(n)
+        m_permits.release(n, m_burst);
+}
+
+void TokenBucket::stop()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if(m_timer){
+        m_timer->cancel();
+        m_timer.reset();
+    }
+}
+
+/// 当前线程优先使用的分片
+static size_t LocalShard(size_t shards)
+{
+    return (size_t)GetThreadId() % shards;
+}
+
+ShardedConcurrencyLimiter::ShardedConcurrencyLimiter(size_t limit, size_t shards)
+    :m_limit(limit)
+{
+    if(shards > limit)
+        shards = limit;
+    if(shards == 0)
+        shards = 1;
+    for(size_t i = 0; i < shards; ++i){
+        // 除不尽的部分分给前面的分片
+        size_t n = limit / shards + (i < limit % shards ? 1 : 0);
+        m_shards.emplace_back(new FiberPermits(n));
+    }
+}
+
+bool ShardedConcurrencyLimiter::tryAcquire(size_t &shard)
+{
+    size_t n = m_shards.size();
+    size_t start = LocalShard(n);
+    for(size_t i = 0; i < n; ++i){
+        size_t idx = (start + i) % n;
+        if(m_shards[idx]->tryAcquire()){
+            shard = idx;
+            return true;
+        }
+    }
+    return false;
+}
+
+int ShardedConcurrencyLimiter::acquire(size_t &shard, uint64_t timeout_ms)
+{
+    if(tryAcquire(shard))
+        return 0;
+    shard = LocalShard(m_shards.size());
+    return m_shards[shard]->acquire(timeout_ms);
+}
+
+ShardedTokenBucket::ShardedTokenBucket(double rate, size_t burst, size_t shards)
+    :m_rate(rate)
+    ,m_lastUs(GetCurrentUS())
+{
+    if(shards == 0)
+        shards = 1;
+    // 每个分片至少能存一个令牌
+    m_burst = std::max(burst / shards, (size_t)1);
+    for(size_t i = 0; i < shards; ++i)
+        m_shards.emplace_back(new FiberPermits(m_burst));
+}
+
+ShardedTokenBucket::ptr ShardedTokenBucket::Create(TimerManager *timers, double rate, size_t burst,
+                                                   size_t shards, uint64_t refill_ms)
+{
+    SYLAR_ASSERT(timers && rate >= 0);
+    ShardedTokenBucket::ptr tb(new ShardedTokenBucket(rate, burst, shards));
+    std::weak_ptr<ShardedTokenBucket> weak(tb);
+    tb->m_timer = timers->addConditionTimer(refill_ms ? refill_ms : 1, [weak](){
+        ShardedTokenBucket::ptr p = weak.lock();
+        if(p) p->refill();
+    }, weak, true);
+    return tb;
+}
+
+ShardedTokenBucket::~ShardedTokenBucket()
+{
+    stop();
+}
+
+void ShardedTokenBucket::refill()
+{
+    size_t s = m_shards.size();
+    std::vector<size_t> give(s, 0);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        uint64_t now = GetCurrentUS();
+        double tokens = m_carry + (now > m_lastUs ? now - m_lastUs : 0) * m_rate / 1000000.0;
+        m_lastUs = now;
+        if(tokens > m_burst * s)
+            tokens = m_burst * s;
+        size_t n = (size_t)tokens;
+        m_carry = tokens - n;
+        // 速率较低时每次只有几个令牌，零头轮流分给各分片
+        for(size_t i = 0; i < s; ++i)
+            give[i] = n / s;
+        for(size_t i = 0; i < n % s; ++i)
+            ++give[(m_next + i) % s];
+        m_next = (m_next + n % s) % s;
+    }
+    for(size_t i = 0; i < s; ++i){
+        if(give[i])
+            m_shards[i]->release(give[i], m_burst);
+    }
+}
+
+int ShardedTokenBucket::acquire(uint64_t timeout_ms)
+{
+    if(tryAcquire())
+        return 0;
+    return m_shards[LocalShard(m_shards.size())]->acquire(timeout_ms);
+}
+
+bool ShardedTokenBucket::tryAcquire()
+{
+    size_t n = m_shards.size();
+    size_t start = LocalShard(n);
+    for(size_t i = 0; i < n; ++i){
+        if(m_shards[(start + i) % n]->tryAcquire())
+            return true;
+    }
+    return false;
+}
+
+void ShardedTokenBucket::stop()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if(m_timer){
+        m_timer->cancel();
+        m_timer.reset();
+    }
+}
@@ -0,0 +1,102 @@
+#include "metrics.h"
+#include <sstream>
+
+void MetricHistogram::Snapshot::merge(const Snapshot &other)
+{
+    for(size_t i = 0; i < kBuckets; ++i)
+        buckets[i] += other.buckets[i];
+    count += other.count;
+    sum += other.sum;
+}
+
+uint64_t MetricHistogram::Snapshot::percentile(double p) const
+{
+    if(!count) return 0;
+    uint64_t target = (uint64_t)(p * count);
+    if(target >= count) target = count - 1;
+    uint64_t seen = 0;
+    for(size_t i = 0; i < kBuckets; ++i){
+        seen += buckets[i];
+        if(seen > target)
+            return BucketBound(i);
+    }
+    return BucketBound(kBuckets - 1);
+}
+
+void MetricHistogram::snapshot(Snapshot &snap) const
+{
+    for(size_t i = 0; i < kBuckets; ++i)
+        snap.buckets[i] = m_buckets[i].load(std::memory_order_relaxed);
+    snap.count = m_count.load(std::memory_order_relaxed);
+    snap.sum = m_sum.load(std::memory_order_relaxed);
+}
+
+// 输出一个Prometheus直方图，桶是累积的，省略末尾的空桶
+static void DumpHistogram(std::ostream &os, const std::string &name, const std::string &labels,
+        const MetricHistogram::Snapshot &h, const char *help)
+{
+    os << "# HELP " << name << " " << help << "\n";
+    os << "# TYPE " << name << " histogram\n";
+    size_t last = 0;
+    for(size_t i = 0; i < MetricHistogram::kBuckets; ++i){
+        if(h.buckets[i]) last = i;
+    }
+    uint64_t cum = 0;
+    for(size_t i = 0; i <= last && i + 1 < MetricHistogram::kBuckets; ++i){
+        cum += h.buckets[i];
+        // 桶i的上界不含2^i，整数值的le即为2^i-1
+        os << name << "_bucket{" << labels << ",le=\"" << MetricHistogram::BucketBound(i) - 1
+           << "\"} " << cum << "\n";
+    }
+    os << name << "_bucket{" << labels << ",le=\"+Inf\"} " << h.count << "\n";
+    os << name << "_sum{" << labels << "} " << h.sum << "\n";
+    os << name << "_count{" << labels << "} " << h.count << "\n";
+}
+
+std::string SchedulerMetrics::toPrometheus(const std::string &prefix) const
+{
+    std::stringstream ss;
+    std::string labels = "scheduler=\"" + name + "\"";
+
+#define XX(metric, type, value, help) \
+    ss << "# HELP " << prefix << "_" #metric " " help "\n" \
+       << "# TYPE " << prefix << "_" #metric " " #type "\n" \
+       << prefix << "_" #metric "{" << labels << "} " << (value) << "\n";
+
+    XX(run_queue_depth, gauge, queueDepth, "Tasks waiting in the run queue");
+    XX(workers, gauge, workers, "Live worker threads");
+    XX(active_threads, gauge, activeThreads, "Worker threads running a task");
+    XX(idle_threads, gauge, idleThreads, "Worker threads in idle");
+    XX(fibers, gauge, totalFibers, "Live fibers in the process");
+    XX(preemptions_total, counter, preemptions, "Preemption requests sent by sysmon");
+    XX(shed_queue_full_total, counter, shedQueueFull, "New tasks rejected because the run queue was full");
+    XX(shed_fibers_total, counter, shedTooManyFibers, "New tasks rejected because of the live fiber limit");
+    XX(shed_stale_total, counter, shedStale, "Tasks run with an expired token after queueing too long");
+    XX(pending_events, gauge, pendingEvents, "Registered IO events not yet triggered");
+    XX(timers, gauge, timers, "Armed timers");
+#undef XX
+
+#define XX(metric, field, help) \
+    ss << "# HELP " << prefix << "_" #metric " " help "\n" \
+       << "# TYPE " << prefix << "_" #metric " counter\n"; \
+    for(auto &w : perWorker){ \
+        ss << prefix << "_" #metric "{" << labels << ",worker=\"" << w.index << "\"} " \
+           << w.field << "\n"; \
+    }
+
+    XX(tasks_executed_total, tasksExecuted, "Task resumes");
+    XX(context_switches_total, contextSwitches, "Fiber resumes including idle");
+    XX(idle_microseconds_total, idleUs, "Time spent in idle");
+    XX(epoll_waits_total, epollWaits, "epoll_wait calls");
+    XX(epoll_wait_microseconds_total, epollWaitUs, "Time blocked in epoll_wait");
+    XX(timer_fires_total, timerFires, "Expired timers dispatched");
+#undef XX
+
+    DumpHistogram(ss, prefix + "_events_per_wait", labels, eventsPerWait,
+            "Events returned by each epoll_wait");
+    DumpHistogram(ss, prefix + "_schedule_latency_microseconds", labels, scheduleLatencyUs,
+            "Time from enqueue to run");
+    DumpHistogram(ss, prefix + "_run_slice_microseconds", labels, runSliceUs,
+            "Time a task runs before yielding");
+    return ss.str();
+}
@@ -0,0 +1,369 @@
+#include "rpc.h"
+#include "cancel.h"
+#include "util.h"
+#include <string.h>
+#include <errno.h>
+#include <algorithm>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+enum RpcType{
+    RPC_REQUEST = 1,
+    RPC_RESPONSE = 2
+};
+
+bool RpcConnection::send(IOBuf &&frame)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if(m_broken)
+        return false;
+    m_pending.append(std::move(frame));
+    if(m_writing)
+        return true;
+    // 写的时候不持有锁，其他协程追加的帧在下一轮一起写出
+    m_writing = true;
+    while(!m_pending.empty()){
+        IOBuf out(std::move(m_pending));
+        lock.unlock();
+        bool ok = out.writeAll(m_fd);
+        lock.lock();
+        if(!ok){
+            m_broken = true;
+            m_pending.clear();
+            break;
+        }
+    }
+    m_writing = false;
+    return !m_broken;
+}
+
+void RpcConnection::EncodeRequest(IOBuf &out, uint64_t id, const std::string &method,
+                                  uint64_t timeout_ms, const IOBuf &payload)
+{
+    IOBuf body;
+    body.writeFixed8(RPC_REQUEST);
+    body.writeFixed64(id);
+    body.writeVarint64(timeout_ms);
+    body.writeVarint64(method.size());
+    body.append(method);
+    body.append(payload);
+    out.writeFixed32(body.size());
+    out.append(std::move(body));
+}
+
+void RpcConnection::EncodeResponse(IOBuf &out, uint64_t id, int status, IOBuf &&payload)
+{
+    IOBuf body;
+    body.writeFixed8(RPC_RESPONSE);
+    body.writeFixed64(id);
+    body.writeVarint64(status);
+    body.append(std::move(payload));
+    out.writeFixed32(body.size());
+    out.append(std::move(body));
+}
+
+int RpcConnection::CutFrame(IOBuf &in, IOBuf &frame)
+{
+    uint32_t len;
+    uint8_t b[4];
+    if(in.copyTo(b, sizeof(b)) < sizeof(b))
+        return 0;
+    len = (uint32_t)b[0] << 24 | (uint32_t)b[1] << 16 | (uint32_t)b[2] << 8 | b[3];
+    if(len > kMaxFrame)
+        return -1;
+    if(in.size() < sizeof(b) + len)
+        return 0;
+    in.consume(sizeof(b));
+    in.cutTo(frame, len);
+    return 1;
+}
+
+RpcChannel::RpcChannel(int fd)
+    :m_fd(fd)
+    ,m_fdOwner(new FdOwner(fd))
+    ,m_conn(fd)
+{
+}
+
+RpcChannel::~RpcChannel()
+{
+    // 唤醒读协程，fd由最后退出的一方关闭
+    shutdown(m_fd, SHUT_RDWR);
+}
+
+RpcChannel::ptr RpcChannel::Connect(IOManager *iom, const std::string &ip, uint16_t port, uint64_t timeout_ms)
+{
+    sockaddr_storage addr;
+    socklen_t addrlen;
+    if(!ParseAddress(ip, port, addr, addrlen)){
+        SYLAR_LOG_ERROR(g_logger) << "RpcChannel::Connect invalid ip=" << ip;
+        return nullptr;
+    }
+
+    int fd = socket(addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd < 0)
+        return nullptr;
+    int rt;
+    {
+        CancelScope scope(timeout_ms);
+        rt = connect(fd, (sockaddr*)&addr, addrlen);
+    }
+    if(rt){
+        SYLAR_LOG_ERROR(g_logger) << "RpcChannel::Connect " << ip << ":" << port
+            << " errno=" << errno << " " << strerror(errno);
+        ::close(fd);
+        return nullptr;
+    }
+    // 请求都很小，不能等Nagle合并
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    RpcChannel::ptr ch(new RpcChannel(fd));
+    std::weak_ptr<RpcChannel> weak(ch);
+    if(!iom->schedule(std::bind(&RpcChannel::ReadLoop, weak, ch->m_fdOwner))){
+        SYLAR_LOG_ERROR(g_logger) << "RpcChannel::Connect " << ip << ":" << port
+            << " read loop rejected by overloaded scheduler";
+        return nullptr;
+    }
+    return ch;
+}
+
+int RpcChannel::call(const std::string &method, const IOBuf &req, IOBuf &resp, uint64_t timeout_ms)
+{
+    CancelToken::ptr token = Fiber::GetThis()->getCancelToken();
+    if(token)
+        timeout_ms = std::min(timeout_ms, token->remainingMS());
+    uint64_t deadline = timeout_ms == ~0ull ? ~0ull : GetCurrentMS() + timeout_ms;
+
+    CallPtr c(new Call);
+    uint64_t id;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if(m_closed)
+            return ECONNRESET;
+        id = ++m_nextId;
+        m_calls[id] = c;
+    }
+
+    IOBuf frame;
+    RpcConnection::EncodeRequest(frame, id, method, timeout_ms, req);
+    if(!m_conn.send(std::move(frame))){
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_calls.erase(id);
+        return ECONNRESET;
+    }
+
+    std::unique_lock<std::mutex> lock(c->mutex);
+    int rt = 0;
+    while(!c->done){
+        uint64_t left = ~0ull;
+        if(deadline != ~0ull){
+            uint64_t now = GetCurrentMS();
+            if(now >= deadline){
+                rt = ETIMEDOUT;
+                break;
+            }
+            left = deadline - now;
+        }
+        rt = c->queue.wait(lock, left);
+        if(rt)
+            break;
+    }
+    if(!c->done){
+        // 超时或取消，之后到达的响应会被读协程丢弃
+        lock.unlock();
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_calls.erase(id);
+        return rt;
+    }
+    resp = std::move(c->resp);
+    return c->status;
+}
+
+void RpcChannel::ReadLoop(std::weak_ptr<RpcChannel> weak, std::shared_ptr<FdOwner> owner)
+{
+    int fd = owner->fd;
+    IOBuf in;
+    IOBuf frame;
+    while(in.readFrom(fd) > 0){
+        // 只在分发响应时持有通道，最后一个用户引用释放后通道马上析构并shutdown，read随之返回
+        RpcChannel::ptr self = weak.lock();
+        if(!self)
+            return;
+        int rt;
+        while((rt = RpcConnection::CutFrame(in, frame)) == 1){
+            if(!self->onResponse(frame)){
+                rt = -1;
+                break;
+            }
+            frame.clear();
+        }
+        if(rt < 0){
+            SYLAR_LOG_ERROR(g_logger) << "RpcChannel fd=" << fd << " bad frame";
+            break;
+        }
+    }
+    RpcChannel::ptr self = weak.lock();
+    if(self)
+        self->failAll(ECONNRESET);
+}
+
+bool RpcChannel::onResponse(IOBuf &frame)
+{
+    uint8_t type;
+    uint64_t id;
+    uint64_t status;
+    if(!frame.readFixed8(type) || type != RPC_RESPONSE
+            || !frame.readFixed64(id) || !frame.readVarint64(status))
+        return false;
+    CallPtr c;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_calls.find(id);
+        if(it != m_calls.end()){
+            c = it->second;
+            m_calls.erase(it);
+        }
+    }
+    if(c){
+        std::lock_guard<std::mutex> lock(c->mutex);
+        c->status = status;
+        c->resp = std::move(frame);
+        c->done = true;
+        c->queue.notifyOne();
+    }
+    return true;
+}
+
+void RpcChannel::failAll(int err)
+{
+    std::unordered_map<uint64_t, CallPtr> calls;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closed = true;
+        calls.swap(m_calls);
+    }
+    for(auto &i : calls){
+        std::lock_guard<std::mutex> lock(i.second->mutex);
+        if(i.second->done)
+            continue;
+        i.second->status = err;
+        i.second->done = true;
+        i.second->queue.notifyAll();
+    }
+}
+
+void RpcChannel::close()
+{
+    if(m_closed.exchange(true))
+        return;
+    // 读协程读到EOF后让所有等待中的调用失败并退出
+    shutdown(m_fd, SHUT_RDWR);
+}
+
+size_t RpcChannel::getPendingCount()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_calls.size();
+}
+
+RpcServer::RpcServer(IOManager *worker, const std::string &name)
+    :TcpServer(worker, name)
+{
+}
+
+void RpcServer::registerMethod(const std::string &name, Method cb)
+{
+    m_methods[name] = cb;
+}
+
+void RpcServer::handleClient(int fd)
+{
+    // 处理协程可能比读循环活得久，连接状态由它们共享
+    struct State{
+        RpcConnection conn;
+        std::mutex mutex;
+        FiberWaitQueue idle;
+        size_t inflight = 0;
+        State(int fd) : conn(fd) {}
+    };
+    auto st = std::make_shared<State>(fd);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    IOBuf in;
+    IOBuf frame;
+    while(true){
+        int rt;
+        while((rt = RpcConnection::CutFrame(in, frame)) == 1){
+            uint8_t type;
+            uint64_t id;
+            uint64_t timeout_ms;
+            uint64_t len;
+            if(!frame.readFixed8(type) || type != RPC_REQUEST || !frame.readFixed64(id)
+                    || !frame.readVarint64(timeout_ms) || !frame.readVarint64(len) || len > frame.size()){
+                rt = -1;
+                break;
+            }
+            std::string name(len, '\0');
+            frame.copyTo(&name[0], len);
+            frame.consume(len);
+
+            auto it = m_methods.find(name);
+            if(it == m_methods.end()){
+                IOBuf out;
+                RpcConnection::EncodeResponse(out, id, RPC_NO_METHOD, IOBuf());
+                st->conn.send(std::move(out));
+                frame.clear();
+                continue;
+            }
+            {
+                std::lock_guard<std::mutex> lock(st->mutex);
+                ++st->inflight;
+            }
+            // 每个请求一个协程，慢请求不会挡住同一连接上的其他请求；
+            // 方法表在start之后不再修改，可以直接引用。
+            // 固定在读请求的当前线程上，每次调度时取，读协程可能被切换到其他线程恢复；
+            // 当前线程不属于m_worker或者之后缩容退出了，调度器会改为任意线程执行
+            const Method *method = &it->second;
+            std::shared_ptr<IOBuf> req = std::make_shared<IOBuf>(std::move(frame));
+            bool ok = m_worker->schedule([st, req, method, id, timeout_ms](){
+                IOBuf resp;
+                int status;
+                // 排队太久被调度器换上了已超时的令牌，调用方多半已经放弃，不再处理
+                CancelToken::ptr token = Fiber::GetCurrentCancelToken();
+                if(token && token->isCancelled()){
+                    status = RPC_OVERLOADED;
+                }else{
+                    CancelScope scope(timeout_ms);
+                    status = (*method)(*req, resp);
+                }
+                IOBuf out;
+                RpcConnection::EncodeResponse(out, id, status, std::move(resp));
+                st->conn.send(std::move(out));
+                std::lock_guard<std::mutex> lock(st->mutex);
+                if(--st->inflight == 0)
+                    st->idle.notifyAll();
+            }, GetThreadId());
+            if(!ok){
+                IOBuf out;
+                RpcConnection::EncodeResponse(out, id, RPC_OVERLOADED, IOBuf());
+                st->conn.send(std::move(out));
+                std::lock_guard<std::mutex> lock(st->mutex);
+                --st->inflight;
+            }
+        }
+        if(rt < 0){
+            SYLAR_LOG_ERROR(g_logger) << "RpcServer fd=" << fd << " bad frame";
+            break;
+        }
+        if(in.readFrom(fd) <= 0)
+            break;
+    }
+
+    // 返回后fd会被关闭，必须等处理协程都结束
+    std::unique_lock<std::mutex> lock(st->mutex);
+    while(st->inflight)
+        st->idle.wait(lock);
+}
@@ -1,6 +1,16 @@
 #include "scheduler.h"
 #include "fiber.cpp"
 #include <vector>
+#include <algorithm>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include "util.h"
+#include "async_log.h"
+#include "cancel.h"
+
+// 异步抢占使用的信号，默认动作是忽略，发给已经结束任务的线程也没有副作用
+static const int PREEMPT_SIGNAL = SIGURG;
 
 /**
  * @brief 创建调度器
@@ -35,12 +45,127 @@ Scheduler::Scheduler(size_t threads, bool use_caller, const std::string &name){
     }
     else{m_rootThread=-1;}
     m_threadCount = threads;  // 设置线程数量
+    m_minWorkers = m_maxWorkers = threads;
 }
 
 Scheduler *Scheduler::GetThis(){
     return t_scheduler;
 }
 
+thread_local Scheduler::Worker *Scheduler::t_worker = nullptr;
+
+void Scheduler::setCpuAffinity(const std::vector<int> &cpus, bool group_by_node){
+    MutexType::Lock lock(m_mutex);
+    SYLAR_ASSERT(m_workers.empty());
+    m_cpus = cpus;
+    if(group_by_node){
+        std::stable_sort(m_cpus.begin(), m_cpus.end(), [](int a, int b){
+            return GetCpuNode(a) < GetCpuNode(b);
+        });
+    }
+}
+
+int Scheduler::GetCurrentNode(){
+    return t_worker ? t_worker->node : -1;
+}
+
+void Scheduler::initWorker(){
+    size_t index = m_nextWorkerIndex++;
+    int cpu = -1;
+    if(!m_cpus.empty()){
+        cpu = m_cpus[index % m_cpus.size()];
+        if(!SetThreadAffinity(cpu)){
+            SYLAR_LOG_ERROR(g_logger) << "SetThreadAffinity(" << cpu << ") fail, worker=" << index;
+            cpu = -1;
+        }
+    }
+
+    // 绑核之后再分配，按首次访问原则落在本节点
+    Worker *worker = new Worker;
+    worker->index = index;
+    worker->cpu = cpu;
+    worker->node = cpu >= 0 ? GetCpuNode(cpu) : -1;
+    worker->threadId = GetThreadId();
+    worker->preemptFlag = &t_fiber_preempt;
+    t_worker = worker;
+
+    MutexType::Lock lock(m_mutex);
+    if(m_workers.size() <= index)
+        m_workers.resize(index + 1);
+    m_workers[index].reset(worker);
+}
+
+/// YieldTo切换后待重新入队的协程
+static thread_local Fiber::ptr t_requeue_fiber = nullptr;
+
+void Scheduler::YieldTo(Fiber::ptr next){
+    Scheduler *sc = GetThis();
+    Fiber *cur = Fiber::GetCurrent();
+    if(!sc || !cur || cur == t_scheduler_fiber || !cur->isRunInScheduler()
+            || !next->isRunInScheduler()){
+        if(sc)
+            sc->schedule(next);
+        return;
+    }
+
+    t_requeue_fiber = cur->shared_from_this();
+    Fiber::SetPostSwitch([](void *arg){
+        Fiber::ptr f;
+        f.swap(t_requeue_fiber);
+        static_cast<Scheduler*>(arg)->schedule(f);
+    }, sc);
+    cur->switchTo(next);
+}
+
+/// SwitchTo切换后待投递到目标调度器的协程
+static thread_local Fiber::ptr t_migrate_fiber = nullptr;
+
+bool Scheduler::SwitchTo(Scheduler *target){
+    SYLAR_ASSERT(target);
+    Scheduler *sc = GetThis();
+    if(sc == target)
+        return true;
+    Fiber *cur = Fiber::GetCurrent();
+    if(!sc || !cur || cur == t_scheduler_fiber || !cur->isRunInScheduler())
+        return false;
+
+    // 切换出去之后才投递，避免目标调度器在当前线程让出之前就resume这个协程
+    t_migrate_fiber = cur->shared_from_this();
+    Fiber::SetPostSwitch([](void *arg){
+        Fiber::ptr f;
+        f.swap(t_migrate_fiber);
+        static_cast<Scheduler*>(arg)->post(f);
+    }, target);
+    cur->yield();
+    return true;
+}
+
+void Scheduler::PreemptCurrent(){
+    t_fiber_preempt = 0;
+    if(!t_worker || t_worker->preemptReqSeq != t_worker->runSeq)
+        return;
+    YieldCurrent();
+}
+
+void Scheduler::YieldCurrent(){
+    Scheduler *sc = GetThis();
+    Fiber *cur = Fiber::GetCurrent();
+    if(!sc || !cur || cur == t_scheduler_fiber || !cur->isRunInScheduler())
+        return;
+    // 没有其他任务在等待，让出也只会马上被重新调度
+    if(!sc->hasPendingTasks())
+        return;
+
+    t_requeue_fiber = cur->shared_from_this();
+    Fiber::SetPostSwitch([](void *arg){
+        Fiber::ptr f;
+        f.swap(t_requeue_fiber);
+        int priority = f->getPriority();
+        static_cast<Scheduler*>(arg)->schedule(f, -1, priority);
+    }, sc);
+    cur->yield();
+}
+
 void Scheduler::start(){
     SYLAR_LOG_DEBUG(g_logger) << "start";
     MutexType::Lock lock(m_mutex); // 锁住调度器的互斥锁，确保线程安全
@@ -48,7 +173,8 @@ void Scheduler::start(){
         SYLAR_LOG_ERROR(g_logger) << "Scheduler is stopped";
         return;
     }
-    SYLAR_ASSERT(m_threads.empty()); // 确保调度线程列表为空
+    SYLAR_ASSERT(!m_started); // 确保只启动一次
+    m_started = true;
     m_threads.resize(m_threadCount);
     for(size_t i=0; i<m_threadCount; i++)
     {
@@ -57,6 +183,605 @@ void Scheduler::start(){
                             m_name + "_" + std::to_string(i)));
         m_threadIds.push_back(m_threads[i]->getID());
     }
+    m_liveWorkerCount = m_threadCount;
+
+    if(needSysmon()){
+        m_sysmonThread.reset(new Thread(std::bind(&Scheduler::sysmon, this),
+                            m_name + "_sysmon"));
+    }
+}
+
+void Scheduler::setWorkerBounds(size_t min_threads, size_t max_threads){
+    SYLAR_ASSERT(min_threads <= max_threads);
+    MutexType::Lock lock(m_mutex);
+    SYLAR_ASSERT(!m_started);
+    m_minWorkers = min_threads;
+    m_maxWorkers = max_threads;
+    m_threadCount = std::min(std::max(m_threadCount, min_threads), max_threads);
+}
+
+void Scheduler::setPreemption(uint64_t slice_ms, bool async){
+    MutexType::Lock lock(m_mutex);
+    SYLAR_ASSERT(!m_started);
+    m_preemptSliceUs = slice_ms * 1000;
+    m_preemptAsync = slice_ms && async;
+    if(m_preemptAsync && !Fiber::InstallPreemptSignal(PREEMPT_SIGNAL)){
+        SYLAR_LOG_ERROR(g_logger) << "InstallPreemptSignal fail, async preemption disabled";
+        m_preemptAsync = false;
+    }
+}
+
+void Scheduler::setAdmissionLimits(size_t max_queue_depth, size_t max_fibers){
+    MutexType::Lock lock(m_mutex);
+    m_maxQueueDepth = max_queue_depth;
+    m_maxFibers = max_fibers;
+}
+
+void Scheduler::setCodel(uint64_t target_ms, uint64_t interval_ms){
+    MutexType::Lock lock(m_mutex);
+    m_codelTargetUs = target_ms * 1000;
+    m_codelIntervalUs = (interval_ms ? interval_ms : 1) * 1000;
+    m_codelWindowEndUs = 0;
+    m_codelMinDelayUs = ~0ull;
+    m_codelOverloaded = false;
+}
+
+void Scheduler::setShedCallback(ShedCallback cb){
+    MutexType::Lock lock(m_mutex);
+    m_shedCb = cb;
+}
+
+bool Scheduler::isOverloaded() const{
+    // 队列清空之后窗口可能还没有结束，不能沿用上一个窗口的判定
+    if(m_codelOverloaded && m_taskCount > 0)
+        return true;
+    size_t max_depth = m_maxQueueDepth;
+    if(max_depth && m_taskCount >= max_depth)
+        return true;
+    size_t max_fibers = m_maxFibers;
+    return max_fibers && Fiber::TotalFibers() >= max_fibers;
+}
+
+int Scheduler::admit(const ScheduleTask &task) const{
+    size_t max_depth = m_maxQueueDepth;
+    size_t max_fibers = m_maxFibers;
+    if(!max_depth && !max_fibers)
+        return 0;
+    if(!task.isNewWork())
+        return 0;
+    if(max_depth && m_taskCount >= max_depth)
+        return SHED_QUEUE_FULL;
+    // 回调任务运行时也要占用一个协程
+    if(max_fibers && Fiber::TotalFibers() >= max_fibers)
+        return SHED_TOO_MANY_FIBERS;
+    return 0;
+}
+
+bool Scheduler::scheduleTask(ScheduleTask &task, int priority, uint64_t deadline){
+    int reason = 0;
+    bool ok = false;
+    bool need_tickle = false;
+    {
+        MutexType::Lock lock(m_mutex);
+        reason = admit(task);
+        if(!reason){
+            need_tickle = m_taskCount == 0;
+            ok = enqueueNoLock(task, priority, deadline);
+        }
+    }
+    if(reason){
+        onShed(reason);
+        return false;
+    }
+    if(need_tickle)
+        tickle(); // 唤醒idle协程
+    return ok;
+}
+
+bool Scheduler::pushMailbox(ScheduleTask &task){
+    if(!task.fiber && !task.cb)
+        return false;
+    int reason = admit(task);
+    if(reason){
+        onShed(reason);
+        return false;
+    }
+    // 投递者不持有m_mutex，用线程局部的抽样计数
+    static thread_local uint32_t t_sample_countdown = 0;
+    stampTask(task, t_sample_countdown);
+    m_mailbox.push(std::move(task));
+    return true;
+}
+
+void Scheduler::signalMailbox(){
+    // 工作线程取邮箱前清除标记，之后投递的任务会再唤醒一次
+    if(!m_mailboxSignaled.exchange(true))
+        tickle();
+}
+
+bool Scheduler::postTask(ScheduleTask &task){
+    if(!pushMailbox(task))
+        return false;
+    signalMailbox();
+    return true;
+}
+
+void Scheduler::drainMailbox(){
+    if(m_mailboxDraining.exchange(true))
+        return;
+    m_mailboxSignaled = false;
+    // 取出和入队都在m_mailboxDraining保护下进行，邮箱里的任务保持投递顺序
+    static thread_local std::vector<ScheduleTask> t_drained;
+    ScheduleTask task;
+    while(m_mailbox.pop(task))
+        t_drained.push_back(std::move(task));
+    size_t count = 0;
+    if(!t_drained.empty()){
+        MutexType::Lock lock(m_mutex);
+        for(auto &i : t_drained){
+            // 投递时已经确定了优先级
+            if(enqueueNoLock(i, PRIORITY_INHERIT, 0))
+                ++count;
+        }
+    }
+    m_mailboxDraining = false;
+    t_drained.clear();
+    // 取完之后、清除m_mailboxDraining之前投递的任务：投递者的唤醒可能已经被上面的draining挡掉，
+    // m_mailboxSignaled还是true，后续投递也不会再唤醒，这里重新发出通知
+    if(!m_mailbox.empty()){
+        m_mailboxSignaled = false;
+        signalMailbox();
+    }
+    // 当前线程马上会取走一个，其余的交给空闲线程
+    if(count > 1)
+        tickleIdle(count - 1);
+}
+
+/**
+ * 简化的CoDel：不像原算法那样按控制律逐步加快丢弃，窗口内最小排队延迟超过目标值就整体进入过载状态，
+ * 过载期间只丢弃排队超过2倍目标值的任务，突发流量下窗口内总有排队很短的任务，不会误判
+ */
+bool Scheduler::codelNoLock(uint64_t enqueue_us){
+    uint64_t now = GetCurrentUS();
+    uint64_t delay = now > enqueue_us ? now - enqueue_us : 0;
+    if(delay < m_codelMinDelayUs)
+        m_codelMinDelayUs = delay;
+    if(now >= m_codelWindowEndUs){
+        m_codelOverloaded = m_codelMinDelayUs > m_codelTargetUs;
+        m_codelMinDelayUs = ~0ull;
+        m_codelWindowEndUs = now + m_codelIntervalUs;
+    }
+    return m_codelOverloaded && delay > 2 * m_codelTargetUs;
+}
+
+void Scheduler::onShed(int reason, size_t count){
+    m_shedCount[reason] += count;
+    ShedCallback cb;
+    {
+        MutexType::Lock lock(m_mutex);
+        cb = m_shedCb;
+    }
+    // 回调按任务调用，和逐个schedule被拒绝时一致
+    for(size_t i = 0; cb && i < count; ++i)
+        cb(reason);
+}
+
+void Scheduler::setSysmonOptions(uint64_t interval_ms, uint64_t stuck_ms){
+    MutexType::Lock lock(m_mutex);
+    m_sysmonIntervalMs = interval_ms ? interval_ms : 1;
+    m_stuckMs = stuck_ms;
+}
+
+bool Scheduler::addWorker(){
+    MutexType::Lock lock(m_mutex);
+    if(m_stopping || !m_started || m_liveWorkerCount >= m_maxWorkers)
+        return false;
+    Thread::ptr thr(new Thread(std::bind(&Scheduler::run, this),
+                    m_name + "_" + std::to_string(m_threads.size())));
+    m_threadIds.push_back(thr->getID());
+    m_threads.push_back(thr);
+    ++m_liveWorkerCount;
+    SYLAR_LOG_INFO(g_logger) << "addWorker workers=" << m_liveWorkerCount;
+    return true;
+}
+
+/**
+ * 切换路径上的开销要小到可以在生产环境一直打开：没有抽中的任务不读时钟，只做几次普通的load+store，
+ * 运行了多久由监控线程根据runSeq的变化自己计时
+ */
+void Scheduler::beginTask(Fiber *fiber, uint64_t enqueue_us, bool sampled){
+    fiber->setScheduler(this);
+    bool timing = FiberStats::IsEnabled();
+    uint64_t now = 0;
+    if(enqueue_us && (sampled || timing)){
+        now = GetCurrentUS();
+        if(now < enqueue_us)
+            now = enqueue_us;
+    }
+    if(now && timing){
+        // 上次让出到入队之间是挂起等待，入队到现在是排队
+        uint64_t last = fiber->getLastYieldUS();
+        fiber->addWaitTime(now - enqueue_us, last && enqueue_us > last ? enqueue_us - last : 0);
+    }
+    if(t_worker){
+        Worker *w = t_worker;
+        // runSeq同时是执行的任务数；只有本线程写，不需要带锁前缀的原子加。先更新序号再标记运行，
+        // 监控线程先读running再读runSeq，看到正在运行时一定能看到新的序号
+        w->runSeq.store(w->runSeq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        w->running.store(true, std::memory_order_release);
+        w->sliceStartUs = sampled ? now : 0;
+        if(sampled && now)
+            w->metrics.scheduleLatencyUs.record(now - enqueue_us);
+    }
+    t_fiber_preempt = 0;
+}
+
+void Scheduler::endTask(){
+    if(t_worker){
+        Worker *w = t_worker;
+        w->running.store(false, std::memory_order_relaxed);
+        uint64_t start = w->sliceStartUs;
+        if(start){
+            w->sliceStartUs = 0;
+            uint64_t now = GetCurrentUS();
+            if(now >= start)
+                w->metrics.runSliceUs.record(now - start);
+        }
+    }
+}
+
+WorkerMetrics *Scheduler::GetWorkerMetrics(){
+    return t_worker ? &t_worker->metrics : nullptr;
+}
+
+void Scheduler::getMetrics(SchedulerMetrics &m){
+    m.name = m_name;
+    m.queueDepth = m_taskCount;
+    m.workers = m_liveWorkerCount;
+    m.activeThreads = m_activeThreadCount;
+    m.idleThreads = m_idleThreadCount;
+    m.totalFibers = Fiber::TotalFibers();
+    m.preemptions = m_preemptCount;
+    m.shedQueueFull = m_shedCount[SHED_QUEUE_FULL];
+    m.shedTooManyFibers = m_shedCount[SHED_TOO_MANY_FIBERS];
+    m.shedStale = m_shedCount[SHED_STALE];
+
+    MutexType::Lock lock(m_mutex);
+    for(auto &i : m_workers){
+        if(!i) continue;
+        WorkerMetrics &wm = i->metrics;
+        SchedulerMetrics::Worker w;
+        w.index = i->index;
+        w.cpu = i->cpu;
+        w.node = i->node;
+        w.tasksExecuted = i->runSeq.load(std::memory_order_relaxed);
+        w.contextSwitches = w.tasksExecuted + wm.idleSwitches.get();
+        w.idleUs = wm.idleUs.get();
+        w.epollWaits = wm.epollWaits.get();
+        w.epollWaitUs = wm.epollWaitUs.get();
+        w.timerFires = wm.timerFires.get();
+        m.perWorker.push_back(w);
+
+        MetricHistogram::Snapshot h;
+        wm.eventsPerWait.snapshot(h);
+        m.eventsPerWait.merge(h);
+        wm.scheduleLatencyUs.snapshot(h);
+        m.scheduleLatencyUs.merge(h);
+        wm.runSliceUs.snapshot(h);
+        m.runSliceUs.merge(h);
+    }
+}
+
+std::string Scheduler::dumpMetrics(const std::string &prefix){
+    SchedulerMetrics m;
+    getMetrics(m);
+    return m.toPrometheus(prefix);
+}
+
+bool Scheduler::shouldRetire(){
+    // caller线程不能退出，否则stop时无法回到caller线程的主协程
+    if(GetThreadId() == m_rootThread || m_stopping)
+        return false;
+    size_t n = m_retireCount;
+    while(n > 0){
+        if(m_retireCount.compare_exchange_weak(n, n - 1)){
+            --m_liveWorkerCount;
+            if(t_worker)
+                t_worker->retired = true;
+            unpinRetired(GetThreadId());
+            SYLAR_LOG_INFO(g_logger) << "worker retire, workers=" << m_liveWorkerCount;
+            return true;
+        }
+    }
+    return false;
+}
+
+void Scheduler::unpinRetired(int thread){
+    bool unpinned = false;
+    {
+        MutexType::Lock lock(m_mutex);
+        m_threadIds.erase(std::remove(m_threadIds.begin(), m_threadIds.end(), thread), m_threadIds.end());
+        // 之后入队的任务由enqueueNoLock改为不固定，这里处理已经在队列里的
+        for(auto &q : m_tasks){
+            for(size_t i = 0; i < q.size(); ++i){
+                if(q[i].thread == thread){
+                    q[i].thread = -1;
+                    unpinned = true;
+                }
+            }
+        }
+        for(auto &t : m_deadlineTasks){
+            if(t.thread == thread){
+                t.thread = -1;
+                unpinned = true;
+            }
+        }
+    }
+    if(unpinned)
+        tickle();
+}
+
+/**
+ * 监控线程：
+ * 1. 某个工作线程运行同一个任务超过m_stuckMs（协程在非hook的调用里阻塞了线程），
+ *    为它补充一个工作线程，同一个任务只补充一次
+ * 2. 队列积压超过存活线程数且没有空闲线程，扩容一个线程
+ * 3. 连续一段时间队列为空且有多个空闲线程，缩容一个线程
+ */
+void Scheduler::sysmon(){
+    SYLAR_LOG_DEBUG(g_logger) << "sysmon";
+    // 连续空闲的检查次数，达到阈值才缩容，避免抖动
+    static const uint32_t SHRINK_TICKS = 100;
+    uint32_t idle_ticks = 0;
+    std::vector<Worker*> workers;
+    // 每个工作线程当前任务已运行的时间(微秒)，没有在运行任务时为0
+    std::vector<uint64_t> run_us;
+    while(!m_stopping){
+        // 监控线程没有开启hook，usleep直接阻塞线程
+        usleep(m_sysmonIntervalMs * 1000);
+        uint64_t now = GetCurrentUS();
+
+        workers.clear();
+        {
+            MutexType::Lock lock(m_mutex);
+            for(auto &i : m_workers){
+                if(i && !i->retired)
+                    workers.push_back(i.get());
+            }
+        }
+
+        // 工作线程切换任务时不读时钟，这里看到runSeq变化时记下时间，之后runSeq一直不变就是同一个任务
+        // 还在运行；运行时长按第一次看到的时间算，比实际最多少一个检查间隔
+        run_us.assign(workers.size(), 0);
+        for(size_t i = 0; i < workers.size(); ++i){
+            Worker *w = workers[i];
+            bool running = w->running.load(std::memory_order_acquire);
+            uint64_t seq = w->runSeq.load(std::memory_order_relaxed);
+            if(seq != w->observedSeq){
+                w->observedSeq = seq;
+                w->observedUs = now;
+            }
+            run_us[i] = running ? now - w->observedUs : 0;
+        }
+
+        if(m_preemptSliceUs){
+            for(size_t i = 0; i < workers.size(); ++i){
+                Worker *w = workers[i];
+                uint64_t seq = w->observedSeq;
+                if(run_us[i] < m_preemptSliceUs)
+                    continue;
+                if(w->preemptedSeq == seq || !w->preemptFlag)
+                    continue;
+                w->preemptedSeq = seq;
+                // 先记下目标任务再设置标记，标记落地之前任务可能已经结束，
+                // 工作线程响应时发现runSeq变了就忽略这个标记
+                w->preemptReqSeq = seq;
+                if(w->runSeq != seq)
+                    continue;
+                *w->preemptFlag = 1;
+                if(m_preemptAsync)
+                    syscall(SYS_tgkill, getpid(), w->threadId, PREEMPT_SIGNAL);
+                ++m_preemptCount;
+            }
+        }
+
+        size_t stuck = 0;
+        if(m_stuckMs){
+            for(size_t i = 0; i < workers.size(); ++i){
+                Worker *w = workers[i];
+                uint64_t seq = w->observedSeq;
+                if(run_us[i] < m_stuckMs * 1000)
+                    continue;
+                if(w->compensatedSeq == seq)
+                    continue;
+                w->compensatedSeq = seq;
+                ++stuck;
+                SYLAR_LOG_INFO(g_logger) << "worker " << w->index << " stuck "
+                    << run_us[i] / 1000 << "ms, add replacement";
+            }
+        }
+        for(size_t i = 0; i < stuck; ++i)
+            addWorker();
+
+        size_t live = m_liveWorkerCount;
+        if(!stuck && m_taskCount > live && m_idleThreadCount == 0)
+            addWorker();
+
+        if(m_taskCount == 0 && m_idleThreadCount > 1 && live > m_minWorkers
+                && m_retireCount == 0){
+            if(++idle_ticks >= SHRINK_TICKS){
+                idle_ticks = 0;
+                ++m_retireCount;
+                tickle();
+            }
+        }else{
+            idle_ticks = 0;
+        }
+
+        onSysmonTick(now);
+    }
+    SYLAR_LOG_DEBUG(g_logger) << "sysmon exit";
+}
+
+void Scheduler::setPriorityWeights(uint32_t high, uint32_t normal, uint32_t low){
+    SYLAR_ASSERT(high > 0 && normal > 0 && low > 0);
+    MutexType::Lock lock(m_mutex);
+    m_weights[PRIORITY_HIGH] = high;
+    m_weights[PRIORITY_NORMAL] = normal;
+    m_weights[PRIORITY_LOW] = low;
+    for(int i = 0; i < PRIORITY_COUNT; ++i)
+        m_credits[i] = 0;
+}
+
+bool Scheduler::takeFromQueueNoLock(RingQueue<ScheduleTask> &queue, ScheduleTask &task, bool &tickle_me){
+    // 偏好其他节点的任务只在队头附近找不到本节点任务时才取，
+    // 相当于只有本节点没有可做的工作时才去其他节点"窃取"
+    static const size_t NODE_SCAN = 16;
+    int my_node = GetCurrentNode();
+    size_t pick = queue.size();
+    size_t remote = queue.size();
+
+    //  遍历该优先级的调度任务
+    for(size_t i = 0; i < queue.size(); ++i){
+        ScheduleTask &t = queue[i];
+        if(t.thread!=-1 && t.thread != GetThreadId()){
+            // 制定了调度线程，但不是在当前线程上调度，标记一下需要通知其他线程进行
+            // 调度，然后跳过这个任务，继续下一个
+            tickle_me = true;
+            continue;
+        }
+        if(my_node >= 0 && t.node >= 0 && t.node != my_node){
+            if(remote == queue.size())
+                remote = i;
+            if(i < NODE_SCAN)
+                continue;
+            break;
+        }
+        pick = i;
+        break;
+    }
+    if(pick == queue.size())
+        pick = remote;
+    if(pick == queue.size())
+        return false;
+
+    // 找到一个未指定线程，或是制定了当前线程的任务
+    ScheduleTask &t = queue[pick];
+    SYLAR_ASSERT(t.fiber || t.cb);
+    if(t.fiber)
+    {
+        // 任务队列的协程一定是ready状态
+        SYLAR_ASSERT(t.fiber->getState() == Fiber::READY);
+    }
+    task = std::move(t);
+    queue.erase(pick);
+    --m_taskCount;
+    return true;
+}
+
+/**
+ * 出队顺序：
+ * 1. EDF模式下，先取截止时间最早的可执行任务
+ * 2. 各优先级之间做平滑加权轮转：每次出队给非空队列加上各自权重，取当前权重最大的队列，
+ *    再减去权重总和，这样高:中:低=8:4:1时低优先级每13次至少出队一次，不会被饿死
+ * 3. 选中的队列里没有当前线程可执行的任务时，按优先级从高到低再找一遍
+ */
+bool Scheduler::takeTaskNoLock(ScheduleTask &task, bool &tickle_me){
+    bool found = false;
+    if(!m_deadlineTasks.empty()){
+        // 堆顶通常可以直接执行；堆顶指定了其他线程时，线性找出当前线程可执行的最早任务
+        size_t pick = m_deadlineTasks.size();
+        for(size_t i = 0; i < m_deadlineTasks.size(); ++i){
+            const ScheduleTask &t = m_deadlineTasks[i];
+            if(t.thread != -1 && t.thread != GetThreadId()){
+                tickle_me = true;
+                continue;
+            }
+            if(i == 0){
+                pick = 0;
+                break;
+            }
+            if(pick == m_deadlineTasks.size() || t.deadline < m_deadlineTasks[pick].deadline)
+                pick = i;
+        }
+        if(pick == 0){
+            std::pop_heap(m_deadlineTasks.begin(), m_deadlineTasks.end(), DeadlineLater());
+            task = std::move(m_deadlineTasks.back());
+            m_deadlineTasks.pop_back();
+            --m_taskCount;
+            found = true;
+        }else if(pick < m_deadlineTasks.size()){
+            task = std::move(m_deadlineTasks[pick]);
+            m_deadlineTasks[pick] = std::move(m_deadlineTasks.back());
+            m_deadlineTasks.pop_back();
+            std::make_heap(m_deadlineTasks.begin(), m_deadlineTasks.end(), DeadlineLater());
+            --m_taskCount;
+            found = true;
+        }
+    }
+
+    if(!found){
+        int best = -1;
+        int64_t total = 0;
+        for(int i = 0; i < PRIORITY_COUNT; ++i){
+            if(m_tasks[i].empty()) continue;
+            m_credits[i] += m_weights[i];
+            total += m_weights[i];
+            if(best < 0 || m_credits[i] > m_credits[best])
+                best = i;
+        }
+        if(best >= 0){
+            m_credits[best] -= total;
+            found = takeFromQueueNoLock(m_tasks[best], task, tickle_me);
+            for(int i = 0; !found && i < PRIORITY_COUNT; ++i){
+                if(i != best)
+                    found = takeFromQueueNoLock(m_tasks[i], task, tickle_me);
+            }
+        }
+    }
+
+    // 当前线程拿完一个任务后，发现任务队列还有剩余，需要tickle一下其他线程
+    if(found && m_taskCount)
+        tickle_me = true;
+    return found;
+}
+
+void Scheduler::tickleIdle(size_t tasks){
+    if(!tasks) return;
+    size_t n = std::min(tasks, (size_t)m_idleThreadCount);
+    if(n == 0) n = 1;
+    for(size_t i = 0; i < n; ++i)
+        tickle();
+}
+
+size_t Scheduler::ScheduleBatch::submit(){
+    if(m_tasks.empty()) return 0;
+    size_t count = 0;
+    size_t shed[SHED_REASON_COUNT] = {0};
+    {
+        MutexType::Lock lock(m_scheduler->m_mutex);
+        for(auto &i : m_tasks){
+            int reason = m_scheduler->admit(i);
+            if(reason)
+                ++shed[reason];
+            // priority在add时已经确定，这里只做移动
+            else if(m_scheduler->enqueueNoLock(i, PRIORITY_INHERIT, 0))
+                ++count;
+        }
+    }
+    m_tasks.clear();
+    for(int i = 1; i < SHED_REASON_COUNT; ++i){
+        if(shed[i])
+            m_scheduler->onShed(i, shed[i]);
+    }
+    if(count)
+        m_scheduler->tickleIdle(count);
+    return count;
+}
+
+bool Scheduler::stopping(){
+    MutexType::Lock lock(m_mutex);
+    return m_stopping && m_taskCount == 0 && m_mailbox.empty() && m_activeThreadCount == 0;
 }
 
 /**用于调度任务与管理线程
@@ -64,9 +789,11 @@ void Scheduler::start(){
  * 直到没有任务可以调度或调度器停止
  */
 void Scheduler::run(){
-    SYLAR_LOG_DEBUG(g_logger) << "run";
+    SYLAR_ALOG_DEBUG("run");
     // 设置当前线程的调度器上下文，如果当前线程不是主线程，则获取当前线程的协程并保存
     setThis();
+    // 先绑核，之后的idle协程、回调协程的栈都在本线程上首次访问
+    initWorker();
     if(GetThreadID()!=m_rootThread){
         t_scheduler_fiber = Fiber::GetThis().get();
     }
@@ -78,36 +805,20 @@ void Scheduler::run(){
     while(true)
     {
         task.reset();
+        if(!m_mailbox.empty())
+            drainMailbox();
         bool tickle_me = false;  // 是否tickle其他线程进行任务调度
+        bool stale = false;      // 是否被CoDel判定为排队太久
         {
             MutexType::Lock lock(m_mutex);
-            auto it = m_tasks.begin();
-            
-            //  遍历所有调度任务
-            while(it!=m_tasks.end()){
-                if(it->thread!=-1 && it->thread != GetThreadId()){
-                    // 制定了调度线程，但不是在当前线程上调度，标记一下需要通知其他线程进行
-                    // 调度，然后跳过这个任务，继续下一个
-                    ++it;
-                    tickle_me = true;
-                    continue;
-                }
-
-                // 找到一个未指定线程，或是制定了当前线程的任务
-                SYLAR_ASSERT(it->fiber || it->cb);
-                if(it->fiber)
-                {
-                    // 任务队列的协程一定是ready状态
-                    SYLAR_ASSERT(it->fiber->getState() == Fiber::READY);
-                }
-                // 当前调度线程找到⼀个任务，准备开始调度，将其从任务队列中剔除，活动线程数加1
-                task = *it;
-                m_tasks.erase(it++);
+            // 当前调度线程找到⼀个任务，准备开始调度，活动线程数加1
+            if(takeTaskNoLock(task, tickle_me)){
                 ++m_activeThreadCount;
-                break;
+                // 所有任务都参与统计排队延迟，但只丢弃新的回调任务
+                // 开启CoDel之前入队的任务没有入队时间
+                if(m_codelTargetUs && task.enqueueUs)
+                    stale = codelNoLock(task.enqueueUs) && task.cb;
             }
-            // 当前线程拿完一个任务后，发现任务队列还有剩余，需要tickle一下其他线程
-            tickle_me |= (it!=m_tasks.end());
         }
 
         // 如果有剩余任务，则通知其他线程进行调度
@@ -116,14 +827,31 @@ void Scheduler::run(){
         // 如果任务是协程（fiber），恢复该协程执行；如果任务是回调函数（cb），则创建或重置协程并执行。
         if(task.fiber){
             // resume协程，resume返回时，协程要么执行结束，要么半路yield，总之这个任务完成了活跃线程数-
+            // 协程记住本次调度的优先级，之后被IO事件或定时器唤醒时沿用
+            task.fiber->setPriority(task.priority);
+            beginTask(task.fiber.get(), task.enqueueUs, task.sampled);
             task.fiber->resume();
+            endTask();
             --m_activeThreadCount;
             task.reset();
         }else if(task.cb){
-            if(cb_fiber) cb_fiber->reset(task.cb);
-            else cb_fiber.reset(new Fiber(task.cb));
+            if(stale){
+                // 不直接丢弃，调度者可能依赖任务做清理（如连接计数）；
+                // 换上已超时的令牌，任务里的阻塞调用立即失败，很快就会结束
+                task.token = task.token ? task.token->fork(0) : CancelToken::Create(0);
+                onShed(SHED_STALE);
+            }
+            if(cb_fiber) cb_fiber->reset(std::move(task.cb));
+            else cb_fiber.reset(new Fiber(std::move(task.cb)));
+            cb_fiber->setCancelToken(task.token);
+            cb_fiber->setPriority(task.priority);
+            cb_fiber->setTag(task.tag);
+            uint64_t enqueue_us = task.enqueueUs;
+            bool sampled = task.sampled;
             task.reset();
+            beginTask(cb_fiber.get(), enqueue_us, sampled);
             cb_fiber->resume();
+            endTask();
             --m_activeThreadCount;
             cb_fiber.reset();
         }else{
@@ -131,15 +859,23 @@ void Scheduler::run(){
             if(idle_fiber->getState()==Fiber::TERM){
                 // 如果调度器没有调度任务，那么idle协程会不停的resume/yield，不会结束，
                 // 如果idle协程结束了，那一定是调度器停止了
-                SYLAR_LOG_DEBUG(g_logger) << "idle fiber term";
+                SYLAR_ALOG_DEBUG("idle fiber term");
                 break;
             }
+            // 监控线程要求缩容，空闲的工作线程直接退出
+            if(shouldRetire())
+                break;
             ++m_idleThreadCount;
+            uint64_t idle_start = GetCurrentUS();
             idle_fiber->resume();
+            if(t_worker){
+                t_worker->metrics.idleSwitches.inc();
+                t_worker->metrics.idleUs.inc(GetCurrentUS() - idle_start);
+            }
             --m_idleThreadCount;
         }
-    SYLAR_LOG_DEBUG(g_logger) << "Scheduler::run() exit";
     }
+    SYLAR_ALOG_DEBUG("Scheduler::run() exit");
 }
 
 void Scheduler::stop(){
@@ -153,8 +889,14 @@ void Scheduler::stop(){
     else
         SYLAR_ASSERT(GetThis()!=this);
 
+    // 先停掉监控线程，之后不会再有新的工作线程
+    if(m_sysmonThread){
+        m_sysmonThread->join();
+        m_sysmonThread.reset();
+    }
+
     // 唤醒所有工作线程，以便他们可以检测到调度器的停止状态并安全的结束
-    for(size_t i=0; i<m_threadCount; i++)
+    for(size_t i=0; i<m_liveWorkerCount; i++)
         tickle();
     
     // 如果存在主协程，则唤醒主协程，检测调度器的停滞状态
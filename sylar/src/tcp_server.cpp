@@ -0,0 +1,213 @@
+#include "tcp_server.h"
+#include "FdManager.h"
+#include "util.h"
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+TcpServer::TcpServer(IOManager *worker, const std::string &name)
+    :m_worker(worker)
+    ,m_name(name)
+{
+    SYLAR_ASSERT(m_worker);
+}
+
+TcpServer::~TcpServer()
+{
+    closeListeners();
+}
+
+bool TcpServer::bind(const std::string &ip, uint16_t port, int backlog)
+{
+    SYLAR_ASSERT(m_listeners.empty());
+    sockaddr_storage addr;
+    memset(&addr, 0, sizeof(addr));
+    socklen_t addrlen = 0;
+    sockaddr_in *v4 = (sockaddr_in*)&addr;
+    sockaddr_in6 *v6 = (sockaddr_in6*)&addr;
+    if(inet_pton(AF_INET, ip.c_str(), &v4->sin_addr) == 1){
+        v4->sin_family = AF_INET;
+        addrlen = sizeof(*v4);
+    }else if(inet_pton(AF_INET6, ip.c_str(), &v6->sin6_addr) == 1){
+        v6->sin6_family = AF_INET6;
+        addrlen = sizeof(*v6);
+    }else{
+        SYLAR_LOG_ERROR(g_logger) << "TcpServer::bind invalid ip=" << ip;
+        return false;
+    }
+
+    std::vector<int> threads = m_worker->getThreadIds();
+    SYLAR_ASSERT2(!threads.empty(), "worker not started");
+    for(int thread : threads){
+        int fd = socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if(fd < 0){
+            SYLAR_LOG_ERROR(g_logger) << "TcpServer::bind socket errno=" << errno << " " << strerror(errno);
+            closeListeners();
+            return false;
+        }
+        int val = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &val, sizeof(val));
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &val, sizeof(val));
+
+        // 第一个socket由内核分配端口时，之后的socket都绑定到这个端口
+        if(addr.ss_family == AF_INET)
+            v4->sin_port = htons(port);
+        else
+            v6->sin6_port = htons(port);
+        if(::bind(fd, (sockaddr*)&addr, addrlen) || listen(fd, backlog)){
+            SYLAR_LOG_ERROR(g_logger) << "TcpServer::bind " << ip << ":" << port
+                << " errno=" << errno << " " << strerror(errno);
+            ::close(fd);
+            closeListeners();
+            return false;
+        }
+        if(!port){
+            sockaddr_storage bound;
+            socklen_t len = sizeof(bound);
+            getsockname(fd, (sockaddr*)&bound, &len);
+            port = ntohs(bound.ss_family == AF_INET ? ((sockaddr_in*)&bound)->sin_port
+                                                    : ((sockaddr_in6*)&bound)->sin6_port);
+        }
+        m_listeners.push_back(Listener{fd, thread});
+    }
+    m_port = port;
+    return true;
+}
+
+bool TcpServer::start()
+{
+    if(!m_stopping || m_listeners.empty())
+        return false;
+    m_stopping = false;
+    auto self = shared_from_this();
+    for(auto &i : m_listeners){
+        ++m_acceptors;
+        if(!m_worker->schedule(std::bind(&TcpServer::acceptLoop, self, i.fd), i.thread)){
+            SYLAR_LOG_ERROR(g_logger) << "TcpServer " << m_name << " start rejected by overloaded scheduler";
+            --m_acceptors;
+            stop(0);
+            return false;
+        }
+    }
+    return true;
+}
+
+void TcpServer::acceptLoop(int lfd)
+{
+    while(!m_stopping){
+        if(m_maxConnections){
+            std::unique_lock<std::mutex> lock(m_mutex);
+            while(!m_stopping && m_clients.size() >= m_maxConnections)
+                m_slots.wait(lock);
+            if(m_stopping)
+                break;
+        }
+        if(m_worker->isOverloaded()){
+            // 在协程中usleep被hook，只挂起accept协程
+            usleep(m_overloadPauseMs * 1000);
+            continue;
+        }
+
+        int fd = accept4(lfd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(fd >= 0){
+            ++m_acceptCount;
+            FdMgr::GetInstance()->get(fd, true);
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_clients.insert(fd);
+            }
+            // 处理协程留在accept的线程上，连接的数据在这个线程的缓存里
+            if(!m_worker->schedule(std::bind(&TcpServer::onClient, shared_from_this(), fd), GetThreadId())){
+                ++m_rejectCount;
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_clients.erase(fd);
+                }
+                ::close(fd);
+            }
+            continue;
+        }
+        if(errno == EINTR || errno == ECONNABORTED)
+            continue;
+        if(errno == EAGAIN || errno == EWOULDBLOCK){
+            if(m_worker->addEvent(lfd, IOManager::READ)){
+                SYLAR_LOG_ERROR(g_logger) << "TcpServer accept addEvent fd=" << lfd << " fail";
+                break;
+            }
+            Fiber::SetCurrentWait("accept", lfd, IOManager::READ);
+            Fiber::GetThis()->yield();
+            continue;
+        }
+        if(errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM){
+            // 资源耗尽时稍后再试，连接留在backlog里
+            SYLAR_LOG_ERROR(g_logger) << "TcpServer accept errno=" << errno << " " << strerror(errno);
+            usleep(10 * 1000);
+            continue;
+        }
+        if(!m_stopping)
+            SYLAR_LOG_ERROR(g_logger) << "TcpServer accept errno=" << errno << " " << strerror(errno);
+        break;
+    }
+    --m_acceptors;
+}
+
+void TcpServer::onClient(int fd)
+{
+    handleClient(fd);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_clients.erase(fd);
+        m_slots.notifyOne();
+    }
+    ::close(fd);
+}
+
+size_t TcpServer::getConnectionCount()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_clients.size();
+}
+
+void TcpServer::closeListeners()
+{
+    for(auto &i : m_listeners)
+        ::close(i.fd);
+    m_listeners.clear();
+}
+
+void TcpServer::stop(uint64_t drain_timeout_ms)
+{
+    if(m_stopping.exchange(true))
+        return;
+
+    // 唤醒挂起在监听socket上或者等待连接名额的accept协程，等它们退出后再关闭，避免fd被复用。
+    // shutdown之后监听socket一直可读、accept返回EINVAL，刚拿到EAGAIN还没有addEvent的协程
+    // 注册事件后也会马上被唤醒，不会错过cancelAll
+    for(auto &i : m_listeners){
+        shutdown(i.fd, SHUT_RD);
+        m_worker->cancelAll(i.fd);
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_slots.notifyAll();
+    }
+    while(m_acceptors > 0)
+        usleep(1000);
+    closeListeners();
+
+    // 在协程中调用时usleep被hook，只挂起当前协程
+    uint64_t deadline = GetCurrentMS() + drain_timeout_ms;
+    while(getConnectionCount() && GetCurrentMS() < deadline)
+        usleep(10 * 1000);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if(!m_clients.empty()){
+        SYLAR_LOG_INFO(g_logger) << "TcpServer " << m_name << " drain timeout, shutdown "
+            << m_clients.size() << " connections";
+        for(int fd : m_clients)
+            shutdown(fd, SHUT_RDWR);
+    }
+}
@@ -0,0 +1,216 @@
+#include "trace.h"
+#include <fstream>
+
+#ifndef SYLAR_ENABLE_TRACE
+
+void Tracer::Record(Type type, uint64_t fiber, uint64_t arg) {}
+void Tracer::SetEnabled(bool v) {}
+bool Tracer::IsEnabled() { return false;}
+std::string Tracer::DumpChromeJson() { return "{\"traceEvents\":[]}";}
+void Tracer::Clear() {}
+
+#else
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <map>
+#include <sstream>
+#include <algorithm>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include "util.h"
+
+/**
+ * 线程的环形缓冲区，只由所属线程写入，head单调递增，
+ * 导出时读取最近kRingSize条记录；线程退出后缓冲区保留，供之后导出
+ */
+struct TraceRing{
+    pid_t tid = 0;
+    std::string name;
+    std::atomic<uint64_t> head = {0};
+    // Clear时的head，导出时跳过它之前的记录
+    std::atomic<uint64_t> cleared = {0};
+    Tracer::Event events[Tracer::kRingSize];
+};
+
+static std::atomic<bool> s_enabled = {true};
+static std::mutex s_mutex;
+static std::vector<TraceRing*> s_rings;
+static thread_local TraceRing *t_ring = nullptr;
+
+/// 时间戳的起点，导出时的时间都相对于它
+static const uint64_t s_base_tsc = GetCycleCount();
+
+static TraceRing *RegisterRing()
+{
+    TraceRing *ring = new TraceRing;
+    ring->tid = syscall(SYS_gettid);
+    char name[32] = {0};
+    if(pthread_getname_np(pthread_self(), name, sizeof(name)) == 0)
+        ring->name = name;
+    std::lock_guard<std::mutex> lock(s_mutex);
+    s_rings.push_back(ring);
+    return ring;
+}
+
+void Tracer::Record(Type type, uint64_t fiber, uint64_t arg)
+{
+    if(!s_enabled.load(std::memory_order_relaxed))
+        return;
+    TraceRing *ring = t_ring;
+    if(!ring)
+        ring = t_ring = RegisterRing();
+    uint64_t idx = ring->head.load(std::memory_order_relaxed);
+    Event &e = ring->events[idx & (kRingSize - 1)];
+    e.tsc = GetCycleCount();
+    e.fiber = fiber;
+    e.arg = arg;
+    e.type = type;
+    ring->head.store(idx + 1, std::memory_order_release);
+}
+
+void Tracer::SetEnabled(bool v)
+{
+    s_enabled = v;
+}
+
+bool Tracer::IsEnabled()
+{
+    return s_enabled;
+}
+
+void Tracer::Clear()
+{
+    // head只由写入方修改，这里只记录一个起点让导出时跳过
+    std::lock_guard<std::mutex> lock(s_mutex);
+    for(auto ring : s_rings)
+        ring->cleared = ring->head.load(std::memory_order_acquire);
+}
+
+namespace {
+struct TraceItem{
+    Tracer::Event event;
+    pid_t tid;
+};
+}
+
+std::string Tracer::DumpChromeJson()
+{
+    // 先拷贝出所有记录，拷贝期间写入方可能覆盖最旧的几条，拷贝完再按head丢弃被覆盖的部分
+    std::vector<TraceItem> items;
+    std::vector<std::pair<pid_t, std::string> > threads;
+    {
+        std::lock_guard<std::mutex> lock(s_mutex);
+        for(auto ring : s_rings){
+            threads.push_back(std::make_pair(ring->tid, ring->name));
+            uint64_t end = ring->head.load(std::memory_order_acquire);
+            uint64_t begin = end > kRingSize ? end - kRingSize : 0;
+            begin = std::max<uint64_t>(begin, ring->cleared);
+            size_t base = items.size();
+            for(uint64_t i = begin; i < end; ++i)
+                items.push_back(TraceItem{ring->events[i & (kRingSize - 1)], ring->tid});
+            uint64_t now = ring->head.load(std::memory_order_acquire);
+            uint64_t valid = now > kRingSize ? now - kRingSize : 0;
+            if(valid > begin && end > begin){
+                size_t drop = std::min<uint64_t>(valid - begin, end - begin);
+                items.erase(items.begin() + base, items.begin() + base + drop);
+            }
+        }
+    }
+    std::stable_sort(items.begin(), items.end(), [](const TraceItem &a, const TraceItem &b){
+        return a.event.tsc < b.event.tsc;
+    });
+
+    // TSC换算成微秒
+    double ticks_per_us = GetCyclesPerUS();
+    auto to_us = [&](uint64_t t){
+        return t > s_base_tsc ? (t - s_base_tsc) / ticks_per_us : 0.0;
+    };
+
+    pid_t pid = getpid();
+    std::stringstream ss;
+    ss.setf(std::ios::fixed);
+    ss.precision(3);
+    ss << "{\"traceEvents\":[";
+    bool first = true;
+    auto sep = [&](){
+        if(!first) ss << ",";
+        first = false;
+        ss << "\n";
+    };
+
+    for(auto &i : threads){
+        sep();
+        ss << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << i.first
+           << ",\"args\":{\"name\":\"" << (i.second.empty() ? std::to_string(i.first) : i.second) << "\"}}";
+    }
+
+    // 每个线程上打开的切片数，缓冲区回绕后开头可能有没有配对RESUME的YIELD，丢弃
+    std::map<pid_t, int> depth;
+    // 协程被唤醒后还没有resume的flow id
+    std::map<uint64_t, uint64_t> pending;
+    uint64_t flow_id = 0;
+    static const char *s_names[] = {"resume", "yield", "schedule", "add_event", "trigger", "timer_fire"};
+
+    for(auto &i : items){
+        const Event &e = i.event;
+        double ts = to_us(e.tsc);
+        switch(e.type){
+            case RESUME:
+                sep();
+                ss << "{\"name\":\"fiber " << e.fiber << "\",\"cat\":\"fiber\",\"ph\":\"B\",\"ts\":" << ts
+                   << ",\"pid\":" << pid << ",\"tid\":" << i.tid << "}";
+                ++depth[i.tid];
+                {
+                    auto it = pending.find(e.fiber);
+                    if(it != pending.end()){
+                        sep();
+                        ss << "{\"name\":\"wakeup\",\"cat\":\"flow\",\"ph\":\"f\",\"bp\":\"e\",\"id\":" << it->second
+                           << ",\"ts\":" << ts << ",\"pid\":" << pid << ",\"tid\":" << i.tid << "}";
+                        pending.erase(it);
+                    }
+                }
+                break;
+            case YIELD:
+                if(depth[i.tid] <= 0)
+                    break;
+                --depth[i.tid];
+                sep();
+                ss << "{\"ph\":\"E\",\"ts\":" << ts << ",\"pid\":" << pid << ",\"tid\":" << i.tid << "}";
+                break;
+            case SCHEDULE:
+            case ADD_EVENT:
+            case TRIGGER:
+            case TIMER_FIRE:
+                sep();
+                ss << "{\"name\":\"" << s_names[e.type] << "\",\"cat\":\"sched\",\"ph\":\"i\",\"s\":\"t\",\"ts\":" << ts
+                   << ",\"pid\":" << pid << ",\"tid\":" << i.tid
+                   << ",\"args\":{\"fiber\":" << e.fiber << ",\"arg\":" << e.arg << "}}";
+                // IO触发的协程随后还会入队一次，flow从触发点开始画
+                if(e.fiber && (e.type == TRIGGER || (e.type == SCHEDULE && !pending.count(e.fiber)))){
+                    pending[e.fiber] = ++flow_id;
+                    sep();
+                    ss << "{\"name\":\"wakeup\",\"cat\":\"flow\",\"ph\":\"s\",\"id\":" << flow_id
+                       << ",\"ts\":" << ts << ",\"pid\":" << pid << ",\"tid\":" << i.tid << "}";
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    ss << "\n]}";
+    return ss.str();
+}
+
+#endif
+
+bool Tracer::DumpToFile(const std::string &path)
+{
+    std::ofstream ofs(path, std::ios::out | std::ios::trunc);
+    if(!ofs)
+        return false;
+    ofs << DumpChromeJson();
+    return (bool)ofs;
+}
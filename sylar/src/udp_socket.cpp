@@ -0,0 +1,203 @@
+#include "udp_socket.h"
+#include "util.h"
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <algorithm>
+#include <netinet/udp.h>
+
+#ifndef SOL_UDP
+#define SOL_UDP 17
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+
+// 每个槽位的控制消息空间，只需要容纳GRO的段长度
+static const size_t CONTROL_SIZE = CMSG_SPACE(sizeof(int));
+
+UdpSocket::RecvBatch::RecvBatch(size_t slot_size)
+    :m_slotSize(slot_size)
+    ,m_buf(slot_size * kMaxBatch)
+    ,m_msgs(kMaxBatch)
+    ,m_iovs(kMaxBatch)
+    ,m_addrs(kMaxBatch)
+    ,m_control(CONTROL_SIZE * kMaxBatch)
+{
+    m_datagrams.reserve(kMaxBatch);
+}
+
+void UdpSocket::RecvBatch::prepare()
+{
+    // 内核会改写msg_namelen、msg_controllen，每次接收前重置
+    for(size_t i = 0; i < kMaxBatch; ++i){
+        m_iovs[i].iov_base = &m_buf[i * m_slotSize];
+        m_iovs[i].iov_len = m_slotSize;
+        msghdr &h = m_msgs[i].msg_hdr;
+        memset(&h, 0, sizeof(h));
+        h.msg_name = &m_addrs[i];
+        h.msg_namelen = sizeof(m_addrs[i]);
+        h.msg_iov = &m_iovs[i];
+        h.msg_iovlen = 1;
+        h.msg_control = &m_control[i * CONTROL_SIZE];
+        h.msg_controllen = CONTROL_SIZE;
+        m_msgs[i].msg_len = 0;
+    }
+    m_datagrams.clear();
+}
+
+void UdpSocket::RecvBatch::parse(size_t n)
+{
+    for(size_t i = 0; i < n; ++i){
+        msghdr &h = m_msgs[i].msg_hdr;
+        size_t len = m_msgs[i].msg_len;
+        size_t seg = len;
+        for(cmsghdr *cm = CMSG_FIRSTHDR(&h); cm; cm = CMSG_NXTHDR(&h, cm)){
+            if(cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO){
+                int v;
+                memcpy(&v, CMSG_DATA(cm), sizeof(v));
+                if(v > 0) seg = v;
+            }
+        }
+        const char *p = (const char*)m_iovs[i].iov_base;
+        // 合并的报文除最后一个外长度都等于段长度
+        do{
+            size_t l = std::min(seg, len);
+            m_datagrams.push_back(Datagram{p, l, (const sockaddr*)&m_addrs[i], h.msg_namelen});
+            p += l;
+            len -= l;
+        }while(len);
+    }
+}
+
+UdpSocket::UdpSocket(int family)
+    :m_family(family)
+{
+    // socket被hook，创建后已注册到FdManager并设置为非阻塞
+    m_fd = socket(family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if(m_fd < 0){
+        SYLAR_LOG_ERROR(g_logger) << "UdpSocket socket errno=" << errno << " " << strerror(errno);
+    }
+}
+
+UdpSocket::~UdpSocket()
+{
+    if(m_fd >= 0)
+        ::close(m_fd);
+}
+
+bool UdpSocket::bind(const std::string &ip, uint16_t port, bool reuse_port)
+{
+    sockaddr_storage addr;
+    socklen_t addrlen;
+    if(m_fd < 0 || !ParseAddress(ip, port, addr, addrlen) || addr.ss_family != m_family){
+        SYLAR_LOG_ERROR(g_logger) << "UdpSocket::bind invalid ip=" << ip;
+        return false;
+    }
+    if(reuse_port){
+        int val = 1;
+        setsockopt(m_fd, SOL_SOCKET, SO_REUSEPORT, &val, sizeof(val));
+    }
+    if(::bind(m_fd, (sockaddr*)&addr, addrlen)){
+        SYLAR_LOG_ERROR(g_logger) << "UdpSocket::bind " << ip << ":" << port
+            << " errno=" << errno << " " << strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+bool UdpSocket::connect(const std::string &ip, uint16_t port)
+{
+    sockaddr_storage addr;
+    socklen_t addrlen;
+    if(m_fd < 0 || !ParseAddress(ip, port, addr, addrlen))
+        return false;
+    // UDP的connect只记录地址，不会挂起
+    return ::connect(m_fd, (sockaddr*)&addr, addrlen) == 0;
+}
+
+uint16_t UdpSocket::getPort() const
+{
+    sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    if(getsockname(m_fd, (sockaddr*)&addr, &len))
+        return 0;
+    return ntohs(addr.ss_family == AF_INET ? ((sockaddr_in*)&addr)->sin_port
+                                           : ((sockaddr_in6*)&addr)->sin6_port);
+}
+
+bool UdpSocket::setGro(bool on)
+{
+    int val = on;
+    return setsockopt(m_fd, SOL_UDP, UDP_GRO, &val, sizeof(val)) == 0;
+}
+
+int UdpSocket::recv(RecvBatch &batch, int flags)
+{
+    batch.prepare();
+    // 阻塞的socket上没有MSG_WAITFORONE会一直等到收满kMaxBatch个
+    int n = recvmmsg(m_fd, batch.m_msgs.data(), kMaxBatch, flags | MSG_WAITFORONE, nullptr);
+    if(n <= 0)
+        return n;
+    batch.parse(n);
+    return batch.size();
+}
+
+int UdpSocket::send(const Datagram *datagrams, size_t n, int flags)
+{
+    mmsghdr msgs[kMaxBatch];
+    iovec iovs[kMaxBatch];
+    if(n > kMaxBatch)
+        n = kMaxBatch;
+    for(size_t i = 0; i < n; ++i){
+        iovs[i].iov_base = (void*)datagrams[i].data;
+        iovs[i].iov_len = datagrams[i].len;
+        msghdr &h = msgs[i].msg_hdr;
+        memset(&h, 0, sizeof(h));
+        h.msg_name = (void*)datagrams[i].addr;
+        h.msg_namelen = datagrams[i].addr ? datagrams[i].addrlen : 0;
+        h.msg_iov = &iovs[i];
+        h.msg_iovlen = 1;
+        msgs[i].msg_len = 0;
+    }
+    // sendmmsg可能只发出一部分，挂起后继续发送剩下的
+    size_t sent = 0;
+    while(sent < n){
+        int rt = sendmmsg(m_fd, msgs + sent, n - sent, flags);
+        if(rt <= 0)
+            return sent ? (int)sent : rt;
+        sent += rt;
+    }
+    return sent;
+}
+
+ssize_t UdpSocket::sendSegments(const void *data, size_t len, uint16_t segment_size,
+                                const sockaddr *addr, socklen_t addrlen)
+{
+    iovec iov;
+    iov.iov_base = (void*)data;
+    iov.iov_len = len;
+    char control[CMSG_SPACE(sizeof(uint16_t))];
+    memset(control, 0, sizeof(control));
+
+    msghdr h;
+    memset(&h, 0, sizeof(h));
+    h.msg_name = (void*)addr;
+    h.msg_namelen = addr ? addrlen : 0;
+    h.msg_iov = &iov;
+    h.msg_iovlen = 1;
+    // 不超过一段时不需要切分
+    if(segment_size && len > segment_size){
+        h.msg_control = control;
+        h.msg_controllen = sizeof(control);
+        cmsghdr *cm = CMSG_FIRSTHDR(&h);
+        cm->cmsg_level = SOL_UDP;
+        cm->cmsg_type = UDP_SEGMENT;
+        cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        memcpy(CMSG_DATA(cm), &segment_size, sizeof(segment_size));
+    }
+    return sendmsg(m_fd, &h, 0);
+}
@@ -0,0 +1,90 @@
+#include "util.h"
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <dirent.h>
+#include <string.h>
+#include <stdlib.h>
+#include <string>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+uint64_t GetCurrentMS()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000ul + ts.tv_nsec / 1000000;
+}
+
+uint64_t GetCurrentUS()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 * 1000ul + ts.tv_nsec / 1000;
+}
+
+int GetCpuNode(int cpu)
+{
+    // sysfs中cpuN目录下有一个nodeX的链接指向所属节点
+    std::string path = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+    DIR *dir = opendir(path.c_str());
+    if(!dir) return 0;
+    int node = 0;
+    while(struct dirent *ent = readdir(dir)){
+        if(strncmp(ent->d_name, "node", 4) == 0 && ent->d_name[4] >= '0' && ent->d_name[4] <= '9'){
+            node = atoi(ent->d_name + 4);
+            break;
+        }
+    }
+    closedir(dir);
+    return node;
+}
+
+static double CalibrateCycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    uint64_t us0 = GetCurrentUS();
+    uint64_t c0 = GetCycleCount();
+    uint64_t us1 = us0;
+    while(us1 - us0 < 1000)
+        us1 = GetCurrentUS();
+    uint64_t c1 = GetCycleCount();
+    return (double)(c1 - c0) / (us1 - us0);
+#else
+    return 1000.0;
+#endif
+}
+
+double GetCyclesPerUS()
+{
+    static const double s_cycles_per_us = CalibrateCycles();
+    return s_cycles_per_us;
+}
+
+bool SetThreadAffinity(int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+bool ParseAddress(const std::string &ip, uint16_t port, sockaddr_storage &addr, socklen_t &addrlen)
+{
+    memset(&addr, 0, sizeof(addr));
+    sockaddr_in *v4 = (sockaddr_in*)&addr;
+    sockaddr_in6 *v6 = (sockaddr_in6*)&addr;
+    if(inet_pton(AF_INET, ip.c_str(), &v4->sin_addr) == 1){
+        v4->sin_family = AF_INET;
+        v4->sin_port = htons(port);
+        addrlen = sizeof(*v4);
+        return true;
+    }
+    if(inet_pton(AF_INET6, ip.c_str(), &v6->sin6_addr) == 1){
+        v6->sin6_family = AF_INET6;
+        v6->sin6_port = htons(port);
+        addrlen = sizeof(*v6);
+        return true;
+    }
+    return false;
+}
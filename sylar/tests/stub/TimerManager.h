@@ -0,0 +1,25 @@
+/**
+ * @file TimerManager.h
+ * @brief 测试桩：不会触发的定时器，令牌桶的补充由测试直接驱动
+ */
+#ifndef __SYLAR_TIMER_MANAGER_H__
+#define __SYLAR_TIMER_MANAGER_H__
+
+#include <memory>
+#include <functional>
+#include <stdint.h>
+
+class Timer{
+public:
+    typedef std::shared_ptr<Timer> ptr;
+    bool cancel() { return true;}
+};
+
+class TimerManager{
+public:
+    Timer::ptr addConditionTimer(uint64_t, std::function<void()>, std::weak_ptr<void>, bool = false){
+        return Timer::ptr(new Timer);
+    }
+};
+
+#endif
@@ -0,0 +1,64 @@
+/**
+ * @file fiber_sync.h
+ * @brief 测试桩：用条件变量实现的FiberWaitQueue
+ * @details 接口和语义与协程版本相同，只是挂起的是线程，
+ * 让依赖它的代码可以在普通线程上做多线程压力测试
+ */
+#ifndef __SYLAR_FIBER_SYNC_H__
+#define __SYLAR_FIBER_SYNC_H__
+
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <list>
+#include <stdint.h>
+#include <errno.h>
+#include "noncopyable.h"
+
+class FiberWaitQueue : Noncopyable{
+public:
+    typedef std::mutex MutexType;
+
+    int wait(std::unique_lock<std::mutex> &lock, uint64_t timeout_ms = ~0ull){
+        if(timeout_ms == 0)
+            return ETIMEDOUT;
+        bool woken = false;
+        auto it = m_waiters.insert(m_waiters.end(), &woken);
+        auto pred = [&](){ return woken;};
+        if(timeout_ms == ~0ull){
+            m_cond.wait(lock, pred);
+            return 0;
+        }
+        if(m_cond.wait_for(lock, std::chrono::milliseconds(timeout_ms), pred))
+            return 0;
+        m_waiters.erase(it);
+        return ETIMEDOUT;
+    }
+
+    bool notifyOne(){
+        if(m_waiters.empty())
+            return false;
+        *m_waiters.front() = true;
+        m_waiters.pop_front();
+        m_cond.notify_all();
+        return true;
+    }
+
+    size_t notifyAll(){
+        size_t n = m_waiters.size();
+        for(bool *w : m_waiters)
+            *w = true;
+        m_waiters.clear();
+        m_cond.notify_all();
+        return n;
+    }
+
+    bool hasWaiters() { return !m_waiters.empty();}
+
+private:
+    std::condition_variable m_cond;
+    // 按FIFO顺序排队的等待者，调用方持有锁时访问
+    std::list<bool*> m_waiters;
+};
+
+#endif
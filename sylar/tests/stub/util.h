@@ -0,0 +1,21 @@
+/**
+ * @file util.h
+ * @brief 测试桩：限流器用到的工具函数和断言
+ * @details 时间函数链接sylar_base中的实现
+ */
+#ifndef __SYLAR_UTIL_H__
+#define __SYLAR_UTIL_H__
+
+#include <stdint.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+uint64_t GetCurrentMS();
+uint64_t GetCurrentUS();
+
+inline int GetThreadId() { return syscall(SYS_gettid);}
+
+#define SYLAR_ASSERT(x) assert(x)
+
+#endif
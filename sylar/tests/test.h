@@ -0,0 +1,22 @@
+/**
+ * @file test.h
+ * @brief 单元测试用的断言宏
+ * @details 不引入测试框架，失败时输出位置并以非0退出，由ctest判定
+ */
+#ifndef __SYLAR_TEST_H__
+#define __SYLAR_TEST_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SYLAR_CHECK(cond) \
+    do{ \
+        if(!(cond)){ \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1); \
+        } \
+    }while(0)
+
+#define SYLAR_CHECK_EQ(a, b) SYLAR_CHECK((a) == (b))
+
+#endif
@@ -0,0 +1,188 @@
+/**
+ * @file test_http_parser.cpp
+ * @brief HttpRequestParser的单元测试：增量输入、流水线请求和错误请求
+ */
+#include "http.h"
+#include "test.h"
+#include <string>
+
+static const char kGet[] =
+    "GET /index.html?a=1&b=2 HTTP/1.1\r\n"
+    "Host: example.com\r\n"
+    "User-Agent:  bench \t\r\n"
+    "\r\n";
+
+static const char kPost[] =
+    "POST /submit HTTP/1.1\r\n"
+    "Host: example.com\r\n"
+    "Content-Length: 11\r\n"
+    "\r\n"
+    "hello world";
+
+static const char kChunked[] =
+    "POST /upload HTTP/1.1\r\n"
+    "Transfer-Encoding: chunked\r\n"
+    "Connection: close\r\n"
+    "\r\n"
+    "5;name=value\r\nhello\r\n"
+    "1A\r\nabcdefghijklmnopqrstuvwxyz\r\n"
+    "0\r\n"
+    "X-Trailer: ignored\r\n"
+    "\r\n";
+
+// 解析一个完整的缓冲区，期望恰好得到一个请求
+static HttpRequestParser::Result ParseAll(const std::string &data, HttpRequest &req,
+                                          HttpRequestParser &parser){
+    IOBuf buf;
+    buf.append(data);
+    return parser.parse(buf, req);
+}
+
+static void test_simple(){
+    HttpRequestParser parser;
+    HttpRequest req;
+    SYLAR_CHECK_EQ(ParseAll(kGet, req, parser), HttpRequestParser::OK);
+    SYLAR_CHECK(req.getMethod().equals("GET"));
+    SYLAR_CHECK(req.getPath().equals("/index.html"));
+    SYLAR_CHECK(req.getQuery().equals("a=1&b=2"));
+    SYLAR_CHECK(req.getVersion().equals("HTTP/1.1"));
+    SYLAR_CHECK(req.isHttp11());
+    SYLAR_CHECK(req.isKeepAlive());
+    SYLAR_CHECK_EQ(req.getHeaders().size(), 2u);
+    // 名字不区分大小写，值去掉两边的空白
+    SYLAR_CHECK(req.getHeader("host").equals("example.com"));
+    SYLAR_CHECK(req.getHeader("User-Agent").equals("bench"));
+    SYLAR_CHECK(req.getHeader("Accept").empty());
+    SYLAR_CHECK(req.getBody().empty());
+    SYLAR_CHECK(parser.isIdle());
+}
+
+// 一个字节一个字节地输入，最后一个字节之前都应该返回AGAIN
+static void test_byte_by_byte(const std::string &data, const std::string &body){
+    HttpRequestParser parser;
+    HttpRequest req;
+    IOBuf buf;
+    for(size_t i = 0; i < data.size(); ++i){
+        buf.append(&data[i], 1);
+        HttpRequestParser::Result rt = parser.parse(buf, req);
+        if(i + 1 < data.size()){
+            SYLAR_CHECK_EQ(rt, HttpRequestParser::AGAIN);
+            // 扫描位置回退3个字节，前3个字节还不算开始了一个请求
+            if(i >= 3)
+                SYLAR_CHECK(!parser.isIdle());
+        }else{
+            SYLAR_CHECK_EQ(rt, HttpRequestParser::OK);
+        }
+    }
+    SYLAR_CHECK(buf.empty());
+    SYLAR_CHECK(parser.isIdle());
+    SYLAR_CHECK(req.getBody().toString() == body);
+}
+
+// 在每个位置把请求切成两次输入
+static void test_every_split(const std::string &data, const std::string &body){
+    for(size_t cut = 1; cut < data.size(); ++cut){
+        HttpRequestParser parser;
+        HttpRequest req;
+        IOBuf buf;
+        buf.append(data.data(), cut);
+        SYLAR_CHECK_EQ(parser.parse(buf, req), HttpRequestParser::AGAIN);
+        buf.append(data.data() + cut, data.size() - cut);
+        SYLAR_CHECK_EQ(parser.parse(buf, req), HttpRequestParser::OK);
+        SYLAR_CHECK(buf.empty());
+        SYLAR_CHECK(req.getBody().toString() == body);
+    }
+}
+
+static void test_incremental(){
+    test_byte_by_byte(kGet, "");
+    test_byte_by_byte(kPost, "hello world");
+    test_byte_by_byte(kChunked, "helloabcdefghijklmnopqrstuvwxyz");
+    test_every_split(kGet, "");
+    test_every_split(kPost, "hello world");
+    test_every_split(kChunked, "helloabcdefghijklmnopqrstuvwxyz");
+}
+
+static void test_pipelined(){
+    HttpRequestParser parser;
+    HttpRequest req;
+    IOBuf buf;
+    std::string all = std::string(kPost) + kGet + kChunked + kGet;
+    // 最后一个请求只到了一半
+    buf.append(all.data(), all.size() - 10);
+
+    SYLAR_CHECK_EQ(parser.parse(buf, req), HttpRequestParser::OK);
+    SYLAR_CHECK(req.getPath().equals("/submit"));
+    SYLAR_CHECK(req.getBody().toString() == "hello world");
+
+    // 同一个请求对象复用，上一个请求的头部和请求体被清掉
+    SYLAR_CHECK_EQ(parser.parse(buf, req), HttpRequestParser::OK);
+    SYLAR_CHECK(req.getPath().equals("/index.html"));
+    SYLAR_CHECK(req.getHeader("Content-Length").empty());
+    SYLAR_CHECK(req.getBody().empty());
+
+    SYLAR_CHECK_EQ(parser.parse(buf, req), HttpRequestParser::OK);
+    SYLAR_CHECK(req.getPath().equals("/upload"));
+    SYLAR_CHECK(!req.isKeepAlive());
+    SYLAR_CHECK(req.getBody().toString() == "helloabcdefghijklmnopqrstuvwxyz");
+    SYLAR_CHECK(parser.isIdle());
+
+    SYLAR_CHECK_EQ(parser.parse(buf, req), HttpRequestParser::AGAIN);
+    buf.append(all.data() + all.size() - 10, 10);
+    SYLAR_CHECK_EQ(parser.parse(buf, req), HttpRequestParser::OK);
+    SYLAR_CHECK(req.getPath().equals("/index.html"));
+    SYLAR_CHECK(buf.empty());
+}
+
+static void test_keep_alive(){
+    HttpRequestParser parser;
+    HttpRequest req;
+    SYLAR_CHECK_EQ(ParseAll("GET / HTTP/1.0\r\n\r\n", req, parser), HttpRequestParser::OK);
+    SYLAR_CHECK(!req.isHttp11());
+    SYLAR_CHECK(!req.isKeepAlive());
+    SYLAR_CHECK_EQ(ParseAll("GET / HTTP/1.0\r\nConnection: Keep-Alive\r\n\r\n", req, parser),
+                   HttpRequestParser::OK);
+    SYLAR_CHECK(req.isKeepAlive());
+    SYLAR_CHECK_EQ(ParseAll("GET / HTTP/1.1\r\nConnection: close\r\n\r\n", req, parser),
+                   HttpRequestParser::OK);
+    SYLAR_CHECK(!req.isKeepAlive());
+}
+
+// 期望解析失败并给出status
+static void ExpectError(const std::string &data, int status, size_t max_header = 8192,
+                        size_t max_body = 1024){
+    HttpRequestParser parser(max_header, max_body);
+    HttpRequest req;
+    IOBuf buf;
+    buf.append(data);
+    SYLAR_CHECK_EQ(parser.parse(buf, req), HttpRequestParser::ERROR);
+    SYLAR_CHECK_EQ(parser.getStatus(), status);
+}
+
+static void test_errors(){
+    ExpectError("GET /\r\n\r\n", 400);
+    ExpectError("GET / HTTP/2.0\r\n\r\n", 400);
+    ExpectError(" / HTTP/1.1\r\n\r\n", 400);
+    ExpectError("GET / HTTP/1.1\r\nNoColon\r\n\r\n", 400);
+    ExpectError("GET / HTTP/1.1\r\nHost : x\r\n\r\n", 400);
+    ExpectError("POST / HTTP/1.1\r\nContent-Length: 12a\r\n\r\n", 400);
+    ExpectError("POST / HTTP/1.1\r\nContent-Length: 2048\r\n\r\n", 413);
+    ExpectError("POST / HTTP/1.1\r\nTransfer-Encoding: gzip\r\n\r\n", 501);
+    ExpectError("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\nContent-Length: 5\r\n\r\n", 400);
+    ExpectError("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\n", 400);
+    ExpectError("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n5\r\nhelloXX", 400);
+    ExpectError("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n800\r\n", 413);
+    // 头部超过上限，无论结束标记是否已经到达
+    ExpectError("GET / HTTP/1.1\r\nX-Long: " + std::string(200, 'x') + "\r\n\r\n", 431, 64);
+    ExpectError("GET / HTTP/1.1\r\nX-Long: " + std::string(200, 'x'), 431, 64);
+}
+
+int main(){
+    test_simple();
+    test_incremental();
+    test_pipelined();
+    test_keep_alive();
+    test_errors();
+    printf("test_http_parser ok\n");
+    return 0;
+}
@@ -0,0 +1,227 @@
+/**
+ * @file test_iobuf.cpp
+ * @brief IOBuf的单元测试：切分、拼接、查找、整数编解码和fd读写
+ */
+#include "iobuf.h"
+#include "test.h"
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <string>
+
+// 跨越多个块的测试数据
+static std::string Pattern(size_t n){
+    std::string s(n, 0);
+    for(size_t i = 0; i < n; ++i)
+        s[i] = 'a' + (i * 7 + i / 13) % 26;
+    return s;
+}
+
+static void test_append(){
+    IOBuf buf;
+    SYLAR_CHECK(buf.empty());
+    std::string s = Pattern(IOBuf::kBlockSize * 3 + 100);
+    // 小段追加，覆盖填满尾块再分配新块的路径
+    for(size_t off = 0; off < s.size(); off += 1000)
+        buf.append(s.data() + off, std::min((size_t)1000, s.size() - off));
+    SYLAR_CHECK_EQ(buf.size(), s.size());
+    SYLAR_CHECK(buf.toString() == s);
+
+    IOBuf other;
+    other.append("head", 4);
+    other.append(buf);
+    SYLAR_CHECK(other.toString() == "head" + s);
+    // 移动追加后源为空
+    IOBuf moved;
+    moved.append(std::move(other));
+    SYLAR_CHECK(other.empty());
+    SYLAR_CHECK_EQ(moved.size(), s.size() + 4);
+}
+
+static void test_cut(){
+    std::string s = Pattern(IOBuf::kBlockSize * 4);
+    // 在各种位置切分，包括块的边界前后
+    size_t cuts[] = {0, 1, 100, IOBuf::kBlockSize - 40, IOBuf::kBlockSize,
+                     IOBuf::kBlockSize + 1, s.size() - 1, s.size(), s.size() + 10};
+    for(size_t n : cuts){
+        IOBuf buf;
+        buf.append(s);
+        IOBuf out;
+        out.append("x", 1);
+        size_t moved = buf.cutTo(out, n);
+        size_t expect = std::min(n, s.size());
+        SYLAR_CHECK_EQ(moved, expect);
+        SYLAR_CHECK(out.toString() == "x" + s.substr(0, expect));
+        SYLAR_CHECK(buf.toString() == s.substr(expect));
+    }
+
+    // 切出的部分和原缓冲区共享块，之后向两边追加互不影响
+    IOBuf a;
+    a.append("0123456789", 10);
+    IOBuf b;
+    a.cutTo(b, 4);
+    a.append("AB", 2);
+    b.append("cd", 2);
+    SYLAR_CHECK(a.toString() == "456789AB");
+    SYLAR_CHECK(b.toString() == "0123cd");
+
+    // 拷贝共享块，修改拷贝不影响原缓冲区
+    IOBuf c(a);
+    c.append("!", 1);
+    c.consume(3);
+    SYLAR_CHECK(a.toString() == "456789AB");
+    SYLAR_CHECK(c.toString() == "789AB!");
+}
+
+static void test_consume_copy_find(){
+    std::string s = Pattern(IOBuf::kBlockSize * 2 + 500);
+    IOBuf buf;
+    buf.append(s);
+
+    char tmp[64];
+    size_t off = IOBuf::kBlockSize - 50;
+    SYLAR_CHECK_EQ(buf.copyTo(tmp, sizeof(tmp), off), sizeof(tmp));
+    SYLAR_CHECK(!memcmp(tmp, s.data() + off, sizeof(tmp)));
+    SYLAR_CHECK_EQ(buf.copyTo(tmp, sizeof(tmp), s.size() - 10), 10u);
+
+    // 跨块查找
+    std::string needle = s.substr(off + 40, 20);
+    SYLAR_CHECK_EQ(buf.find(needle.data(), needle.size()), s.find(needle));
+    SYLAR_CHECK_EQ(buf.find("\r\n\r\n", 4), IOBuf::npos);
+    // 从start开始查找，跳过前面的匹配
+    std::string twice = "abcXabcX";
+    IOBuf small;
+    small.append(twice);
+    SYLAR_CHECK_EQ(small.find("abc", 3, 1), (size_t)4);
+    SYLAR_CHECK_EQ(small.find("abc", 3, 5), IOBuf::npos);
+
+    SYLAR_CHECK_EQ(buf.consume(off), off);
+    SYLAR_CHECK(buf.toString() == s.substr(off));
+    SYLAR_CHECK_EQ(buf.find(needle.data(), needle.size()), (size_t)40);
+    SYLAR_CHECK_EQ(buf.consume(s.size()), s.size() - off);
+    SYLAR_CHECK(buf.empty());
+}
+
+static void test_fixed(){
+    IOBuf buf;
+    buf.writeFixed8(0xab);
+    buf.writeFixed16(0x1234);
+    buf.writeFixed32(0xdeadbeef);
+    buf.writeFixed64(0x0102030405060708ull);
+    // 网络字节序
+    std::string s = buf.toString();
+    SYLAR_CHECK(s.substr(0, 3) == "\xab\x12\x34");
+    uint8_t a; uint16_t b; uint32_t c; uint64_t d;
+    SYLAR_CHECK(buf.readFixed8(a) && a == 0xab);
+    SYLAR_CHECK(buf.readFixed16(b) && b == 0x1234);
+    SYLAR_CHECK(buf.readFixed32(c) && c == 0xdeadbeef);
+    // 数据不足时不消费
+    IOBuf part;
+    part.append("\x01\x02\x03", 3);
+    SYLAR_CHECK(!part.readFixed32(c));
+    SYLAR_CHECK_EQ(part.size(), 3u);
+    SYLAR_CHECK(buf.readFixed64(d) && d == 0x0102030405060708ull);
+    SYLAR_CHECK(buf.empty());
+}
+
+static void test_varint(){
+    uint64_t values[] = {0, 1, 127, 128, 300, 16383, 16384, (1ull << 21) - 1, 1ull << 21,
+                         UINT32_MAX, (uint64_t)UINT32_MAX + 1, 1ull << 63, UINT64_MAX};
+    size_t lens[] = {1, 1, 1, 2, 2, 2, 3, 3, 4, 5, 5, 10, 10};
+    IOBuf buf;
+    for(size_t i = 0; i < sizeof(values) / sizeof(values[0]); ++i){
+        size_t before = buf.size();
+        buf.writeVarint64(values[i]);
+        SYLAR_CHECK_EQ(buf.size() - before, lens[i]);
+    }
+    for(uint64_t v : values){
+        uint64_t x = 0;
+        SYLAR_CHECK(buf.readVarint64(x));
+        SYLAR_CHECK_EQ(x, v);
+    }
+    SYLAR_CHECK(buf.empty());
+
+    // 32位读取拒绝超出范围的值，且不消费
+    buf.writeVarint64((uint64_t)UINT32_MAX + 1);
+    uint32_t v32;
+    SYLAR_CHECK(!buf.readVarint32(v32));
+    SYLAR_CHECK_EQ(buf.size(), 5u);
+    buf.clear();
+
+    int64_t signed_values[] = {0, -1, 1, -64, 64, INT32_MIN, INT32_MAX, INT64_MIN, INT64_MAX};
+    for(int64_t v : signed_values){
+        SYLAR_CHECK_EQ(IOBuf::DecodeZigzag(IOBuf::EncodeZigzag(v)), v);
+        buf.writeVarintS64(v);
+    }
+    // 绝对值小的负数编码也短
+    SYLAR_CHECK_EQ(IOBuf::EncodeZigzag(-1), 1u);
+    for(int64_t v : signed_values){
+        int64_t x;
+        SYLAR_CHECK(buf.readVarintS64(x));
+        SYLAR_CHECK_EQ(x, v);
+    }
+    buf.writeVarintS32(INT32_MIN);
+    int32_t s32;
+    SYLAR_CHECK(buf.readVarintS32(s32) && s32 == INT32_MIN);
+
+    // 不完整的编码：返回false且不消费，补齐后可以读出
+    IOBuf part;
+    part.append("\xac", 1);
+    uint64_t x;
+    SYLAR_CHECK_EQ(part.peekVarint64(x), 0u);
+    SYLAR_CHECK(!part.readVarint64(x));
+    SYLAR_CHECK_EQ(part.size(), 1u);
+    part.append("\x02", 1);
+    SYLAR_CHECK_EQ(part.peekVarint64(x), 2u);
+    SYLAR_CHECK(part.readVarint64(x) && x == 300);
+
+    // 超过10字节的编码是非法的
+    IOBuf bad;
+    bad.append(std::string(11, '\xff'));
+    SYLAR_CHECK_EQ(bad.peekVarint64(x), 0u);
+
+    // 编码跨越块的边界
+    IOBuf cross;
+    cross.append(std::string(IOBuf::kBlockSize - sizeof(IOBuf::Block) - 2, 'x'));
+    cross.writeVarint64(UINT64_MAX);
+    cross.consume(cross.size() - 10);
+    SYLAR_CHECK(cross.readVarint64(x) && x == UINT64_MAX);
+}
+
+static void test_fd(){
+    int sv[2];
+    SYLAR_CHECK(!socketpair(AF_UNIX, SOCK_STREAM, 0, sv));
+    // 写端非阻塞，缓冲区满时writeTo返回EAGAIN，读端阻塞
+    fcntl(sv[0], F_SETFL, fcntl(sv[0], F_GETFL) | O_NONBLOCK);
+    std::string s = Pattern(100 * 1000);
+    IOBuf out;
+    out.append(s);
+    IOBuf in;
+    // 一边写一边读，数据量超过socket缓冲区
+    while(!out.empty() || in.size() < s.size()){
+        if(!out.empty()){
+            ssize_t n = out.writeTo(sv[0]);
+            SYLAR_CHECK(n > 0 || errno == EAGAIN);
+        }
+        SYLAR_CHECK(in.readFrom(sv[1], 16 * 1024) > 0);
+    }
+    SYLAR_CHECK(in.toString() == s);
+    close(sv[0]);
+    SYLAR_CHECK_EQ(in.readFrom(sv[1]), 0);
+    close(sv[1]);
+}
+
+int main(){
+    test_append();
+    test_cut();
+    test_consume_copy_find();
+    test_fixed();
+    test_varint();
+    test_fd();
+    printf("test_iobuf ok\n");
+    return 0;
+}
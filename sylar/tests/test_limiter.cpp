@@ -0,0 +1,163 @@
+/**
+ * @file test_limiter.cpp
+ * @brief FiberPermits和并发数限制的计数测试
+ * @details 用测试桩把挂起协程换成挂起线程，多个线程同时获取、超时和归还，
+ * 检查任何时刻占用数不超过限制，结束后许可一个不多一个不少
+ */
+#include "limiter.h"
+#include "test.h"
+#include <errno.h>
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+static void test_basic(){
+    ConcurrencyLimiter lim(3);
+    SYLAR_CHECK(lim.tryAcquire());
+    SYLAR_CHECK(lim.tryAcquire());
+    SYLAR_CHECK_EQ(lim.acquire(), 0);
+    SYLAR_CHECK_EQ(lim.getInUse(), 3u);
+    SYLAR_CHECK(!lim.tryAcquire());
+    // 不等待的获取失败后计数恢复原状
+    SYLAR_CHECK_EQ(lim.acquire(0), ETIMEDOUT);
+    SYLAR_CHECK_EQ(lim.acquire(5), ETIMEDOUT);
+    SYLAR_CHECK_EQ(lim.getWaiting(), 0u);
+    SYLAR_CHECK_EQ(lim.getInUse(), 3u);
+    lim.release();
+    SYLAR_CHECK_EQ(lim.getInUse(), 2u);
+    {
+        LimiterGuard guard(lim);
+        SYLAR_CHECK(guard.ok());
+        LimiterGuard fail(lim, 0);
+        SYLAR_CHECK(!fail.ok());
+        SYLAR_CHECK_EQ(fail.getError(), ETIMEDOUT);
+    }
+    SYLAR_CHECK_EQ(lim.getInUse(), 2u);
+    lim.release();
+    lim.release();
+    SYLAR_CHECK_EQ(lim.getInUse(), 0u);
+}
+
+// 归还的许可直接交给等待者，有上限时多余的丢弃
+static void test_handoff_and_cap(){
+    FiberPermits p(0);
+    p.release(10, 5);
+    SYLAR_CHECK_EQ(p.getState(), 5);
+    for(int i = 0; i < 5; ++i)
+        SYLAR_CHECK(p.tryAcquire());
+    SYLAR_CHECK(!p.tryAcquire());
+
+    std::atomic<int> got = {0};
+    std::thread waiter([&](){
+        SYLAR_CHECK_EQ(p.acquire(), 0);
+        ++got;
+    });
+    while(p.getWaiting() == 0)
+        usleep(100);
+    SYLAR_CHECK_EQ(p.getState(), -1);
+    // 有等待者时tryAcquire不能插队
+    SYLAR_CHECK(!p.tryAcquire());
+    p.release(3, 2);
+    waiter.join();
+    SYLAR_CHECK_EQ(got.load(), 1);
+    SYLAR_CHECK_EQ(p.getState(), 2);
+}
+
+/**
+ * 多个线程混合使用无限等待、短超时和不等待的获取，
+ * 检查占用数的上限和结束后的计数
+ */
+static void test_stress(){
+    const size_t kLimit = 4;
+    const int kThreads = 16;
+    const int kIters = 3000;
+    ConcurrencyLimiter lim(kLimit);
+    std::atomic<int> in_use = {0};
+    std::atomic<int> max_use = {0};
+    std::atomic<int> ok = {0};
+    std::atomic<int> timeouts = {0};
+    std::vector<std::thread> threads;
+    for(int t = 0; t < kThreads; ++t){
+        threads.emplace_back([&, t](){
+            for(int i = 0; i < kIters; ++i){
+                uint64_t timeout = (i + t) % 7 == 0 ? 0 : ((i + t) % 3 ? ~0ull : 1);
+                int rt = lim.acquire(timeout);
+                if(rt){
+                    SYLAR_CHECK_EQ(rt, ETIMEDOUT);
+                    ++timeouts;
+                    continue;
+                }
+                int c = ++in_use;
+                int m = max_use;
+                while(c > m && !max_use.compare_exchange_weak(m, c));
+                if(i % 50 == 0)
+                    usleep(100);
+                --in_use;
+                ++ok;
+                lim.release();
+            }
+        });
+    }
+    for(auto &t : threads)
+        t.join();
+    SYLAR_CHECK_EQ(ok + timeouts, kThreads * kIters);
+    SYLAR_CHECK(max_use <= (int)kLimit);
+    SYLAR_CHECK_EQ(lim.getInUse(), 0u);
+    SYLAR_CHECK_EQ(lim.getWaiting(), 0u);
+    // 全部许可都还在，既没有泄漏也没有多出来
+    size_t n = 0;
+    while(lim.tryAcquire())
+        ++n;
+    SYLAR_CHECK_EQ(n, kLimit);
+}
+
+static void test_sharded(){
+    ShardedConcurrencyLimiter lim(5, 3);
+    SYLAR_CHECK_EQ(lim.getShardCount(), 3u);
+    std::vector<size_t> shards;
+    size_t s;
+    while(lim.tryAcquire(s))
+        shards.push_back(s);
+    SYLAR_CHECK_EQ(shards.size(), 5u);
+    for(size_t i : shards)
+        lim.release(i);
+
+    // 分片数被限制在总数以内
+    ShardedConcurrencyLimiter small(2, 8);
+    SYLAR_CHECK_EQ(small.getShardCount(), 2u);
+
+    std::atomic<int> in_use = {0};
+    std::atomic<int> max_use = {0};
+    std::vector<std::thread> threads;
+    for(int t = 0; t < 8; ++t){
+        threads.emplace_back([&](){
+            for(int i = 0; i < 2000; ++i){
+                size_t shard;
+                if(lim.acquire(shard, 1))
+                    continue;
+                int c = ++in_use;
+                int m = max_use;
+                while(c > m && !max_use.compare_exchange_weak(m, c));
+                --in_use;
+                lim.release(shard);
+            }
+        });
+    }
+    for(auto &t : threads)
+        t.join();
+    SYLAR_CHECK(max_use <= 5);
+    size_t n = 0;
+    while(lim.tryAcquire(s))
+        ++n;
+    SYLAR_CHECK_EQ(n, 5u);
+}
+
+int main(){
+    test_basic();
+    test_handoff_and_cap();
+    test_stress();
+    test_sharded();
+    printf("test_limiter ok\n");
+    return 0;
+}
@@ -0,0 +1,94 @@
+/**
+ * @file test_mpsc_queue.cpp
+ * @brief MpscQueue的单元测试：单线程语义、多生产者下每个生产者内部的顺序和元素的析构
+ */
+#include "mpsc_queue.h"
+#include "test.h"
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+static void test_single_thread(){
+    MpscQueue<int> q;
+    int v = -1;
+    SYLAR_CHECK(q.empty());
+    SYLAR_CHECK(!q.pop(v));
+    for(int i = 0; i < 100; ++i){
+        int x = i;
+        q.push(std::move(x));
+    }
+    SYLAR_CHECK(!q.empty());
+    for(int i = 0; i < 100; ++i){
+        SYLAR_CHECK(q.pop(v));
+        SYLAR_CHECK_EQ(v, i);
+    }
+    SYLAR_CHECK(!q.pop(v));
+    SYLAR_CHECK(q.empty());
+}
+
+// 只能移动的元素；队列析构时没有取走的元素也要释放
+static void test_move_only(){
+    std::weak_ptr<std::string> weak;
+    {
+        MpscQueue<std::unique_ptr<std::string>> q;
+        std::unique_ptr<std::string> a(new std::string("a"));
+        q.push(std::move(a));
+        SYLAR_CHECK(!a);
+        std::unique_ptr<std::string> out;
+        SYLAR_CHECK(q.pop(out));
+        SYLAR_CHECK(*out == "a");
+
+        MpscQueue<std::shared_ptr<std::string>> left;
+        std::shared_ptr<std::string> s(new std::string("left"));
+        weak = s;
+        left.push(std::move(s));
+        SYLAR_CHECK(!weak.expired());
+    }
+    SYLAR_CHECK(weak.expired());
+}
+
+/**
+ * 4个生产者各推送20万个元素，消费者同时取出：
+ * 元素不丢不重，同一个生产者的元素保持推送的顺序
+ */
+static void test_producers(){
+    const int kProducers = 4;
+    const long kPerProducer = 200000;
+    MpscQueue<long> q;
+    std::vector<std::thread> threads;
+    for(int p = 0; p < kProducers; ++p){
+        threads.emplace_back([&q, p, kPerProducer](){
+            for(long i = 0; i < kPerProducer; ++i){
+                long v = p * kPerProducer + i;
+                q.push(std::move(v));
+            }
+        });
+    }
+    std::vector<long> next(kProducers, 0);
+    long got = 0;
+    long v;
+    while(got < kProducers * kPerProducer){
+        if(!q.pop(v))
+            continue;
+        int p = v / kPerProducer;
+        SYLAR_CHECK(p >= 0 && p < kProducers);
+        SYLAR_CHECK_EQ(v % kPerProducer, next[p]);
+        ++next[p];
+        ++got;
+    }
+    for(auto &t : threads)
+        t.join();
+    for(int p = 0; p < kProducers; ++p)
+        SYLAR_CHECK_EQ(next[p], kPerProducer);
+    SYLAR_CHECK(!q.pop(v));
+    SYLAR_CHECK(q.empty());
+}
+
+int main(){
+    test_single_thread();
+    test_move_only();
+    test_producers();
+    printf("test_mpsc_queue ok\n");
+    return 0;
+}
@@ -0,0 +1,153 @@
+/**
+ * @file test_task.cpp
+ * @brief TaskFunc和RingQueue的单元测试
+ */
+#include "task.h"
+#include "ring_queue.h"
+#include "test.h"
+#include <memory>
+#include <string>
+#include <functional>
+
+// 统计存活对象数，检查移动和析构不泄漏、不重复析构
+struct Counted{
+    static int s_alive;
+    int *hits;
+    Counted(int *h) : hits(h) { ++s_alive;}
+    Counted(Counted &&rhs) noexcept : hits(rhs.hits) { ++s_alive;}
+    ~Counted() { --s_alive;}
+    void operator()() { ++*hits;}
+};
+int Counted::s_alive = 0;
+
+// 超过内联大小，只能放在堆上
+struct Big{
+    int *hits;
+    char pad[TaskFunc::kInlineSize * 2];
+    void operator()() { ++*hits;}
+};
+
+static void test_empty(){
+    TaskFunc a;
+    SYLAR_CHECK(!a);
+    TaskFunc b(nullptr);
+    SYLAR_CHECK(!b);
+    std::function<void()> f;
+    TaskFunc c(f);
+    SYLAR_CHECK(!c);
+    void (*fp)() = nullptr;
+    TaskFunc d(fp);
+    SYLAR_CHECK(!d);
+}
+
+static void test_inline_and_heap(){
+    int hits = 0;
+    {
+        TaskFunc a{Counted(&hits)};
+        SYLAR_CHECK_EQ(Counted::s_alive, 1);
+        a();
+        TaskFunc b(std::move(a));
+        SYLAR_CHECK(!a);
+        SYLAR_CHECK(b);
+        b();
+        SYLAR_CHECK_EQ(Counted::s_alive, 1);
+        b = nullptr;
+        SYLAR_CHECK_EQ(Counted::s_alive, 0);
+    }
+    SYLAR_CHECK_EQ(hits, 2);
+
+    Big big;
+    big.hits = &hits;
+    TaskFunc h(big);
+    TaskFunc h2(std::move(h));
+    h2();
+    SYLAR_CHECK_EQ(hits, 3);
+
+    // 只能移动的捕获
+    std::unique_ptr<int> up(new int(5));
+    int *raw = up.get();
+    struct Owner{
+        std::unique_ptr<int> p;
+        int *sum;
+        void operator()() { *sum += *p;}
+    };
+    TaskFunc m(Owner{std::move(up), &hits});
+    m();
+    SYLAR_CHECK_EQ(hits, 8);
+    SYLAR_CHECK(raw != nullptr);
+
+    std::string s(100, 'x');
+    size_t len = 0;
+    TaskFunc sf([s, &len](){ len = s.size();});
+    sf();
+    SYLAR_CHECK_EQ(len, 100u);
+}
+
+static void test_swap(){
+    int a = 0, b = 0;
+    TaskFunc fa([&a](){ ++a;});
+    TaskFunc fb([&b](){ b += 10;});
+    fa.swap(fb);
+    fa();
+    fb();
+    SYLAR_CHECK_EQ(a, 1);
+    SYLAR_CHECK_EQ(b, 10);
+}
+
+static void test_ring_queue(){
+    RingQueue<int> q;
+    SYLAR_CHECK(q.empty());
+    // 反复入队出队让队头绕过数组末尾，再触发扩容
+    for(int round = 0; round < 5; ++round){
+        for(int i = 0; i < 10; ++i)
+            q.push_back(int(i));
+        for(int i = 0; i < 10; ++i){
+            SYLAR_CHECK_EQ(q.front(), i);
+            q.pop_front();
+        }
+    }
+    for(int i = 0; i < 100; ++i)
+        q.push_back(int(i));
+    SYLAR_CHECK_EQ(q.size(), 100u);
+    for(size_t i = 0; i < q.size(); ++i)
+        SYLAR_CHECK_EQ(q[i], (int)i);
+
+    q.erase(0);
+    q.erase(5);
+    SYLAR_CHECK_EQ(q.size(), 98u);
+    SYLAR_CHECK_EQ(q[0], 1);
+    SYLAR_CHECK_EQ(q[4], 5);
+    SYLAR_CHECK_EQ(q[5], 7);
+    SYLAR_CHECK_EQ(q[97], 99);
+    q.clear();
+    SYLAR_CHECK(q.empty());
+}
+
+static void test_ring_queue_tasks(){
+    int hits = 0;
+    {
+        RingQueue<TaskFunc> q;
+        for(int i = 0; i < 40; ++i)
+            q.push_back(TaskFunc(Counted(&hits)));
+        SYLAR_CHECK_EQ(Counted::s_alive, 40);
+        q.erase(3);
+        SYLAR_CHECK_EQ(Counted::s_alive, 39);
+        for(int i = 0; i < 20; ++i){
+            q.front()();
+            q.pop_front();
+        }
+        SYLAR_CHECK_EQ(hits, 20);
+    }
+    // 析构时销毁剩余的任务
+    SYLAR_CHECK_EQ(Counted::s_alive, 0);
+}
+
+int main(){
+    test_empty();
+    test_inline_and_heap();
+    test_swap();
+    test_ring_queue();
+    test_ring_queue_tasks();
+    printf("test_task ok\n");
+    return 0;
+}